@@ -0,0 +1,524 @@
+#ifndef SVC_ANCESTRY
+#define SVC_ANCESTRY
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include "structures.h"
+#include "commit_table.h"
+
+// Ancestry queries over the commit graph
+// Parents are always made before their children, so handles are in
+// topological order as well as in creation order. Walks visit the
+// highest handle first, so every commit is seen after all of its
+// descendants the walk reaches, and recent history is all they touch.
+// Marks are kept per handle in a byte array sized to the number of
+// commits. A commit only reaches commits of a lower generation and a
+// lower handle, which bounds walks looking for one commit.
+//
+// Each branch head also gets a bitmap of every commit it reaches, made
+// on the first question about it. When the head moves forward only the
+// new commits are added, commits already set cover all their ancestors.
+
+#define ANCESTRY_OURS 1
+#define ANCESTRY_THEIRS 2
+#define ANCESTRY_QUEUED 4
+
+
+// Commits reachable from one branch head, including the head itself
+struct ReachBitmap {
+
+    uint32_t head; // Commit the bits were made for, COMMIT_NONE if none yet
+    uint64_t* bits;
+    size_t num_words;
+
+};
+
+// Max heap of commits ordered by handle
+struct CommitQueue {
+
+    struct Commit** commits;
+    size_t count;
+    size_t cap;
+
+};
+
+static void commit_queue_push(struct CommitQueue* queue, struct Commit* commit){
+
+    if(queue->count == queue->cap){
+        queue->cap = queue->cap == 0 ? 16 : queue->cap*2;
+        queue->commits = (struct Commit**)realloc(queue->commits, sizeof(struct Commit*)*queue->cap);
+    }
+
+    size_t i = queue->count++;
+
+    while(i > 0 && commit->seq > queue->commits[(i - 1)/2]->seq){
+        queue->commits[i] = queue->commits[(i - 1)/2];
+        i = (i - 1)/2;
+    }
+
+    queue->commits[i] = commit;
+
+}
+
+static struct Commit* commit_queue_pop(struct CommitQueue* queue){
+
+    struct Commit* top = queue->commits[0];
+    struct Commit* last = queue->commits[--queue->count];
+
+    size_t i = 0;
+
+    while(2*i + 1 < queue->count){
+
+        size_t child = 2*i + 1;
+
+        if(child + 1 < queue->count && queue->commits[child + 1]->seq > queue->commits[child]->seq){
+            child++;
+        }
+
+        if(queue->commits[child]->seq <= last->seq){
+            break;
+        }
+
+        queue->commits[i] = queue->commits[child];
+        i = child;
+    }
+
+    if(queue->count > 0){
+        queue->commits[i] = last;
+    }
+
+    return top;
+
+}
+
+// True if ancestor can be reached from commit following parents
+// Only commits of a higher generation and handle than ancestor are walked
+static bool commit_walk_reaches(struct System* system, struct Commit* ancestor, struct Commit* commit){
+
+    if(commit == ancestor){
+        return true;
+    }
+
+    if(commit->generation <= ancestor->generation || commit->seq < ancestor->seq){
+        return false;
+    }
+
+    unsigned char* seen = (unsigned char*)calloc(system->num_commits, 1);
+    struct Commit** stack = (struct Commit**)malloc(sizeof(struct Commit*)*16);
+    size_t count = 0;
+    size_t cap = 16;
+    bool found = false;
+
+    stack[count++] = commit;
+    seen[commit->seq] = 1;
+
+    while(count > 0 && !found){
+
+        struct Commit* current = stack[--count];
+
+        for(size_t k = 0; k < current->num_parents; k++){
+
+            struct Commit* parent = commit_parent(system, current, k);
+
+            if(parent == ancestor){
+                found = true;
+                break;
+            }
+
+            // Too old to lead to the ancestor, or already walked
+            if(parent->generation <= ancestor->generation || parent->seq < ancestor->seq || seen[parent->seq]){
+                continue;
+            }
+
+            seen[parent->seq] = 1;
+
+            if(count == cap){
+                cap *= 2;
+                stack = (struct Commit**)realloc(stack, sizeof(struct Commit*)*cap);
+            }
+            stack[count++] = parent;
+        }
+    }
+
+    free(stack);
+    free(seen);
+
+    return found;
+
+}
+
+static bool reach_test(const struct ReachBitmap* map, uint32_t seq){
+
+    return seq/64 < map->num_words && (map->bits[seq/64] >> (seq % 64) & 1) != 0;
+
+}
+
+// Set the bits of head and everything it reaches that is not set yet
+static void reach_mark(struct System* system, struct ReachBitmap* map, struct Commit* head){
+
+    size_t cap = 16;
+    size_t count = 0;
+    uint32_t* stack = (uint32_t*)malloc(sizeof(uint32_t)*cap);
+
+    stack[count++] = head->seq;
+
+    while(count > 0){
+
+        uint32_t seq = stack[--count];
+
+        if(reach_test(map, seq)){
+            // Set commits already have all their ancestors set
+            continue;
+        }
+
+        map->bits[seq/64] |= (uint64_t)1 << (seq % 64);
+
+        struct Commit* commit = commit_at(system, seq);
+
+        if(count + 2 > cap){
+            cap *= 2;
+            stack = (uint32_t*)realloc(stack, sizeof(uint32_t)*cap);
+        }
+
+        for(size_t k = 0; k < commit->num_parents; k++){
+            stack[count++] = commit->parents[k];
+        }
+    }
+
+    free(stack);
+
+}
+
+// Bitmap of the commits the head of branch reaches, NULL if it has none
+static struct ReachBitmap* reach_bitmap(struct System* system, size_t branch){
+
+    struct Commit* head = system->branch_ptrs[branch];
+
+    if(head == NULL){
+        return NULL;
+    }
+
+    // Grown for every branch at once, so a bitmap already handed out for
+    // another branch is not moved by asking for this one
+    if(system->num_reach < system->num_branches){
+        system->reach = (struct ReachBitmap*)realloc(system->reach, sizeof(struct ReachBitmap)*system->num_branches);
+        for(size_t b = system->num_reach; b < system->num_branches; b++){
+            system->reach[b].head = COMMIT_NONE;
+            system->reach[b].bits = NULL;
+            system->reach[b].num_words = 0;
+        }
+        system->num_reach = system->num_branches;
+    }
+
+    struct ReachBitmap* map = &system->reach[branch];
+
+    if(map->head == head->seq){
+        return map;
+    }
+
+    size_t num_words = (system->num_commits + 63)/64;
+
+    if(map->num_words < num_words){
+        map->bits = (uint64_t*)realloc(map->bits, sizeof(uint64_t)*num_words);
+        memset(map->bits + map->num_words, 0, sizeof(uint64_t)*(num_words - map->num_words));
+        map->num_words = num_words;
+    }
+
+    // Bits of an older head still hold if the new head descends from it,
+    // otherwise the head was reset or moved sideways and they start over
+    if(map->head != COMMIT_NONE && !commit_walk_reaches(system, commit_at(system, map->head), head)){
+        memset(map->bits, 0, sizeof(uint64_t)*map->num_words);
+    }
+
+    reach_mark(system, map, head);
+    map->head = head->seq;
+
+    return map;
+
+}
+
+// Bitmap of commit if it is the head of a branch, otherwise NULL
+static struct ReachBitmap* reach_bitmap_of(struct System* system, struct Commit* commit){
+
+    for(size_t b = 0; b < system->num_branches; b++){
+
+        if(system->branch_ptrs[b] == commit){
+            return reach_bitmap(system, b);
+        }
+
+    }
+
+    return NULL;
+
+}
+
+static void reach_free(struct System* system){
+
+    for(size_t b = 0; b < system->num_reach; b++){
+        free(system->reach[b].bits);
+    }
+
+    free(system->reach);
+
+}
+
+// True if ancestor is commit or one of its ancestors
+static bool commit_is_ancestor(struct System* system, struct Commit* ancestor, struct Commit* commit){
+
+    if(ancestor == commit){
+        return true;
+    }
+
+    if(ancestor->generation >= commit->generation){
+        return false;
+    }
+
+    struct ReachBitmap* map = reach_bitmap_of(system, commit);
+
+    if(map != NULL){
+        return reach_test(map, ancestor->seq);
+    }
+
+    return commit_walk_reaches(system, ancestor, commit);
+
+}
+
+// Highest handle set in both bitmaps
+// No commit both reach can descend from it, so it is a merge base
+static struct Commit* reach_highest_common(struct System* system, const struct ReachBitmap* a, const struct ReachBitmap* b){
+
+    size_t num_words = a->num_words < b->num_words ? a->num_words : b->num_words;
+
+    for(size_t w = num_words; w-- > 0;){
+
+        uint64_t common = a->bits[w] & b->bits[w];
+
+        if(common != 0){
+            return commit_at(system, w*64 + 63 - __builtin_clzll(common));
+        }
+    }
+
+    return NULL;
+
+}
+
+// First commit reached from commit, highest handle first, that map holds
+// Nothing the map holds is walked past, all its ancestors are set too
+static struct Commit* reach_first_common(struct System* system, const struct ReachBitmap* map, struct Commit* commit){
+
+    unsigned char* queued = (unsigned char*)calloc(system->num_commits, 1);
+    struct CommitQueue queue = {NULL, 0, 0};
+    struct Commit* base = NULL;
+
+    queued[commit->seq] = 1;
+    commit_queue_push(&queue, commit);
+
+    while(queue.count > 0){
+
+        struct Commit* current = commit_queue_pop(&queue);
+
+        if(reach_test(map, current->seq)){
+            base = current;
+            break;
+        }
+
+        for(size_t k = 0; k < current->num_parents; k++){
+
+            struct Commit* parent = commit_parent(system, current, k);
+
+            if(!queued[parent->seq]){
+                queued[parent->seq] = 1;
+                commit_queue_push(&queue, parent);
+            }
+        }
+    }
+
+    free(queue.commits);
+    free(queued);
+
+    return base;
+
+}
+
+// Lowest common ancestor of two commits, either of which may be NULL
+// The first commit reached from both sides is not an ancestor of any
+// other common ancestor, since those all have higher handles
+// Returns NULL if the histories never meet
+static struct Commit* merge_base(struct System* system, struct Commit* ours, struct Commit* theirs){
+
+    if(ours == NULL || theirs == NULL){
+        return NULL;
+    }
+
+    // Branch heads, as in every merge, are answered from their bitmaps
+    struct ReachBitmap* ours_map = reach_bitmap_of(system, ours);
+    struct ReachBitmap* theirs_map = reach_bitmap_of(system, theirs);
+
+    if(ours_map != NULL && theirs_map != NULL){
+        return reach_highest_common(system, ours_map, theirs_map);
+    }
+
+    if(ours_map != NULL){
+        return reach_first_common(system, ours_map, theirs);
+    }
+
+    if(theirs_map != NULL){
+        return reach_first_common(system, theirs_map, ours);
+    }
+
+    unsigned char* marks = (unsigned char*)calloc(system->num_commits, 1);
+    struct CommitQueue queue = {NULL, 0, 0};
+
+    marks[ours->seq] |= ANCESTRY_OURS | ANCESTRY_QUEUED;
+    commit_queue_push(&queue, ours);
+
+    if((marks[theirs->seq] & ANCESTRY_QUEUED) == 0){
+        commit_queue_push(&queue, theirs);
+    }
+    marks[theirs->seq] |= ANCESTRY_THEIRS | ANCESTRY_QUEUED;
+
+    struct Commit* base = NULL;
+
+    while(queue.count > 0){
+
+        struct Commit* commit = commit_queue_pop(&queue);
+        unsigned char side = marks[commit->seq] & (ANCESTRY_OURS | ANCESTRY_THEIRS);
+
+        if(side == (ANCESTRY_OURS | ANCESTRY_THEIRS)){
+            base = commit;
+            break;
+        }
+
+        for(size_t k = 0; k < commit->num_parents; k++){
+
+            struct Commit* parent = commit_parent(system, commit, k);
+
+            marks[parent->seq] |= side;
+
+            if((marks[parent->seq] & ANCESTRY_QUEUED) == 0){
+                marks[parent->seq] |= ANCESTRY_QUEUED;
+                commit_queue_push(&queue, parent);
+            }
+        }
+    }
+
+    free(queue.commits);
+    free(marks);
+
+    return base;
+
+}
+
+// Commits reachable from commit that map does not hold
+static size_t reach_count_outside(struct System* system, const struct ReachBitmap* map, struct Commit* commit){
+
+    unsigned char* seen = (unsigned char*)calloc(system->num_commits, 1);
+    size_t cap = 16;
+    size_t count = 0;
+    size_t outside = 0;
+    uint32_t* stack = (uint32_t*)malloc(sizeof(uint32_t)*cap);
+
+    stack[count++] = commit->seq;
+    seen[commit->seq] = 1;
+
+    while(count > 0){
+
+        struct Commit* current = commit_at(system, stack[--count]);
+
+        if(reach_test(map, current->seq)){
+            continue;
+        }
+
+        outside++;
+
+        if(count + 2 > cap){
+            cap *= 2;
+            stack = (uint32_t*)realloc(stack, sizeof(uint32_t)*cap);
+        }
+
+        for(size_t k = 0; k < current->num_parents; k++){
+            if(!seen[current->parents[k]]){
+                seen[current->parents[k]] = 1;
+                stack[count++] = current->parents[k];
+            }
+        }
+    }
+
+    free(stack);
+    free(seen);
+
+    return outside;
+
+}
+
+// Number of commits reachable from commit but not from exclude, which
+// may be NULL to count everything commit reaches. The walk ends once
+// every queued commit is reachable from exclude
+static size_t count_between(struct System* system, struct Commit* exclude, struct Commit* commit){
+
+    struct ReachBitmap* map = exclude == NULL ? NULL : reach_bitmap_of(system, exclude);
+
+    if(map != NULL){
+        return reach_count_outside(system, map, commit);
+    }
+
+    unsigned char* marks = (unsigned char*)calloc(system->num_commits, 1);
+    struct CommitQueue queue = {NULL, 0, 0};
+
+    // Queued commits not yet known to be reachable from exclude
+    size_t counted_queued = 0;
+    size_t count = 0;
+
+    marks[commit->seq] = ANCESTRY_OURS | ANCESTRY_QUEUED;
+    commit_queue_push(&queue, commit);
+    counted_queued++;
+
+    if(exclude != NULL){
+        if(marks[exclude->seq] & ANCESTRY_QUEUED){
+            counted_queued--;
+        } else {
+            commit_queue_push(&queue, exclude);
+        }
+        marks[exclude->seq] |= ANCESTRY_THEIRS | ANCESTRY_QUEUED;
+    }
+
+    while(queue.count > 0 && counted_queued > 0){
+
+        struct Commit* current = commit_queue_pop(&queue);
+        unsigned char side = marks[current->seq] & (ANCESTRY_OURS | ANCESTRY_THEIRS);
+
+        if(side == ANCESTRY_OURS){
+            count++;
+            counted_queued--;
+        }
+
+        for(size_t k = 0; k < current->num_parents; k++){
+
+            struct Commit* parent = commit_parent(system, current, k);
+            unsigned char before = marks[parent->seq];
+
+            marks[parent->seq] |= side | ANCESTRY_QUEUED;
+
+            if((before & ANCESTRY_QUEUED) == 0){
+                commit_queue_push(&queue, parent);
+                if(side == ANCESTRY_OURS){
+                    counted_queued++;
+                }
+            } else if((before & (ANCESTRY_OURS | ANCESTRY_THEIRS)) == ANCESTRY_OURS && (side & ANCESTRY_THEIRS)){
+                // Turned out to be reachable from exclude while queued
+                counted_queued--;
+            }
+        }
+    }
+
+    free(queue.commits);
+    free(marks);
+
+    return count;
+
+}
+
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef SVC_ARENA
+#define SVC_ARENA
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+// Region allocator for history metadata
+// Commits, their file lists, changes, ids, path strings and branch names
+// live as long as the system, so they are bump allocated from large
+// blocks and released all at once, one free per block, by arena_destroy.
+// Blocks come from the allocator given to svc_init_opts, or malloc.
+
+#define ARENA_BLOCK_SIZE (64*1024)
+#define ARENA_ALIGN 16
+
+typedef void* (*arena_alloc_fn)(size_t size, void* user);
+typedef void (*arena_release_fn)(void* ptr, size_t size, void* user);
+
+struct ArenaBlock {
+
+    struct ArenaBlock* next;
+    size_t size; // Bytes usable in data
+    size_t used;
+    max_align_t data[];
+
+};
+
+struct Arena {
+
+    struct ArenaBlock* head; // Block currently being filled
+    arena_alloc_fn alloc;
+    arena_release_fn release;
+    void* user;
+
+    size_t num_blocks;
+    size_t num_allocs;
+
+};
+
+
+static void* arena_default_alloc(size_t size, void* user){
+
+    (void)user;
+    return malloc(size);
+
+}
+
+static void arena_default_release(void* ptr, size_t size, void* user){
+
+    (void)size;
+    (void)user;
+    free(ptr);
+
+}
+
+// Make an arena drawing its blocks from alloc and release
+// Either may be NULL to use malloc and free
+static struct Arena* arena_create(arena_alloc_fn alloc, arena_release_fn release, void* user){
+
+    if(alloc == NULL || release == NULL){
+        alloc = arena_default_alloc;
+        release = arena_default_release;
+        user = NULL;
+    }
+
+    struct Arena* arena = (struct Arena*)alloc(sizeof(struct Arena), user);
+
+    if(arena == NULL){
+        return NULL;
+    }
+
+    arena->head = NULL;
+    arena->alloc = alloc;
+    arena->release = release;
+    arena->user = user;
+    arena->num_blocks = 0;
+    arena->num_allocs = 0;
+
+    return arena;
+
+}
+
+// Hand every block back to the allocator
+static void arena_destroy(struct Arena* arena){
+
+    if(arena == NULL){
+        return;
+    }
+
+    struct ArenaBlock* block = arena->head;
+
+    while(block != NULL){
+        struct ArenaBlock* next = block->next;
+        arena->release(block, sizeof(struct ArenaBlock) + block->size, arena->user);
+        block = next;
+    }
+
+    arena->release(arena, sizeof(struct Arena), arena->user);
+
+}
+
+static struct ArenaBlock* arena_new_block(struct Arena* arena, size_t size){
+
+    struct ArenaBlock* block = (struct ArenaBlock*)arena->alloc(sizeof(struct ArenaBlock) + size, arena->user);
+
+    if(block == NULL){
+        return NULL;
+    }
+
+    block->size = size;
+    block->used = 0;
+    arena->num_blocks++;
+
+    return block;
+
+}
+
+// Uninitialised memory that stays valid until arena_destroy
+// Returns NULL only if the allocator fails
+static void* arena_alloc(struct Arena* arena, size_t size){
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    struct ArenaBlock* head = arena->head;
+
+    if(head == NULL || head->size - head->used < size){
+
+        if(size > ARENA_BLOCK_SIZE/4){
+
+            // Large requests get a block of their own, kept behind the
+            // current one so its free space is not abandoned
+            struct ArenaBlock* block = arena_new_block(arena, size);
+
+            if(block == NULL){
+                return NULL;
+            }
+
+            block->used = size;
+
+            if(head == NULL){
+                block->next = NULL;
+                arena->head = block;
+            } else {
+                block->next = head->next;
+                head->next = block;
+            }
+
+            arena->num_allocs++;
+            return block->data;
+        }
+
+        head = arena_new_block(arena, ARENA_BLOCK_SIZE);
+
+        if(head == NULL){
+            return NULL;
+        }
+
+        head->next = arena->head;
+        arena->head = head;
+    }
+
+    void* ptr = (char*)head->data + head->used;
+    head->used += size;
+    arena->num_allocs++;
+
+    return ptr;
+
+}
+
+static void* arena_calloc(struct Arena* arena, size_t count, size_t size){
+
+    void* ptr = arena_alloc(arena, count*size);
+
+    if(ptr != NULL){
+        memset(ptr, 0, count*size);
+    }
+
+    return ptr;
+
+}
+
+static void* arena_memdup(struct Arena* arena, const void* data, size_t size){
+
+    void* ptr = arena_alloc(arena, size);
+
+    if(ptr != NULL){
+        memcpy(ptr, data, size);
+    }
+
+    return ptr;
+
+}
+
+static char* arena_strdup(struct Arena* arena, const char* str){
+
+    return (char*)arena_memdup(arena, str, strlen(str) + 1);
+
+}
+
+
+#endif
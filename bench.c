@@ -0,0 +1,1199 @@
+#include "svc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "fileio.h"
+#include "bytesum.h"
+#include "lz.h"
+
+// Benchmarks for the svc library
+// Usage: ./bench [file size in MB] [largest kernel buffer in MB] [staged paths] [commits] [snapshot files]
+// The checkout and reset benchmarks use the snapshot file count as well
+// Linked with --wrap for the allocation functions so calls from svc.c are counted
+
+#define BENCH_FILE "bench_data.bin"
+#define BENCH_STAGE_DIR "bench_stage"
+#define BENCH_SCAN_FILES 2000
+#define BENCH_SCAN_SIZE (64*1024)
+#define BENCH_COMMIT_FILE "bench_commit.txt"
+#define BENCH_RESOLVED_FILE "bench_resolved.txt"
+#define BENCH_SNAP_DIR "bench_snap"
+#define BENCH_SNAP_COMMITS 1000
+#define BENCH_CHECKOUTS 20
+#define BENCH_MERGES 20
+#define BENCH_TOPIC_EVERY 100
+#define BENCH_TOPIC_COMMITS 10
+#define BENCH_QUERIES 1000
+#define BENCH_DELTA_REPO "bench_repo"
+#define BENCH_DELTA_FILE "bench_config.txt"
+#define BENCH_DELTA_COMMITS 100
+#define BENCH_DELTA_EDITS 5
+#define BENCH_DELTA_LINE 29
+#define BENCH_LZ_SIZE (8 << 20)
+#define BENCH_LZ_ROUNDS 3
+#define BENCH_DIFF_FILE "bench_diff.c"
+#define BENCH_DIFF_SOURCE (64*1024)
+#define BENCH_DIFF_ROUNDS 200
+#define BENCH_DIFF_BUFFER (1 << 20)
+
+
+// Allocation calls made by svc.c, counted through the linker wraps
+size_t count_allocs = 0;
+size_t count_frees = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+char* __real_strdup(const char* str);
+void __real_free(void* ptr);
+
+void* __wrap_malloc(size_t size){
+    __atomic_fetch_add(&count_allocs, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size){
+    __atomic_fetch_add(&count_allocs, 1, __ATOMIC_RELAXED);
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size){
+    __atomic_fetch_add(&count_allocs, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+char* __wrap_strdup(const char* str){
+    __atomic_fetch_add(&count_allocs, 1, __ATOMIC_RELAXED);
+    return __real_strdup(str);
+}
+
+void __wrap_free(void* ptr){
+    if(ptr != NULL){
+        __atomic_fetch_add(&count_frees, 1, __ATOMIC_RELAXED);
+    }
+    __real_free(ptr);
+}
+
+// Allocator handed to svc_init_opts, tracking the arena's footprint
+size_t arena_bytes = 0;
+
+void* bench_arena_alloc(size_t size, void* user){
+    *(size_t*)user += size;
+    return __real_malloc(size);
+}
+
+void bench_arena_release(void* ptr, size_t size, void* user){
+    *(size_t*)user -= size;
+    __real_free(ptr);
+}
+
+
+double now_seconds(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+
+}
+
+// Write a file of pseudo random bytes
+void make_file(char* path, size_t size){
+
+    FILE* file = fopen(path, "wb");
+    char* block = (char*)malloc(1 << 20);
+    unsigned int seed = 12345;
+
+    for(size_t i = 0; i < (1 << 20); i++){
+        seed = seed * 1103515245 + 12345;
+        block[i] = (char)(seed >> 16);
+    }
+
+    for(size_t written = 0; written < size; written += (1 << 20)){
+        size_t chunk = size - written < (1 << 20) ? size - written : (1 << 20);
+        fwrite(block, 1, chunk, file);
+    }
+
+    free(block);
+    fclose(file);
+
+}
+
+// The original one byte at a time reader, kept as the baseline
+int hash_file_fgetc(char* file_path){
+
+    FILE* file = fopen(file_path, "rb");
+
+    if(file == NULL){
+        return -2;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long file_length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    size_t hash = 0;
+
+    for(size_t i = 0; i < strlen(file_path); i++){
+        hash = (hash + file_path[i]) % 1000;
+    }
+
+    for(long j = 0; j < file_length; j++){
+        size_t buf = fgetc(file);
+        hash = (hash + buf) % 2000000000;
+    }
+
+    fclose(file);
+
+    return hash;
+
+}
+
+void bench_file_reading(void* helper, size_t size){
+
+    make_file(BENCH_FILE, size);
+
+    double mb = size / (1024.0 * 1024.0);
+
+    // Warm the page cache so both readers see the same conditions
+    hash_file(helper, BENCH_FILE);
+
+    // Raw reading layer, touching every page once
+    char* buffer = NULL;
+    size_t buffer_cap = 0;
+    struct FileView view;
+    unsigned long touched = 0;
+
+    double start = now_seconds();
+    file_view_open(BENCH_FILE, &view, &buffer, &buffer_cap);
+    for(size_t i = 0; i < view.size; i += 4096){
+        touched += (unsigned char)view.data[i];
+    }
+    file_view_close(&view);
+    double read_time = now_seconds() - start;
+
+    free(buffer);
+
+    printf("fileio read         %8.1f MB/s (%lu)\n", mb / read_time, touched % 10);
+
+    start = now_seconds();
+    int slow = hash_file_fgetc(BENCH_FILE);
+    double slow_time = now_seconds() - start;
+
+    start = now_seconds();
+    int fast = hash_file(helper, BENCH_FILE);
+    double fast_time = now_seconds() - start;
+
+    printf("hash_file fgetc     %8.1f MB/s\n", mb / slow_time);
+    printf("hash_file fileio    %8.1f MB/s%s\n", mb / fast_time, slow == fast ? "" : "  MISMATCH");
+
+    // svc_add reads once for both the hash and the stored copy
+    start = now_seconds();
+    svc_add(helper, BENCH_FILE);
+    double add_time = now_seconds() - start;
+
+    printf("svc_add             %8.1f MB/s\n", mb / add_time);
+
+    svc_rm(helper, BENCH_FILE);
+    remove(BENCH_FILE);
+
+}
+
+
+// Stage n small files then unstage them all again
+// Each svc_add checks for a duplicate path and each svc_rm finds its path,
+// so a linear scan of the staging area makes both phases quadratic
+void bench_staging(size_t n){
+
+    mkdir(BENCH_STAGE_DIR, 0755);
+
+    char** paths = (char**)malloc(sizeof(char*)*n);
+
+    for(size_t i = 0; i < n; i++){
+        char path[64];
+        snprintf(path, sizeof(path), "%s/f%zu.txt", BENCH_STAGE_DIR, i);
+        paths[i] = strdup(path);
+
+        FILE* file = fopen(path, "w");
+        fprintf(file, "%zu\n", i);
+        fclose(file);
+    }
+
+    void* helper = svc_init();
+
+    double start = now_seconds();
+    for(size_t i = 0; i < n; i++){
+        svc_add(helper, paths[i]);
+    }
+    double add_time = now_seconds() - start;
+
+    start = now_seconds();
+    for(size_t i = 0; i < n; i++){
+        svc_rm(helper, paths[i]);
+    }
+    double rm_time = now_seconds() - start;
+
+    printf("\nstaging %zu paths\n", n);
+    printf("svc_add             %8.2f s  %8.2f us/op\n", add_time, add_time * 1e6 / n);
+    printf("svc_rm              %8.2f s  %8.2f us/op\n", rm_time, rm_time * 1e6 / n);
+
+    cleanup(helper);
+
+    for(size_t i = 0; i < n; i++){
+        remove(paths[i]);
+        free(paths[i]);
+    }
+    free(paths);
+    rmdir(BENCH_STAGE_DIR);
+
+}
+
+
+// Rewrite every tracked file then commit, with the given number of threads
+double time_commit_scan(char** paths, size_t n, int num_threads){
+
+    svc_options options = {.num_threads = num_threads};
+    void* helper = svc_init_opts(&options);
+
+    char* block = (char*)malloc(BENCH_SCAN_SIZE);
+
+    for(size_t i = 0; i < n; i++){
+        svc_add(helper, paths[i]);
+    }
+    svc_commit(helper, "base");
+
+    for(size_t i = 0; i < n; i++){
+        memset(block, 'a' + i % 26, BENCH_SCAN_SIZE);
+        block[0] = (char)num_threads;
+        FILE* file = fopen(paths[i], "wb");
+        fwrite(block, 1, BENCH_SCAN_SIZE, file);
+        fclose(file);
+    }
+
+    double start = now_seconds();
+    svc_commit(helper, "rewrite");
+    double elapsed = now_seconds() - start;
+
+    free(block);
+    cleanup(helper);
+
+    return elapsed;
+
+}
+
+// Commit after every tracked file changed, serially and on the thread pool
+void bench_commit_scan(void){
+
+    mkdir(BENCH_STAGE_DIR, 0755);
+
+    char** paths = (char**)malloc(sizeof(char*)*BENCH_SCAN_FILES);
+
+    for(size_t i = 0; i < BENCH_SCAN_FILES; i++){
+        char path[64];
+        snprintf(path, sizeof(path), "%s/s%zu.bin", BENCH_STAGE_DIR, i);
+        paths[i] = strdup(path);
+        make_file(path, BENCH_SCAN_SIZE);
+    }
+
+    double mb = (double)BENCH_SCAN_FILES * BENCH_SCAN_SIZE / (1024.0 * 1024.0);
+    double serial = time_commit_scan(paths, BENCH_SCAN_FILES, 1);
+    double parallel = time_commit_scan(paths, BENCH_SCAN_FILES, 0);
+
+    printf("\ncommit of %d changed files\n", BENCH_SCAN_FILES);
+    printf("1 thread            %8.1f MB/s\n", mb / serial);
+    printf("all threads         %8.1f MB/s\n", mb / parallel);
+
+    for(size_t i = 0; i < BENCH_SCAN_FILES; i++){
+        remove(paths[i]);
+        free(paths[i]);
+    }
+    free(paths);
+    rmdir(BENCH_STAGE_DIR);
+
+}
+
+
+// Make n commits that each change one tracked file
+// Reports allocation calls per commit and the frees needed to tear down
+void bench_commits(size_t n){
+
+    svc_options options = {.num_threads = 1, .alloc = bench_arena_alloc, .release = bench_arena_release, .alloc_user = &arena_bytes};
+    void* helper = svc_init_opts(&options);
+
+    FILE* file = fopen(BENCH_COMMIT_FILE, "w");
+    fclose(file);
+    svc_add(helper, BENCH_COMMIT_FILE);
+
+    char message[32];
+    size_t allocs_before = count_allocs;
+
+    double start = now_seconds();
+    for(size_t i = 0; i < n; i++){
+        file = fopen(BENCH_COMMIT_FILE, "w");
+        fprintf(file, "%zu\n", i);
+        fclose(file);
+
+        snprintf(message, sizeof(message), "commit %zu", i);
+        svc_commit(helper, message);
+    }
+    double commit_time = now_seconds() - start;
+
+    size_t allocs = count_allocs - allocs_before;
+    size_t bytes = arena_bytes;
+
+    size_t frees_before = count_frees;
+    start = now_seconds();
+    cleanup(helper);
+    double cleanup_time = now_seconds() - start;
+    size_t frees = count_frees - frees_before;
+
+    remove(BENCH_COMMIT_FILE);
+
+    printf("\n%zu commits\n", n);
+    printf("commit              %8.2f us/op  %8.2f allocs/op\n", commit_time * 1e6 / n, (double)allocs / n);
+    printf("arena               %8.1f MB\n", bytes / (1024.0 * 1024.0));
+    printf("cleanup             %8.2f ms     %8zu frees\n", cleanup_time * 1e3, frees);
+
+}
+
+
+// Compare the byte sum kernels on in memory buffers from 4 KB upwards
+void bench_bytesum(size_t max_size){
+
+    struct {
+        char* name;
+        bytesum_fn kernel;
+        int available;
+    } kernels[] = {
+        {"scalar", bytesum_scalar, 1},
+#ifdef BYTESUM_X86
+        {"sse2", bytesum_sse2, __builtin_cpu_supports("sse2")},
+        {"avx2", bytesum_avx2, __builtin_cpu_supports("avx2")},
+        {"avx512", bytesum_avx512, __builtin_cpu_supports("avx512bw")},
+#endif
+    };
+    size_t num_kernels = sizeof(kernels) / sizeof(kernels[0]);
+
+    unsigned char* buffer = (unsigned char*)malloc(max_size);
+    unsigned int seed = 777;
+    for(size_t i = 0; i < max_size; i++){
+        seed = seed * 1103515245 + 12345;
+        buffer[i] = (unsigned char)(seed >> 16);
+    }
+
+    printf("\n%-10s", "bytes");
+    for(size_t k = 0; k < num_kernels; k++){
+        printf("%12s", kernels[k].name);
+    }
+    printf("   (GB/s)\n");
+
+    for(size_t size = 4096; size <= max_size; size *= 4){
+
+        // Repeat small buffers so each measurement covers at least 256 MB
+        size_t repeats = (256u << 20) / size;
+        if(repeats == 0){
+            repeats = 1;
+        }
+
+        uint64_t expected = bytesum_scalar(buffer, size);
+
+        printf("%-10zu", size);
+
+        for(size_t k = 0; k < num_kernels; k++){
+
+            if(!kernels[k].available){
+                printf("%12s", "-");
+                continue;
+            }
+
+            uint64_t total = 0;
+            double start = now_seconds();
+            for(size_t r = 0; r < repeats; r++){
+                total += kernels[k].kernel(buffer, size);
+            }
+            double elapsed = now_seconds() - start;
+
+            double gbps = (double)size * repeats / elapsed / 1e9;
+            printf("%12.2f%s", gbps, total == expected * repeats ? "" : "!");
+        }
+
+        printf("\n");
+    }
+
+    free(buffer);
+
+}
+
+// Track n files in a few directories, then make commits that each change
+// one of them, reporting the history memory each commit adds
+void bench_snapshots(size_t n){
+
+    size_t arena = 0;
+    svc_options options = {.num_threads = 1, .alloc = bench_arena_alloc, .release = bench_arena_release, .alloc_user = &arena};
+    void* helper = svc_init_opts(&options);
+
+    mkdir(BENCH_SNAP_DIR, 0755);
+
+    char** paths = (char**)malloc(sizeof(char*)*(n + 1));
+
+    for(size_t i = 0; i < n; i++){
+        char path[64];
+        snprintf(path, sizeof(path), "%s/d%zu", BENCH_SNAP_DIR, i % 16);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/d%zu/f%zu.txt", BENCH_SNAP_DIR, i % 16, i);
+        paths[i] = strdup(path);
+
+        FILE* file = fopen(path, "w");
+        fprintf(file, "%zu\n", i);
+        fclose(file);
+        svc_add(helper, paths[i]);
+    }
+
+    svc_commit(helper, "initial");
+
+    size_t arena_before = arena;
+    char message[32];
+
+    double start = now_seconds();
+    for(size_t i = 0; i < BENCH_SNAP_COMMITS; i++){
+        FILE* file = fopen(paths[(i*7919) % n], "w");
+        fprintf(file, "changed %zu\n", i);
+        fclose(file);
+
+        snprintf(message, sizeof(message), "change %zu", i);
+        svc_commit(helper, message);
+    }
+    double commit_time = now_seconds() - start;
+
+    printf("\n%d one file commits over %zu files\n", BENCH_SNAP_COMMITS, n);
+    printf("commit              %8.2f us/op\n", commit_time * 1e6 / BENCH_SNAP_COMMITS);
+    printf("snapshot            %8.1f KB/op\n", (arena - arena_before) / 1024.0 / BENCH_SNAP_COMMITS);
+
+    cleanup(helper);
+
+    for(size_t i = 0; i < n; i++){
+        remove(paths[i]);
+        free(paths[i]);
+    }
+    for(size_t d = 0; d < 16; d++){
+        char path[64];
+        snprintf(path, sizeof(path), "%s/d%zu", BENCH_SNAP_DIR, d);
+        rmdir(path);
+    }
+    free(paths);
+    rmdir(BENCH_SNAP_DIR);
+
+}
+
+// Switch back and forth between two branches of n files that differ in one
+void bench_checkout(size_t n){
+
+    void* helper = svc_init();
+
+    mkdir(BENCH_SNAP_DIR, 0755);
+
+    char** paths = (char**)malloc(sizeof(char*)*(n + 1));
+
+    for(size_t i = 0; i < n; i++){
+        char path[64];
+        snprintf(path, sizeof(path), "%s/f%zu.txt", BENCH_SNAP_DIR, i);
+        paths[i] = strdup(path);
+
+        FILE* file = fopen(path, "w");
+        fprintf(file, "%zu\n", i);
+        fclose(file);
+        svc_add(helper, paths[i]);
+    }
+
+    svc_commit(helper, "initial");
+    svc_branch(helper, "other");
+    svc_checkout(helper, "other");
+
+    FILE* file = fopen(paths[0], "w");
+    fprintf(file, "other\n");
+    fclose(file);
+    svc_commit(helper, "one change");
+
+    svc_checkout_plan plan;
+    svc_plan_checkout(helper, "master", &plan);
+
+    double start = now_seconds();
+    for(size_t i = 0; i < BENCH_CHECKOUTS; i++){
+        svc_checkout(helper, i % 2 == 0 ? "master" : "other");
+    }
+    double checkout_time = now_seconds() - start;
+
+    printf("\ncheckout between branches of %zu files\n", n);
+    printf("checkout            %8.2f ms/op  %8zu paths  %8zu bytes\n", checkout_time * 1e3 / BENCH_CHECKOUTS, plan.n_entries, plan.bytes);
+
+    svc_free_plan(&plan);
+    cleanup(helper);
+
+    for(size_t i = 0; i < n; i++){
+        remove(paths[i]);
+        free(paths[i]);
+    }
+    free(paths);
+    rmdir(BENCH_SNAP_DIR);
+
+}
+
+// Reset back and forth between two commits of n files that differ in one
+void bench_reset(size_t n){
+
+    void* helper = svc_init();
+
+    mkdir(BENCH_SNAP_DIR, 0755);
+
+    char** paths = (char**)malloc(sizeof(char*)*(n + 1));
+
+    for(size_t i = 0; i < n; i++){
+        char path[64];
+        snprintf(path, sizeof(path), "%s/f%zu.txt", BENCH_SNAP_DIR, i);
+        paths[i] = strdup(path);
+
+        FILE* file = fopen(path, "w");
+        fprintf(file, "%zu\n", i);
+        fclose(file);
+        svc_add(helper, paths[i]);
+    }
+
+    // Files older than the commit that scans them keep a trusted stat
+    sleep(1);
+
+    char* first = strdup(svc_commit(helper, "initial"));
+
+    FILE* file = fopen(paths[0], "w");
+    fprintf(file, "changed\n");
+    fclose(file);
+    char* second = strdup(svc_commit(helper, "one change"));
+
+    double start = now_seconds();
+    for(size_t i = 0; i < BENCH_CHECKOUTS; i++){
+        svc_reset(helper, i % 2 == 0 ? first : second);
+    }
+    double reset_time = now_seconds() - start;
+
+    printf("\nreset between commits of %zu files\n", n);
+    printf("reset               %8.2f ms/op\n", reset_time * 1e3 / BENCH_CHECKOUTS);
+
+    free(first);
+    free(second);
+    cleanup(helper);
+
+    for(size_t i = 0; i < n; i++){
+        remove(paths[i]);
+        free(paths[i]);
+    }
+    free(paths);
+    rmdir(BENCH_SNAP_DIR);
+
+}
+
+// Walk the log from head, returns the seconds taken
+double bench_log(void* helper, void* head, const svc_log_options* options, size_t* count){
+
+    svc_log_entry entry;
+    size_t length = 0;
+
+    double start = now_seconds();
+
+    svc_log* log = svc_log_open(helper, head, options);
+    while(svc_log_next(log, &entry)){
+        length += entry.message[0] != '\0';
+    }
+    svc_log_close(log);
+
+    *count = length;
+
+    return now_seconds() - start;
+
+}
+
+// History of n commits on master with a topic branch merged back in
+// every BENCH_TOPIC_EVERY commits, then ancestry queries and log walks
+void bench_ancestry(size_t n){
+
+    if(n < BENCH_TOPIC_EVERY*20){
+        return;
+    }
+
+    svc_options options = {.num_threads = 1, .alloc = bench_arena_alloc, .release = bench_arena_release, .alloc_user = &arena_bytes};
+    void* helper = svc_init_opts(&options);
+
+    FILE* file = fopen(BENCH_COMMIT_FILE, "w");
+    fclose(file);
+    svc_add(helper, BENCH_COMMIT_FILE);
+    svc_commit(helper, "initial");
+    svc_branch(helper, "topic");
+
+    void** commits = (void**)malloc(sizeof(void*)*(n + 1));
+    size_t num_commits = 0;
+    char message[32];
+
+    FILE* saved = stdout;
+    stdout = fopen("/dev/null", "w");
+
+    while(num_commits < n){
+
+        if(num_commits % BENCH_TOPIC_EVERY == BENCH_TOPIC_EVERY - 1){
+
+            svc_checkout(helper, "topic");
+            for(size_t i = 0; i < BENCH_TOPIC_COMMITS; i++){
+                file = fopen(BENCH_COMMIT_FILE, "w");
+                fprintf(file, "topic %zu %zu\n", num_commits, i);
+                fclose(file);
+                snprintf(message, sizeof(message), "topic %zu", i);
+                svc_commit(helper, message);
+            }
+            svc_checkout(helper, "master");
+
+            // The topic always wins, its edits are the newer ones
+            resolution resolved = {BENCH_COMMIT_FILE, BENCH_RESOLVED_FILE};
+            file = fopen(BENCH_RESOLVED_FILE, "w");
+            fprintf(file, "topic %zu\n", num_commits);
+            fclose(file);
+            svc_merge(helper, "topic", &resolved, 1);
+            commits[num_commits++] = svc_branch_head(helper, "master");
+            continue;
+        }
+
+        file = fopen(BENCH_COMMIT_FILE, "w");
+        fprintf(file, "%zu\n", num_commits);
+        fclose(file);
+        snprintf(message, sizeof(message), "commit %zu", num_commits);
+        svc_commit(helper, message);
+        commits[num_commits++] = svc_branch_head(helper, "master");
+    }
+
+    fclose(stdout);
+    stdout = saved;
+
+    // Commit ids are short and repeat over long histories, so commits
+    // are queried by handle
+    void* head = commits[n - 1];
+    void* topic = svc_branch_head(helper, "topic");
+    unsigned int seed = 4242;
+
+    // Merges have already made the bitmap of each branch head
+    int found = 0;
+
+    double start = now_seconds();
+    for(size_t i = 0; i < BENCH_QUERIES; i++){
+        found += svc_is_ancestor(helper, commits[rand_r(&seed) % n], head);
+    }
+    double head_time = now_seconds() - start;
+
+    // Commits that are not a branch head are answered by a pruned walk
+    start = now_seconds();
+    for(size_t i = 0; i < BENCH_QUERIES; i++){
+        size_t later = n/2 + rand_r(&seed) % (n/2);
+        size_t earlier = later - 1 - rand_r(&seed) % (BENCH_TOPIC_EVERY*4);
+        found += svc_is_ancestor(helper, commits[earlier], commits[later]);
+    }
+    double walk_time = now_seconds() - start;
+
+    start = now_seconds();
+    for(size_t i = 0; i < BENCH_QUERIES; i++){
+        found += svc_merge_base(helper, head, topic) != NULL;
+    }
+    double base_time = now_seconds() - start;
+
+    start = now_seconds();
+    int between = 0;
+    for(size_t i = 0; i < BENCH_QUERIES; i++){
+        between = svc_count_between(helper, commits[n - 1 - BENCH_TOPIC_EVERY*10], head);
+    }
+    double between_time = now_seconds() - start;
+
+    start = now_seconds();
+    int total = svc_count_between(helper, NULL, head);
+    double total_time = now_seconds() - start;
+
+    printf("\nancestry over %zu commits, %d reachable from master\n", n, total);
+    printf("is_ancestor head    %8.2f us/op\n", head_time * 1e6 / BENCH_QUERIES);
+    printf("is_ancestor walk    %8.2f us/op\n", walk_time * 1e6 / BENCH_QUERIES);
+    printf("merge_base          %8.2f us/op\n", base_time * 1e6 / BENCH_QUERIES);
+    printf("count_between       %8.2f us/op  %8d commits\n", between_time * 1e6 / BENCH_QUERIES, between);
+    printf("count all           %8.2f ms     %8d found\n", total_time * 1e3, found);
+
+    svc_log_options options_log = {SVC_LOG_DATE_ORDER, 0, NULL, 0, 0, 0};
+    size_t count = 0;
+
+    double date_time = bench_log(helper, head, &options_log, &count);
+    printf("log date order      %8.2f ns/commit  %8zu commits\n", date_time * 1e9 / count, count);
+
+    options_log.order = SVC_LOG_TOPO_ORDER;
+    double topo_time = bench_log(helper, head, &options_log, &count);
+    printf("log topo order      %8.2f ns/commit  %8zu commits\n", topo_time * 1e9 / count, count);
+
+    options_log.first_parent = 1;
+    double first_time = bench_log(helper, head, &options_log, &count);
+    printf("log first parent    %8.2f ns/commit  %8zu commits\n", first_time * 1e9 / count, count);
+
+    // A page from the middle still walks the commits it skips
+    options_log.first_parent = 0;
+    options_log.order = SVC_LOG_DATE_ORDER;
+    options_log.skip = n/2;
+    options_log.max_count = 50;
+    double page_time = bench_log(helper, head, &options_log, &count);
+    printf("log page at %-7zu %8.2f ms     %8zu commits\n", n/2, page_time * 1e3, count);
+
+    free(commits);
+    cleanup(helper);
+
+    remove(BENCH_COMMIT_FILE);
+    remove(BENCH_RESOLVED_FILE);
+
+}
+
+// Merge a branch of n files into another, each side changing one file
+// of its own and a different line of one shared file per round
+void bench_merge(size_t n){
+
+    void* helper = svc_init();
+
+    mkdir(BENCH_SNAP_DIR, 0755);
+
+    char** paths = (char**)malloc(sizeof(char*)*(n + 1));
+
+    for(size_t i = 0; i < n; i++){
+        char path[64];
+        snprintf(path, sizeof(path), "%s/f%zu.txt", BENCH_SNAP_DIR, i);
+        paths[i] = strdup(path);
+
+        FILE* file = fopen(path, "w");
+        fprintf(file, "%zu\nsecond line\nthird line\n", i);
+        fclose(file);
+        svc_add(helper, paths[i]);
+    }
+
+    svc_commit(helper, "initial");
+    svc_branch(helper, "other");
+
+    double merge_time = 0;
+    size_t merged = 0;
+    char message[32];
+
+    for(size_t i = 0; i < BENCH_MERGES; i++){
+
+        svc_checkout(helper, "other");
+
+        FILE* file = fopen(paths[(i*7919 + 1) % n], "w");
+        fprintf(file, "other %zu\n", i);
+        fclose(file);
+
+        file = fopen(paths[0], "w");
+        fprintf(file, "0\nsecond line\nother %zu\n", i);
+        fclose(file);
+
+        snprintf(message, sizeof(message), "other %zu", i);
+        svc_commit(helper, message);
+
+        svc_checkout(helper, "master");
+
+        file = fopen(paths[(i*104729 + 2) % n], "w");
+        fprintf(file, "master %zu\n", i);
+        fclose(file);
+
+        file = fopen(paths[0], "w");
+        fprintf(file, "master %zu\nsecond line\nother %zu\n", i, i == 0 ? 0 : i - 1);
+        fclose(file);
+
+        snprintf(message, sizeof(message), "master %zu", i);
+        svc_commit(helper, message);
+
+        // Only the merge itself is timed
+        FILE* saved = stdout;
+        stdout = fopen("/dev/null", "w");
+
+        double start = now_seconds();
+        merged += svc_merge(helper, "other", NULL, 0) != NULL;
+        merge_time += now_seconds() - start;
+
+        fclose(stdout);
+        stdout = saved;
+    }
+
+    printf("\nmerge between branches of %zu files\n", n);
+    printf("merge               %8.2f ms/op  %8zu clean\n", merge_time * 1e3 / BENCH_MERGES, merged);
+
+    cleanup(helper);
+
+    for(size_t i = 0; i < n; i++){
+        remove(paths[i]);
+        free(paths[i]);
+    }
+    free(paths);
+    rmdir(BENCH_SNAP_DIR);
+
+}
+
+// Rewrite a config file of fixed width lines, changing a few per commit
+void write_config(char* data, size_t num_lines, size_t version){
+
+    // Room for the widest size_t fields, only the first BENCH_DELTA_LINE bytes are kept
+    char line[64];
+
+    for(size_t e = 0; e < BENCH_DELTA_EDITS && version > 0; e++){
+        size_t l = (version*7919 + e*104729) % num_lines;
+        snprintf(line, sizeof(line), "key_%07zu = value %08zu\n", l, version);
+        memcpy(data + l*BENCH_DELTA_LINE, line, BENCH_DELTA_LINE);
+    }
+
+    FILE* file = fopen(BENCH_DELTA_FILE, "w");
+    fwrite(data, 1, num_lines*BENCH_DELTA_LINE, file);
+    fclose(file);
+
+}
+
+// Commit a large file that changes by a few lines each time into a
+// repository, and measure what the objects file grows by
+void bench_deltas(size_t size){
+
+    mkdir(BENCH_DELTA_REPO, 0755);
+
+    void* helper = svc_open(BENCH_DELTA_REPO);
+
+    size_t num_lines = size / BENCH_DELTA_LINE;
+    char* data = (char*)malloc(num_lines*BENCH_DELTA_LINE + 1);
+    char line[64];
+
+    for(size_t l = 0; l < num_lines; l++){
+        snprintf(line, sizeof(line), "key_%07zu = value %08d\n", l, 0);
+        memcpy(data + l*BENCH_DELTA_LINE, line, BENCH_DELTA_LINE);
+    }
+
+    write_config(data, num_lines, 0);
+    svc_add(helper, BENCH_DELTA_FILE);
+
+    char* first = strdup(svc_commit(helper, "initial"));
+    char* last = NULL;
+    char message[32];
+
+    double start = now_seconds();
+    for(size_t i = 1; i <= BENCH_DELTA_COMMITS; i++){
+        write_config(data, num_lines, i);
+        snprintf(message, sizeof(message), "edit %zu", i);
+        last = svc_commit(helper, message);
+    }
+    double commit_time = now_seconds() - start;
+    last = strdup(last);
+
+    struct stat st;
+    stat(BENCH_DELTA_REPO "/objects", &st);
+
+    // The newest version is at the end of a delta chain, reopen so
+    // nothing rebuilt while committing is still cached
+    cleanup(helper);
+    helper = svc_open(BENCH_DELTA_REPO);
+
+    start = now_seconds();
+    svc_reset(helper, first);
+    double oldest_time = now_seconds() - start;
+
+    start = now_seconds();
+    svc_reset(helper, last);
+    double newest_time = now_seconds() - start;
+
+    printf("\n%d commits of a %zu KB file, %d lines changed each\n", BENCH_DELTA_COMMITS, num_lines*BENCH_DELTA_LINE / 1024, BENCH_DELTA_EDITS);
+    printf("commit              %8.2f us/op\n", commit_time * 1e6 / BENCH_DELTA_COMMITS);
+    printf("stored              %8.1f KB/op  %8.1f KB full copy\n", st.st_size / 1024.0 / (BENCH_DELTA_COMMITS + 1), num_lines*BENCH_DELTA_LINE / 1024.0);
+    printf("reset to oldest     %8.2f ms\n", oldest_time * 1e3);
+    printf("reset to newest     %8.2f ms\n", newest_time * 1e3);
+
+    free(first);
+    free(last);
+    free(data);
+    cleanup(helper);
+
+    const char* files[] = {"objects", "commits", "index", "state"};
+    for(size_t f = 0; f < sizeof(files)/sizeof(files[0]); f++){
+        char path[64];
+        snprintf(path, sizeof(path), "%s/%s", BENCH_DELTA_REPO, files[f]);
+        remove(path);
+    }
+    rmdir(BENCH_DELTA_REPO);
+    remove(BENCH_DELTA_FILE);
+
+}
+
+// Source code like text, lines built from a small vocabulary
+void make_text_corpus(char* data, size_t size){
+
+    static const char* words[] = {"if", "value", "return", "count", "struct", "size_t", "index", "system", "file", "->", "=", "+=", "(", ")", "{", "}", ";", "NULL", "0", "1"};
+    size_t num_words = sizeof(words)/sizeof(words[0]);
+    size_t position = 0;
+
+    while(position < size){
+        char line[128];
+        int length = snprintf(line, sizeof(line), "    ");
+        for(int w = 0; w < 3 + rand() % 6; w++){
+            length += snprintf(line + length, sizeof(line) - length, "%s ", words[rand() % num_words]);
+        }
+        length += snprintf(line + length, sizeof(line) - length, "%d;\n", rand() % 100);
+
+        size_t take = position + length < size ? (size_t)length : size - position;
+        memcpy(data + position, line, take);
+        position += take;
+    }
+
+}
+
+// Fixed size records of counters, timestamps and flags
+void make_binary_corpus(char* data, size_t size){
+
+    uint32_t record[4] = {0, 1700000000, 0, 0};
+
+    for(size_t position = 0; position < size; position += sizeof(record)){
+        record[0]++;
+        record[1] += rand() % 4;
+        record[2] = rand() % 1000;
+        record[3] = rand() % 8 == 0 ? rand() : 0;
+
+        size_t take = position + sizeof(record) < size ? sizeof(record) : size - position;
+        memcpy(data + position, record, take);
+    }
+
+}
+
+// Already compressed data, which the sampling check should turn away
+void make_random_corpus(char* data, size_t size){
+
+    for(size_t i = 0; i < size; i++){
+        data[i] = rand();
+    }
+
+}
+
+void bench_lz_corpus(const char* name, const char* data, size_t size){
+
+    size_t bound = size + size/255 + 16;
+    char* packed = (char*)malloc(bound);
+    char* unpacked = (char*)malloc(size);
+
+    double start = now_seconds();
+    int worth = lz_worth_compressing(data, size);
+    double sample_time = now_seconds() - start;
+
+    printf("%-8s sample check %6.3f ms, %s\n", name, sample_time * 1e3, worth ? "compressed" : "stored as is");
+
+    const char* levels[] = {"", "fast", "high"};
+
+    for(int level = LZ_FAST; level <= LZ_HIGH; level++){
+
+        long length = 0;
+
+        start = now_seconds();
+        for(int r = 0; r < BENCH_LZ_ROUNDS; r++){
+            length = lz_compress(data, size, packed, bound, level);
+        }
+        double compress_time = (now_seconds() - start) / BENCH_LZ_ROUNDS;
+
+        start = now_seconds();
+        for(int r = 0; r < BENCH_LZ_ROUNDS; r++){
+            lz_decompress(packed, length, unpacked, size);
+        }
+        double decompress_time = (now_seconds() - start) / BENCH_LZ_ROUNDS;
+
+        if(memcmp(data, unpacked, size) != 0){
+            printf("%-8s %s round trip failed\n", name, levels[level]);
+        }
+
+        printf("%-8s %-4s  ratio %5.2f  compress %8.1f MB/s  decompress %8.1f MB/s\n", name, levels[level], (double)size / length, size / compress_time / (1 << 20), size / decompress_time / (1 << 20));
+    }
+
+    free(packed);
+    free(unpacked);
+
+}
+
+// Compression ratio and speed of both codec levels on each corpus
+void bench_lz(void){
+
+    char* data = (char*)malloc(BENCH_LZ_SIZE);
+
+    printf("\nblob compression, %d MB corpora\n", BENCH_LZ_SIZE >> 20);
+
+    srand(1);
+
+    make_text_corpus(data, BENCH_LZ_SIZE);
+    bench_lz_corpus("text", data, BENCH_LZ_SIZE);
+
+    make_binary_corpus(data, BENCH_LZ_SIZE);
+    bench_lz_corpus("binary", data, BENCH_LZ_SIZE);
+
+    make_random_corpus(data, BENCH_LZ_SIZE);
+    bench_lz_corpus("random", data, BENCH_LZ_SIZE);
+
+    free(data);
+
+}
+
+// Write data to path with every step-th line from first on edited, in
+// turn changed, followed by two new lines, or deleted
+void write_edited(const char* path, const char* data, size_t size, size_t first, size_t step){
+
+    FILE* file = fopen(path, "w");
+    size_t position = 0;
+
+    for(size_t line = 0; position < size; line++){
+
+        const char* end = (const char*)memchr(data + position, '\n', size - position);
+        size_t length = end == NULL ? size - position : (size_t)(end - (data + position)) + 1;
+
+        if(line < first || (line - first) % step != 0){
+            fwrite(data + position, 1, length, file);
+        } else if((line - first) / step % 3 == 0){
+            fprintf(file, "    count += %zu;\n", line);
+        } else if((line - first) / step % 3 == 1){
+            fwrite(data + position, 1, length, file);
+            fprintf(file, "    index = %zu;\n    return index;\n", line);
+        }
+
+        position += length;
+    }
+
+    fclose(file);
+
+}
+
+// Time one diff of the head against the commit before it
+void bench_diff_large(void* helper, char* name, const char* data, size_t size, size_t first, size_t step, char* buffer){
+
+    FILE* file = fopen(BENCH_DIFF_FILE, "w");
+    fwrite(data, 1, size, file);
+    fclose(file);
+    svc_commit(helper, "original");
+    void* before = svc_branch_head(helper, "master");
+
+    write_edited(BENCH_DIFF_FILE, data, size, first, step);
+    svc_commit(helper, name);
+    void* after = svc_branch_head(helper, "master");
+
+    double start = now_seconds();
+    long length = svc_diff(helper, before, after, buffer, BENCH_DIFF_BUFFER);
+    double diff_time = now_seconds() - start;
+
+    printf("%-20s%8.2f ms  %8.1f MB/s  %8ld bytes\n", name, diff_time * 1e3, size / diff_time / (1 << 20), length);
+
+}
+
+// Diff a source file after a typical edit, then a large file after a
+// few scattered edits and after many
+void bench_diff(size_t size){
+
+    void* helper = svc_init();
+    char* buffer = (char*)malloc(BENCH_DIFF_BUFFER);
+    char* data = (char*)malloc(size > BENCH_DIFF_SOURCE ? size : BENCH_DIFF_SOURCE);
+
+    srand(1);
+    make_text_corpus(data, BENCH_DIFF_SOURCE);
+
+    FILE* file = fopen(BENCH_DIFF_FILE, "w");
+    fwrite(data, 1, BENCH_DIFF_SOURCE, file);
+    fclose(file);
+    svc_add(helper, BENCH_DIFF_FILE);
+    svc_commit(helper, "original");
+    void* before = svc_branch_head(helper, "master");
+
+    // A change, an insertion, a deletion and another change
+    write_edited(BENCH_DIFF_FILE, data, BENCH_DIFF_SOURCE, 300, 450);
+
+    long length = 0;
+
+    double start = now_seconds();
+    for(size_t i = 0; i < BENCH_DIFF_ROUNDS; i++){
+        length = svc_diff_working(helper, buffer, BENCH_DIFF_BUFFER);
+    }
+    double working_time = now_seconds() - start;
+
+    svc_commit(helper, "edit");
+    void* after = svc_branch_head(helper, "master");
+
+    start = now_seconds();
+    for(size_t i = 0; i < BENCH_DIFF_ROUNDS; i++){
+        svc_diff(helper, before, after, buffer, BENCH_DIFF_BUFFER);
+    }
+    double commit_time = now_seconds() - start;
+
+    printf("\ndiff of a %d KB source file after a typical edit, %ld bytes\n", BENCH_DIFF_SOURCE / 1024, length);
+    printf("diff commits        %8.2f us/op\n", commit_time * 1e6 / BENCH_DIFF_ROUNDS);
+    printf("diff working copy   %8.2f us/op\n", working_time * 1e6 / BENCH_DIFF_ROUNDS);
+
+    make_text_corpus(data, size);
+
+    size_t num_lines = 0;
+    for(const char* line = data; (line = (const char*)memchr(line, '\n', data + size - line)) != NULL; line++){
+        num_lines++;
+    }
+
+    printf("\ndiff of a %zu MB file of %zu lines\n", size >> 20, num_lines);
+    bench_diff_large(helper, "60 edits", data, size, 1000, num_lines / 60, buffer);
+    bench_diff_large(helper, "every 64th line", data, size, 0, 64, buffer);
+
+    free(data);
+    free(buffer);
+    cleanup(helper);
+    remove(BENCH_DIFF_FILE);
+
+}
+
+
+int main(int argc, char** argv){
+
+    size_t size_mb = 64;
+    size_t kernel_mb = 1024;
+    size_t staged_paths = 100000;
+    size_t commits = 100000;
+    size_t snapshot_files = 20000;
+
+    if(argc > 1){
+        size_mb = strtoul(argv[1], NULL, 10);
+    }
+    if(argc > 2){
+        kernel_mb = strtoul(argv[2], NULL, 10);
+    }
+    if(argc > 3){
+        staged_paths = strtoul(argv[3], NULL, 10);
+    }
+    if(argc > 4){
+        commits = strtoul(argv[4], NULL, 10);
+    }
+    if(argc > 5){
+        snapshot_files = strtoul(argv[5], NULL, 10);
+    }
+
+    void* helper = svc_init();
+
+    bench_file_reading(helper, size_mb << 20);
+
+    bench_bytesum(kernel_mb << 20);
+
+    cleanup(helper);
+
+    bench_staging(staged_paths);
+
+    bench_commit_scan();
+
+    bench_commits(commits);
+
+    bench_ancestry(commits);
+
+    bench_snapshots(snapshot_files);
+
+    bench_checkout(snapshot_files);
+
+    bench_reset(snapshot_files);
+
+    bench_merge(snapshot_files);
+
+    bench_deltas(size_mb << 20);
+
+    bench_lz();
+
+    bench_diff(size_mb << 20);
+
+    return 0;
+
+}
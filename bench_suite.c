@@ -0,0 +1,468 @@
+#include "svc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+// Benchmark suite timing each svc.h call on a generated repository
+// Usage: ./bench_suite [-n files] [-m commits] [-b branches] [-e files edited per commit]
+//                      [-s size distribution] [-f csv|json] [-o output file] [-r seed]
+// Size distributions are fixed:SIZE, uniform:MIN:MAX or pareto:MIN:MAX:ALPHA
+// Commits go round the branches, each branch editing only its own share
+// of the files, and every SUITE_MERGE_EVERY commits master merges the
+// others. Every call is timed on its own, and each is reported with its
+// calls per second, median and 99th percentile latency, and the peak RSS
+// of the process once its phase is over
+
+#define SUITE_DIR "bench_suite_repo"
+#define SUITE_FILES_PER_DIR 100
+#define SUITE_MERGE_EVERY 20
+#define SUITE_RESETS 50
+#define SUITE_LOOKUPS 10000
+
+#define SIZE_FIXED 0
+#define SIZE_UNIFORM 1
+#define SIZE_PARETO 2
+
+struct SizeDistribution {
+
+    int kind;
+    double min;
+    double max;
+    double alpha;
+
+};
+
+#define OP_HASH_FILE 0
+#define OP_ADD 1
+#define OP_COMMIT 2
+#define OP_CHECKOUT 3
+#define OP_RESET 4
+#define OP_MERGE 5
+#define OP_GET_COMMIT 6
+#define OP_CLEANUP 7
+#define NUM_OPS 8
+
+// Latency of every call made to one function
+struct OpTimes {
+
+    const char* name;
+    double* samples;
+    size_t count;
+    size_t cap;
+    long peak_rss_kb;
+
+};
+
+
+double now_seconds(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+
+}
+
+long peak_rss_kb(void){
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+
+}
+
+void record(struct OpTimes* op, double seconds){
+
+    if(op->count == op->cap){
+        op->cap = op->cap == 0 ? 64 : op->cap*2;
+        op->samples = (double*)realloc(op->samples, sizeof(double)*op->cap);
+    }
+
+    op->samples[op->count++] = seconds;
+
+}
+
+int compare_doubles(const void* a, const void* b){
+
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+
+}
+
+// Nearest rank percentile of sorted samples
+double percentile(const double* sorted, size_t count, double fraction){
+
+    size_t rank = (size_t)ceil(fraction * count);
+
+    return sorted[rank == 0 ? 0 : rank - 1];
+
+}
+
+// Parse fixed:SIZE, uniform:MIN:MAX or pareto:MIN:MAX:ALPHA
+// Returns -1 if the spec is not one of them
+int parse_sizes(const char* spec, struct SizeDistribution* sizes){
+
+    if(sscanf(spec, "fixed:%lf", &sizes->min) == 1){
+        sizes->kind = SIZE_FIXED;
+        sizes->max = sizes->min;
+        return 0;
+    }
+
+    if(sscanf(spec, "uniform:%lf:%lf", &sizes->min, &sizes->max) == 2 && sizes->min <= sizes->max){
+        sizes->kind = SIZE_UNIFORM;
+        return 0;
+    }
+
+    if(sscanf(spec, "pareto:%lf:%lf:%lf", &sizes->min, &sizes->max, &sizes->alpha) == 3 && sizes->min > 0 && sizes->min <= sizes->max && sizes->alpha > 0){
+        sizes->kind = SIZE_PARETO;
+        return 0;
+    }
+
+    return -1;
+
+}
+
+// A size drawn from the distribution, pareto is bounded to [min, max]
+size_t draw_size(const struct SizeDistribution* sizes, unsigned int* seed){
+
+    double u = rand_r(seed) / ((double)RAND_MAX + 1);
+
+    if(sizes->kind == SIZE_UNIFORM){
+        return sizes->min + u * (sizes->max - sizes->min);
+    }
+
+    if(sizes->kind == SIZE_PARETO){
+        double ratio = pow(sizes->min / sizes->max, sizes->alpha);
+        return sizes->min / pow(1 - u * (1 - ratio), 1 / sizes->alpha);
+    }
+
+    return sizes->min;
+
+}
+
+void file_path(char* path, size_t length, size_t index){
+
+    snprintf(path, length, "%s/d%03zu/f%06zu.txt", SUITE_DIR, index / SUITE_FILES_PER_DIR, index);
+
+}
+
+// Source like text that is the same for a file every time it is written,
+// apart from a version stamp at a place that moves with the version
+void write_content(size_t index, size_t size, size_t version){
+
+    static const char* words[] = {"if", "value", "return", "count", "struct", "size_t", "index", "system", "file", "->", "=", "+=", "(", ")", "{", "}", ";", "NULL", "0", "1"};
+
+    char path[64];
+    file_path(path, sizeof(path), index);
+
+    char* data = (char*)malloc(size + 64);
+    unsigned int seed = index + 1;
+    size_t position = 0;
+
+    while(position < size){
+        position += snprintf(data + position, 64, "%s ", words[rand_r(&seed) % 20]);
+        if(rand_r(&seed) % 8 == 0){
+            data[position - 1] = '\n';
+        }
+    }
+
+    char stamp[32];
+    int stamp_length = snprintf(stamp, sizeof(stamp), "<v%zu>", version);
+    if(size >= (size_t)stamp_length){
+        memcpy(data + (version * 7919) % (size - stamp_length + 1), stamp, stamp_length);
+    }
+
+    FILE* file = fopen(path, "w");
+    fwrite(data, 1, size, file);
+    fclose(file);
+
+    free(data);
+
+}
+
+void report(FILE* out, const char* format, struct OpTimes* ops, size_t files, size_t commits, size_t branches, size_t edits, const char* sizes){
+
+    if(strcmp(format, "json") == 0){
+        fprintf(out, "{\"files\": %zu, \"commits\": %zu, \"branches\": %zu, \"edits\": %zu, \"sizes\": \"%s\", \"ops\": [\n", files, commits, branches, edits, sizes);
+    } else {
+        fprintf(out, "op,calls,ops_per_s,p50_us,p99_us,peak_rss_kb\n");
+    }
+
+    for(size_t i = 0; i < NUM_OPS; i++){
+
+        struct OpTimes* op = &ops[i];
+        double total = 0;
+
+        for(size_t s = 0; s < op->count; s++){
+            total += op->samples[s];
+        }
+
+        double rate = 0;
+        double p50 = 0;
+        double p99 = 0;
+
+        if(op->count > 0){
+            qsort(op->samples, op->count, sizeof(double), compare_doubles);
+            rate = total > 0 ? op->count / total : 0;
+            p50 = percentile(op->samples, op->count, 0.50) * 1e6;
+            p99 = percentile(op->samples, op->count, 0.99) * 1e6;
+        }
+
+        if(strcmp(format, "json") == 0){
+            fprintf(out, "  {\"op\": \"%s\", \"calls\": %zu, \"ops_per_s\": %.1f, \"p50_us\": %.2f, \"p99_us\": %.2f, \"peak_rss_kb\": %ld}%s\n", op->name, op->count, rate, p50, p99, op->peak_rss_kb, i + 1 < NUM_OPS ? "," : "");
+        } else {
+            fprintf(out, "%s,%zu,%.1f,%.2f,%.2f,%ld\n", op->name, op->count, rate, p50, p99, op->peak_rss_kb);
+        }
+    }
+
+    if(strcmp(format, "json") == 0){
+        fprintf(out, "]}\n");
+    }
+
+}
+
+int main(int argc, char** argv){
+
+    size_t num_files = 1000;
+    size_t num_commits = 200;
+    size_t num_branches = 4;
+    size_t edits = 4;
+    const char* sizes_spec = "pareto:512:1048576:1.2";
+    const char* format = "csv";
+    const char* output = NULL;
+    unsigned int seed = 1;
+
+    int option;
+
+    while((option = getopt(argc, argv, "n:m:b:e:s:f:o:r:")) != -1){
+        switch(option){
+            case 'n': num_files = strtoul(optarg, NULL, 10); break;
+            case 'm': num_commits = strtoul(optarg, NULL, 10); break;
+            case 'b': num_branches = strtoul(optarg, NULL, 10); break;
+            case 'e': edits = strtoul(optarg, NULL, 10); break;
+            case 's': sizes_spec = optarg; break;
+            case 'f': format = optarg; break;
+            case 'o': output = optarg; break;
+            case 'r': seed = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-n files] [-m commits] [-b branches] [-e edits] [-s sizes] [-f csv|json] [-o output] [-r seed]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    struct SizeDistribution sizes;
+
+    if(parse_sizes(sizes_spec, &sizes) != 0){
+        fprintf(stderr, "size distribution must be fixed:SIZE, uniform:MIN:MAX or pareto:MIN:MAX:ALPHA\n");
+        return 1;
+    }
+
+    if(num_branches == 0 || num_files < num_branches || (strcmp(format, "csv") != 0 && strcmp(format, "json") != 0)){
+        fprintf(stderr, "need at least one branch, a file per branch and a format of csv or json\n");
+        return 1;
+    }
+
+    struct OpTimes ops[NUM_OPS] = {
+        {"hash_file", NULL, 0, 0, 0}, {"svc_add", NULL, 0, 0, 0}, {"svc_commit", NULL, 0, 0, 0}, {"svc_checkout", NULL, 0, 0, 0},
+        {"svc_reset", NULL, 0, 0, 0}, {"svc_merge", NULL, 0, 0, 0}, {"get_commit", NULL, 0, 0, 0}, {"cleanup", NULL, 0, 0, 0},
+    };
+
+    // Generate the working copy
+    mkdir(SUITE_DIR, 0755);
+
+    size_t* file_sizes = (size_t*)malloc(sizeof(size_t)*num_files);
+    char path[64];
+
+    for(size_t i = 0; i < num_files; i++){
+
+        if(i % SUITE_FILES_PER_DIR == 0){
+            snprintf(path, sizeof(path), "%s/d%03zu", SUITE_DIR, i / SUITE_FILES_PER_DIR);
+            mkdir(path, 0755);
+        }
+
+        file_sizes[i] = draw_size(&sizes, &seed);
+        write_content(i, file_sizes[i], 0);
+    }
+
+    // Library calls print their outcome, none of it is wanted here
+    FILE* saved = stdout;
+    stdout = fopen("/dev/null", "w");
+
+    void* helper = svc_init();
+
+    for(size_t i = 0; i < num_files; i++){
+        file_path(path, sizeof(path), i);
+        double start = now_seconds();
+        hash_file(helper, path);
+        record(&ops[OP_HASH_FILE], now_seconds() - start);
+    }
+    ops[OP_HASH_FILE].peak_rss_kb = peak_rss_kb();
+
+    for(size_t i = 0; i < num_files; i++){
+        file_path(path, sizeof(path), i);
+        double start = now_seconds();
+        svc_add(helper, path);
+        record(&ops[OP_ADD], now_seconds() - start);
+    }
+    ops[OP_ADD].peak_rss_kb = peak_rss_kb();
+
+    svc_commit(helper, "initial");
+
+    char** branch_names = (char**)malloc(sizeof(char*)*num_branches);
+    branch_names[0] = strdup("master");
+
+    for(size_t b = 1; b < num_branches; b++){
+        char name[32];
+        snprintf(name, sizeof(name), "branch%zu", b);
+        branch_names[b] = strdup(name);
+        svc_branch(helper, name);
+    }
+
+    char** ids = (char**)malloc(sizeof(char*)*(num_commits + 1));
+    size_t num_ids = 0;
+    size_t current = 0;
+    size_t version = 0;
+    size_t share = (num_files - 1) / num_branches + 1;
+    char message[32];
+
+    for(size_t i = 0; i < num_commits; i++){
+
+        size_t branch = i % num_branches;
+
+        if(branch != current){
+            double start = now_seconds();
+            svc_checkout(helper, branch_names[branch]);
+            record(&ops[OP_CHECKOUT], now_seconds() - start);
+            current = branch;
+        }
+
+        // Each branch edits only the files it owns, so merges are clean
+        for(size_t e = 0; e < edits; e++){
+            size_t index = (rand_r(&seed) % share) * num_branches + branch;
+            if(index >= num_files){
+                index = branch;
+            }
+            write_content(index, file_sizes[index], ++version);
+        }
+
+        snprintf(message, sizeof(message), "commit %zu", i);
+
+        double start = now_seconds();
+        char* id = svc_commit(helper, message);
+        record(&ops[OP_COMMIT], now_seconds() - start);
+
+        if(id != NULL){
+            ids[num_ids++] = strdup(id);
+        }
+
+        if((i + 1) % SUITE_MERGE_EVERY == 0 && num_branches > 1){
+
+            if(current != 0){
+                start = now_seconds();
+                svc_checkout(helper, branch_names[0]);
+                record(&ops[OP_CHECKOUT], now_seconds() - start);
+                current = 0;
+            }
+
+            for(size_t b = 1; b < num_branches; b++){
+                start = now_seconds();
+                svc_merge(helper, branch_names[b], NULL, 0);
+                record(&ops[OP_MERGE], now_seconds() - start);
+            }
+        }
+    }
+    ops[OP_COMMIT].peak_rss_kb = peak_rss_kb();
+    ops[OP_CHECKOUT].peak_rss_kb = ops[OP_COMMIT].peak_rss_kb;
+    ops[OP_MERGE].peak_rss_kb = ops[OP_COMMIT].peak_rss_kb;
+
+    // Resets jump around the first parent history of master
+    if(current != 0){
+        svc_checkout(helper, branch_names[0]);
+    }
+
+    svc_log_options first_parent = {SVC_LOG_DATE_ORDER, 1, NULL, 0, 0, 0};
+    svc_log* log = svc_log_open(helper, svc_branch_head(helper, branch_names[0]), &first_parent);
+    svc_log_entry entry;
+
+    char** history = (char**)malloc(sizeof(char*)*(num_commits + 2));
+    size_t history_length = 0;
+
+    while(svc_log_next(log, &entry)){
+        history[history_length++] = strdup(entry.id);
+    }
+    svc_log_close(log);
+
+    for(size_t r = 0; r < SUITE_RESETS; r++){
+        char* target = r + 1 < SUITE_RESETS ? history[rand_r(&seed) % history_length] : history[0];
+        double start = now_seconds();
+        svc_reset(helper, target);
+        record(&ops[OP_RESET], now_seconds() - start);
+    }
+    ops[OP_RESET].peak_rss_kb = peak_rss_kb();
+
+    for(size_t l = 0; l < SUITE_LOOKUPS && num_ids > 0; l++){
+        char* id = ids[rand_r(&seed) % num_ids];
+        double start = now_seconds();
+        get_commit(helper, id);
+        record(&ops[OP_GET_COMMIT], now_seconds() - start);
+    }
+    ops[OP_GET_COMMIT].peak_rss_kb = peak_rss_kb();
+
+    double start = now_seconds();
+    cleanup(helper);
+    record(&ops[OP_CLEANUP], now_seconds() - start);
+    ops[OP_CLEANUP].peak_rss_kb = peak_rss_kb();
+
+    fclose(stdout);
+    stdout = saved;
+
+    FILE* out = output == NULL ? stdout : fopen(output, "w");
+
+    if(out == NULL){
+        fprintf(stderr, "can not write %s\n", output);
+        return 1;
+    }
+
+    report(out, format, ops, num_files, num_commits, num_branches, edits, sizes_spec);
+
+    if(out != stdout){
+        fclose(out);
+    }
+
+    // Remove the working copy
+    for(size_t i = 0; i < num_files; i++){
+        file_path(path, sizeof(path), i);
+        remove(path);
+    }
+    for(size_t d = 0; d <= (num_files - 1) / SUITE_FILES_PER_DIR; d++){
+        snprintf(path, sizeof(path), "%s/d%03zu", SUITE_DIR, d);
+        rmdir(path);
+    }
+    rmdir(SUITE_DIR);
+
+    for(size_t i = 0; i < num_ids; i++){
+        free(ids[i]);
+    }
+    for(size_t i = 0; i < history_length; i++){
+        free(history[i]);
+    }
+    for(size_t b = 0; b < num_branches; b++){
+        free(branch_names[b]);
+    }
+    for(size_t i = 0; i < NUM_OPS; i++){
+        free(ops[i].samples);
+    }
+    free(ids);
+    free(history);
+    free(branch_names);
+    free(file_sizes);
+
+    return 0;
+
+}
@@ -0,0 +1,473 @@
+#ifndef SVC_BLOBS
+#define SVC_BLOBS
+
+#include <stdlib.h>
+#include <string.h>
+#include "structures.h"
+#include "delta.h"
+#include "lz.h"
+#include "stats.h"
+
+#define BLOB_TABLE_EMPTY -1
+#define BLOB_TABLE_TOMBSTONE -2
+#define BLOB_NONE -1
+
+// New versions of a path are stored as a delta against the previous one
+// when they are at least DELTA_MIN_LENGTH bytes and the delta is at most
+// half their size. Once a chain is DELTA_MAX_DEPTH deep the next version
+// starts a new one against the full content at its root instead, so
+// rebuilding never applies more than that many deltas. Rebuilt versions
+// are kept in a small cache since the next version usually needs them.
+#define DELTA_MIN_LENGTH 64
+#define DELTA_MAX_DEPTH 10
+#define BLOB_CACHE_SIZE 32
+
+// Stored bytes, full content or a delta, are compressed with the system's
+// codec when there are at least COMPRESS_MIN_LENGTH of them and that saves
+// an eighth. Samples are tried first so compressed media is not attempted.
+#define COMPRESS_MIN_LENGTH 128
+
+static char* blob_content(struct System* system, int index);
+
+
+// Set up an empty blob store inside the system
+static void blob_store_init(struct System* system){
+
+    system->blobs = (struct Blob*)malloc(sizeof(struct Blob));
+    system->num_blobs = 0;
+    system->cap_blobs = 1;
+    system->free_blob = BLOB_NONE;
+
+    system->blob_table_cap = 16;
+    system->blob_table_used = 0;
+    system->blob_table = (int*)malloc(sizeof(int)*system->blob_table_cap);
+    for(size_t i = 0; i < system->blob_table_cap; i++){
+        system->blob_table[i] = BLOB_TABLE_EMPTY;
+    }
+
+    system->blob_cache = (struct BlobCacheEntry*)malloc(sizeof(struct BlobCacheEntry)*BLOB_CACHE_SIZE);
+    for(size_t i = 0; i < BLOB_CACHE_SIZE; i++){
+        system->blob_cache[i].blob = BLOB_NONE;
+        system->blob_cache[i].content = NULL;
+    }
+    system->blob_cache_clock = 0;
+
+    system->scratch = NULL;
+    system->scratch_cap = 0;
+
+}
+
+// Free every blob still held by the store
+static void blob_store_free(struct System* system){
+
+    for(size_t i = 0; i < system->num_blobs; i++){
+        free(system->blobs[i].content);
+    }
+
+    for(size_t i = 0; i < BLOB_CACHE_SIZE; i++){
+        free(system->blob_cache[i].content);
+    }
+
+    free(system->blobs);
+    free(system->blob_table);
+    free(system->blob_cache);
+    free(system->scratch);
+
+}
+
+// Position in the table to start probing for this digest
+static size_t blob_slot(struct System* system, const unsigned char* digest){
+
+    size_t key;
+    memcpy(&key, digest, sizeof(size_t));
+
+    return key & (system->blob_table_cap - 1);
+
+}
+
+// Return index of the blob holding this digest, or BLOB_NONE
+static int blob_lookup(struct System* system, const unsigned char* digest){
+
+    size_t slot = blob_slot(system, digest);
+
+    while(system->blob_table[slot] != BLOB_TABLE_EMPTY){
+
+        int index = system->blob_table[slot];
+
+        if(index >= 0 && memcmp(system->blobs[index].digest, digest, SHA256_DIGEST_SIZE) == 0){
+            return index;
+        }
+
+        slot = (slot + 1) & (system->blob_table_cap - 1);
+    }
+
+    return BLOB_NONE;
+
+}
+
+static void blob_table_put(struct System* system, int index){
+
+    size_t slot = blob_slot(system, system->blobs[index].digest);
+
+    while(system->blob_table[slot] >= 0){
+        slot = (slot + 1) & (system->blob_table_cap - 1);
+    }
+
+    if(system->blob_table[slot] == BLOB_TABLE_EMPTY){
+        system->blob_table_used++;
+    }
+
+    system->blob_table[slot] = index;
+
+}
+
+// Rebuild the table, growing it when live entries need the room
+static void blob_table_rehash(struct System* system){
+
+    size_t live = 0;
+    for(size_t i = 0; i < system->num_blobs; i++){
+        if(system->blobs[i].refcount > 0){
+            live++;
+        }
+    }
+
+    while(live*2 >= system->blob_table_cap){
+        system->blob_table_cap = system->blob_table_cap*2;
+    }
+
+    system->blob_table = (int*)realloc(system->blob_table, sizeof(int)*system->blob_table_cap);
+    for(size_t i = 0; i < system->blob_table_cap; i++){
+        system->blob_table[i] = BLOB_TABLE_EMPTY;
+    }
+    system->blob_table_used = 0;
+
+    for(size_t i = 0; i < system->num_blobs; i++){
+        if(system->blobs[i].refcount > 0){
+            blob_table_put(system, i);
+        }
+    }
+
+}
+
+// Add new content to the store, taking ownership of the buffer
+// Content may be NULL for blobs that are only stored in the repository
+// Returns the index with a single reference held by the caller
+static int blob_insert(struct System* system, const unsigned char* digest, char* content, int length){
+
+    int index;
+
+    // Keep the load factor (including tombstones) under 3/4
+    // Done before the new blob is live, so the rehash can not enter it too
+    if((system->blob_table_used + 1)*4 > system->blob_table_cap*3){
+        blob_table_rehash(system);
+    }
+
+    if(system->free_blob != BLOB_NONE){
+        // Reuse a released slot
+        index = system->free_blob;
+        system->free_blob = system->blobs[index].next_free;
+    } else {
+        if(system->num_blobs == system->cap_blobs){
+            system->blobs = (struct Blob*)realloc(system->blobs, sizeof(struct Blob)*system->cap_blobs*2);
+            system->cap_blobs = system->cap_blobs*2;
+        }
+        index = system->num_blobs;
+        system->num_blobs++;
+    }
+
+    struct Blob* blob = &system->blobs[index];
+    memcpy(blob->digest, digest, SHA256_DIGEST_SIZE);
+    blob->content = content;
+    blob->mapped = NULL;
+    blob->disk_offset = -1;
+    blob->length = length;
+    blob->stored_length = length;
+    blob->base = BLOB_NONE;
+    blob->depth = 0;
+    blob->codec = 0;
+    blob->raw_length = length;
+    blob->refcount = 1;
+    blob->next_free = BLOB_NONE;
+
+    blob_table_put(system, index);
+
+    if(content != NULL){
+        stats_bump(&system->stats->blobs_stored, 1);
+        stats_bump(&system->stats->blob_bytes, length);
+    }
+
+    return index;
+
+}
+
+static void blob_retain(struct System* system, int index){
+
+    system->blobs[index].refcount++;
+
+}
+
+// Make a blob a delta against base, its content must already be the delta
+static void blob_set_base(struct System* system, int index, int base, int stored_length){
+
+    struct Blob* blob = &system->blobs[index];
+
+    blob->base = base;
+    blob->depth = system->blobs[base].depth + 1;
+    if(blob->content != NULL){
+        stats_bump(&system->stats->blob_bytes, stored_length - blob->stored_length);
+    }
+    blob->stored_length = stored_length;
+    blob->raw_length = stored_length;
+
+    blob_retain(system, base);
+
+}
+
+// Compress the bytes a new blob holds in memory with the system's codec
+static void blob_compress(struct System* system, int index){
+
+    struct Blob* blob = &system->blobs[index];
+
+    if(system->compression == 0 || blob->content == NULL || blob->stored_length < COMPRESS_MIN_LENGTH){
+        return;
+    }
+
+    if(!lz_worth_compressing(blob->content, blob->stored_length)){
+        return;
+    }
+
+    size_t max_packed = blob->stored_length - blob->stored_length/8;
+    char* packed = (char*)malloc(max_packed);
+    long packed_length = lz_compress(blob->content, blob->stored_length, packed, max_packed, system->compression);
+
+    if(packed_length <= 0){
+        free(packed);
+        return;
+    }
+
+    free(blob->content);
+    blob->content = (char*)realloc(packed, packed_length);
+    stats_bump(&system->stats->blob_bytes, packed_length - blob->stored_length);
+    blob->stored_length = packed_length;
+    blob->codec = system->compression;
+
+}
+
+// Add new content to the store, taking ownership of the buffer
+// It is kept as a delta against base when that is worth it, base may be BLOB_NONE,
+// and compressed with the system's codec
+// Returns the index with a single reference held by the caller
+static int blob_insert_against(struct System* system, const unsigned char* digest, char* content, int length, int base){
+
+    unsigned char* delta = NULL;
+    long delta_length = -1;
+
+    if(base != BLOB_NONE && length >= DELTA_MIN_LENGTH){
+
+        if(system->blobs[base].depth >= DELTA_MAX_DEPTH){
+            while(system->blobs[base].base != BLOB_NONE){
+                base = system->blobs[base].base;
+            }
+        }
+
+        const char* base_content = blob_content(system, base);
+        size_t max_delta = length / 2;
+        delta = (unsigned char*)malloc(max_delta);
+
+        if(base_content != NULL){
+            delta_length = delta_encode(base_content, system->blobs[base].length, content, length, delta, max_delta);
+        }
+    }
+
+    int index;
+
+    if(delta_length < 0){
+        free(delta);
+        index = blob_insert(system, digest, content, length);
+    } else {
+        free(content);
+        delta = (unsigned char*)realloc(delta, delta_length);
+        index = blob_insert(system, digest, (char*)delta, length);
+        blob_set_base(system, index, base, delta_length);
+    }
+
+    blob_compress(system, index);
+
+    return index;
+
+}
+
+static int blob_cache_find(struct System* system, int index){
+
+    for(int i = 0; i < BLOB_CACHE_SIZE; i++){
+        if(system->blob_cache[i].blob == index){
+            system->blob_cache[i].last_used = ++system->blob_cache_clock;
+            return i;
+        }
+    }
+
+    return -1;
+
+}
+
+// Keep rebuilt content, replacing the least recently used entry
+static char* blob_cache_put(struct System* system, int index, char* content){
+
+    int victim = 0;
+
+    for(int i = 1; i < BLOB_CACHE_SIZE; i++){
+        if(system->blob_cache[i].blob == BLOB_NONE){
+            victim = i;
+            break;
+        }
+        if(system->blob_cache[i].last_used < system->blob_cache[victim].last_used){
+            victim = i;
+        }
+    }
+
+    free(system->blob_cache[victim].content);
+    system->blob_cache[victim].blob = index;
+    system->blob_cache[victim].content = content;
+    system->blob_cache[victim].last_used = ++system->blob_cache_clock;
+
+    return content;
+
+}
+
+static void blob_cache_drop(struct System* system, int index){
+
+    int entry = blob_cache_find(system, index);
+
+    if(entry != -1){
+        free(system->blob_cache[entry].content);
+        system->blob_cache[entry].blob = BLOB_NONE;
+        system->blob_cache[entry].content = NULL;
+    }
+
+}
+
+// Drop one reference, freeing the content once nothing refers to it
+static void blob_release(struct System* system, int index){
+
+    struct Blob* blob = &system->blobs[index];
+
+    blob->refcount--;
+
+    if(blob->refcount > 0){
+        return;
+    }
+
+    // Replace the table entry with a tombstone so probe chains stay intact
+    size_t slot = blob_slot(system, blob->digest);
+    while(system->blob_table[slot] != index){
+        slot = (slot + 1) & (system->blob_table_cap - 1);
+    }
+    system->blob_table[slot] = BLOB_TABLE_TOMBSTONE;
+
+    int base = blob->base;
+
+    if(base != BLOB_NONE || blob->codec != 0){
+        blob_cache_drop(system, index);
+    }
+
+    if(blob->content != NULL){
+        stats_bump(&system->stats->blob_bytes, -(uint64_t)blob->stored_length);
+    }
+
+    free(blob->content);
+    blob->content = NULL;
+    blob->mapped = NULL;
+    blob->length = 0;
+    blob->base = BLOB_NONE;
+    blob->codec = 0;
+    blob->next_free = system->free_blob;
+    system->free_blob = index;
+
+    if(base != BLOB_NONE){
+        blob_release(system, base);
+    }
+
+}
+
+// Decompress a blob, then apply its delta to its base, whose content may be
+// rebuilt in turn. Returns NULL if the stored bytes are damaged
+static char* blob_rebuild(struct System* system, int index){
+
+    int entry = blob_cache_find(system, index);
+
+    if(entry != -1){
+        return system->blob_cache[entry].content;
+    }
+
+    struct Blob* blob = &system->blobs[index];
+    const char* stored = blob->content != NULL ? blob->content : blob->mapped;
+
+    if(stored == NULL){
+        return NULL;
+    }
+
+    char* raw = (char*)stored;
+
+    if(blob->codec != 0){
+
+        raw = (char*)malloc(blob->raw_length + 1);
+
+        if(lz_decompress(stored, blob->stored_length, raw, blob->raw_length) != 0){
+            free(raw);
+            return NULL;
+        }
+
+        if(blob->base == BLOB_NONE){
+            raw[blob->raw_length] = '\0';
+            return blob_cache_put(system, index, raw);
+        }
+    }
+
+    const char* base = blob_content(system, blob->base);
+    char* content = NULL;
+
+    if(base != NULL && delta_result_length(raw, blob->raw_length) == blob->length){
+
+        content = (char*)malloc(blob->length + 1);
+
+        if(delta_apply(base, system->blobs[blob->base].length, raw, blob->raw_length, content) != 0){
+            free(content);
+            content = NULL;
+        }
+    }
+
+    if(raw != stored){
+        free(raw);
+    }
+
+    if(content == NULL){
+        return NULL;
+    }
+
+    content[blob->length] = '\0';
+
+    return blob_cache_put(system, index, content);
+
+}
+
+// Contents of a blob, either held in memory or mapped from the repository
+// Content rebuilt from a delta or decompressed lives in the cache, and
+// stays valid for at least BLOB_CACHE_SIZE / (DELTA_MAX_DEPTH + 1) further calls
+static char* blob_content(struct System* system, int index){
+
+    struct Blob* blob = &system->blobs[index];
+
+    if(blob->base != BLOB_NONE || blob->codec != 0){
+        return blob_rebuild(system, index);
+    }
+
+    if(blob->content != NULL){
+        return blob->content;
+    }
+
+    return (char*)blob->mapped;
+
+}
+
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef SVC_BYTESUM
+#define SVC_BYTESUM
+
+#include <stdlib.h>
+#include <stdint.h>
+
+// Sum of all bytes in a buffer, the core of hash_file
+// Summing into 64 bit lanes can not overflow for any buffer under 2^56
+// bytes, so the modulo of the hash is applied once to the total and the
+// result is identical to reducing after every byte
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BYTESUM_X86
+#include <immintrin.h>
+#endif
+
+
+static uint64_t bytesum_scalar(const unsigned char* data, size_t length){
+
+    uint64_t sum = 0;
+
+    for(size_t i = 0; i < length; i++){
+        sum += data[i];
+    }
+
+    return sum;
+
+}
+
+#ifdef BYTESUM_X86
+
+// psadbw against zero adds each group of 8 bytes into a 64 bit lane
+__attribute__((target("sse2")))
+static uint64_t bytesum_sse2(const unsigned char* data, size_t length){
+
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+    size_t i = 0;
+
+    for(; i + 32 <= length; i += 32){
+        __m128i a = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(data + i + 16));
+        acc0 = _mm_add_epi64(acc0, _mm_sad_epu8(a, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_sad_epu8(b, zero));
+    }
+
+    acc0 = _mm_add_epi64(acc0, acc1);
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc0);
+
+    return lanes[0] + lanes[1] + bytesum_scalar(data + i, length - i);
+
+}
+
+__attribute__((target("avx2")))
+static uint64_t bytesum_avx2(const unsigned char* data, size_t length){
+
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for(; i + 64 <= length; i += 64){
+        __m256i a = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(data + i + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_sad_epu8(a, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_sad_epu8(b, zero));
+    }
+
+    acc0 = _mm256_add_epi64(acc0, acc1);
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc0);
+
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + bytesum_scalar(data + i, length - i);
+
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static uint64_t bytesum_avx512(const unsigned char* data, size_t length){
+
+    __m512i zero = _mm512_setzero_si512();
+    __m512i acc0 = _mm512_setzero_si512();
+    __m512i acc1 = _mm512_setzero_si512();
+    size_t i = 0;
+
+    for(; i + 128 <= length; i += 128){
+        __m512i a = _mm512_loadu_si512((const void*)(data + i));
+        __m512i b = _mm512_loadu_si512((const void*)(data + i + 64));
+        acc0 = _mm512_add_epi64(acc0, _mm512_sad_epu8(a, zero));
+        acc1 = _mm512_add_epi64(acc1, _mm512_sad_epu8(b, zero));
+    }
+
+    acc0 = _mm512_add_epi64(acc0, acc1);
+
+    return _mm512_reduce_add_epi64(acc0) + bytesum_scalar(data + i, length - i);
+
+}
+
+#endif
+
+typedef uint64_t (*bytesum_fn)(const unsigned char* data, size_t length);
+
+// Pick the widest kernel the CPU supports
+static bytesum_fn bytesum_select(void){
+
+#ifdef BYTESUM_X86
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx512bw")){
+        return bytesum_avx512;
+    }
+    if(__builtin_cpu_supports("avx2")){
+        return bytesum_avx2;
+    }
+    if(__builtin_cpu_supports("sse2")){
+        return bytesum_sse2;
+    }
+#endif
+
+    return bytesum_scalar;
+
+}
+
+static inline uint64_t bytesum(const void* data, size_t length){
+
+    // Threads racing to pick the kernel all store the same choice
+    static bytesum_fn kernel = NULL;
+
+    bytesum_fn chosen = __atomic_load_n(&kernel, __ATOMIC_RELAXED);
+
+    if(chosen == NULL){
+        chosen = bytesum_select();
+        __atomic_store_n(&kernel, chosen, __ATOMIC_RELAXED);
+    }
+
+    return chosen((const unsigned char*)data, length);
+
+}
+
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef SVC_COMMIT_INDEX
+#define SVC_COMMIT_INDEX
+
+#include <stdlib.h>
+#include <string.h>
+#include "structures.h"
+#include "arena.h"
+#include "commit_table.h"
+#include "stats.h"
+
+// Commit lookup structures
+// A hash table gives exact id lookups in constant time
+// A trie over the hex digits of each id resolves unique prefixes
+// Both hold handles, so commits opened from a repository are found
+// without making their skeletons, and their ids are only added, straight
+// from the mapped index records, when the first lookup needs them.
+
+// Table entries keep their own pointer to the id string, so probing
+// never has to load the commit itself
+struct CommitEntry {
+
+    const char* id;
+    uint32_t handle;
+
+};
+
+struct TrieNode {
+
+    struct TrieNode* children[16];
+    size_t count; // Number of distinct ids below this node
+    uint32_t handle; // Commit whose id ends at this node, or COMMIT_NONE
+
+};
+
+// Defined with the repository, see repository.h
+static void repo_index_ids(struct System* system);
+
+
+// Value of a hex digit, or -1 if the character is not one
+static int hex_value(char c){
+
+    if(c >= '0' && c <= '9'){
+        return c - '0';
+    } else if(c >= 'a' && c <= 'f'){
+        return c - 'a' + 10;
+    } else if(c >= 'A' && c <= 'F'){
+        return c - 'A' + 10;
+    }
+
+    return -1;
+
+}
+
+// FNV-1a over the id string
+static size_t commit_id_hash(const char* id){
+
+    size_t hash = 14695981039346656037ULL;
+
+    for(; *id != '\0'; id++){
+        hash = (hash ^ (unsigned char)*id) * 1099511628211ULL;
+    }
+
+    return hash;
+
+}
+
+static struct TrieNode* commit_trie_node(struct System* system){
+
+    struct TrieNode* node = (struct TrieNode*)arena_calloc(system->arena, 1, sizeof(struct TrieNode));
+    node->handle = COMMIT_NONE;
+
+    return node;
+
+}
+
+static void commit_index_init(struct System* system){
+
+    system->commit_table_cap = 16;
+    system->commit_table = (struct CommitEntry*)calloc(system->commit_table_cap, sizeof(struct CommitEntry));
+    system->commit_trie = commit_trie_node(system);
+    system->num_unindexed = 0;
+
+}
+
+// Trie nodes belong to the system arena
+static void commit_index_free(struct System* system){
+
+    free(system->commit_table);
+
+}
+
+// Slot holding this id, or the empty slot where it belongs
+static size_t commit_table_slot(struct System* system, const char* id){
+
+    size_t slot = commit_id_hash(id) & (system->commit_table_cap - 1);
+    uint64_t compared = 0;
+
+    while(system->commit_table[slot].id != NULL && (compared++, strcmp(system->commit_table[slot].id, id) != 0)){
+        slot = (slot + 1) & (system->commit_table_cap - 1);
+    }
+
+    stats_bump(&system->stats->string_compares, compared);
+
+    return slot;
+
+}
+
+static void commit_table_grow(struct System* system){
+
+    struct CommitEntry* old_table = system->commit_table;
+    size_t old_cap = system->commit_table_cap;
+
+    system->commit_table_cap = old_cap*2;
+    system->commit_table = (struct CommitEntry*)calloc(system->commit_table_cap, sizeof(struct CommitEntry));
+
+    for(size_t i = 0; i < old_cap; i++){
+        if(old_table[i].id != NULL){
+            system->commit_table[commit_table_slot(system, old_table[i].id)] = old_table[i];
+        }
+    }
+
+    free(old_table);
+
+}
+
+// True if the id can be found by prefix, only ids made entirely of hex digits can
+static bool commit_id_is_hex(const char* id){
+
+    for(const char* c = id; *c != '\0'; c++){
+        if(hex_value(*c) < 0){
+            return false;
+        }
+    }
+
+    return true;
+
+}
+
+// Register the id of the commit with handle
+// When two commits share an id the one created first keeps it, so lookups
+// return the earliest made. The old search walked children breadth first
+// from the initial commit, and so returned the shallowest match instead.
+// Ids opened from a repository are added after the commits made since,
+// so an earlier handle takes the id over from a later one.
+static void commit_index_put(struct System* system, const char* id, uint32_t handle){
+
+    if((system->num_commits + 1)*2 > system->commit_table_cap){
+        commit_table_grow(system);
+    }
+
+    size_t slot = commit_table_slot(system, id);
+    struct CommitEntry* entry = &system->commit_table[slot];
+    bool taken = entry->id != NULL;
+
+    if(taken && entry->handle < handle){
+        return;
+    }
+
+    entry->id = id;
+    entry->handle = handle;
+
+    if(!commit_id_is_hex(id)){
+        return;
+    }
+
+    struct TrieNode* node = system->commit_trie;
+    node->count += !taken;
+
+    for(const char* c = id; *c != '\0'; c++){
+
+        int digit = hex_value(*c);
+
+        if(node->children[digit] == NULL){
+            node->children[digit] = commit_trie_node(system);
+        }
+
+        node = node->children[digit];
+        node->count += !taken;
+    }
+
+    node->handle = handle;
+
+}
+
+// Register a newly created commit
+static void commit_index_add(struct System* system, struct Commit* commit){
+
+    commit_index_put(system, commit->id, commit->seq);
+
+}
+
+static struct Commit* commit_index_find(struct System* system, const char* id){
+
+    stats_bump(&system->stats->commit_lookups, 1);
+
+    if(system->num_unindexed > 0){
+        repo_index_ids(system);
+    }
+
+    struct CommitEntry* entry = &system->commit_table[commit_table_slot(system, id)];
+
+    return entry->id == NULL ? NULL : commit_at(system, entry->handle);
+
+}
+
+// Resolve a prefix to the single commit it identifies
+// Returns NULL when no id, or more than one id, starts with the prefix
+static struct Commit* commit_index_resolve(struct System* system, const char* prefix){
+
+    if(system->num_unindexed > 0){
+        repo_index_ids(system);
+    }
+
+    struct TrieNode* node = system->commit_trie;
+
+    stats_bump(&system->stats->commit_lookups, 1);
+
+    for(const char* c = prefix; *c != '\0'; c++){
+
+        int digit = hex_value(*c);
+
+        if(digit < 0 || node->children[digit] == NULL){
+            return NULL;
+        }
+
+        node = node->children[digit];
+    }
+
+    if(node->count != 1){
+        return NULL;
+    }
+
+    // Follow the only branch down to the end of the id
+    while(node->handle == COMMIT_NONE){
+
+        int digit = 0;
+        while(node->children[digit] == NULL){
+            digit++;
+        }
+
+        node = node->children[digit];
+    }
+
+    return commit_at(system, node->handle);
+
+}
+
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef SVC_COMMIT_TABLE
+#define SVC_COMMIT_TABLE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "structures.h"
+#include "arena.h"
+
+// Storage for every commit, addressed by a 32 bit handle
+// Handles are given out in creation order and double as Commit.seq.
+// Commits live in fixed size chunks that are never moved, so pointers
+// to them stay valid and making a commit never touches any other one.
+// The fields graph walks need sit in struct Commit, the rest in a
+// parallel struct CommitBody, so walking history stays in cache.
+// Chunks of commits opened from a repository are left NULL until a
+// handle in them is first used, then made from the mapped index records.
+
+#define COMMIT_CHUNK_BITS 12
+#define COMMIT_CHUNK_SIZE (1u << COMMIT_CHUNK_BITS)
+
+
+static void commit_table_init(struct System* system){
+
+    system->num_commits = 0;
+    system->commit_chunks = NULL;
+    system->body_chunks = NULL;
+    system->num_chunks = 0;
+    system->cap_chunks = 0;
+
+}
+
+// The chunks themselves belong to the arena
+static void commit_table_free(struct System* system){
+
+    free(system->commit_chunks);
+    free(system->body_chunks);
+
+}
+
+// Defined with the repository, see repository.h
+static struct Commit* repo_load_chunk(struct System* system, size_t chunk);
+
+static struct Commit* commit_at(struct System* system, uint32_t handle){
+
+    struct Commit* chunk = system->commit_chunks[handle >> COMMIT_CHUNK_BITS];
+
+    if(chunk == NULL){
+        chunk = repo_load_chunk(system, handle >> COMMIT_CHUNK_BITS);
+    }
+
+    return &chunk[handle & (COMMIT_CHUNK_SIZE - 1)];
+
+}
+
+// Cold half of a commit, see commit_load for commits read from a repository
+static struct CommitBody* commit_body(struct System* system, const struct Commit* commit){
+
+    return &system->body_chunks[commit->seq >> COMMIT_CHUNK_BITS][commit->seq & (COMMIT_CHUNK_SIZE - 1)];
+
+}
+
+// Parent number k of a commit, or NULL
+static struct Commit* commit_parent(struct System* system, const struct Commit* commit, size_t k){
+
+    if(k >= commit->num_parents){
+        return NULL;
+    }
+
+    return commit_at(system, commit->parents[k]);
+
+}
+
+// A fresh commit with no parents and an empty body
+// Returns NULL once every handle has been used
+static struct Commit* commit_new(struct System* system){
+
+    if(system->num_commits >= COMMIT_NONE){
+        return NULL;
+    }
+
+    if(system->num_commits == system->num_chunks*COMMIT_CHUNK_SIZE){
+
+        if(system->num_chunks == system->cap_chunks){
+            system->cap_chunks = system->cap_chunks == 0 ? 16 : system->cap_chunks*2;
+            system->commit_chunks = (struct Commit**)realloc(system->commit_chunks, sizeof(struct Commit*)*system->cap_chunks);
+            system->body_chunks = (struct CommitBody**)realloc(system->body_chunks, sizeof(struct CommitBody*)*system->cap_chunks);
+        }
+
+        system->commit_chunks[system->num_chunks] = (struct Commit*)arena_alloc(system->arena, sizeof(struct Commit)*COMMIT_CHUNK_SIZE);
+        system->body_chunks[system->num_chunks] = (struct CommitBody*)arena_alloc(system->arena, sizeof(struct CommitBody)*COMMIT_CHUNK_SIZE);
+        system->num_chunks++;
+    }
+
+    uint32_t handle = system->num_commits;
+    system->num_commits++;
+
+    struct Commit* commit = commit_at(system, handle);
+    memset(commit, 0, sizeof(struct Commit));
+    commit->seq = handle;
+    commit->parents[0] = COMMIT_NONE;
+    commit->parents[1] = COMMIT_NONE;
+    commit->generation = 1;
+    commit->loaded = true;
+
+    memset(commit_body(system, commit), 0, sizeof(struct CommitBody));
+
+    return commit;
+
+}
+
+// Record the parents of a commit, either may be NULL
+// Generation is one more than the highest parent generation
+static void commit_set_parents(struct Commit* commit, struct Commit* parent, struct Commit* parent2){
+
+    commit->num_parents = 0;
+    commit->generation = 1;
+
+    struct Commit* parents[2] = {parent, parent2};
+
+    for(size_t k = 0; k < 2; k++){
+
+        if(parents[k] == NULL){
+            continue;
+        }
+
+        commit->parents[commit->num_parents] = parents[k]->seq;
+        commit->num_parents++;
+
+        if(parents[k]->generation + 1 > commit->generation){
+            commit->generation = parents[k]->generation + 1;
+        }
+    }
+
+}
+
+
+#endif
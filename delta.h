@@ -0,0 +1,252 @@
+#ifndef SVC_DELTA
+#define SVC_DELTA
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Delta encoding of one version of a file against another
+//
+// A delta is the base and result lengths as varints, then instructions
+//   0x01 - 0x7f   insert that many literal bytes, which follow
+//   0x80          copy, followed by varint offset and varint length in the base
+//
+// Matches are found by indexing the base in DELTA_BLOCK byte blocks and
+// extending each block hit in both directions, so lines moved or edited
+// in a large file still copy everything around them.
+
+#define DELTA_BLOCK 16
+#define DELTA_MAX_INSERT 0x7f
+#define DELTA_COPY 0x80
+#define DELTA_NONE UINT32_MAX
+
+
+// Append a varint, returns 0 if it does not fit before end
+static int delta_put_varint(unsigned char** out, unsigned char* end, uint64_t value){
+
+    do {
+        if(*out == end){
+            return 0;
+        }
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        *(*out)++ = byte | (value != 0 ? 0x80 : 0);
+    } while(value != 0);
+
+    return 1;
+
+}
+
+// Read a varint, returns 0 if the delta ends inside it
+static int delta_get_varint(const unsigned char** in, const unsigned char* end, uint64_t* value){
+
+    *value = 0;
+
+    for(unsigned shift = 0; shift < 64; shift += 7){
+        if(*in == end){
+            return 0;
+        }
+        unsigned char byte = *(*in)++;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if((byte & 0x80) == 0){
+            return 1;
+        }
+    }
+
+    return 0;
+
+}
+
+static uint32_t delta_block_hash(const char* data){
+
+    uint64_t a;
+    uint64_t b;
+    memcpy(&a, data, sizeof(uint64_t));
+    memcpy(&b, data + sizeof(uint64_t), sizeof(uint64_t));
+
+    uint64_t hash = (a ^ (b * 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL;
+
+    return (uint32_t)(hash >> 32);
+
+}
+
+// Flush pending literal bytes as insert instructions
+static int delta_put_insert(unsigned char** out, unsigned char* end, const char* data, size_t length){
+
+    while(length > 0){
+
+        size_t chunk = length < DELTA_MAX_INSERT ? length : DELTA_MAX_INSERT;
+
+        if((size_t)(end - *out) < chunk + 1){
+            return 0;
+        }
+
+        *(*out)++ = (unsigned char)chunk;
+        memcpy(*out, data, chunk);
+        *out += chunk;
+
+        data += chunk;
+        length -= chunk;
+    }
+
+    return 1;
+
+}
+
+static int delta_put_copy(unsigned char** out, unsigned char* end, size_t offset, size_t length){
+
+    if(*out == end){
+        return 0;
+    }
+
+    *(*out)++ = DELTA_COPY;
+
+    return delta_put_varint(out, end, offset) && delta_put_varint(out, end, length);
+
+}
+
+// Encode target against base into out, using at most max_out bytes
+// Returns the delta length, or -1 if it would not fit, in which case
+// storing the target in full is the better choice
+static long delta_encode(const char* base, size_t base_length, const char* target, size_t target_length, unsigned char* out, size_t max_out){
+
+    unsigned char* pos = out;
+    unsigned char* end = out + max_out;
+
+    if(!delta_put_varint(&pos, end, base_length) || !delta_put_varint(&pos, end, target_length)){
+        return -1;
+    }
+
+    // Start of the last base block with each hash, table sized to a power of two
+    size_t num_blocks = base_length / DELTA_BLOCK;
+    size_t cap = 16;
+    while(cap < num_blocks*2){
+        cap *= 2;
+    }
+
+    uint32_t* table = (uint32_t*)malloc(sizeof(uint32_t)*cap);
+    for(size_t i = 0; i < cap; i++){
+        table[i] = DELTA_NONE;
+    }
+    for(size_t b = 0; b < num_blocks; b++){
+        table[delta_block_hash(base + b*DELTA_BLOCK) & (cap - 1)] = b*DELTA_BLOCK;
+    }
+
+    size_t literal = 0; // Start of bytes not yet covered by an instruction
+    size_t i = 0;
+    int fits = 1;
+
+    while(fits && i + DELTA_BLOCK <= target_length){
+
+        uint32_t candidate = num_blocks > 0 ? table[delta_block_hash(target + i) & (cap - 1)] : DELTA_NONE;
+
+        if(candidate == DELTA_NONE || memcmp(base + candidate, target + i, DELTA_BLOCK) != 0){
+            i++;
+            continue;
+        }
+
+        // Grow the match backwards into pending literals, then forwards
+        size_t start = candidate;
+        size_t from = i;
+        while(start > 0 && from > literal && base[start - 1] == target[from - 1]){
+            start--;
+            from--;
+        }
+
+        size_t length = i - from + DELTA_BLOCK;
+        while(start + length < base_length && from + length < target_length && base[start + length] == target[from + length]){
+            length++;
+        }
+
+        fits = delta_put_insert(&pos, end, target + literal, from - literal)
+            && delta_put_copy(&pos, end, start, length);
+
+        i = from + length;
+        literal = i;
+    }
+
+    free(table);
+
+    if(!fits || !delta_put_insert(&pos, end, target + literal, target_length - literal)){
+        return -1;
+    }
+
+    return pos - out;
+
+}
+
+// Length of the content a delta produces, or -1 if it is malformed
+static long delta_result_length(const char* delta, size_t delta_length){
+
+    const unsigned char* in = (const unsigned char*)delta;
+    const unsigned char* end = in + delta_length;
+    uint64_t base_length;
+    uint64_t result_length;
+
+    if(!delta_get_varint(&in, end, &base_length) || !delta_get_varint(&in, end, &result_length)){
+        return -1;
+    }
+
+    return (long)result_length;
+
+}
+
+// Rebuild the content a delta encodes into out, which must hold
+// delta_result_length bytes. Returns 0, or -1 if the delta is malformed
+// or was not made against a base of this length
+static int delta_apply(const char* base, size_t base_length, const char* delta, size_t delta_length, char* out){
+
+    const unsigned char* in = (const unsigned char*)delta;
+    const unsigned char* end = in + delta_length;
+    uint64_t expected_base;
+    uint64_t result_length;
+
+    if(!delta_get_varint(&in, end, &expected_base) || !delta_get_varint(&in, end, &result_length)){
+        return -1;
+    }
+
+    if(expected_base != base_length){
+        return -1;
+    }
+
+    size_t written = 0;
+
+    while(in < end){
+
+        unsigned char op = *in++;
+
+        if(op == DELTA_COPY){
+
+            uint64_t offset;
+            uint64_t length;
+
+            if(!delta_get_varint(&in, end, &offset) || !delta_get_varint(&in, end, &length)){
+                return -1;
+            }
+            if(offset > base_length || length > base_length - offset || length > result_length - written){
+                return -1;
+            }
+
+            memcpy(out + written, base + offset, length);
+            written += length;
+
+        } else {
+
+            if(op == 0 || op > DELTA_MAX_INSERT || (size_t)(end - in) < op || op > result_length - written){
+                return -1;
+            }
+
+            memcpy(out + written, in, op);
+            in += op;
+            written += op;
+
+        }
+
+    }
+
+    return written == result_length ? 0 : -1;
+
+}
+
+
+#endif
@@ -0,0 +1,670 @@
+#ifndef SVC_DIFF
+#define SVC_DIFF
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Line diffs and three-way merges of file contents
+//
+// Files are split into lines, each hashed once so most comparisons are a
+// single integer compare. diff_match finds a longest common subsequence
+// with Myers' algorithm in its linear space form: the middle snake of the
+// edit graph is found by searching from both ends, then each half is
+// solved the same way. diff3_merge combines two edits of a common base,
+// diff_unified writes the changes between two versions as unified hunks.
+
+#define DIFF_NONE SIZE_MAX
+
+// Edit cost past which a middle snake search stops looking for the
+// shortest script and splits where it got furthest, keeping very
+// different files from taking quadratic time
+#define DIFF_MAX_COST 256
+
+// Lines of unchanged context around each hunk of a unified diff
+#define DIFF_CONTEXT 3
+
+
+struct DiffLine {
+
+    const char* start;
+    size_t length; // Including the newline, if the line has one
+    uint64_t hash;
+
+};
+
+struct DiffFile {
+
+    struct DiffLine* lines;
+    size_t num_lines;
+
+};
+
+// Scratch space shared by every step of one diff
+struct DiffContext {
+
+    const struct DiffFile* a;
+    const struct DiffFile* b;
+    size_t* match; // For each line of a, the matching line of b or DIFF_NONE
+    long* forward;
+    long* backward;
+
+};
+
+
+// Lines are hashed a word at a time
+static uint64_t diff_hash(const char* data, size_t length){
+
+    uint64_t hash = length * 0x9e3779b97f4a7c15ULL;
+    uint64_t word = 0;
+
+    if(length < sizeof(uint64_t)){
+        for(size_t i = 0; i < length; i++){
+            word = word << 8 | (unsigned char)data[i];
+        }
+    } else {
+        const char* last = data + length - sizeof(uint64_t);
+
+        for(; data < last; data += sizeof(uint64_t)){
+            memcpy(&word, data, sizeof(uint64_t));
+            hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+            hash ^= hash >> 29;
+        }
+
+        // Overlaps the word before unless length is a multiple of a word
+        memcpy(&word, last, sizeof(uint64_t));
+    }
+
+    hash = (hash ^ word) * 0xc4ceb9fe1a85ec53ULL;
+
+    return hash ^ (hash >> 32);
+
+}
+
+// Split data into lines, the last one may lack a newline
+// Newlines are found with memchr, which scans a vector at a time
+static void diff_split(const char* data, size_t length, struct DiffFile* file){
+
+    size_t cap = 16;
+    file->lines = (struct DiffLine*)malloc(sizeof(struct DiffLine)*cap);
+    file->num_lines = 0;
+
+    const char* end = data + length;
+
+    while(data < end){
+
+        const char* newline = (const char*)memchr(data, '\n', end - data);
+        size_t line_length = newline == NULL ? (size_t)(end - data) : (size_t)(newline - data) + 1;
+
+        if(file->num_lines == cap){
+            cap *= 2;
+            file->lines = (struct DiffLine*)realloc(file->lines, sizeof(struct DiffLine)*cap);
+        }
+
+        struct DiffLine* line = &file->lines[file->num_lines++];
+        line->start = data;
+        line->length = line_length;
+        line->hash = diff_hash(data, line_length);
+
+        data += line_length;
+    }
+
+}
+
+static void diff_free(struct DiffFile* file){
+
+    free(file->lines);
+
+}
+
+static int diff_lines_equal(const struct DiffLine* x, const struct DiffLine* y){
+
+    return x->hash == y->hash && x->length == y->length && memcmp(x->start, y->start, x->length) == 0;
+
+}
+
+static int diff_equal(struct DiffContext* context, size_t i, size_t j){
+
+    return diff_lines_equal(&context->a->lines[i], &context->b->lines[j]);
+
+}
+
+// Find where the middle snake of a[a_lo, a_hi) against b[b_lo, b_hi)
+// crosses the diagonal, the two halves either side are then solved apart.
+// Returns 0 if the ranges share nothing
+static int diff_middle_snake(struct DiffContext* context, size_t a_lo, size_t a_hi, size_t b_lo, size_t b_hi, size_t* split_a, size_t* split_b){
+
+    long n = a_hi - a_lo;
+    long m = b_hi - b_lo;
+    long max_d = (n + m + 1) / 2;
+    long offset = max_d;
+    long width = 2*max_d + 2;
+
+    long* forward = context->forward;
+    long* backward = context->backward;
+
+    // Only diagonals within the cost limit are ever reached
+    long reach = (max_d < DIFF_MAX_COST ? max_d : DIFF_MAX_COST) + 1;
+    long first = offset - reach > 0 ? offset - reach : 0;
+    long last = offset + reach < width ? offset + reach + 1 : width;
+
+    for(long k = first; k < last; k++){
+        forward[k] = -1;
+        backward[k] = -1;
+    }
+    forward[offset + 1] = 0;
+    backward[offset + 1] = 0;
+
+    long delta = n - m;
+    int odd = (delta & 1) != 0;
+
+    // Diagonals that ran off the graph are not searched again
+    long forward_start = 0;
+    long forward_end = 0;
+    long backward_start = 0;
+    long backward_end = 0;
+
+    long d;
+
+    for(d = 0; d < max_d && d < DIFF_MAX_COST; d++){
+
+        for(long k = -d + forward_start; k <= d - forward_end; k += 2){
+
+            long slot = offset + k;
+            long x = (k == -d || (k != d && forward[slot - 1] < forward[slot + 1])) ? forward[slot + 1] : forward[slot - 1] + 1;
+            long y = x - k;
+
+            while(x < n && y < m && diff_equal(context, a_lo + x, b_lo + y)){
+                x++;
+                y++;
+            }
+
+            forward[slot] = x;
+
+            if(x > n){
+                forward_end += 2;
+            } else if(y > m){
+                forward_start += 2;
+            } else if(odd){
+                long other = offset + delta - k;
+                if(other >= first && other < last && backward[other] != -1 && x >= n - backward[other]){
+                    *split_a = a_lo + x;
+                    *split_b = b_lo + y;
+                    return 1;
+                }
+            }
+        }
+
+        for(long k = -d + backward_start; k <= d - backward_end; k += 2){
+
+            long slot = offset + k;
+            long x = (k == -d || (k != d && backward[slot - 1] < backward[slot + 1])) ? backward[slot + 1] : backward[slot - 1] + 1;
+            long y = x - k;
+
+            while(x < n && y < m && diff_equal(context, a_hi - x - 1, b_hi - y - 1)){
+                x++;
+                y++;
+            }
+
+            backward[slot] = x;
+
+            if(x > n){
+                backward_end += 2;
+            } else if(y > m){
+                backward_start += 2;
+            } else if(!odd){
+                long other = offset + delta - k;
+                if(other >= first && other < last && forward[other] != -1){
+                    long forward_x = forward[other];
+                    long forward_y = forward_x - (other - offset);
+                    if(forward_x >= n - x){
+                        *split_a = a_lo + forward_x;
+                        *split_b = b_lo + forward_y;
+                        return 1;
+                    }
+                }
+            }
+        }
+    }
+
+    if(d == max_d){
+        return 0;
+    }
+
+    // Too costly to search on, split where either search got furthest.
+    // The halves still diff correctly, the script is just not the shortest
+    long best = 0;
+
+    for(long slot = first; slot < last; slot++){
+
+        long k = slot - offset;
+        long x = forward[slot];
+        long y = x - k;
+
+        if(x >= 0 && x <= n && y >= 0 && y <= m && x + y > best && x + y < n + m){
+            best = x + y;
+            *split_a = a_lo + x;
+            *split_b = b_lo + y;
+        }
+
+        x = backward[slot];
+        y = x - k;
+
+        if(x >= 0 && x <= n && y >= 0 && y <= m && x + y > best && x + y < n + m){
+            best = x + y;
+            *split_a = a_hi - x;
+            *split_b = b_hi - y;
+        }
+    }
+
+    return best > 0;
+
+}
+
+static void diff_compare(struct DiffContext* context, size_t a_lo, size_t a_hi, size_t b_lo, size_t b_hi){
+
+    // Lines shared at either end match without any search
+    while(a_lo < a_hi && b_lo < b_hi && diff_equal(context, a_lo, b_lo)){
+        context->match[a_lo++] = b_lo++;
+    }
+
+    while(a_lo < a_hi && b_lo < b_hi && diff_equal(context, a_hi - 1, b_hi - 1)){
+        context->match[--a_hi] = --b_hi;
+    }
+
+    if(a_lo == a_hi || b_lo == b_hi){
+        return;
+    }
+
+    size_t split_a;
+    size_t split_b;
+
+    if(!diff_middle_snake(context, a_lo, a_hi, b_lo, b_hi, &split_a, &split_b)){
+        return;
+    }
+
+    diff_compare(context, a_lo, split_a, b_lo, split_b);
+    diff_compare(context, split_a, a_hi, split_b, b_hi);
+
+}
+
+// For each line of a, the line of b it is kept as in a shortest edit
+// script, or DIFF_NONE if it is deleted. The caller frees the array
+static size_t* diff_match(const struct DiffFile* a, const struct DiffFile* b){
+
+    size_t width = a->num_lines + b->num_lines + 3;
+
+    struct DiffContext context;
+    context.a = a;
+    context.b = b;
+    context.match = (size_t*)malloc(sizeof(size_t)*(a->num_lines + 1));
+    context.forward = (long*)malloc(sizeof(long)*width);
+    context.backward = (long*)malloc(sizeof(long)*width);
+
+    for(size_t i = 0; i < a->num_lines; i++){
+        context.match[i] = DIFF_NONE;
+    }
+
+    diff_compare(&context, 0, a->num_lines, 0, b->num_lines);
+
+    free(context.forward);
+    free(context.backward);
+
+    return context.match;
+
+}
+
+// Output buffer of a merge
+struct DiffOutput {
+
+    char* data;
+    size_t length;
+    size_t cap;
+
+};
+
+static void diff_output_lines(struct DiffOutput* out, const struct DiffFile* file, size_t lo, size_t hi){
+
+    for(size_t i = lo; i < hi; i++){
+
+        const struct DiffLine* line = &file->lines[i];
+
+        if(out->length + line->length + 1 > out->cap){
+            while(out->length + line->length + 1 > out->cap){
+                out->cap = out->cap == 0 ? 256 : out->cap*2;
+            }
+            out->data = (char*)realloc(out->data, out->cap);
+        }
+
+        memcpy(out->data + out->length, line->start, line->length);
+        out->length += line->length;
+    }
+
+}
+
+static int diff_ranges_equal(const struct DiffFile* x, size_t x_lo, size_t x_hi, const struct DiffFile* y, size_t y_lo, size_t y_hi){
+
+    if(x_hi - x_lo != y_hi - y_lo){
+        return 0;
+    }
+
+    for(size_t i = 0; i < x_hi - x_lo; i++){
+        if(!diff_lines_equal(&x->lines[x_lo + i], &y->lines[y_lo + i])){
+            return 0;
+        }
+    }
+
+    return 1;
+
+}
+
+// One region where base, ours and theirs do not all agree
+// Returns 1 if both sides changed it differently
+static int diff3_chunk(struct DiffOutput* out, const struct DiffFile* base, size_t base_lo, size_t base_hi, const struct DiffFile* ours, size_t ours_lo, size_t ours_hi, const struct DiffFile* theirs, size_t theirs_lo, size_t theirs_hi){
+
+    if(diff_ranges_equal(ours, ours_lo, ours_hi, base, base_lo, base_hi)){
+        diff_output_lines(out, theirs, theirs_lo, theirs_hi);
+        return 0;
+    }
+
+    if(diff_ranges_equal(theirs, theirs_lo, theirs_hi, base, base_lo, base_hi) || diff_ranges_equal(ours, ours_lo, ours_hi, theirs, theirs_lo, theirs_hi)){
+        diff_output_lines(out, ours, ours_lo, ours_hi);
+        return 0;
+    }
+
+    diff_output_lines(out, ours, ours_lo, ours_hi);
+    return 1;
+
+}
+
+// Merge the changes ours and theirs made to base, line by line
+// Returns the number of regions both changed differently, or -1 for
+// binary content, which is never merged. When 0 the merged content is
+// left in *merged, which the caller frees
+static int diff3_merge(const char* base, size_t base_length, const char* ours, size_t ours_length, const char* theirs, size_t theirs_length, char** merged, size_t* merged_length){
+
+    *merged = NULL;
+    *merged_length = 0;
+
+    if(memchr(base, '\0', base_length) != NULL || memchr(ours, '\0', ours_length) != NULL || memchr(theirs, '\0', theirs_length) != NULL){
+        return -1;
+    }
+
+    struct DiffFile base_file;
+    struct DiffFile ours_file;
+    struct DiffFile theirs_file;
+    diff_split(base, base_length, &base_file);
+    diff_split(ours, ours_length, &ours_file);
+    diff_split(theirs, theirs_length, &theirs_file);
+
+    size_t* to_ours = diff_match(&base_file, &ours_file);
+    size_t* to_theirs = diff_match(&base_file, &theirs_file);
+
+    struct DiffOutput out = {NULL, 0, 0};
+    int conflicts = 0;
+
+    size_t b = 0;
+    size_t o = 0;
+    size_t t = 0;
+
+    while(b < base_file.num_lines || o < ours_file.num_lines || t < theirs_file.num_lines){
+
+        // Lines all three keep in step are copied as they are
+        size_t stable = 0;
+        while(b + stable < base_file.num_lines && to_ours[b + stable] == o + stable && to_theirs[b + stable] == t + stable){
+            stable++;
+        }
+
+        if(stable > 0){
+            diff_output_lines(&out, &base_file, b, b + stable);
+            b += stable;
+            o += stable;
+            t += stable;
+            continue;
+        }
+
+        // The next base line both sides kept ends the unstable region
+        size_t next = b;
+        while(next < base_file.num_lines && (to_ours[next] == DIFF_NONE || to_theirs[next] == DIFF_NONE)){
+            next++;
+        }
+
+        size_t ours_end = next < base_file.num_lines ? to_ours[next] : ours_file.num_lines;
+        size_t theirs_end = next < base_file.num_lines ? to_theirs[next] : theirs_file.num_lines;
+
+        conflicts += diff3_chunk(&out, &base_file, b, next, &ours_file, o, ours_end, &theirs_file, t, theirs_end);
+
+        b = next;
+        o = ours_end;
+        t = theirs_end;
+    }
+
+    free(to_ours);
+    free(to_theirs);
+    diff_free(&base_file);
+    diff_free(&ours_file);
+    diff_free(&theirs_file);
+
+    if(conflicts > 0){
+        free(out.data);
+        return conflicts;
+    }
+
+    if(out.data == NULL){
+        out.data = (char*)malloc(1);
+    }
+    out.data[out.length] = '\0';
+
+    *merged = out.data;
+    *merged_length = out.length;
+
+    return 0;
+
+}
+
+
+// Text written by diff_unified. Like snprintf, length keeps counting past
+// size so the caller learns how large a buffer the whole diff needs
+struct DiffWriter {
+
+    char* buffer;
+    size_t size; // Bytes buffer can hold, one is kept for the terminator
+    size_t length;
+
+};
+
+static void diff_write(struct DiffWriter* out, const char* data, size_t length){
+
+    if(out->length + 1 < out->size){
+        size_t room = out->size - 1 - out->length;
+        memcpy(out->buffer + out->length, data, length < room ? length : room);
+    }
+
+    out->length += length;
+
+}
+
+static void diff_write_string(struct DiffWriter* out, const char* text){
+
+    diff_write(out, text, strlen(text));
+
+}
+
+// Terminates the buffer after whatever fitted
+static void diff_write_end(struct DiffWriter* out){
+
+    if(out->size > 0){
+        out->buffer[out->length < out->size ? out->length : out->size - 1] = '\0';
+    }
+
+}
+
+static void diff_write_line(struct DiffWriter* out, char prefix, const struct DiffLine* line){
+
+    diff_write(out, &prefix, 1);
+    diff_write(out, line->start, line->length);
+
+    if(line->length == 0 || line->start[line->length - 1] != '\n'){
+        diff_write_string(out, "\n\\ No newline at end of file\n");
+    }
+
+}
+
+// Range of a hunk header, a single line is shown without its length
+// and an empty range by the line before it
+static void diff_write_range(struct DiffWriter* out, size_t start, size_t count){
+
+    char text[64];
+
+    if(count == 1){
+        snprintf(text, sizeof(text), "%zu", start + 1);
+    }
+    else{
+        snprintf(text, sizeof(text), "%zu,%zu", count == 0 ? start : start + 1, count);
+    }
+
+    diff_write_string(out, text);
+
+}
+
+// Lines of a replaced by lines of b, with equal lines between each
+// block and the next
+struct DiffBlock {
+
+    size_t a_lo;
+    size_t a_hi;
+    size_t b_lo;
+    size_t b_hi;
+
+};
+
+static void diff_write_hunk(struct DiffWriter* out, const struct DiffFile* a, const struct DiffFile* b, const struct DiffBlock* blocks, size_t num_blocks){
+
+    const struct DiffBlock* first = &blocks[0];
+    const struct DiffBlock* last = &blocks[num_blocks - 1];
+
+    size_t before = first->a_lo < DIFF_CONTEXT ? first->a_lo : DIFF_CONTEXT;
+    size_t after = a->num_lines - last->a_hi < DIFF_CONTEXT ? a->num_lines - last->a_hi : DIFF_CONTEXT;
+
+    size_t a_start = first->a_lo - before;
+    size_t b_start = first->b_lo - before;
+    size_t a_end = last->a_hi + after;
+    size_t b_end = last->b_hi + after;
+
+    diff_write_string(out, "@@ -");
+    diff_write_range(out, a_start, a_end - a_start);
+    diff_write_string(out, " +");
+    diff_write_range(out, b_start, b_end - b_start);
+    diff_write_string(out, " @@\n");
+
+    size_t i = a_start;
+
+    for(size_t k = 0; k < num_blocks; k++){
+
+        for(; i < blocks[k].a_lo; i++){
+            diff_write_line(out, ' ', &a->lines[i]);
+        }
+
+        for(size_t j = blocks[k].a_lo; j < blocks[k].a_hi; j++){
+            diff_write_line(out, '-', &a->lines[j]);
+        }
+
+        for(size_t j = blocks[k].b_lo; j < blocks[k].b_hi; j++){
+            diff_write_line(out, '+', &b->lines[j]);
+        }
+
+        i = blocks[k].a_hi;
+    }
+
+    for(; i < a_end; i++){
+        diff_write_line(out, ' ', &a->lines[i]);
+    }
+
+}
+
+// Write the changes from old to new as a unified diff. A NULL name stands
+// for a file that does not exist on that side. Binary content is only
+// reported as differing
+static void diff_unified(struct DiffWriter* out, const char* old_name, const char* old, size_t old_length, const char* new_name, const char* new, size_t new_length){
+
+    if(memchr(old, '\0', old_length) != NULL || memchr(new, '\0', new_length) != NULL){
+        diff_write_string(out, "Binary files ");
+        diff_write_string(out, old_name != NULL ? "a/" : "/dev/null");
+        diff_write_string(out, old_name != NULL ? old_name : "");
+        diff_write_string(out, " and ");
+        diff_write_string(out, new_name != NULL ? "b/" : "/dev/null");
+        diff_write_string(out, new_name != NULL ? new_name : "");
+        diff_write_string(out, " differ\n");
+        return;
+    }
+
+    struct DiffFile a;
+    struct DiffFile b;
+    diff_split(old, old_length, &a);
+    diff_split(new, new_length, &b);
+
+    size_t* match = diff_match(&a, &b);
+
+    diff_write_string(out, old_name != NULL ? "--- a/" : "--- /dev/null");
+    diff_write_string(out, old_name != NULL ? old_name : "");
+    diff_write_string(out, "\n+++ ");
+    diff_write_string(out, new_name != NULL ? "b/" : "/dev/null");
+    diff_write_string(out, new_name != NULL ? new_name : "");
+    diff_write_string(out, "\n");
+
+    struct DiffBlock* blocks = NULL;
+    size_t num_blocks = 0;
+    size_t cap_blocks = 0;
+
+    size_t i = 0;
+    size_t j = 0;
+
+    while(i < a.num_lines || j < b.num_lines){
+
+        if(i < a.num_lines && match[i] == j){
+            i++;
+            j++;
+            continue;
+        }
+
+        // Deleted lines of a, then the lines of b up to the next kept line
+        struct DiffBlock block;
+        block.a_lo = i;
+        block.b_lo = j;
+
+        while(i < a.num_lines && match[i] == DIFF_NONE){
+            i++;
+        }
+
+        j = i < a.num_lines ? match[i] : b.num_lines;
+        block.a_hi = i;
+        block.b_hi = j;
+
+        // Blocks close enough to share context go in the same hunk
+        if(num_blocks > 0 && block.a_lo - blocks[num_blocks - 1].a_hi > 2*DIFF_CONTEXT){
+            diff_write_hunk(out, &a, &b, blocks, num_blocks);
+            num_blocks = 0;
+        }
+
+        if(num_blocks == cap_blocks){
+            cap_blocks = cap_blocks == 0 ? 16 : cap_blocks*2;
+            blocks = (struct DiffBlock*)realloc(blocks, sizeof(struct DiffBlock)*cap_blocks);
+        }
+
+        blocks[num_blocks++] = block;
+    }
+
+    if(num_blocks > 0){
+        diff_write_hunk(out, &a, &b, blocks, num_blocks);
+    }
+
+    free(blocks);
+    free(match);
+    diff_free(&a);
+    diff_free(&b);
+
+}
+
+
+#endif
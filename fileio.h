@@ -0,0 +1,130 @@
+#ifndef SVC_FILEIO
+#define SVC_FILEIO
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Shared file reading layer
+// A single fstat gives the size, small files are pulled in with large
+// read() calls into a reusable buffer and big files are mapped for a
+// sequential pass, so callers always see the whole file as one array
+
+#define FILEIO_MAP_THRESHOLD (256*1024)
+#define FILEIO_BLOCK_SIZE (1024*1024)
+
+struct FileView {
+
+    const char* data;
+    size_t size;
+    bool mapped;
+    struct stat st; // Stat taken when the file was opened
+
+};
+
+
+// Read a whole descriptor into the caller's buffer, growing it if needed
+static ssize_t file_view_read(int fd, size_t size, char** buffer, size_t* buffer_cap){
+
+    if(*buffer_cap < size + 1){
+        char* grown = (char*)realloc(*buffer, size + 1);
+        if(grown == NULL){
+            return -1;
+        }
+        *buffer = grown;
+        *buffer_cap = size + 1;
+    }
+
+    size_t done = 0;
+
+    while(done < size){
+
+        size_t want = size - done;
+        if(want > FILEIO_BLOCK_SIZE){
+            want = FILEIO_BLOCK_SIZE;
+        }
+
+        ssize_t got = read(fd, *buffer + done, want);
+
+        if(got < 0){
+            return -1;
+        }
+
+        if(got == 0){
+            // File shrank underneath us
+            break;
+        }
+
+        done += got;
+    }
+
+    (*buffer)[done] = '\0';
+
+    return done;
+
+}
+
+// Open file_path and expose its contents
+// buffer is reused across calls for files too small to be worth mapping
+// Returns -1 if the file can not be opened
+static int file_view_open(const char* file_path, struct FileView* view, char** buffer, size_t* buffer_cap){
+
+    int fd = open(file_path, O_RDONLY);
+
+    if(fd < 0){
+        return -1;
+    }
+
+    if(fstat(fd, &view->st) != 0){
+        close(fd);
+        return -1;
+    }
+
+    view->size = view->st.st_size;
+    view->mapped = false;
+
+    if(view->size >= FILEIO_MAP_THRESHOLD){
+
+        void* data = mmap(NULL, view->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if(data != MAP_FAILED){
+            madvise(data, view->size, MADV_SEQUENTIAL);
+            view->data = (const char*)data;
+            view->mapped = true;
+            close(fd);
+            return 0;
+        }
+    }
+
+    ssize_t got = file_view_read(fd, view->size, buffer, buffer_cap);
+
+    close(fd);
+
+    if(got < 0){
+        return -1;
+    }
+
+    view->data = *buffer;
+    view->size = got;
+
+    return 0;
+
+}
+
+static void file_view_close(struct FileView* view){
+
+    if(view->mapped){
+        munmap((void*)view->data, view->size);
+    }
+
+    view->data = NULL;
+    view->size = 0;
+    view->mapped = false;
+
+}
+
+
+#endif
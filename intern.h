@@ -0,0 +1,183 @@
+#ifndef SVC_INTERN
+#define SVC_INTERN
+
+#include <stdlib.h>
+#include <string.h>
+#include "structures.h"
+#include "arena.h"
+#include "stats.h"
+
+// Every path the system has seen is stored once and given a small id
+// Staging areas, snapshots and changes all point at the one copy, so
+// two paths are the same exactly when their ids are equal.
+// Ids are handed out in order from 0 and never reused.
+
+#define PATH_NONE -1
+
+struct PathTable {
+
+    char** paths; // Id to string, strings live in the system arena
+    uint64_t* hashes; // Id to path_hash of the string, the same in every process
+    size_t num_paths;
+    size_t cap_paths;
+
+    int* slots; // Open addressing from string to id
+    size_t cap_slots;
+
+};
+
+
+// FNV-1a over the first length bytes of a path
+static size_t path_hash(const char* path, size_t length){
+
+    size_t hash = 14695981039346656037ULL;
+
+    for(size_t i = 0; i < length; i++){
+        hash = (hash ^ (unsigned char)path[i]) * 1099511628211ULL;
+    }
+
+    return hash;
+
+}
+
+static struct PathTable* path_table_create(void){
+
+    struct PathTable* table = (struct PathTable*)malloc(sizeof(struct PathTable));
+
+    table->num_paths = 0;
+    table->cap_paths = 16;
+    table->paths = (char**)malloc(sizeof(char*)*table->cap_paths);
+    table->hashes = (uint64_t*)malloc(sizeof(uint64_t)*table->cap_paths);
+
+    table->cap_slots = 32;
+    table->slots = (int*)malloc(sizeof(int)*table->cap_slots);
+    for(size_t i = 0; i < table->cap_slots; i++){
+        table->slots[i] = PATH_NONE;
+    }
+
+    return table;
+
+}
+
+static void path_table_free(struct PathTable* table){
+
+    free(table->paths);
+    free(table->hashes);
+    free(table->slots);
+    free(table);
+
+}
+
+// Slot holding this path, or the empty slot where it belongs
+// The strings compared on the way are added to compares, unless it is NULL
+static size_t path_table_slot(struct PathTable* table, const char* path, size_t length, uint64_t* compares){
+
+    size_t slot = path_hash(path, length) & (table->cap_slots - 1);
+    uint64_t compared = 0;
+
+    while(table->slots[slot] != PATH_NONE){
+
+        const char* stored = table->paths[table->slots[slot]];
+        compared++;
+
+        if(strncmp(stored, path, length) == 0 && stored[length] == '\0'){
+            break;
+        }
+
+        slot = (slot + 1) & (table->cap_slots - 1);
+    }
+
+    if(compares != NULL){
+        stats_bump(compares, compared);
+    }
+
+    return slot;
+
+}
+
+static void path_table_grow(struct PathTable* table){
+
+    free(table->slots);
+
+    table->cap_slots = table->cap_slots*2;
+    table->slots = (int*)malloc(sizeof(int)*table->cap_slots);
+    for(size_t i = 0; i < table->cap_slots; i++){
+        table->slots[i] = PATH_NONE;
+    }
+
+    for(size_t id = 0; id < table->num_paths; id++){
+        const char* path = table->paths[id];
+        table->slots[path_table_slot(table, path, strlen(path), NULL)] = id;
+    }
+
+}
+
+// Id of a path that is not null terminated, adding it if it is new
+static int path_intern_n(struct System* system, const char* path, size_t length){
+
+    struct PathTable* table = system->paths;
+    size_t slot = path_table_slot(table, path, length, &system->stats->string_compares);
+
+    stats_bump(&system->stats->path_lookups, 1);
+
+    if(table->slots[slot] != PATH_NONE){
+        return table->slots[slot];
+    }
+
+    if(table->num_paths == table->cap_paths){
+        table->cap_paths = table->cap_paths*2;
+        table->paths = (char**)realloc(table->paths, sizeof(char*)*table->cap_paths);
+        table->hashes = (uint64_t*)realloc(table->hashes, sizeof(uint64_t)*table->cap_paths);
+    }
+
+    int id = table->num_paths;
+    char* stored = (char*)arena_alloc(system->arena, length + 1);
+    memcpy(stored, path, length);
+    stored[length] = '\0';
+
+    table->paths[id] = stored;
+    table->hashes[id] = path_hash(path, length);
+    table->num_paths++;
+    table->slots[slot] = id;
+
+    // Keep the load factor under 1/2
+    if(table->num_paths*2 > table->cap_slots){
+        path_table_grow(table);
+    }
+
+    return id;
+
+}
+
+static int path_intern(struct System* system, const char* path){
+
+    return path_intern_n(system, path, strlen(path));
+
+}
+
+// Id of a path already in the table, or PATH_NONE
+static int path_lookup_n(struct System* system, const char* path, size_t length){
+
+    struct PathTable* table = system->paths;
+
+    stats_bump(&system->stats->path_lookups, 1);
+
+    return table->slots[path_table_slot(table, path, length, &system->stats->string_compares)];
+
+}
+
+static int path_lookup(struct System* system, const char* path){
+
+    return path_lookup_n(system, path, strlen(path));
+
+}
+
+// The single stored copy of a path
+static char* path_string(struct System* system, int id){
+
+    return system->paths->paths[id];
+
+}
+
+
+#endif
@@ -0,0 +1,265 @@
+#ifndef SVC_LOG
+#define SVC_LOG
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include "structures.h"
+#include "commit_table.h"
+#include "repository.h"
+
+// Commit log walks
+// Handles are in creation order and parents always come first, so date
+// order is a scan down the handles from the start commit. A bit per
+// handle marks the commits reached so far, a commit is yielded when the
+// scan meets its bit and then marks its parents. Words with no bits set
+// are passed over whole, and the scan stops once no marked commit is left.
+// Topological order first counts the children each reachable commit has,
+// then yields a commit once all its children have been, following first
+// parents depth first so each line of history comes out in one run.
+// Everything is allocated when the walk starts, steps never allocate.
+
+struct svc_log {
+
+    struct System* system;
+    int order;
+    bool first_parent;
+
+    // Filter paths, without a trailing slash
+    char** paths;
+    size_t num_paths;
+
+    size_t skip;
+    size_t remaining; // Commits left to yield, SIZE_MAX for no limit
+
+    // First parent walks, the commit yielded next
+    struct Commit* next;
+
+    // Date order scan
+    uint64_t* seen;
+    int64_t position; // Highest handle not scanned yet
+    size_t pending; // Marked commits not yielded yet
+
+    // Topological order, children not yielded yet per handle
+    uint32_t* in_degree;
+    struct Commit** stack;
+    size_t stack_count;
+
+    uint32_t trace_id; // Number the call recorder gave the walk
+
+};
+
+// Next marked commit in date order, its parents are marked in turn
+// Returns NULL once every reachable commit has been yielded
+static struct Commit* log_scan(struct svc_log* log){
+
+    while(log->pending > 0){
+
+        size_t word = log->position >> 6;
+        uint64_t bits = log->seen[word] & (~0ULL >> (63 - (log->position & 63)));
+
+        if(bits == 0){
+            log->position = (int64_t)word*64 - 1;
+            continue;
+        }
+
+        uint32_t seq = word*64 + 63 - __builtin_clzll(bits);
+        struct Commit* commit = commit_at(log->system, seq);
+
+        log->position = (int64_t)seq - 1;
+        log->pending--;
+
+        for(uint32_t k = 0; k < commit->num_parents; k++){
+
+            uint32_t parent = commit->parents[k];
+
+            if((log->seen[parent >> 6] & (1ULL << (parent & 63))) == 0){
+                log->seen[parent >> 6] |= 1ULL << (parent & 63);
+                log->pending++;
+            }
+        }
+
+        return commit;
+    }
+
+    return NULL;
+
+}
+
+static void log_scan_start(struct svc_log* log, struct Commit* start){
+
+    memset(log->seen, 0, sizeof(uint64_t)*(start->seq/64 + 1));
+
+    log->seen[start->seq >> 6] |= 1ULL << (start->seq & 63);
+    log->position = start->seq;
+    log->pending = 1;
+
+}
+
+// Next commit of the walk in its order, NULL once it is done
+static struct Commit* log_step(struct svc_log* log){
+
+    if(log->first_parent){
+
+        struct Commit* commit = log->next;
+
+        if(commit != NULL){
+            log->next = commit_parent(log->system, commit, 0);
+        }
+
+        return commit;
+    }
+
+    if(log->order == SVC_LOG_DATE_ORDER){
+        return log_scan(log);
+    }
+
+    if(log->stack_count == 0){
+        return NULL;
+    }
+
+    struct Commit* commit = log->stack[--log->stack_count];
+
+    // First parent goes on top, so its line is followed first
+    for(uint32_t k = commit->num_parents; k-- > 0;){
+        uint32_t parent = commit->parents[k];
+        if(--log->in_degree[parent] == 0){
+            log->stack[log->stack_count++] = commit_at(log->system, parent);
+        }
+    }
+
+    return commit;
+
+}
+
+// True if a commit changed one of the filter paths, or a file below one
+static bool log_touches(struct svc_log* log, struct Commit* commit){
+
+    if(log->num_paths == 0){
+        return true;
+    }
+
+    struct CommitBody* body = commit_load_changes(log->system, commit);
+
+    for(size_t i = 0; i < body->num_changes; i++){
+
+        const char* name = body->changes[i].file_name;
+
+        for(size_t p = 0; p < log->num_paths; p++){
+
+            size_t length = strlen(log->paths[p]);
+
+            if(strncmp(name, log->paths[p], length) == 0 && (name[length] == '\0' || name[length] == '/')){
+                return true;
+            }
+        }
+    }
+
+    return false;
+
+}
+
+static void log_close(struct svc_log* log){
+
+    for(size_t p = 0; p < log->num_paths; p++){
+        free(log->paths[p]);
+    }
+
+    free(log->paths);
+    free(log->seen);
+    free(log->in_degree);
+    free(log->stack);
+    free(log);
+
+}
+
+static struct svc_log* log_open(struct System* system, struct Commit* start, const svc_log_options* options){
+
+    struct svc_log* log = (struct svc_log*)calloc(1, sizeof(struct svc_log));
+
+    log->system = system;
+    log->order = options == NULL ? SVC_LOG_DATE_ORDER : options->order;
+    log->first_parent = options != NULL && options->first_parent;
+    log->skip = options == NULL ? 0 : options->skip;
+    log->remaining = options == NULL || options->max_count == 0 ? SIZE_MAX : options->max_count;
+
+    if(options != NULL && options->n_paths > 0){
+
+        log->paths = (char**)malloc(sizeof(char*)*options->n_paths);
+
+        for(int p = 0; p < options->n_paths; p++){
+
+            char* path = strdup(options->paths[p]);
+            size_t length = strlen(path);
+
+            while(length > 0 && path[length - 1] == '/'){
+                path[--length] = '\0';
+            }
+
+            log->paths[log->num_paths++] = path;
+        }
+    }
+
+    if(log->first_parent){
+        log->next = start;
+        return log;
+    }
+
+    log->seen = (uint64_t*)malloc(sizeof(uint64_t)*(start->seq/64 + 1));
+    log_scan_start(log, start);
+
+    if(log->order == SVC_LOG_DATE_ORDER){
+        return log;
+    }
+
+    // Count the children each reachable commit has within the walk
+    log->in_degree = (uint32_t*)calloc(start->seq + 1, sizeof(uint32_t));
+
+    size_t reachable = 0;
+    struct Commit* commit;
+
+    while((commit = log_scan(log)) != NULL){
+
+        reachable++;
+
+        for(uint32_t k = 0; k < commit->num_parents; k++){
+            log->in_degree[commit->parents[k]]++;
+        }
+    }
+
+    log->stack = (struct Commit**)malloc(sizeof(struct Commit*)*reachable);
+    log->stack[0] = start;
+    log->stack_count = 1;
+
+    return log;
+
+}
+
+// Next commit that passes the filters and paging, NULL once there are none
+static struct Commit* log_next(struct svc_log* log){
+
+    struct Commit* commit;
+
+    while(log->remaining > 0 && (commit = log_step(log)) != NULL){
+
+        if(!log_touches(log, commit)){
+            continue;
+        }
+
+        if(log->skip > 0){
+            log->skip--;
+            continue;
+        }
+
+        log->remaining--;
+
+        return commit;
+    }
+
+    return NULL;
+
+}
+
+
+#endif
@@ -0,0 +1,378 @@
+#ifndef SVC_LZ
+#define SVC_LZ
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// LZ77 block codec for stored blobs
+//
+// A block is a run of sequences, each one a token byte whose high nibble
+// is the literal count and low nibble the match length minus LZ_MIN_MATCH,
+// then the literals and a 16 bit little endian offset back into the output.
+// A nibble of 15 is continued in following bytes, added up until one is
+// below 255. The last sequence ends after its literals and has no match.
+//
+// LZ_FAST looks at one earlier position per hash and skips ahead faster
+// the longer nothing matches, LZ_HIGH walks a hash chain for the longest
+// match and defers a match by a byte when the next one is longer.
+
+#define LZ_FAST 1
+#define LZ_HIGH 2
+
+#define LZ_MIN_MATCH 4
+#define LZ_WINDOW 65535
+#define LZ_FAST_BITS 14
+#define LZ_HIGH_BITS 16
+#define LZ_HIGH_DEPTH 64
+#define LZ_CHAIN_NONE UINT32_MAX
+
+// Data that is compressed in samples of this size first, and skipped
+// when the samples do not shrink by at least 1/LZ_SAMPLE_GAIN
+#define LZ_SAMPLE 4096
+#define LZ_SAMPLE_GAIN 16
+
+
+static uint32_t lz_read32(const char* data){
+
+    uint32_t value;
+    memcpy(&value, data, sizeof(uint32_t));
+    return value;
+
+}
+
+static uint32_t lz_hash(const char* data, unsigned bits){
+
+    return (lz_read32(data) * 2654435761U) >> (32 - bits);
+
+}
+
+// Length of the common prefix of a and b, reading no further than limit from b
+static size_t lz_match_length(const char* a, const char* b, const char* limit){
+
+    const char* start = b;
+
+    while(b + sizeof(uint64_t) <= limit){
+        uint64_t x;
+        uint64_t y;
+        memcpy(&x, a, sizeof(uint64_t));
+        memcpy(&y, b, sizeof(uint64_t));
+        if(x != y){
+            return b - start + (__builtin_ctzll(x ^ y) >> 3);
+        }
+        a += sizeof(uint64_t);
+        b += sizeof(uint64_t);
+    }
+
+    while(b < limit && *a == *b){
+        a++;
+        b++;
+    }
+
+    return b - start;
+
+}
+
+// Remainder of a length that did not fit in its nibble
+static int lz_put_length(unsigned char** out, unsigned char* end, size_t length){
+
+    while(length >= 255){
+        if(*out == end){
+            return 0;
+        }
+        *(*out)++ = 255;
+        length -= 255;
+    }
+
+    if(*out == end){
+        return 0;
+    }
+    *(*out)++ = (unsigned char)length;
+
+    return 1;
+
+}
+
+// Emit literals, then a match unless match_length is 0
+static int lz_put_sequence(unsigned char** out, unsigned char* end, const char* literals, size_t num_literals, size_t offset, size_t match_length){
+
+    if(*out == end){
+        return 0;
+    }
+
+    size_t match_code = match_length > 0 ? match_length - LZ_MIN_MATCH : 0;
+    unsigned char* token = (*out)++;
+    *token = (unsigned char)(((num_literals < 15 ? num_literals : 15) << 4) | (match_code < 15 ? match_code : 15));
+
+    if(num_literals >= 15 && !lz_put_length(out, end, num_literals - 15)){
+        return 0;
+    }
+
+    if((size_t)(end - *out) < num_literals){
+        return 0;
+    }
+    memcpy(*out, literals, num_literals);
+    *out += num_literals;
+
+    if(match_length == 0){
+        return 1;
+    }
+
+    if(end - *out < 2){
+        return 0;
+    }
+    *(*out)++ = offset & 0xff;
+    *(*out)++ = offset >> 8;
+
+    return match_code < 15 || lz_put_length(out, end, match_code - 15);
+
+}
+
+// Longest earlier match for position i along its hash chain
+static size_t lz_chain_match(const char* in, size_t i, size_t n, const uint32_t* chain, uint32_t candidate, size_t* offset){
+
+    size_t best = 0;
+
+    for(int depth = 0; depth < LZ_HIGH_DEPTH && candidate != LZ_CHAIN_NONE && i - candidate <= LZ_WINDOW; depth++){
+
+        if(i + best == n){
+            // Nothing can be longer than a match to the end
+            break;
+        }
+
+        // Only worth comparing if it could beat the best so far
+        if(in[candidate + best] == in[i + best]){
+            size_t length = lz_match_length(in + candidate, in + i, in + n);
+            if(length > best){
+                best = length;
+                *offset = i - candidate;
+            }
+        }
+
+        candidate = chain[candidate & LZ_WINDOW];
+    }
+
+    return best >= LZ_MIN_MATCH ? best : 0;
+
+}
+
+static void lz_chain_insert(const char* in, size_t i, uint32_t* head, uint32_t* chain){
+
+    uint32_t hash = lz_hash(in + i, LZ_HIGH_BITS);
+    chain[i & LZ_WINDOW] = head[hash];
+    head[hash] = i;
+
+}
+
+// Compress n bytes of in with the given level into out
+// Returns the compressed length, or -1 if it would be more than max_out
+static long lz_compress(const char* in, size_t n, char* out, size_t max_out, int level){
+
+    unsigned char* pos = (unsigned char*)out;
+    unsigned char* end = pos + max_out;
+
+    size_t literal = 0;
+    size_t i = 0;
+    int fits = 1;
+
+    if(level == LZ_HIGH){
+
+        uint32_t* head = (uint32_t*)malloc(sizeof(uint32_t) << LZ_HIGH_BITS);
+        uint32_t* chain = (uint32_t*)malloc(sizeof(uint32_t)*(LZ_WINDOW + 1));
+        memset(head, 0xff, sizeof(uint32_t) << LZ_HIGH_BITS);
+
+        while(fits && i + LZ_MIN_MATCH <= n){
+
+            size_t offset = 0;
+            size_t length = lz_chain_match(in, i, n, chain, head[lz_hash(in + i, LZ_HIGH_BITS)], &offset);
+            lz_chain_insert(in, i, head, chain);
+
+            if(length == 0){
+                i++;
+                continue;
+            }
+
+            // A longer match one byte on is worth a literal
+            if(i + 1 + LZ_MIN_MATCH <= n){
+                size_t next_offset = 0;
+                size_t next = lz_chain_match(in, i + 1, n, chain, head[lz_hash(in + i + 1, LZ_HIGH_BITS)], &next_offset);
+                if(next > length + 1){
+                    i++;
+                    continue;
+                }
+            }
+
+            fits = lz_put_sequence(&pos, end, in + literal, i - literal, offset, length);
+
+            for(size_t j = i + 1; j < i + length && j + LZ_MIN_MATCH <= n; j++){
+                lz_chain_insert(in, j, head, chain);
+            }
+
+            i += length;
+            literal = i;
+        }
+
+        free(head);
+        free(chain);
+
+    } else {
+
+        uint32_t* table = (uint32_t*)calloc(1 << LZ_FAST_BITS, sizeof(uint32_t));
+        size_t misses = 0;
+
+        while(fits && i + LZ_MIN_MATCH <= n){
+
+            uint32_t hash = lz_hash(in + i, LZ_FAST_BITS);
+            size_t candidate = table[hash];
+            table[hash] = i;
+
+            if(candidate >= i || i - candidate > LZ_WINDOW || lz_read32(in + candidate) != lz_read32(in + i)){
+                // Incompressible stretches are crossed in growing steps
+                i += 1 + (misses++ >> 5);
+                continue;
+            }
+
+            misses = 0;
+
+            // Take in literals that also match
+            while(i > literal && candidate > 0 && in[i - 1] == in[candidate - 1]){
+                i--;
+                candidate--;
+            }
+
+            size_t length = lz_match_length(in + candidate, in + i, in + n);
+
+            fits = lz_put_sequence(&pos, end, in + literal, i - literal, i - candidate, length);
+
+            i += length;
+            literal = i;
+
+            if(i >= 2 && i + LZ_MIN_MATCH <= n){
+                table[lz_hash(in + i - 2, LZ_FAST_BITS)] = i - 2;
+            }
+        }
+
+        free(table);
+
+    }
+
+    if(!fits || !lz_put_sequence(&pos, end, in + literal, n - literal, 0, 0)){
+        return -1;
+    }
+
+    return (char*)pos - out;
+
+}
+
+// Decompress a block into out, which must hold exactly out_length bytes
+// Returns 0, or -1 if the block is malformed or has another length
+static int lz_decompress(const char* in, size_t n, char* out, size_t out_length){
+
+    const unsigned char* pos = (const unsigned char*)in;
+    const unsigned char* end = pos + n;
+    size_t written = 0;
+
+    while(pos < end){
+
+        unsigned char token = *pos++;
+        size_t num_literals = token >> 4;
+
+        if(num_literals == 15){
+            unsigned char byte;
+            do {
+                if(pos == end){
+                    return -1;
+                }
+                byte = *pos++;
+                num_literals += byte;
+            } while(byte == 255);
+        }
+
+        if((size_t)(end - pos) < num_literals || num_literals > out_length - written){
+            return -1;
+        }
+
+        memcpy(out + written, pos, num_literals);
+        pos += num_literals;
+        written += num_literals;
+
+        if(pos == end){
+            // Last sequence, no match follows
+            break;
+        }
+
+        if(end - pos < 2){
+            return -1;
+        }
+
+        size_t offset = pos[0] | (pos[1] << 8);
+        pos += 2;
+
+        size_t length = (token & 0x0f);
+
+        if(length == 15){
+            unsigned char byte;
+            do {
+                if(pos == end){
+                    return -1;
+                }
+                byte = *pos++;
+                length += byte;
+            } while(byte == 255);
+        }
+
+        length += LZ_MIN_MATCH;
+
+        if(offset == 0 || offset > written || length > out_length - written){
+            return -1;
+        }
+
+        char* to = out + written;
+        const char* from = to - offset;
+
+        if(offset >= length){
+            memcpy(to, from, length);
+        } else {
+            // Overlapping copy repeats the last offset bytes
+            for(size_t k = 0; k < length; k++){
+                to[k] = from[k];
+            }
+        }
+
+        written += length;
+    }
+
+    return written == out_length ? 0 : -1;
+
+}
+
+// False if compressing samples from the start, middle and end of the
+// data barely shrinks them, as for already compressed files
+static int lz_worth_compressing(const char* data, size_t n){
+
+    if(n <= LZ_SAMPLE*3){
+        return 1;
+    }
+
+    char* out = (char*)malloc(LZ_SAMPLE);
+    size_t sampled = 0;
+    size_t packed = 0;
+
+    size_t starts[3] = {0, n/2 - LZ_SAMPLE/2, n - LZ_SAMPLE};
+
+    for(int s = 0; s < 3; s++){
+
+        long length = lz_compress(data + starts[s], LZ_SAMPLE, out, LZ_SAMPLE, LZ_FAST);
+
+        sampled += LZ_SAMPLE;
+        packed += length < 0 ? LZ_SAMPLE : (size_t)length;
+    }
+
+    free(out);
+
+    return packed <= sampled - sampled/LZ_SAMPLE_GAIN;
+
+}
+
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef SVC_PATH_INDEX
+#define SVC_PATH_INDEX
+
+#include <stdlib.h>
+#include <string.h>
+#include "structures.h"
+
+// Path id to slot index for each branch staging area
+// Removing a file leaves a hole (file_name == NULL) in the files array
+// and a tombstone in the index, so svc_rm is O(1). Holes are squeezed
+// out in one pass, preserving order, before anything walks the array.
+
+#define PATH_INDEX_EMPTY -1
+#define PATH_INDEX_TOMBSTONE -2
+
+struct PathIndex {
+
+    int* slots;
+    size_t cap;
+    size_t used; // Slots that are not empty, including tombstones
+
+};
+
+
+// Ids are dense, so spread them with a multiplicative hash
+static size_t path_id_hash(int path_id){
+
+    return ((size_t)path_id * 0x9E3779B97F4A7C15ULL) >> 32;
+
+}
+
+static void path_index_reset(struct PathIndex* index, size_t min_entries){
+
+    size_t cap = 16;
+    while(cap < min_entries*2){
+        cap = cap*2;
+    }
+
+    if(index->cap != cap){
+        free(index->slots);
+        index->slots = (int*)malloc(sizeof(int)*cap);
+        index->cap = cap;
+    }
+
+    for(size_t i = 0; i < cap; i++){
+        index->slots[i] = PATH_INDEX_EMPTY;
+    }
+
+    index->used = 0;
+
+}
+
+static void path_index_put(struct PathIndex* index, struct File* files, int file_index){
+
+    size_t slot = path_id_hash(files[file_index].path_id) & (index->cap - 1);
+
+    while(index->slots[slot] >= 0){
+        slot = (slot + 1) & (index->cap - 1);
+    }
+
+    if(index->slots[slot] == PATH_INDEX_EMPTY){
+        index->used++;
+    }
+
+    index->slots[slot] = file_index;
+
+}
+
+// Index every live file of the branch from scratch
+static void path_index_rebuild(struct System* system, size_t branch){
+
+    struct PathIndex* index = &system->file_index[branch];
+
+    path_index_reset(index, system->num_files[branch]);
+
+    for(size_t i = 0; i < system->num_files[branch]; i++){
+        if(system->files[branch][i].file_name != NULL){
+            path_index_put(index, system->files[branch], i);
+        }
+    }
+
+}
+
+// Set up the index of a branch whose files array has just been filled
+static void path_index_create(struct System* system, size_t branch){
+
+    system->file_index[branch].slots = NULL;
+    system->file_index[branch].cap = 0;
+    system->num_dead[branch] = 0;
+
+    path_index_rebuild(system, branch);
+
+}
+
+// Position of the path in the branch files array, or -1
+static int path_index_find(struct System* system, size_t branch, int path_id){
+
+    if(path_id < 0){
+        return -1;
+    }
+
+    struct PathIndex* index = &system->file_index[branch];
+    size_t slot = path_id_hash(path_id) & (index->cap - 1);
+
+    while(index->slots[slot] != PATH_INDEX_EMPTY){
+
+        int file_index = index->slots[slot];
+
+        if(file_index >= 0 && system->files[branch][file_index].path_id == path_id){
+            return file_index;
+        }
+
+        slot = (slot + 1) & (index->cap - 1);
+    }
+
+    return -1;
+
+}
+
+// Register the file just stored at file_index, which must be below num_files
+static void path_index_add(struct System* system, size_t branch, int file_index){
+
+    struct PathIndex* index = &system->file_index[branch];
+
+    // Keep the load factor (including tombstones) under 3/4
+    // A rebuild already picks up the new file
+    if((index->used + 1)*4 > index->cap*3){
+        path_index_rebuild(system, branch);
+        return;
+    }
+
+    path_index_put(index, system->files[branch], file_index);
+
+}
+
+// Replace the entry for file_index with a tombstone
+// Must be called while the file still has its path
+static void path_index_remove(struct System* system, size_t branch, int file_index){
+
+    struct PathIndex* index = &system->file_index[branch];
+    size_t slot = path_id_hash(system->files[branch][file_index].path_id) & (index->cap - 1);
+
+    while(index->slots[slot] != file_index){
+        slot = (slot + 1) & (index->cap - 1);
+    }
+
+    index->slots[slot] = PATH_INDEX_TOMBSTONE;
+
+}
+
+// Squeeze the holes left by removed files out of the branch, keeping order
+// Returns the files array, ready to be walked from 0 to num_files
+static struct File* branch_files(struct System* system, size_t branch){
+
+    if(system->num_dead[branch] == 0){
+        return system->files[branch];
+    }
+
+    size_t live = 0;
+
+    for(size_t i = 0; i < system->num_files[branch]; i++){
+        if(system->files[branch][i].file_name != NULL){
+            if(live != i){
+                system->files[branch][live] = system->files[branch][i];
+            }
+            live++;
+        }
+    }
+
+    system->num_files[branch] = live;
+    system->num_dead[branch] = 0;
+
+    path_index_rebuild(system, branch);
+
+    return system->files[branch];
+
+}
+
+
+#endif
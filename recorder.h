@@ -0,0 +1,616 @@
+#ifndef SVC_RECORDER
+#define SVC_RECORDER
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "svc.h"
+#include "structures.h"
+#include "statcache.h"
+#include "fileio.h"
+#include "diff.h"
+#include "commit_index.h"
+#include "trace.h"
+#include "stats.h"
+#include "spans.h"
+
+// Call recorder, see trace.h for what it writes
+// Only the outermost public call is recorded, calls the library makes to
+// its own entry points run inside it. Before a call that reads the working
+// copy, the staged paths and the paths the call names are checked, and
+// any whose content changed since it was last recorded is fingerprinted.
+// Paths whose stat is unchanged are not read again, by the same rules as
+// the stat cache. Strings are sent once and referred to by index after.
+
+// Chunk cuts, about 8 KiB apart past the minimum
+#define TRACE_CHUNK_MIN 2048
+#define TRACE_CHUNK_MAX 65536
+#define TRACE_CHUNK_MASK (0x1fffULL << 51)
+
+// Kinds of string, each anonymised its own way
+#define TRACE_KIND_PATH 'p'
+#define TRACE_KIND_NAME 'n'
+#define TRACE_KIND_MESSAGE 'm'
+#define TRACE_KIND_ID 'i'
+#define TRACE_KIND_COMPONENT 'c' // Part of an anonymised path, never sent
+
+#define TRACE_BRANCH_CHARS "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_/"
+
+struct TraceEntry {
+
+    char* key; // Kind then the string, NULL for an empty slot
+    uint32_t id; // Index the string was sent as, or component number
+
+    // Paths, what was last recorded for them
+    int state; // TRACE_FILE, TRACE_GONE or TRACE_RUN before any record
+    size_t size;
+    uint64_t digest;
+    struct File stat; // Only the stat cache fields are used
+
+};
+
+struct Trace {
+
+    FILE* out;
+    int flags;
+
+    // Strings sent so far, open addressing on the key
+    struct TraceEntry* entries;
+    size_t cap_entries;
+    size_t num_entries;
+    uint32_t num_strings;
+    uint32_t num_components;
+
+    uint32_t num_logs;
+
+    char* scratch;
+    size_t scratch_cap;
+    // Length and fingerprint of each chunk of the file being recorded
+    uint64_t* chunks;
+    size_t cap_chunks;
+
+};
+
+// One public call, ended when it goes out of scope
+struct TraceCall {
+
+    struct System* system;
+    int op;
+    int mode; // 0 without a system, 1 inside another call, 2 when outermost
+    bool recorded;
+    bool timed; // For svc_stats
+    uint64_t start;
+    size_t commits;
+    struct Span span; // Covers nested calls too
+
+};
+
+static void trace_call_end(struct TraceCall* call);
+
+// Opens a call, counting and timing it for svc_stats and giving it a
+// span, the block that follows writes its arguments and ends with
+// trace_call_run, and only runs if it is recorded
+#define TRACE_CALL(call_system, op) \
+    struct TraceCall trace_call __attribute__((cleanup(trace_call_end))) = {.system = (call_system)}; \
+    if(trace_call_begin(&trace_call, op))
+
+static uint64_t trace_gear[256];
+
+
+static void trace_put_varint(FILE* out, uint64_t value){
+
+    while(value >= 0x80){
+        putc_unlocked((int)(value & 0x7f) | 0x80, out);
+        value >>= 7;
+    }
+
+    putc_unlocked((int)value, out);
+
+}
+
+static void trace_put_signed(FILE* out, int64_t value){
+
+    trace_put_varint(out, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+
+}
+
+static void trace_put_fingerprint(FILE* out, uint64_t value){
+
+    for(int i = 0; i < 8; i++){
+        putc_unlocked((int)(value >> (i*8)) & 0xff, out);
+    }
+
+}
+
+static uint64_t trace_key_hash(char kind, const char* string){
+
+    return diff_hash(string, strlen(string)) + (unsigned char)kind;
+
+}
+
+static struct TraceEntry* trace_find(struct Trace* trace, char kind, const char* string){
+
+    if(trace->cap_entries == 0){
+        return NULL;
+    }
+
+    size_t mask = trace->cap_entries - 1;
+
+    for(size_t slot = trace_key_hash(kind, string) & mask; trace->entries[slot].key != NULL; slot = (slot + 1) & mask){
+
+        const char* key = trace->entries[slot].key;
+
+        if(key[0] == kind && strcmp(key + 1, string) == 0){
+            return &trace->entries[slot];
+        }
+    }
+
+    return NULL;
+
+}
+
+// New entry for a string not in the table, entries may move
+static struct TraceEntry* trace_insert(struct Trace* trace, char kind, const char* string){
+
+    if((trace->num_entries + 1)*2 > trace->cap_entries){
+
+        size_t cap = trace->cap_entries == 0 ? 256 : trace->cap_entries*2;
+        struct TraceEntry* entries = (struct TraceEntry*)calloc(cap, sizeof(struct TraceEntry));
+
+        for(size_t i = 0; i < trace->cap_entries; i++){
+
+            if(trace->entries[i].key == NULL){
+                continue;
+            }
+
+            size_t slot = trace_key_hash(trace->entries[i].key[0], trace->entries[i].key + 1) & (cap - 1);
+
+            while(entries[slot].key != NULL){
+                slot = (slot + 1) & (cap - 1);
+            }
+
+            entries[slot] = trace->entries[i];
+        }
+
+        free(trace->entries);
+        trace->entries = entries;
+        trace->cap_entries = cap;
+    }
+
+    size_t mask = trace->cap_entries - 1;
+    size_t slot = trace_key_hash(kind, string) & mask;
+
+    while(trace->entries[slot].key != NULL){
+        slot = (slot + 1) & mask;
+    }
+
+    size_t length = strlen(string);
+    struct TraceEntry* entry = &trace->entries[slot];
+
+    entry->key = (char*)malloc(length + 2);
+    entry->key[0] = kind;
+    memcpy(entry->key + 1, string, length + 1);
+    entry->state = TRACE_RUN;
+
+    trace->num_entries++;
+
+    return entry;
+
+}
+
+// Stand-in for a string, paths keep their shape with each component
+// replaced, branch names stay valid or invalid, ids never match a commit
+static char* trace_anonymise(struct Trace* trace, char kind, const char* string){
+
+    size_t length = strlen(string);
+    char* text = (char*)malloc(length*12 + 16);
+
+    if(kind == TRACE_KIND_PATH){
+
+        size_t used = 0;
+
+        while(*string != '\0'){
+
+            size_t part = strcspn(string, "/");
+
+            if(part == 0 || (part == 1 && string[0] == '.') || (part == 2 && string[0] == '.' && string[1] == '.')){
+                memcpy(text + used, string, part);
+                used += part;
+            } else {
+                char* component = strndup(string, part);
+                struct TraceEntry* entry = trace_find(trace, TRACE_KIND_COMPONENT, component);
+
+                if(entry == NULL){
+                    entry = trace_insert(trace, TRACE_KIND_COMPONENT, component);
+                    entry->id = trace->num_components++;
+                }
+
+                used += sprintf(text + used, "p%u", entry->id);
+                free(component);
+            }
+
+            string += part;
+
+            if(*string == '/'){
+                text[used++] = '/';
+                string++;
+            }
+        }
+
+        text[used] = '\0';
+
+    } else if(kind == TRACE_KIND_NAME){
+
+        if(strcmp(string, "master") == 0){
+            strcpy(text, string);
+        } else {
+            sprintf(text, strspn(string, TRACE_BRANCH_CHARS) == length ? "b%u" : "b%u!", trace->num_strings);
+        }
+
+    } else if(kind == TRACE_KIND_MESSAGE){
+
+        sprintf(text, "m%u", trace->num_strings);
+
+    } else {
+
+        memset(text, '~', length);
+        text[length] = '\0';
+    }
+
+    return text;
+
+}
+
+static void trace_string(struct Trace* trace, char kind, const char* string){
+
+    if(string == NULL){
+        trace_put_varint(trace->out, TRACE_STRING_NULL);
+        return;
+    }
+
+    struct TraceEntry* entry = trace_find(trace, kind, string);
+
+    if(entry != NULL){
+        trace_put_varint(trace->out, TRACE_STRING_FIRST + entry->id);
+        return;
+    }
+
+    char* text = (trace->flags & SVC_TRACE_ANONYMISE) ? trace_anonymise(trace, kind, string) : NULL;
+    const char* sent = text != NULL ? text : string;
+    size_t length = strlen(sent);
+
+    entry = trace_insert(trace, kind, string);
+    entry->id = trace->num_strings++;
+
+    trace_put_varint(trace->out, TRACE_STRING_NEW);
+    trace_put_varint(trace->out, length);
+    fwrite(sent, 1, length, trace->out);
+
+    free(text);
+
+}
+
+static void trace_number(struct Trace* trace, int64_t value){
+
+    trace_put_signed(trace->out, value);
+
+}
+
+// A commit handle, by its creation number
+static void trace_handle(struct Trace* trace, const void* commit){
+
+    if(commit == NULL){
+        trace_put_varint(trace->out, TRACE_COMMIT_NONE);
+    } else {
+        trace_put_varint(trace->out, TRACE_COMMIT_FIRST + ((const struct Commit*)commit)->seq);
+    }
+
+}
+
+// A commit id or id prefix, by the commit it names when there is one
+static void trace_commit_id(struct System* system, char* id){
+
+    struct Trace* trace = system->trace;
+    struct Commit* commit = NULL;
+
+    if(id == NULL){
+        trace_put_varint(trace->out, TRACE_COMMIT_NONE);
+        return;
+    }
+
+    if(id[0] != '\0' && system->num_commits > 0){
+
+        commit = commit_index_find(system, id);
+
+        if(commit == NULL){
+            commit = commit_index_resolve(system, id);
+        }
+    }
+
+    if(commit == NULL){
+        trace_put_varint(trace->out, TRACE_COMMIT_LITERAL);
+        trace_string(trace, TRACE_KIND_ID, id);
+        return;
+    }
+
+    trace_put_varint(trace->out, TRACE_COMMIT_FIRST + commit->seq);
+    trace_put_varint(trace->out, strlen(id));
+
+}
+
+static void trace_buffer(struct Trace* trace, const char* buffer, size_t size){
+
+    trace_put_varint(trace->out, buffer == NULL ? 0 : (uint64_t)size + 1);
+
+}
+
+static void trace_log_options(struct Trace* trace, const svc_log_options* options){
+
+    if(options == NULL){
+        trace_put_varint(trace->out, 0);
+        return;
+    }
+
+    trace_put_varint(trace->out, 1);
+    trace_number(trace, options->order);
+    trace_number(trace, options->first_parent);
+    trace_number(trace, options->n_paths);
+
+    for(int p = 0; p < options->n_paths; p++){
+        trace_string(trace, TRACE_KIND_PATH, options->paths[p]);
+    }
+
+    trace_put_varint(trace->out, options->skip);
+    trace_put_varint(trace->out, options->max_count);
+
+}
+
+// Cuts data where a rolling hash of the last bytes hits the mask, so an
+// edit only changes the chunks around it. Returns the number of chunks
+static size_t trace_chunk(struct Trace* trace, const char* data, size_t size){
+
+    size_t count = 0;
+    size_t start = 0;
+
+    while(start < size){
+
+        size_t limit = size - start < TRACE_CHUNK_MAX ? size : start + TRACE_CHUNK_MAX;
+        size_t end = start + TRACE_CHUNK_MIN < limit ? start + TRACE_CHUNK_MIN : limit;
+        uint64_t hash = 0;
+
+        for(; end < limit; end++){
+
+            hash = (hash << 1) + trace_gear[(unsigned char)data[end]];
+
+            if((hash & TRACE_CHUNK_MASK) == 0){
+                end++;
+                break;
+            }
+        }
+
+        if(count*2 + 2 > trace->cap_chunks){
+            trace->cap_chunks = trace->cap_chunks == 0 ? 64 : trace->cap_chunks*2;
+            trace->chunks = (uint64_t*)realloc(trace->chunks, sizeof(uint64_t)*trace->cap_chunks);
+        }
+
+        trace->chunks[count*2] = end - start;
+        trace->chunks[count*2 + 1] = diff_hash(data + start, end - start);
+        count++;
+
+        start = end;
+    }
+
+    return count;
+
+}
+
+// Record what path holds, unless it is what was recorded last
+static void trace_sync(struct Trace* trace, const char* path){
+
+    if(path == NULL){
+        return;
+    }
+
+    struct TraceEntry* entry = trace_find(trace, TRACE_KIND_PATH, path);
+    struct stat st;
+
+    if(stat(path, &st) == 0 && S_ISREG(st.st_mode) && entry != NULL && entry->state == TRACE_FILE && stat_cache_fresh(&entry->stat, &st)){
+        return;
+    }
+
+    struct FileView view;
+
+    if(file_view_open(path, &view, &trace->scratch, &trace->scratch_cap) != 0){
+
+        if(entry == NULL || entry->state != TRACE_GONE){
+            trace_put_varint(trace->out, TRACE_GONE);
+            trace_string(trace, TRACE_KIND_PATH, path);
+            trace_find(trace, TRACE_KIND_PATH, path)->state = TRACE_GONE;
+        }
+
+        return;
+    }
+
+    size_t count = trace_chunk(trace, view.data, view.size);
+    uint64_t digest = diff_hash((const char*)trace->chunks, sizeof(uint64_t)*count*2);
+
+    if(entry == NULL || entry->state != TRACE_FILE || entry->digest != digest || entry->size != view.size){
+
+        trace_put_varint(trace->out, TRACE_FILE);
+        trace_string(trace, TRACE_KIND_PATH, path);
+        trace_put_varint(trace->out, view.size);
+        trace_put_varint(trace->out, count);
+
+        for(size_t i = 0; i < count; i++){
+            trace_put_varint(trace->out, trace->chunks[i*2]);
+            trace_put_fingerprint(trace->out, trace->chunks[i*2 + 1]);
+        }
+
+        entry = trace_find(trace, TRACE_KIND_PATH, path);
+        entry->state = TRACE_FILE;
+        entry->size = view.size;
+        entry->digest = digest;
+    }
+
+    stat_cache_record(&entry->stat, &view.st);
+
+    file_view_close(&view);
+
+}
+
+// Record every path staged on the active branch
+static void trace_sync_staged(struct System* system){
+
+    size_t branch = system->active_branch_id;
+
+    for(size_t i = 0; i < system->num_files[branch]; i++){
+
+        const char* name = system->files[branch][i].file_name;
+
+        if(name != NULL){
+            trace_sync(system->trace, name);
+        }
+    }
+
+}
+
+// Starts a trace for options->trace_path, NULL if it can not be written
+// opened is the number of commits the system was opened with
+static struct Trace* trace_open(const svc_options* options, size_t opened){
+
+    FILE* out = fopen(options->trace_path, "wb");
+
+    if(out == NULL){
+        return NULL;
+    }
+
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+    if(trace_gear[0] == 0){
+        uint64_t state = 0;
+        for(int i = 0; i < 256; i++){
+            trace_gear[i] = trace_splitmix(&state);
+        }
+    }
+
+    struct Trace* trace = (struct Trace*)calloc(1, sizeof(struct Trace));
+
+    trace->out = out;
+    trace->flags = options->trace_flags;
+
+    fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_LENGTH, out);
+    trace_put_varint(out, TRACE_VERSION);
+    trace_put_varint(out, options->trace_flags);
+
+    // The system was made before the trace, so it records no time
+    putc_unlocked(TRACE_INIT, out);
+    trace_put_varint(out, options->num_threads > 0 ? options->num_threads : 0);
+    trace_put_varint(out, options->compression);
+    trace_put_varint(out, opened);
+    putc_unlocked(TRACE_RUN, out);
+    trace_put_varint(out, 0);
+    trace_put_varint(out, 0);
+
+    return trace;
+
+}
+
+// Ends the trace, with the time cleanup took since start
+static void trace_close(struct Trace* trace, uint64_t start){
+
+    if(trace == NULL){
+        return;
+    }
+
+    trace_put_varint(trace->out, stats_now() - start);
+    trace_put_varint(trace->out, 0);
+
+    fclose(trace->out);
+
+    for(size_t i = 0; i < trace->cap_entries; i++){
+        free(trace->entries[i].key);
+    }
+
+    free(trace->entries);
+    free(trace->scratch);
+    free(trace->chunks);
+    free(trace);
+
+}
+
+// True if the call is recorded, its op is then written
+static bool trace_call_begin(struct TraceCall* call, int op){
+
+    struct System* system = call->system;
+
+    if(system == NULL){
+        return false;
+    }
+
+    call->span = span_begin(system->spans, trace_op_names[op]);
+
+    if(system->call_depth++ > 0){
+        call->mode = 1;
+        return false;
+    }
+
+    call->op = op;
+    call->mode = 2;
+    call->timed = stats_call_begin(system->stats, op);
+
+    if(system->trace == NULL){
+        call->start = call->timed ? stats_now() : 0;
+        return false;
+    }
+
+    call->recorded = true;
+    putc_unlocked(op, system->trace->out);
+
+    return true;
+
+}
+
+// Arguments are written, the call itself starts
+static void trace_call_run(struct TraceCall* call){
+
+    putc_unlocked(TRACE_RUN, call->system->trace->out);
+
+    call->commits = call->system->num_commits;
+    call->start = stats_now();
+
+}
+
+static void trace_call_end(struct TraceCall* call){
+
+    if(call->mode == 0){
+        return;
+    }
+
+    struct System* system = call->system;
+
+    span_end(&call->span);
+    system->call_depth--;
+
+    if(call->mode == 1 || (!call->recorded && !call->timed)){
+        return;
+    }
+
+    uint64_t elapsed = stats_now() - call->start;
+
+    if(call->timed){
+        stats_call_end(system->stats, call->op, elapsed);
+    }
+
+    if(call->recorded){
+        trace_put_varint(system->trace->out, elapsed);
+        trace_put_varint(system->trace->out, system->num_commits - call->commits);
+    }
+
+}
+
+
+#endif
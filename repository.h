@@ -0,0 +1,1074 @@
+#ifndef SVC_REPOSITORY
+#define SVC_REPOSITORY
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "structures.h"
+#include "blobs.h"
+#include "arena.h"
+#include "commit_table.h"
+#include "commit_index.h"
+#include "intern.h"
+#include "path_index.h"
+#include "tree.h"
+#include "stats.h"
+
+// On-disk repository layout, all files live in one directory
+//
+//   objects   append only, per blob: digest, u32 length, u32 stored length,
+//             u32 length once decompressed, u32 codec, u64 offset of the
+//             base blob's bytes, then the stored bytes. These are compressed
+//             unless the codec is 0, and once decompressed are a delta
+//             against the base unless it is REPO_NO_BASE
+//   commits   append only, per commit: message and changes, then the
+//             snapshot tree nodes no earlier commit wrote, children first.
+//             Nodes refer to their children by offset, so a commit that
+//             changes k files adds O(k) nodes rather than a file list
+//   index     append only, one fixed size DiskCommit record per commit
+//   state     rewritten atomically: next staging order, branch names
+//             and heads
+//   stage.N   rewritten atomically: staging area of branch N, only when
+//             that branch's staging area may have changed
+//
+// Opening only maps index, commits and objects and reads the state file.
+// Commit skeletons are made from the fixed size index records a chunk at
+// a time when first used, ids are added to the lookup structures on the
+// first lookup, and bodies, snapshots and blob contents are read from the
+// mappings when first needed. A commit's message and changes come before
+// its nodes and can be read without them, which is all a log needs.
+// Staging areas are read when their branch is first used.
+
+#define REPO_ID_SIZE 16
+#define REPO_MAGIC 0x31435653 // "SVC1"
+#define REPO_OBJECT_HEADER (SHA256_DIGEST_SIZE + 4*sizeof(uint32_t) + sizeof(uint64_t))
+#define REPO_NO_BASE UINT64_MAX
+#define REPO_NO_TREE UINT64_MAX // Root offset of an empty snapshot
+
+struct DiskCommit {
+
+    uint64_t body_offset;
+    uint64_t tree_offset;
+    uint32_t body_length;
+    int32_t parent;
+    int32_t parent2;
+    uint32_t branch_id;
+    uint32_t generation;
+    char id[REPO_ID_SIZE]; // Always NUL terminated
+
+};
+
+// Tree node read back from the commits file
+struct RepoNode {
+
+    uint64_t offset; // 0 for an empty slot, no node starts a commit record
+    struct TreeNode* node;
+
+};
+
+struct Repository {
+
+    char* path;
+
+    int objects_fd;
+    int commits_fd;
+    int index_fd;
+
+    // Bytes in each append only file, the next record goes here
+    uint64_t objects_size;
+    uint64_t commits_size;
+
+    // Read only mappings of what existed when the repository was opened
+    char* objects_map;
+    size_t objects_map_size;
+    char* commits_map;
+    size_t commits_map_size;
+    char* index_map;
+    size_t index_map_size;
+
+    // Nodes already read, by offset, so a subtree several commits share is
+    // read once
+    struct RepoNode* nodes;
+    size_t cap_nodes;
+    size_t num_nodes;
+
+};
+
+// Header in front of each blob in the objects file
+struct ObjectHeader {
+
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    uint32_t length;
+    uint32_t stored_length;
+    uint32_t raw_length;
+    uint32_t codec;
+    uint64_t base_offset;
+
+};
+
+// Growable byte buffer used to serialise records
+struct Buffer {
+
+    char* data;
+    size_t length;
+    size_t capacity;
+
+};
+
+
+static void buffer_put(struct Buffer* buffer, const void* data, size_t length){
+
+    if(buffer->length + length > buffer->capacity){
+        while(buffer->length + length > buffer->capacity){
+            buffer->capacity = buffer->capacity == 0 ? 256 : buffer->capacity*2;
+        }
+        buffer->data = (char*)realloc(buffer->data, buffer->capacity);
+    }
+
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+
+}
+
+static void buffer_put_u32(struct Buffer* buffer, uint32_t value){
+
+    buffer_put(buffer, &value, sizeof(value));
+
+}
+
+static void buffer_put_u64(struct Buffer* buffer, uint64_t value){
+
+    buffer_put(buffer, &value, sizeof(value));
+
+}
+
+static void buffer_put_str(struct Buffer* buffer, const char* str){
+
+    uint32_t length = strlen(str);
+    buffer_put_u32(buffer, length);
+    buffer_put(buffer, str, length);
+
+}
+
+// Cursor for reading records back out of a mapping
+struct Reader {
+
+    const char* data;
+    size_t position;
+    size_t length;
+
+};
+
+static void reader_get(struct Reader* reader, void* out, size_t length){
+
+    if(reader->position + length > reader->length){
+        memset(out, 0, length);
+        reader->position = reader->length;
+        return;
+    }
+
+    memcpy(out, reader->data + reader->position, length);
+    reader->position += length;
+
+}
+
+static uint32_t reader_get_u32(struct Reader* reader){
+
+    uint32_t value;
+    reader_get(reader, &value, sizeof(value));
+    return value;
+
+}
+
+static uint64_t reader_get_u64(struct Reader* reader){
+
+    uint64_t value;
+    reader_get(reader, &value, sizeof(value));
+    return value;
+
+}
+
+// Strings are kept in the arena for the life of the system
+static char* reader_get_str(struct Reader* reader, struct Arena* arena){
+
+    uint32_t length = reader_get_u32(reader);
+
+    if(reader->position + length > reader->length){
+        length = reader->length - reader->position;
+    }
+
+    char* str = (char*)arena_alloc(arena, length + 1);
+    memcpy(str, reader->data + reader->position, length);
+    str[length] = '\0';
+    reader->position += length;
+
+    return str;
+
+}
+
+// Id of a stored path, interned straight from the mapping
+static int reader_get_path(struct System* system, struct Reader* reader){
+
+    uint32_t length = reader_get_u32(reader);
+
+    if(reader->position + length > reader->length){
+        length = reader->length - reader->position;
+    }
+
+    int path_id = path_intern_n(system, reader->data + reader->position, length);
+    reader->position += length;
+
+    return path_id;
+
+}
+
+// Write the whole buffer to an append only file
+static int write_all(int fd, const char* data, size_t length){
+
+    while(length > 0){
+
+        ssize_t written = write(fd, data, length);
+
+        if(written < 0){
+            return -1;
+        }
+
+        data += written;
+        length -= written;
+    }
+
+    return 0;
+
+}
+
+static char* repo_file_path(struct Repository* repo, const char* name){
+
+    char* path = (char*)malloc(strlen(repo->path) + strlen(name) + 2);
+    sprintf(path, "%s/%s", repo->path, name);
+    return path;
+
+}
+
+// Open one of the append only files and map its current contents
+static int repo_open_file(struct Repository* repo, const char* name, char** map, size_t* map_size){
+
+    char* path = repo_file_path(repo, name);
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    free(path);
+
+    *map = NULL;
+    *map_size = 0;
+
+    if(fd < 0){
+        return -1;
+    }
+
+    struct stat st;
+
+    if(fstat(fd, &st) == 0 && st.st_size > 0){
+
+        void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if(mapped != MAP_FAILED){
+            *map = (char*)mapped;
+            *map_size = st.st_size;
+        }
+    }
+
+    return fd;
+
+}
+
+static void repo_close(struct Repository* repo){
+
+    if(repo == NULL){
+        return;
+    }
+
+    if(repo->objects_map != NULL){
+        munmap(repo->objects_map, repo->objects_map_size);
+    }
+    if(repo->commits_map != NULL){
+        munmap(repo->commits_map, repo->commits_map_size);
+    }
+    if(repo->index_map != NULL){
+        munmap(repo->index_map, repo->index_map_size);
+    }
+
+    close(repo->objects_fd);
+    close(repo->commits_fd);
+    close(repo->index_fd);
+
+    free(repo->nodes);
+    free(repo->path);
+    free(repo);
+
+}
+
+// Header of the object whose bytes start at offset in the mapping
+// Returns -1 if no whole object starts there
+static int repo_object_header(struct Repository* repo, uint64_t offset, struct ObjectHeader* header){
+
+    if(offset < REPO_OBJECT_HEADER || offset > repo->objects_map_size){
+        return -1;
+    }
+
+    const char* data = repo->objects_map + offset - REPO_OBJECT_HEADER;
+
+    memcpy(header->digest, data, SHA256_DIGEST_SIZE);
+    data += SHA256_DIGEST_SIZE;
+    memcpy(&header->length, data, sizeof(uint32_t));
+    memcpy(&header->stored_length, data + sizeof(uint32_t), sizeof(uint32_t));
+    memcpy(&header->raw_length, data + 2*sizeof(uint32_t), sizeof(uint32_t));
+    memcpy(&header->codec, data + 3*sizeof(uint32_t), sizeof(uint32_t));
+    memcpy(&header->base_offset, data + 4*sizeof(uint32_t), sizeof(uint64_t));
+
+    if(header->stored_length > repo->objects_map_size - offset){
+        return -1;
+    }
+
+    return 0;
+
+}
+
+// Find or lazily register the blob for a record read from disk
+// The returned index carries one reference for the caller
+static int repo_blob_ref(struct System* system, const unsigned char* digest, uint64_t offset, int length){
+
+    int index = blob_lookup(system, digest);
+
+    if(index != BLOB_NONE){
+        blob_retain(system, index);
+        return index;
+    }
+
+    struct ObjectHeader header;
+    int mapped = repo_object_header(system->repo, offset, &header) == 0;
+
+    // A delta's base is registered first, the reference it returns is kept by the delta
+    int base = BLOB_NONE;
+
+    if(mapped && header.base_offset != REPO_NO_BASE){
+
+        struct ObjectHeader base_header;
+
+        if(repo_object_header(system->repo, header.base_offset, &base_header) != 0){
+            mapped = 0;
+        } else {
+            base = repo_blob_ref(system, base_header.digest, header.base_offset, base_header.length);
+        }
+    }
+
+    index = blob_insert(system, digest, NULL, length);
+    system->blobs[index].disk_offset = offset;
+
+    // Contents stored before the repository was opened are served from the mapping
+    if(mapped){
+        system->blobs[index].mapped = system->repo->objects_map + offset;
+        system->blobs[index].stored_length = header.stored_length;
+        system->blobs[index].raw_length = header.raw_length;
+        system->blobs[index].codec = header.codec;
+    }
+
+    if(base != BLOB_NONE){
+        system->blobs[index].base = base;
+        system->blobs[index].depth = system->blobs[base].depth + 1;
+    }
+
+    return index;
+
+}
+
+// Append a blob to the objects file unless it is already there
+// A delta is written after its base, so the base's offset is known
+static void repo_store_blob(struct System* system, int index){
+
+    struct Repository* repo = system->repo;
+
+    if(system->blobs[index].disk_offset >= 0){
+        return;
+    }
+
+    uint64_t base_offset = REPO_NO_BASE;
+    int base = system->blobs[index].base;
+
+    if(base != BLOB_NONE){
+        repo_store_blob(system, base);
+        base_offset = system->blobs[base].disk_offset;
+    }
+
+    struct Blob* blob = &system->blobs[index];
+
+    if(base != BLOB_NONE && system->blobs[base].disk_offset < 0){
+        // The base could not be written, so neither can the delta
+        return;
+    }
+
+    // Stored bytes exactly as they are held in memory
+    const char* data = blob->content != NULL ? blob->content : blob->mapped;
+
+    char header[REPO_OBJECT_HEADER];
+    uint32_t fields[4] = {(uint32_t)blob->length, (uint32_t)blob->stored_length, (uint32_t)blob->raw_length, (uint32_t)blob->codec};
+    memcpy(header, blob->digest, SHA256_DIGEST_SIZE);
+    memcpy(header + SHA256_DIGEST_SIZE, fields, sizeof(fields));
+    memcpy(header + SHA256_DIGEST_SIZE + sizeof(fields), &base_offset, sizeof(uint64_t));
+
+    if(write_all(repo->objects_fd, header, sizeof(header)) != 0){
+        return;
+    }
+    if(write_all(repo->objects_fd, data, blob->stored_length) != 0){
+        return;
+    }
+
+    blob->disk_offset = repo->objects_size + sizeof(header);
+    repo->objects_size += sizeof(header) + blob->stored_length;
+    stats_bump(&system->stats->bytes_written, sizeof(header) + blob->stored_length);
+
+}
+
+static void repo_put_file(struct System* system, struct Buffer* buffer, const struct File* file){
+
+    repo_store_blob(system, file->fc_index);
+
+    struct Blob* blob = &system->blobs[file->fc_index];
+
+    buffer_put_str(buffer, file->file_name);
+    buffer_put_u64(buffer, file->hash);
+    buffer_put(buffer, blob->digest, SHA256_DIGEST_SIZE);
+    buffer_put_u64(buffer, blob->disk_offset);
+    buffer_put_u32(buffer, file->fc_length);
+    buffer_put_u64(buffer, file->order);
+
+}
+
+static void repo_get_file(struct System* system, struct Reader* reader, struct File* file){
+
+    unsigned char digest[SHA256_DIGEST_SIZE];
+
+    file->path_id = reader_get_path(system, reader);
+    file->file_name = path_string(system, file->path_id);
+    file->hash = reader_get_u64(reader);
+    reader_get(reader, digest, SHA256_DIGEST_SIZE);
+    uint64_t offset = reader_get_u64(reader);
+    file->fc_length = reader_get_u32(reader);
+    file->fc_index = repo_blob_ref(system, digest, offset, file->fc_length);
+    file->order = reader_get_u64(reader);
+
+    // Files staged from now on must come after every file read back
+    if(file->order >= system->next_order){
+        system->next_order = file->order + 1;
+    }
+
+}
+
+// Staged files also keep their stat cache, so unchanged files are not
+// re-hashed after a restart
+static void repo_put_staged(struct System* system, struct Buffer* buffer, const struct File* file){
+
+    repo_put_file(system, buffer, file);
+
+    buffer_put_u64(buffer, file->st_size);
+    buffer_put_u64(buffer, file->st_mtime_ns);
+    buffer_put_u64(buffer, file->st_ctime_ns);
+    buffer_put_u64(buffer, file->st_inode);
+    buffer_put_u64(buffer, file->st_recorded_s);
+
+}
+
+static void repo_get_staged(struct System* system, struct Reader* reader, struct File* file){
+
+    repo_get_file(system, reader, file);
+
+    file->st_size = reader_get_u64(reader);
+    file->st_mtime_ns = reader_get_u64(reader);
+    file->st_ctime_ns = reader_get_u64(reader);
+    file->st_inode = reader_get_u64(reader);
+    file->st_recorded_s = reader_get_u64(reader);
+
+}
+
+// Nodes given an offset by the commit being written, so they can be
+// forgotten again if it fails to write
+struct NodeList {
+
+    struct TreeNode** nodes;
+    size_t count;
+    size_t capacity;
+
+};
+
+// Serialise the nodes below node that are not stored yet, children first
+// Returns the offset node will have once the buffer is appended at base
+static uint64_t repo_put_node(struct System* system, struct Buffer* buffer, struct NodeList* written, uint64_t base, struct TreeNode* node){
+
+    if(node == NULL){
+        return REPO_NO_TREE;
+    }
+
+    if(node->stored != 0){
+        return node->stored;
+    }
+
+    uint64_t children[TREE_WIDTH];
+    int count = node->kind == TREE_INNER ? __builtin_popcount(node->bitmap) : 0;
+
+    for(int i = 0; i < count; i++){
+        children[i] = repo_put_node(system, buffer, written, base, node->children[i]);
+    }
+
+    uint64_t root = node->kind == TREE_DIR ? repo_put_node(system, buffer, written, base, node->root) : 0;
+    uint64_t offset = base + buffer->length;
+
+    buffer_put_u32(buffer, node->kind);
+
+    if(node->kind == TREE_FILE){
+        repo_put_file(system, buffer, &node->file);
+    } else if(node->kind == TREE_DIR){
+        buffer_put_str(buffer, path_string(system, node->key/2));
+        buffer_put_u64(buffer, root);
+    } else {
+        buffer_put_u32(buffer, node->bitmap);
+        buffer_put(buffer, children, sizeof(uint64_t)*count);
+    }
+
+    if(written->count == written->capacity){
+        written->capacity = written->capacity == 0 ? 16 : written->capacity*2;
+        written->nodes = (struct TreeNode**)realloc(written->nodes, sizeof(struct TreeNode*)*written->capacity);
+    }
+
+    written->nodes[written->count++] = node;
+    node->stored = offset;
+
+    return offset;
+
+}
+
+static size_t repo_node_slot(struct Repository* repo, uint64_t offset){
+
+    size_t slot = (offset*0x9E3779B97F4A7C15ULL >> 32) & (repo->cap_nodes - 1);
+
+    while(repo->nodes[slot].offset != 0 && repo->nodes[slot].offset != offset){
+        slot = (slot + 1) & (repo->cap_nodes - 1);
+    }
+
+    return slot;
+
+}
+
+static void repo_remember_node(struct Repository* repo, uint64_t offset, struct TreeNode* node){
+
+    // Keep the load factor under 1/2
+    if((repo->num_nodes + 1)*2 > repo->cap_nodes){
+
+        struct RepoNode* old = repo->nodes;
+        size_t old_cap = repo->cap_nodes;
+
+        repo->cap_nodes = old_cap == 0 ? 64 : old_cap*2;
+        repo->nodes = (struct RepoNode*)calloc(repo->cap_nodes, sizeof(struct RepoNode));
+
+        for(size_t i = 0; i < old_cap; i++){
+            if(old[i].offset != 0){
+                repo->nodes[repo_node_slot(repo, old[i].offset)] = old[i];
+            }
+        }
+
+        free(old);
+    }
+
+    size_t slot = repo_node_slot(repo, offset);
+
+    repo->nodes[slot].offset = offset;
+    repo->nodes[slot].node = node;
+    repo->num_nodes++;
+
+}
+
+// Snapshot tree node stored at offset, read from the mapping along with
+// every node below it not read before. Nodes are interned again as they
+// are read, since digests are built from ids only valid in one process.
+// Returns NULL for an empty snapshot or a node that can not be read
+static struct TreeNode* repo_load_node(struct System* system, uint64_t offset){
+
+    struct Repository* repo = system->repo;
+
+    if(offset == 0 || offset >= repo->commits_map_size){
+        return NULL;
+    }
+
+    if(repo->cap_nodes > 0){
+
+        struct RepoNode* known = &repo->nodes[repo_node_slot(repo, offset)];
+
+        if(known->offset == offset){
+            return known->node;
+        }
+    }
+
+    struct Reader reader = {repo->commits_map + offset, 0, repo->commits_map_size - offset};
+    struct TreeNode* node = NULL;
+    int kind = reader_get_u32(&reader);
+
+    if(kind == TREE_FILE){
+
+        struct File file;
+        memset(&file, 0, sizeof(file));
+        repo_get_file(system, &reader, &file);
+
+        const char* slash = strrchr(file.file_name, '/');
+        const char* name = slash == NULL ? file.file_name : slash + 1;
+
+        node = tree_make_file(system, path_intern_n(system, name, strlen(name)), &file);
+
+        // The node holds its own reference
+        blob_release(system, file.fc_index);
+
+    } else if(kind == TREE_DIR){
+
+        int name_id = reader_get_path(system, &reader);
+        struct TreeNode* root = repo_load_node(system, reader_get_u64(&reader));
+
+        if(root != NULL){
+            node = tree_make_dir(system, name_id, root);
+        }
+
+    } else if(kind == TREE_INNER){
+
+        uint32_t bitmap = reader_get_u32(&reader);
+        struct TreeNode* children[TREE_WIDTH];
+        int count = __builtin_popcount(bitmap);
+
+        for(int i = 0; i < count; i++){
+
+            children[i] = repo_load_node(system, reader_get_u64(&reader));
+
+            if(children[i] == NULL){
+                return NULL;
+            }
+        }
+
+        node = tree_make_inner(system, bitmap, children, count);
+    }
+
+    if(node == NULL){
+        return NULL;
+    }
+
+    if(node->stored == 0){
+        node->stored = offset;
+    }
+
+    repo_remember_node(repo, offset, node);
+
+    return node;
+
+}
+
+// Append a new commit to the commits file and its record to the index
+static void repo_write_commit(struct System* system, struct Commit* commit){
+
+    struct Repository* repo = system->repo;
+    struct CommitBody* data = commit_body(system, commit);
+    struct Buffer body = {NULL, 0, 0};
+
+    buffer_put_str(&body, data->message);
+
+    buffer_put_u32(&body, data->num_changes);
+    for(size_t i = 0; i < data->num_changes; i++){
+        struct Changes* change = &data->changes[i];
+        uint32_t flags = change->addition | (change->deletion << 1) | (change->modification << 2);
+        buffer_put_str(&body, change->file_name);
+        buffer_put_u32(&body, flags);
+        buffer_put_u32(&body, change->prev_hash);
+        buffer_put_u32(&body, change->new_hash);
+    }
+
+    struct DiskCommit record;
+    memset(&record, 0, sizeof(record));
+    record.body_offset = repo->commits_size;
+    record.body_length = body.length;
+
+    // Only the nodes the snapshot does not share with an earlier one follow
+    struct NodeList written = {NULL, 0, 0};
+    record.tree_offset = repo_put_node(system, &body, &written, repo->commits_size, data->tree);
+
+    record.parent = commit->num_parents > 0 ? (int32_t)commit->parents[0] : -1;
+    record.parent2 = commit->num_parents > 1 ? (int32_t)commit->parents[1] : -1;
+    record.branch_id = commit->branch_id;
+    record.generation = commit->generation;
+    strncpy(record.id, commit->id, REPO_ID_SIZE - 1);
+
+    if(write_all(repo->commits_fd, body.data, body.length) == 0){
+        repo->commits_size += body.length;
+        write_all(repo->index_fd, (char*)&record, sizeof(record));
+        stats_bump(&system->stats->bytes_written, body.length + sizeof(record));
+    } else {
+        // Nothing was stored, the next commit writes these nodes itself
+        for(size_t i = 0; i < written.count; i++){
+            written.nodes[i]->stored = 0;
+        }
+    }
+
+    free(written.nodes);
+    free(body.data);
+
+}
+
+// Message and changes of a commit, read from the repository the first
+// time they are needed without reading its snapshot
+// Returns NULL for a NULL commit
+static struct CommitBody* commit_load_changes(struct System* system, struct Commit* commit){
+
+    if(commit == NULL){
+        return NULL;
+    }
+
+    struct CommitBody* data = commit_body(system, commit);
+
+    // Every commit has a message once its body is read
+    if(data->message != NULL){
+        return data;
+    }
+
+    struct Reader reader = {system->repo->commits_map + data->body_offset, 0, data->body_length};
+
+    data->message = reader_get_str(&reader, system->arena);
+
+    data->num_changes = reader_get_u32(&reader);
+    data->changes = (struct Changes*)arena_alloc(system->arena, sizeof(struct Changes)*data->num_changes);
+    for(size_t i = 0; i < data->num_changes; i++){
+        struct Changes* change = &data->changes[i];
+        change->path_id = reader_get_path(system, &reader);
+        change->file_name = path_string(system, change->path_id);
+        uint32_t flags = reader_get_u32(&reader);
+        change->addition = flags & 1;
+        change->deletion = (flags >> 1) & 1;
+        change->modification = (flags >> 2) & 1;
+        change->prev_hash = reader_get_u32(&reader);
+        change->new_hash = reader_get_u32(&reader);
+    }
+
+    return data;
+
+}
+
+// Whole body of a commit, snapshot included, read the first time it is needed
+// Returns NULL for a NULL commit
+static struct CommitBody* commit_load(struct System* system, struct Commit* commit){
+
+    if(commit == NULL){
+        return NULL;
+    }
+
+    struct CommitBody* data = commit_load_changes(system, commit);
+
+    if(commit->loaded){
+        return data;
+    }
+
+    // Subtrees already read for other commits are shared, not read again
+    data->tree = repo_load_node(system, data->tree_offset);
+
+    commit->loaded = true;
+
+    return data;
+
+}
+
+// Write data to the named file in place of what it held
+// Written to a temporary file and renamed so a crash never leaves half of it
+static void repo_replace_file(struct System* system, const char* name, const struct Buffer* data){
+
+    char* path = repo_file_path(system->repo, name);
+    char* temp = (char*)malloc(strlen(path) + 5);
+    sprintf(temp, "%s.tmp", path);
+
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if(fd >= 0){
+        int failed = write_all(fd, data->data, data->length);
+        close(fd);
+        if(!failed){
+            rename(temp, path);
+            stats_bump(&system->stats->bytes_written, data->length);
+        }
+    }
+
+    free(path);
+    free(temp);
+
+}
+
+// Rewrite the staging area of a branch
+// Staging areas only change while their branch is active, so only the
+// branch active since the last save, and a new branch, need writing
+static void repo_save_stage(struct System* system, size_t branch){
+
+    struct Buffer stage = {NULL, 0, 0};
+    struct File* files = branch_files(system, branch);
+
+    buffer_put_u32(&stage, system->num_files[branch]);
+
+    for(size_t i = 0; i < system->num_files[branch]; i++){
+        repo_put_staged(system, &stage, &files[i]);
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "stage.%zu", branch);
+    repo_replace_file(system, name, &stage);
+
+    free(stage.data);
+
+}
+
+// Rewrite the branch table and heads
+static void repo_save_state(struct System* system){
+
+    struct Buffer state = {NULL, 0, 0};
+
+    buffer_put_u32(&state, REPO_MAGIC);
+    buffer_put_u32(&state, system->num_branches);
+    buffer_put_u32(&state, system->active_branch_id);
+    buffer_put_u64(&state, system->next_order);
+
+    for(size_t b = 0; b < system->num_branches; b++){
+
+        struct Commit* head = system->branch_ptrs[b];
+
+        buffer_put_str(&state, system->branches[b]);
+        buffer_put_u32(&state, head == NULL ? UINT32_MAX : head->seq);
+    }
+
+    repo_replace_file(system, "state", &state);
+
+    free(state.data);
+
+}
+
+// Make the skeletons of one chunk of commits from the mapped index records
+// Generations are stored in the records, so the parents' chunks are not needed
+static struct Commit* repo_load_chunk(struct System* system, size_t chunk){
+
+    struct Repository* repo = system->repo;
+    size_t count = repo->index_map_size / sizeof(struct DiskCommit);
+    const struct DiskCommit* records = (const struct DiskCommit*)repo->index_map;
+
+    struct Commit* commits = (struct Commit*)arena_alloc(system->arena, sizeof(struct Commit)*COMMIT_CHUNK_SIZE);
+    struct CommitBody* bodies = (struct CommitBody*)arena_alloc(system->arena, sizeof(struct CommitBody)*COMMIT_CHUNK_SIZE);
+
+    system->commit_chunks[chunk] = commits;
+    system->body_chunks[chunk] = bodies;
+
+    size_t first = chunk*COMMIT_CHUNK_SIZE;
+    size_t end = first + COMMIT_CHUNK_SIZE < count ? first + COMMIT_CHUNK_SIZE : count;
+
+    for(size_t i = first; i < end; i++){
+
+        const struct DiskCommit* record = &records[i];
+        struct Commit* commit = &commits[i - first];
+        struct CommitBody* body = &bodies[i - first];
+
+        memset(commit, 0, sizeof(struct Commit));
+        memset(body, 0, sizeof(struct CommitBody));
+
+        // Ids are used straight from the mapping
+        commit->id = (char*)record->id;
+        commit->seq = i;
+        commit->branch_id = record->branch_id;
+        commit->generation = record->generation;
+        commit->parents[0] = COMMIT_NONE;
+        commit->parents[1] = COMMIT_NONE;
+
+        // Parents always come before their children
+        int32_t parents[2] = {record->parent, record->parent2};
+
+        for(size_t k = 0; k < 2; k++){
+            if(parents[k] >= 0 && (size_t)parents[k] < i){
+                commit->parents[commit->num_parents++] = parents[k];
+            }
+        }
+
+        // The body is read on first use
+        commit->loaded = false;
+        body->body_offset = record->body_offset;
+        body->body_length = record->body_length;
+        body->tree_offset = record->tree_offset;
+    }
+
+    return commits;
+
+}
+
+// Add the ids of every commit opened from the repository to the lookup
+// structures, done by the first lookup rather than on open
+static void repo_index_ids(struct System* system){
+
+    const struct DiskCommit* records = (const struct DiskCommit*)system->repo->index_map;
+    size_t count = system->num_unindexed;
+
+    system->num_unindexed = 0;
+
+    for(size_t i = 0; i < count; i++){
+        commit_index_put(system, records[i].id, i);
+    }
+
+}
+
+// Map a whole file for reading, NULL if it is missing or empty
+static char* repo_map_file(struct Repository* repo, const char* name, size_t* size){
+
+    char* path = repo_file_path(repo, name);
+    int fd = open(path, O_RDONLY);
+    free(path);
+
+    if(fd < 0){
+        return NULL;
+    }
+
+    struct stat st;
+    char* data = NULL;
+
+    if(fstat(fd, &st) == 0 && st.st_size > 0){
+        data = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        *size = st.st_size;
+    }
+
+    close(fd);
+
+    return data == MAP_FAILED ? NULL : data;
+
+}
+
+// Read the staging area of a branch the first time it is needed
+static void repo_load_stage(struct System* system, size_t branch){
+
+    if(system->files[branch] != NULL){
+        return;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "stage.%zu", branch);
+
+    size_t size = 0;
+    char* data = repo_map_file(system->repo, name, &size);
+    struct Reader reader = {data, 0, data == NULL ? 0 : size};
+
+    system->num_files[branch] = reader_get_u32(&reader);
+    system->cap_files[branch] = system->num_files[branch] > 0 ? system->num_files[branch] : 1;
+    system->files[branch] = (struct File*)malloc(sizeof(struct File)*system->cap_files[branch]);
+
+    for(size_t i = 0; i < system->num_files[branch]; i++){
+        repo_get_staged(system, &reader, &system->files[branch][i]);
+    }
+
+    path_index_create(system, branch);
+
+    if(data != NULL){
+        munmap(data, size);
+    }
+
+}
+
+// Restore branches from the state file, only the active branch's staging
+// area is read now
+static void repo_load_state(struct System* system){
+
+    size_t size = 0;
+    char* data = repo_map_file(system->repo, "state", &size);
+
+    if(data == NULL){
+        return;
+    }
+
+    struct Reader reader = {data, 0, size};
+
+    if(reader_get_u32(&reader) != REPO_MAGIC){
+        munmap(data, size);
+        return;
+    }
+
+    // Drop the default master branch set up by svc_init
+    free(system->files[0]);
+    free(system->file_index[0].slots);
+
+    system->num_branches = reader_get_u32(&reader);
+    system->active_branch_id = reader_get_u32(&reader);
+    // Orders stay unique across branches whose staging areas are not read yet
+    system->next_order = reader_get_u64(&reader);
+
+    system->branches = (char**)realloc(system->branches, sizeof(char*)*system->num_branches);
+    system->branch_ptrs = (struct Commit**)realloc(system->branch_ptrs, sizeof(struct Commit*)*system->num_branches);
+    system->files = (struct File**)realloc(system->files, sizeof(struct File*)*system->num_branches);
+    system->num_files = (size_t*)realloc(system->num_files, sizeof(size_t)*system->num_branches);
+    system->cap_files = (size_t*)realloc(system->cap_files, sizeof(size_t)*system->num_branches);
+    system->file_index = (struct PathIndex*)realloc(system->file_index, sizeof(struct PathIndex)*system->num_branches);
+    system->num_dead = (size_t*)realloc(system->num_dead, sizeof(size_t)*system->num_branches);
+
+    for(size_t b = 0; b < system->num_branches; b++){
+
+        system->branches[b] = reader_get_str(&reader, system->arena);
+
+        uint32_t head = reader_get_u32(&reader);
+        system->branch_ptrs[b] = head < system->num_commits ? commit_at(system, head) : NULL;
+
+        // Not read yet, see repo_load_stage
+        system->files[b] = NULL;
+        system->num_files[b] = 0;
+        system->cap_files[b] = 0;
+        system->file_index[b].slots = NULL;
+        system->file_index[b].cap = 0;
+        system->num_dead[b] = 0;
+    }
+
+    system->head_commit = system->branch_ptrs[system->active_branch_id];
+
+    munmap(data, size);
+
+    repo_load_stage(system, system->active_branch_id);
+
+}
+
+// Attach a repository directory to a freshly initialised system
+static int repo_open(struct System* system, const char* path){
+
+    mkdir(path, 0755);
+
+    struct Repository* repo = (struct Repository*)calloc(1, sizeof(struct Repository));
+    repo->path = strdup(path);
+
+    repo->objects_fd = repo_open_file(repo, "objects", &repo->objects_map, &repo->objects_map_size);
+    repo->commits_fd = repo_open_file(repo, "commits", &repo->commits_map, &repo->commits_map_size);
+    repo->index_fd = repo_open_file(repo, "index", &repo->index_map, &repo->index_map_size);
+
+    if(repo->objects_fd < 0 || repo->commits_fd < 0 || repo->index_fd < 0){
+        repo_close(repo);
+        return -1;
+    }
+
+    repo->objects_size = repo->objects_map_size;
+    repo->commits_size = repo->commits_map_size;
+
+    system->repo = repo;
+
+    // Every stored commit has a handle, but no chunk is made yet
+    size_t count = repo->index_map_size / sizeof(struct DiskCommit);
+
+    system->num_commits = count;
+    system->num_unindexed = count;
+    system->num_chunks = (count + COMMIT_CHUNK_SIZE - 1) / COMMIT_CHUNK_SIZE;
+    system->cap_chunks = system->num_chunks > 16 ? system->num_chunks : 16;
+    system->commit_chunks = (struct Commit**)calloc(system->cap_chunks, sizeof(struct Commit*));
+    system->body_chunks = (struct CommitBody**)calloc(system->cap_chunks, sizeof(struct CommitBody*));
+
+    repo_load_state(system);
+
+    return 0;
+
+}
+
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef SVC_SPANS
+#define SVC_SPANS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "stats.h"
+
+// Timed spans of internal phases, for finding where a slow call went
+// Off by default, a span then costs a load and a branch. Once switched on
+// every thread that opens a span gets a ring of the latest SPAN_RING_EVENTS
+// it closed, found through a thread local pointer, so recording takes no
+// lock. Rings are only registered with the system under its lock, the
+// first time a thread records for it. Spans are written out as Chrome
+// trace events, which chrome://tracing and Perfetto both open.
+
+#define SPAN_RING_EVENTS 8192 // Power of two
+
+struct SpanEvent {
+
+    const char* name; // Static string
+    uint64_t start;
+    uint64_t duration;
+
+};
+
+struct SpanRing {
+
+    long tid;
+    uint64_t head; // Events ever closed, the latest sit just before it
+    struct SpanEvent events[SPAN_RING_EVENTS];
+
+};
+
+struct Spans {
+
+    int enabled;
+    uint64_t id; // Never reused, so a thread can tell a stale ring from this system's
+    uint64_t origin; // Timestamps are written relative to this
+
+    pthread_mutex_t lock;
+    struct SpanRing** rings;
+    size_t num_rings;
+    size_t cap_rings;
+
+};
+
+// An open span, ring is NULL when spans were off as it opened
+struct Span {
+
+    struct SpanRing* ring;
+    const char* name;
+    uint64_t start;
+
+};
+
+static uint64_t spans_next_id = 1;
+
+// Ring this thread last recorded to, and the id of the system it belongs to
+static __thread uint64_t span_owner;
+static __thread struct SpanRing* span_ring;
+
+static void span_end(struct Span* span);
+
+// Opens a span named name that closes when the enclosing scope ends
+#define SPAN_JOIN(a, b) a##b
+#define SPAN_VAR(line) SPAN_JOIN(span_, line)
+#define SPAN(spans, name) \
+    struct Span SPAN_VAR(__LINE__) __attribute__((cleanup(span_end))) = span_begin(spans, name)
+
+
+static struct Spans* spans_create(void){
+
+    struct Spans* spans = (struct Spans*)calloc(1, sizeof(struct Spans));
+
+    spans->id = __atomic_fetch_add(&spans_next_id, 1, __ATOMIC_RELAXED);
+    spans->origin = stats_now();
+    pthread_mutex_init(&spans->lock, NULL);
+
+    return spans;
+
+}
+
+static void spans_free(struct Spans* spans){
+
+    for(size_t i = 0; i < spans->num_rings; i++){
+        free(spans->rings[i]);
+    }
+
+    pthread_mutex_destroy(&spans->lock);
+    free(spans->rings);
+    free(spans);
+
+}
+
+static void spans_enable(struct Spans* spans, bool enabled){
+
+    __atomic_store_n(&spans->enabled, enabled, __ATOMIC_RELAXED);
+
+}
+
+// This thread's ring, registering one the first time
+static struct SpanRing* span_ring_for(struct Spans* spans){
+
+    if(span_owner == spans->id){
+        return span_ring;
+    }
+
+    long tid = syscall(SYS_gettid);
+    struct SpanRing* ring = NULL;
+
+    pthread_mutex_lock(&spans->lock);
+
+    for(size_t i = 0; i < spans->num_rings; i++){
+        if(spans->rings[i]->tid == tid){
+            ring = spans->rings[i];
+            break;
+        }
+    }
+
+    if(ring == NULL){
+
+        if(spans->num_rings == spans->cap_rings){
+            spans->cap_rings = spans->cap_rings == 0 ? 4 : spans->cap_rings*2;
+            spans->rings = (struct SpanRing**)realloc(spans->rings, sizeof(struct SpanRing*)*spans->cap_rings);
+        }
+
+        ring = (struct SpanRing*)malloc(sizeof(struct SpanRing));
+        ring->tid = tid;
+        ring->head = 0;
+        spans->rings[spans->num_rings++] = ring;
+    }
+
+    pthread_mutex_unlock(&spans->lock);
+
+    span_owner = spans->id;
+    span_ring = ring;
+
+    return ring;
+
+}
+
+// Recording halves of span_begin and span_end, kept out of line so the
+// checks for spans being off stay small enough to inline
+__attribute__((noinline)) static struct Span span_open(struct Spans* spans, const char* name){
+
+    struct Span span = {span_ring_for(spans), name, stats_now()};
+
+    return span;
+
+}
+
+static struct Span span_begin(struct Spans* spans, const char* name){
+
+    if(!__atomic_load_n(&spans->enabled, __ATOMIC_RELAXED)){
+        struct Span off = {NULL, name, 0};
+        return off;
+    }
+
+    return span_open(spans, name);
+
+}
+
+__attribute__((noinline)) static void span_close(struct Span* span){
+
+    struct SpanRing* ring = span->ring;
+    struct SpanEvent* event = &ring->events[ring->head & (SPAN_RING_EVENTS - 1)];
+
+    event->name = span->name;
+    event->start = span->start;
+    event->duration = stats_now() - span->start;
+
+    ring->head++;
+
+    span->ring = NULL;
+
+}
+
+static void span_end(struct Span* span){
+
+    if(span->ring != NULL){
+        span_close(span);
+    }
+
+}
+
+// Write every ring as complete events, timestamps in microseconds
+// Workers only record during calls, so between calls no ring is changing
+// Returns -1 if the file could not be written
+static int spans_dump(struct Spans* spans, const char* path){
+
+    FILE* out = fopen(path, "w");
+
+    if(out == NULL){
+        return -1;
+    }
+
+    int pid = getpid();
+    bool first = true;
+
+    fprintf(out, "{\"traceEvents\": [\n");
+
+    pthread_mutex_lock(&spans->lock);
+
+    for(size_t r = 0; r < spans->num_rings; r++){
+
+        struct SpanRing* ring = spans->rings[r];
+        uint64_t count = ring->head < SPAN_RING_EVENTS ? ring->head : SPAN_RING_EVENTS;
+
+        for(uint64_t i = ring->head - count; i < ring->head; i++){
+
+            struct SpanEvent* event = &ring->events[i & (SPAN_RING_EVENTS - 1)];
+
+            fprintf(out, "%s{\"name\": \"%s\", \"cat\": \"svc\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %ld}",
+                first ? "" : ",\n", event->name, (event->start - spans->origin) / 1e3, event->duration / 1e3, pid, ring->tid);
+
+            first = false;
+        }
+    }
+
+    pthread_mutex_unlock(&spans->lock);
+
+    fprintf(out, "\n], \"displayTimeUnit\": \"ns\"}\n");
+
+    if(fclose(out) != 0){
+        return -1;
+    }
+
+    return 0;
+
+}
+
+
+#endif
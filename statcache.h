@@ -0,0 +1,79 @@
+#ifndef SVC_STATCACHE
+#define SVC_STATCACHE
+
+#include <stdbool.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "structures.h"
+
+// Stat cache kept next to the hash of each struct File
+// While size, mtime, ctime and inode are unchanged the file still holds
+// the content that was hashed, so it does not need to be read again.
+// A file modified in the same second the stat was recorded could change
+// again without its timestamps moving, so such entries are never trusted.
+
+
+static long long stat_mtime_ns(const struct stat* st){
+
+    return (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+
+}
+
+static long long stat_ctime_ns(const struct stat* st){
+
+    return (long long)st->st_ctim.tv_sec * 1000000000LL + st->st_ctim.tv_nsec;
+
+}
+
+// Remember the stat of a file whose content matches file->hash
+static void stat_cache_record(struct File* file, const struct stat* st){
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    file->st_size = st->st_size;
+    file->st_mtime_ns = stat_mtime_ns(st);
+    file->st_ctime_ns = stat_ctime_ns(st);
+    file->st_inode = st->st_ino;
+    file->st_recorded_s = now.tv_sec;
+
+}
+
+static void stat_cache_clear(struct File* file){
+
+    file->st_recorded_s = 0;
+
+}
+
+// Carry a recorded stat over to another entry for the same content
+static void stat_cache_copy(struct File* file, const struct File* from){
+
+    file->st_size = from->st_size;
+    file->st_mtime_ns = from->st_mtime_ns;
+    file->st_ctime_ns = from->st_ctime_ns;
+    file->st_inode = from->st_inode;
+    file->st_recorded_s = from->st_recorded_s;
+
+}
+
+// True if the file on disk is known to still match file->hash
+static bool stat_cache_fresh(const struct File* file, const struct stat* st){
+
+    if(file->st_recorded_s == 0){
+        return false;
+    }
+
+    // Racy entry, modified within the second the stat was taken
+    if(st->st_mtim.tv_sec >= file->st_recorded_s || st->st_ctim.tv_sec >= file->st_recorded_s){
+        return false;
+    }
+
+    return file->st_size == (long long)st->st_size
+        && file->st_mtime_ns == stat_mtime_ns(st)
+        && file->st_ctime_ns == stat_ctime_ns(st)
+        && file->st_inode == (unsigned long long)st->st_ino;
+
+}
+
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef SVC_STATS
+#define SVC_STATS
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+#include "svc.h"
+#include "fileio.h"
+#include "trace.h"
+
+// Counters and call latencies behind svc_stats
+// Counters only grow. The ones worker threads also bump while scanning
+// files take atomic adds, the rest only have the calling thread writing
+// them and are bumped with relaxed loads and stores, which compile to
+// plain moves, so no counter is ever locked or fenced. A reset copies the
+// counters into a baseline that snapshots subtract, so it never writes a
+// counter another thread may be bumping.
+// Each outermost call is counted and timed into power of two buckets.
+// Lookups that take well under a microsecond only time one call in
+// STATS_SAMPLE, reading the clock twice would cost about as much as them.
+
+#define STATS_SAMPLE 64
+
+_Static_assert(TRACE_NUM_OPS - TRACE_HASH_FILE == SVC_STATS_CALLS, "every traced call has its stats");
+
+struct StatsCall {
+
+    uint64_t calls;
+    uint64_t timed;
+    uint64_t total_ns;
+    uint64_t max_ns; // Cleared by a reset rather than subtracted
+    uint64_t buckets[SVC_STATS_BUCKETS];
+
+};
+
+struct Stats {
+
+    // Counters, everything up to blob_bytes is a uint64_t the baseline covers
+    uint64_t files_opened; // Also bumped by workers
+    uint64_t bytes_read; // Also bumped by workers
+    uint64_t bytes_hashed; // Also bumped by workers
+    uint64_t bytes_written;
+    uint64_t blobs_stored;
+    uint64_t path_lookups;
+    uint64_t commit_lookups;
+    uint64_t branch_lookups;
+    uint64_t string_compares;
+    uint64_t commits;
+    uint64_t branches;
+    struct StatsCall calls[TRACE_NUM_OPS];
+
+    // Levels
+    uint64_t blob_bytes;
+
+    // Counters as of the last reset
+    struct Stats* baseline;
+
+};
+
+#define STATS_COUNTERS (offsetof(struct Stats, blob_bytes) / sizeof(uint64_t))
+
+// Lookups timed one call in STATS_SAMPLE
+static const bool stats_sampled[TRACE_NUM_OPS] = {
+    [TRACE_GET_COMMIT] = true, [TRACE_RESOLVE_COMMIT] = true, [TRACE_PREV_COMMITS] = true,
+    [TRACE_BRANCH_HEAD] = true, [TRACE_IS_ANCESTOR] = true, [TRACE_LOG_NEXT] = true,
+};
+
+
+static uint64_t stats_now(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+}
+
+// Bump a counter workers may bump at the same time
+static void stats_add(uint64_t* counter, uint64_t n){
+
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+
+}
+
+// Bump a counter only the calling thread writes
+static void stats_bump(uint64_t* counter, uint64_t n){
+
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+
+}
+
+static struct Stats* stats_create(void){
+
+    struct Stats* stats = (struct Stats*)calloc(1, sizeof(struct Stats));
+    stats->baseline = (struct Stats*)calloc(1, sizeof(struct Stats));
+
+    return stats;
+
+}
+
+static void stats_free(struct Stats* stats){
+
+    free(stats->baseline);
+    free(stats);
+
+}
+
+// file_view_open, counting the file and the bytes read
+static int stats_view_open(struct Stats* stats, const char* path, struct FileView* view, char** buffer, size_t* buffer_cap){
+
+    int failed = file_view_open(path, view, buffer, buffer_cap);
+
+    if(failed == 0){
+        stats_add(&stats->files_opened, 1);
+        stats_add(&stats->bytes_read, view->size);
+    }
+
+    return failed;
+
+}
+
+// Counts an outermost call, true if it should also be timed
+static bool stats_call_begin(struct Stats* stats, int op){
+
+    uint64_t calls = __atomic_load_n(&stats->calls[op].calls, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&stats->calls[op].calls, calls + 1, __ATOMIC_RELAXED);
+
+    return !stats_sampled[op] || calls % STATS_SAMPLE == 0;
+
+}
+
+static void stats_call_end(struct Stats* stats, int op, uint64_t elapsed){
+
+    struct StatsCall* call = &stats->calls[op];
+    int bucket = elapsed == 0 ? 0 : 63 - __builtin_clzll(elapsed);
+
+    if(bucket >= SVC_STATS_BUCKETS){
+        bucket = SVC_STATS_BUCKETS - 1;
+    }
+
+    stats_bump(&call->timed, 1);
+    stats_bump(&call->total_ns, elapsed);
+    stats_bump(&call->buckets[bucket], 1);
+
+    if(elapsed > __atomic_load_n(&call->max_ns, __ATOMIC_RELAXED)){
+        __atomic_store_n(&call->max_ns, elapsed, __ATOMIC_RELAXED);
+    }
+
+}
+
+static void stats_reset(struct Stats* stats){
+
+    uint64_t* counters = (uint64_t*)stats;
+    uint64_t* baseline = (uint64_t*)stats->baseline;
+
+    for(size_t i = 0; i < STATS_COUNTERS; i++){
+        __atomic_store_n(&baseline[i], __atomic_load_n(&counters[i], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    }
+
+    for(int op = 0; op < TRACE_NUM_OPS; op++){
+        __atomic_store_n(&stats->calls[op].max_ns, 0, __ATOMIC_RELAXED);
+    }
+
+}
+
+static void stats_snapshot(struct Stats* stats, struct svc_stats* out){
+
+    struct Stats now;
+    uint64_t* counters = (uint64_t*)stats;
+    uint64_t* baseline = (uint64_t*)stats->baseline;
+    uint64_t* since = (uint64_t*)&now;
+
+    for(size_t i = 0; i < STATS_COUNTERS; i++){
+        since[i] = __atomic_load_n(&counters[i], __ATOMIC_RELAXED) - __atomic_load_n(&baseline[i], __ATOMIC_RELAXED);
+    }
+
+    out->files_opened = now.files_opened;
+    out->bytes_read = now.bytes_read;
+    out->bytes_hashed = now.bytes_hashed;
+    out->bytes_written = now.bytes_written;
+    out->blobs_stored = now.blobs_stored;
+    out->path_lookups = now.path_lookups;
+    out->commit_lookups = now.commit_lookups;
+    out->branch_lookups = now.branch_lookups;
+    out->string_compares = now.string_compares;
+    out->commits = now.commits;
+    out->branches = now.branches;
+    out->blob_bytes = __atomic_load_n(&stats->blob_bytes, __ATOMIC_RELAXED);
+
+    for(int i = 0; i < SVC_STATS_CALLS; i++){
+
+        int op = TRACE_HASH_FILE + i;
+        svc_call_stats* call = &out->calls[i];
+
+        call->name = trace_op_names[op];
+        call->calls = now.calls[op].calls;
+        call->timed = now.calls[op].timed;
+        call->total_ns = now.calls[op].total_ns;
+        call->max_ns = __atomic_load_n(&stats->calls[op].max_ns, __ATOMIC_RELAXED);
+
+        for(int b = 0; b < SVC_STATS_BUCKETS; b++){
+            call->buckets[b] = now.calls[op].buckets[b];
+        }
+    }
+
+}
+
+
+#endif
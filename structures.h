@@ -4,47 +4,111 @@
 #include <stdlib.h>
 #include "svc.h"
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include "sha256.h"
 
+// Handle that refers to no commit
+#define COMMIT_NONE UINT32_MAX
+
+// Fields read while walking history, kept small so walks stay in cache
 struct Commit{
 
-    char* message;
     char* id;
-    struct File* files;
-    size_t num_files;
+    uint32_t parents[2]; // Handles of the parents, COMMIT_NONE if absent
+    uint32_t num_parents;
+    uint32_t generation; // One more than the highest parent generation
+    uint32_t seq; // Handle of this commit, its position in creation order
+    uint32_t branch_id;
 
-    struct Commit* parent_commit; // Pointer to parent commit
-    struct Commit* parent_commit2;
-    size_t num_parents;
-    struct Commit* child_commits; // An array of commits
-    size_t num_childs;
-    bool child_allocated;
+    // False until the snapshot of a commit opened from a repository is read
+    bool loaded;
+
+};
+
+// Fields only needed when a commit is shown, compared or checked out
+struct CommitBody{
+
+    char* message;
+    struct TreeNode* tree; // Snapshot of the tracked files, see tree.h
 
     struct Changes* changes;
     size_t num_changes;
 
-    char* branch_name;
-    size_t branch_id;
-
+    // Location of the body and of the snapshot's root node in the
+    // repository commits file
+    size_t body_offset;
+    size_t body_length;
+    uint64_t tree_offset;
 
 };
 
 struct System{
 
 
+    // Everything that lives until cleanup, commits, ids, paths and branch names
+    struct Arena* arena;
+
+    // Every path seen, shared by staging areas, snapshots and changes
+    struct PathTable* paths;
+
+    // Every snapshot tree node, shared between commits
+    struct TreeTable* trees;
+
     // Commits
-    struct Commit* initial_commit;
     struct Commit* head_commit; // Currently active commit
+    size_t num_commits;
+
+    // Chunked commit storage, see commit_table.h
+    struct Commit** commit_chunks;
+    struct CommitBody** body_chunks;
+    size_t num_chunks;
+    size_t cap_chunks;
+
+    // Commit lookup by id and by id prefix
+    struct CommitEntry* commit_table;
+    size_t commit_table_cap;
+    struct TrieNode* commit_trie;
+    // Commits opened from a repository whose ids are only added on the first lookup
+    size_t num_unindexed;
 
     
     // Files
     struct File** files;
     size_t* num_files;
     size_t* cap_files;
+    // Path lookup for each branch, and the number of removed files
+    // still leaving a hole in that branch's files array
+    struct PathIndex* file_index;
+    size_t* num_dead;
+    // Order given to the next file added to any staging area
+    uint64_t next_order;
 
     // File content control
-    char** file_contents;
-    size_t num_content;
-    size_t cap_content;
+    // Content addressed store, every distinct content is held once
+    struct Blob* blobs;
+    size_t num_blobs;
+    size_t cap_blobs;
+    int free_blob; // Head of the list of released blob slots
+
+    // Open addressing table from digest to blob index
+    int* blob_table;
+    size_t blob_table_cap;
+    size_t blob_table_used;
+
+    // Recently rebuilt delta and compressed blobs
+    struct BlobCacheEntry* blob_cache;
+    uint64_t blob_cache_clock;
+    int compression; // Codec for new blobs, 0 to store them as they are
+
+    // Reusable read buffer for store_content
+    char* scratch;
+    size_t scratch_cap;
+
+    // Threads scanning tracked files, started on the first large commit
+    struct WorkerPool* workers;
+    size_t num_threads;
 
 
     // Branches
@@ -54,24 +118,180 @@ struct System{
     struct Commit** branch_ptrs;
     size_t active_branch_id;
 
+    // Branch whose head becomes the second parent of the commit svc_merge makes
+    // Kept as a branch id since its head may move while the commit is attached
+    size_t merge_branch;
+
+    // Commits reachable from each branch head, built when first asked for
+    // and kept up to date as the heads move, see ancestry.h
+    struct ReachBitmap* reach;
+    size_t num_reach;
+
+    // On-disk repository, NULL for a purely in memory system
+    struct Repository* repo;
+
+    // Call recorder, NULL unless svc_options asked for one, see recorder.h
+    struct Trace* trace;
+
+    // Counters and call latencies, see stats.h
+    struct Stats* stats;
+    int call_depth; // Public calls in progress, only the outermost is counted
+
+    // Spans of internal phases, recorded once svc_spans switches them on
+    struct Spans* spans;
+
 
 };
 
 struct File {
 
     size_t hash;
+    // Interned path, file_name is the shared copy of path_id
+    // A NULL file_name marks a hole left in a staging area by svc_rm
+    int path_id;
     char* file_name;
-    // Index of file content in the array file_content
+    // Index of file content in the blob store
     int fc_index; 
     // MARK: Might need to store the actual file content as well
     int fc_length;
+    // Files staged later have a larger order, snapshots list files by it
+    uint64_t order;
+
+    // Stat of the file when its content last matched hash
+    // st_recorded_s is 0 when nothing has been recorded
+    long long st_size;
+    long long st_mtime_ns;
+    long long st_ctime_ns;
+    unsigned long long st_inode;
+    long long st_recorded_s;
+
+
+};
+
+
+struct Blob {
+
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    char* content; // NULL once the blob has been released
+    const char* mapped; // Contents inside the repository mapping
+    long long disk_offset; // Offset in the objects file, -1 if not written
+    int length; // Length of the full content
+    // A blob with a base holds a delta against it in content or mapped,
+    // see delta.h, and a reference on the base
+    int stored_length;
+    int base;
+    int depth; // Deltas applied to rebuild the content, 0 for full content
+    // LZ_FAST or LZ_HIGH when the stored bytes are compressed, see lz.h,
+    // raw_length is then the length of the delta or content they hold
+    int codec;
+    int raw_length;
+    size_t refcount;
+    int next_free;
+
+};
+
+// Content rebuilt from a delta or decompressed, kept for a while since
+// the next version of the path usually needs it as a base
+struct BlobCacheEntry {
+
+    int blob; // BLOB_NONE for an empty entry
+    char* content;
+    uint64_t last_used;
+
+};
+
+
+// Outcome of reading one tracked file during a commit
+struct ScanResult {
+
+    int hash; // -2 if the file could not be read
+    // New content, only kept when hash differs from the tracked hash
+    char* content;
+    size_t length;
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    struct stat st;
+
+};
+
+struct ScanJob {
+
+    struct File* files;
+    struct ScanResult* results;
+    struct Stats* stats;
+    struct Spans* spans;
+
+};
+
+
+// Head snapshot files no longer staged, found by walking the snapshot
+// Either appended to changes, or when changes is NULL only the first
+// in path order is kept
+struct DeletionWalk {
+
+    struct System* system;
+    size_t branch;
+    struct Changes** changes;
+    size_t* num_changes;
+    size_t* cap_changes;
+    char* first;
+
+};
+
+
+// One path a checkout has to touch, new_file is NULL for a deletion
+// and old_file is NULL for a file the active branch does not track
+struct CheckoutStep {
+
+    const struct File* old_file;
+    const struct File* new_file;
+
+};
+
+// Steps found by diffing the active head with another branch's head,
+// or the two sides of a diff
+struct CheckoutPlan {
+
+    struct System* system;
+    size_t branch; // Branch being checked out, or whose staged files a diff reads
+    struct CheckoutStep* steps;
+    size_t num_steps;
+    size_t cap_steps;
+
+};
+
+#define MERGE_TAKE_THEIRS 0 // Only the other branch changed the path
+#define MERGE_CONTENT 1 // Both changed it, merged line by line
+#define MERGE_CONFLICT 2 // Both changed it in ways that do not combine
+
+// One path the other branch changed since the merge base
+// Any of the files is NULL where that side does not track the path
+struct MergeStep {
+
+    const struct File* base;
+    const struct File* ours;
+    const struct File* theirs;
+    int action;
+    char* merged; // Result of MERGE_CONTENT, owned by the step
+    size_t merged_length;
+
+};
+
+// Steps found by diffing the merge base with the other branch's head
+struct MergePlan {
 
+    struct System* system;
+    struct TreeNode* ours_tree;
+    struct MergeStep* steps;
+    size_t num_steps;
+    size_t cap_steps;
+    size_t num_conflicts;
 
 };
 
 
 struct Changes {
 
+    int path_id;
     char* file_name;
     bool addition;
     bool deletion;
@@ -3,31 +3,91 @@
 #include <string.h>
 #include <stdbool.h>
 #include <ctype.h>
-#include "queue.h"
 #include "structures.h"
-
-#define MAX_QUEUE_SIZE 200
+#include "blobs.h"
+#include "arena.h"
+#include "commit_table.h"
+#include "commit_index.h"
+#include "intern.h"
+#include "tree.h"
+#include "path_index.h"
+#include "repository.h"
+#include "fileio.h"
+#include "bytesum.h"
+#include "statcache.h"
+#include "workers.h"
+#include "ancestry.h"
+#include "diff.h"
+#include "log.h"
+#include "stats.h"
+#include "spans.h"
+#include "recorder.h"
+
+#define CHANGE_ADDITION 0
+#define CHANGE_DELETION 1
+#define CHANGE_MODIFICATION 2
+
+// Branches with fewer tracked files are scanned on the calling thread
+#define SCAN_PARALLEL_MIN 64
 
 
 int num_bytes(FILE* file);
-char* get_commit_id(struct Commit* commit, struct Changes* changes, size_t num_changes);
+size_t hash_content(char* file_path, const char* data, size_t length);
+int store_view(struct System* system, const char* data, size_t length);
+int store_owned(struct System* system, const unsigned char* digest, char* content, size_t length, int base);
+struct ScanResult* scan_tracked_files(struct System* system, struct File* files, size_t num_files);
+void apply_scan_result(struct System* system, struct File* file, struct ScanResult* result);
+void free_scan_results(struct ScanResult* results, size_t num_results);
+int tracked_file_hash(struct System* system, struct File* file);
+char* get_commit_id(struct Arena* arena, char* message, struct Changes* changes, size_t num_changes);
 void add_to_parent(struct Commit* child, struct Commit* parent);
-void post_order_recursion(struct Commit* commit, struct Queue* queue);
-void organise_files(struct System* system, int index);
-struct Changes* detect_changes(struct System* system, size_t* num_changes);
+void remove_file_at(struct System* system, size_t branch, size_t index);
+int compare_paths(const char* a, const char* b);
+struct Changes* detect_changes(struct System* system, size_t* num_changes, struct TreeNode** snapshot);
 int check_validity(char* name);
 int check_uncommitted_changes(struct System* system);
-int store_content(struct System* system, FILE* file);
+int store_content(struct System* system, char* file_path);
 void resolve_file_clashes(struct System* system, struct resolution *resolutions, int n_resolutions);
-int check_branch_for_file(struct System* system, size_t branch, char* file_name);
+size_t find_branch(struct System* system, char* branch_name);
+void plan_checkout(struct System* system, size_t branch, struct CheckoutPlan* plan);
+void append_step(struct CheckoutPlan* plan, const struct File* old_file, const struct File* new_file);
+int compare_steps(const void* a, const void* b);
+int write_blob(struct System* system, const char* path, int fc_index, int length);
+int working_copy_matches(struct System* system, const struct File* staged, const struct File* target);
 
 void *svc_init(void) {
+
+    return svc_init_opts(NULL);
+
+}
+
+// Initialise with the given options, NULL gives the defaults
+void *svc_init_opts(const svc_options *options) {
     
     struct System* system = (struct System*)malloc(sizeof(struct System));
 
+    if(options != NULL){
+        system->arena = arena_create(options->alloc, options->release, options->alloc_user);
+    } else {
+        system->arena = arena_create(NULL, NULL, NULL);
+    }
+
+    if(system->arena == NULL){
+        free(system);
+        return NULL;
+    }
+
+    system->stats = stats_create();
+    system->call_depth = 0;
+    system->spans = spans_create();
+
+    system->paths = path_table_create();
+    system->trees = tree_table_create();
+
     // Initialise commits
-    system->initial_commit = NULL;
     system->head_commit = NULL;
+    commit_table_init(system);
+    commit_index_init(system);
 
     // Initialise files
     // Allocate enough space for 1 struct File pointer
@@ -39,143 +99,213 @@ void *svc_init(void) {
     system->num_files[0] = 0;
     system->cap_files = (size_t*)malloc(sizeof(size_t));
     system->cap_files[0] = 1;
+    system->file_index = (struct PathIndex*)malloc(sizeof(struct PathIndex));
+    system->num_dead = (size_t*)malloc(sizeof(size_t));
+    path_index_create(system, 0);
+    system->next_order = 0;
 
     // Initialise file_contents
-    system->file_contents = (char**)malloc(sizeof(char*));
-    system->num_content = 0;
-    system->cap_content = 1;
+    blob_store_init(system);
+
+    system->compression = LZ_FAST;
+    if(options != NULL && options->compression == SVC_COMPRESS_HIGH){
+        system->compression = LZ_HIGH;
+    } else if(options != NULL && options->compression == SVC_COMPRESS_NONE){
+        system->compression = 0;
+    }
 
     // Initialise branches
     system->num_branches = 1;
     system->branches = (char**)malloc(sizeof(char*));
-    system->branches[0] = strdup("master");
+    system->branches[0] = arena_strdup(system->arena, "master");
     system->active_branch_id = 0;
     system->branch_ptrs = (struct Commit**)malloc(sizeof(struct Commit*));
+    system->branch_ptrs[0] = NULL;
+
+    system->merge_branch = -1;
+    system->repo = NULL;
+
+    system->reach = NULL;
+    system->num_reach = 0;
+
+    system->workers = NULL;
+    system->num_threads = workers_default_threads();
+    if(options != NULL && options->num_threads > 0){
+        system->num_threads = options->num_threads;
+    }
+
+    system->trace = NULL;
+
+    if(options != NULL && options->trace_path != NULL){
+
+        system->trace = trace_open(options, 0);
+
+        if(system->trace == NULL){
+            cleanup(system);
+            return NULL;
+        }
+    }
 
 
     return system;
 }
 
-void cleanup(void *helper) {
+// Open the repository stored in repo_path, creating it if needed
+// History is written back to the directory as it is made
+void *svc_open(char *repo_path) {
 
-    struct System* system = (struct System*)helper;
+    return svc_open_opts(repo_path, NULL);
 
-    // Clean up file allocations
-    for(int h = 0; h < system->num_branches; h++){
+}
 
+// Open the repository with the given options, NULL gives the defaults
+// A trace starts once the repository is open, so calls the opening makes
+// are not recorded and recorded commits are numbered after the opened ones
+void *svc_open_opts(char *repo_path, const svc_options *options) {
 
-        for(int i = 0; i < system->num_files[h]; i++){
+    if(repo_path == NULL){
+        return NULL;
+    }
 
-            free(system->files[h][i].file_name);
-        }
+    svc_options untraced = {0};
 
-        free(system->files[h]);
+    if(options != NULL){
+        untraced = *options;
+        untraced.trace_path = NULL;
+    }
 
+    struct System* system = (struct System*)svc_init_opts(&untraced);
 
+    if(system == NULL){
+        return NULL;
     }
 
-    free(system->num_files);
+    if(repo_open(system, repo_path) != 0){
+        cleanup(system);
+        return NULL;
+    }
 
-    free(system->cap_files);
+    if(options != NULL && options->trace_path != NULL){
 
-    free(system->files);
+        system->trace = trace_open(options, system->num_commits);
 
-    // Clean up file_content allocations
-    for(int v = 0; v < system->num_content; v++){
+        if(system->trace == NULL){
+            cleanup(system);
+            return NULL;
+        }
+    }
 
-        free(system->file_contents[v]);
+    return system;
+}
 
-    }
+void cleanup(void *helper) {
 
-    free(system->file_contents);
+    struct System* system = (struct System*)helper;
 
+    // The trace outlives the system, so cleanup is timed by hand
+    struct Trace* trace = system->trace;
+    uint64_t trace_start = 0;
 
-    // Clean up branch allocations
-    for(int j = 0; j < system->num_branches; j++){
-        free(system->branches[j]);
+    if(trace != NULL){
+        putc_unlocked(TRACE_CLEANUP, trace->out);
+        putc_unlocked(TRACE_RUN, trace->out);
+        trace_start = stats_now();
     }
 
-    free(system->branches);
+    // Clean up file allocations
+    for(int h = 0; h < system->num_branches; h++){
 
-    free(system->branch_ptrs);
 
+        // Paths are interned, only the arrays are owned by the branch
+        free(system->files[h]);
 
-    // Clean up commit allocations
+        free(system->file_index[h].slots);
 
-    struct Queue* queue = createQueue(MAX_QUEUE_SIZE);
 
-    post_order_recursion(system->initial_commit, queue);
+    }
 
-    while(!isEmpty(queue)){
+    free(system->file_index);
 
-        struct Commit* cursor = dequeue(queue);
+    free(system->num_dead);
 
+    free(system->num_files);
 
-        free(cursor->message);
+    free(system->cap_files);
 
-        free(cursor->id);
+    free(system->files);
 
-        if(cursor->child_allocated){
-            free(cursor->child_commits);
-        }
+    // Clean up file_content allocations
+    blob_store_free(system);
 
-        for(int i = 0; i < cursor->num_files; i++){
-            free(cursor->files[i].file_name);
-        }
+    // Mapped contents are no longer referenced, close the repository
+    repo_close(system->repo);
 
-        free(cursor->files);
 
-        for(int j = 0; j < cursor->num_changes; j++){
-            free(cursor->changes[j].file_name);
-        }
+    // Clean up branch allocations
+    // Branch names belong to the arena
+    free(system->branches);
 
-        free(cursor->changes);
+    free(system->branch_ptrs);
 
-    }
+    reach_free(system);
 
-    free(system->initial_commit);
 
-    free(system);
+    // Clean up commit allocations
+    // Commits and everything they point to belong to the arena
 
-    freeQueue(queue);
+    commit_index_free(system);
 
+    commit_table_free(system);
 
-}
+    tree_table_free(system->trees);
 
-// Post order recursion using ciruclar queue
-void post_order_recursion(struct Commit* commit, struct Queue* queue){
+    path_table_free(system->paths);
 
-    if(commit == NULL){
-        return;
-    }
+    workers_destroy(system->workers);
 
-    for(int i = 0; i < commit->num_childs; i++){
+    arena_destroy(system->arena);
 
-        post_order_recursion(&commit->child_commits[i], queue);
-    }
+    stats_free(system->stats);
 
-    enqueue(queue, commit);
+    spans_free(system->spans);
 
-    return;
+    free(system);
+
+    trace_close(trace, trace_start);
 
 }
 
 // File hashing algorithm as described 
 int hash_file(void *helper, char *file_path) {
+
+    struct System* system = (struct System*)helper;
+
+    TRACE_CALL(system, TRACE_HASH_FILE){
+        trace_string(system->trace, TRACE_KIND_PATH, file_path);
+        trace_sync(system->trace, file_path);
+        trace_call_run(&trace_call);
+    }
     
     if(file_path == NULL){
         return -1;
     }
 
-    FILE* file = fopen(file_path, "rb");
+    struct FileView view;
 
-    if(file == NULL){
+    if(stats_view_open(system->stats, file_path, &view, &system->scratch, &system->scratch_cap) != 0){
         return -2;
     }
 
-    // Hashing algorithm as described
+    size_t hash = hash_content(file_path, view.data, view.size);
+    stats_add(&system->stats->bytes_hashed, view.size);
+
+    file_view_close(&view);
 
-    int file_length = num_bytes(file);
+    return hash;
+}
+
+// Hashing algorithm as described, over contents already in memory
+size_t hash_content(char* file_path, const char* data, size_t length){
 
     size_t hash = 0;
 
@@ -183,17 +313,9 @@ int hash_file(void *helper, char *file_path) {
         hash = (hash + file_path[i]) % 1000;
     }
 
-
-    for(int j = 0; j < file_length; j++){
-        
-        size_t buf = fgetc(file);
-
-        hash = (hash + buf) % 2000000000;
-
-    }
-
-    fclose(file);
-    
+    // Adding every byte then reducing once gives the same value as
+    // reducing after each byte, so the vectorised sum can be used
+    hash = (hash + bytesum(data, length)) % 2000000000;
 
     return hash;
 }
@@ -201,17 +323,13 @@ int hash_file(void *helper, char *file_path) {
 // Return the number of bytes inside file
 int num_bytes(FILE* file){
 
-    fseek(file, 0, SEEK_SET);
-
-    int length;
+    struct stat st;
 
-    fseek(file, 0, SEEK_END);
-
-    length = ftell(file);
-
-    fseek(file, 0, SEEK_SET);
+    if(fstat(fileno(file), &st) != 0){
+        return 0;
+    }
 
-    return length;
+    return st.st_size;
 
 }
 
@@ -220,6 +338,12 @@ char *svc_commit(void *helper, char *message) {
 
     struct System* system = (struct System*)helper;
 
+    TRACE_CALL(system, TRACE_COMMIT){
+        trace_string(system->trace, TRACE_KIND_MESSAGE, message);
+        trace_sync_staged(system);
+        trace_call_run(&trace_call);
+    }
+
     int branch = system->active_branch_id;
 
     if(message == NULL){
@@ -228,431 +352,247 @@ char *svc_commit(void *helper, char *message) {
 
 
     size_t num_changes = 0;
-    struct Changes* changes = detect_changes(system, &num_changes);
+    struct TreeNode* snapshot = NULL;
+    struct Changes* changes = detect_changes(system, &num_changes, &snapshot);
 
     if(num_changes == 0){
         free(changes);
         return NULL;
     }
 
+    // The history keeps an exact sized copy of the changes
+    struct Changes* grown = changes;
+    changes = (struct Changes*)arena_memdup(system->arena, grown, sizeof(struct Changes)*num_changes);
+    free(grown);
 
 
-    struct Commit* commit = NULL;
-
-    // Check whether the first commit has occured
-    if(system->initial_commit == NULL){
-
-        // If first commit has not occured
-        // Initialise commit structure
-
-        system->initial_commit = (struct Commit*)malloc(sizeof(struct Commit)); 
-        system->head_commit = system->initial_commit;
-        commit = system->initial_commit;
-        commit->branch_name = system->branches[0];
-        commit->branch_id = branch;
-        commit->parent_commit = NULL;
-        commit->num_parents = 0;
-
-    } else {
-
-        // First commit has occured before this
-        // Append to parent commit
-
-        struct Commit* parent = system->head_commit;
-
-        // There has been a previous commit
-        // Check if there are childs
-        if(!parent->child_allocated){
-            // If no children has been allocated before for this commit
-            // We need to malloc
-            parent->child_commits = (struct Commit*)malloc(sizeof(struct Commit));
-            parent->child_allocated = true;
-        } else {
-            // If there has been children allocated to this commit before
-            // We need to realloc
-
-            struct Commit** child_pointers;
-
-            size_t num_child = parent->num_childs;
-
-            child_pointers = (struct Commit**)malloc(sizeof(struct Commit*)*num_child);
 
-            for(int k = 0; k < num_child; k++){
-                
-                child_pointers[k] = &parent->child_commits[k];
+    // Commits are made in place in the commit table and never move
+    struct Commit* commit = commit_new(system);
 
-            }
+    if(commit == NULL){
+        return NULL;
+    }
 
-            parent->child_commits = (struct Commit*)realloc(parent->child_commits, sizeof(struct Commit)*(num_child+1));
-        
-            // Check if any of the child_commits are branch_ptrs
-            // And update the branch_ptrs if they were
+    struct CommitBody* body = commit_body(system, commit);
 
-            for(int i = 0; i < system->num_branches; i++){
+    // The head commit is the parent, merges also record the merged branch
+    struct Commit* parent2 = NULL;
 
-                for(int j = 0; j < num_child; j++){
+    if(system->merge_branch != (size_t)-1){
+        parent2 = system->branch_ptrs[system->merge_branch];
+    }
 
-                    if(system->branch_ptrs[i] == child_pointers[j]){
-                        // Child j is a branch_ptr for branch i
-                        // Update the branch_ptrs to point at the new position
-                        system->branch_ptrs[i] = &parent->child_commits[j];
+    commit_set_parents(commit, system->head_commit, parent2);
 
-                    }
+    commit->branch_id = branch;
 
-                }
+    // Make the current commit as the new head commit
+    system->head_commit = commit;
 
-            }
+    // update all fields of the commit struct
 
+    body->message = arena_strdup(system->arena, message);
 
-            free(child_pointers);
+    body->tree = snapshot;
 
+    commit->id = get_commit_id(system->arena, body->message, changes, num_changes);
 
-        }
+    body->changes = changes;
 
-        // Store the new commit as a child for the head_commit
-        commit = &parent->child_commits[parent->num_childs];
-        parent->num_childs++;
+    body->num_changes = num_changes;
 
-        // Store the current head commit as the parent of our new commit
-        commit->parent_commit = parent;
-        commit->num_parents = 1;
+    commit_index_add(system, commit);
 
-        // Make the current commit as the new head commit
-        system->head_commit = commit;
+    // Update branch ptr for this branch
+    system->branch_ptrs[branch] = commit;
 
-        commit->branch_id = branch;
-        
+    if(system->repo != NULL){
+        repo_write_commit(system, commit);
+        repo_save_stage(system, branch);
+        repo_save_state(system);
     }
 
-    // Begin common set up despite status of initial commit
-    // update all fields of the commit struct
-
-    commit->message = strdup(message);
+    stats_bump(&system->stats->commits, 1);
 
-    commit->files = (struct File*)malloc(sizeof(struct File)*system->num_files[branch]);
+    return commit->id;
+}
 
-    memcpy(commit->files, system->files[branch], sizeof(struct File)*system->num_files[branch]);
+// Order print_commit lists changes in
+// Case insensitive first, ties broken by case
+int compare_paths(const char* a, const char* b){
 
-    commit->num_files = system->num_files[branch];
+    int order = strcasecmp(a, b);
 
-    // String duplicate all filenames across
-    for(int i = 0; i < commit->num_files; i++){
-        commit->files[i].file_name = strdup(system->files[branch][i].file_name);
-        commit->files[i].hash = hash_file(system, commit->files[i].file_name);
+    if(order != 0){
+        return order;
     }
 
-    commit->child_commits = NULL;
-
-    commit->num_childs = 0;
+    return strcmp(a, b);
 
-    commit->id = get_commit_id(commit, changes, num_changes);
-
-    commit->changes = changes;
+}
 
-    commit->num_changes = num_changes;
+int compare_file_ptrs(const void* a, const void* b){
 
-    // Update branch ptr for this branch
-    system->branch_ptrs[branch] = commit;
+    return compare_paths((*(struct File* const*)a)->file_name, (*(struct File* const*)b)->file_name);
 
-    return commit->id;
 }
 
-// Reorder the struct Changes array into alphabetical order
-void sort_changes(struct Changes* changes, size_t num_changes){
-    
-    // Perform bubble sort
-    bool sorted = false;
+int compare_changes(const void* a, const void* b){
 
-    while(!sorted){
+    return compare_paths(((const struct Changes*)a)->file_name, ((const struct Changes*)b)->file_name);
 
-        sorted = true;
+}
 
-        for(size_t i = 0; i < num_changes - 1; i++){
+// Append one entry to a growing changes array
+void append_change(struct System* system, struct Changes** changes, size_t* change_count, size_t* change_cap, int path_id, int type, int prev_hash, int new_hash){
 
-            if(strcasecmp(changes[i].file_name, changes[i+1].file_name) > 0){
-                sorted = false;
+    if(*change_count == *change_cap){
+        *change_cap = *change_cap*2;
+        *changes = (struct Changes*)realloc(*changes, sizeof(struct Changes)*(*change_cap));
+    }
 
-                // Swap their positions
-                struct Changes temp;
-                memcpy(&temp, &changes[i], sizeof(struct Changes));
-                memcpy(&changes[i], &changes[i+1], sizeof(struct Changes));
-                memcpy(&changes[i+1], &temp, sizeof(struct Changes));
+    struct Changes* change = &(*changes)[*change_count];
+    change->path_id = path_id;
+    change->file_name = path_string(system, path_id);
+    change->addition = type == CHANGE_ADDITION;
+    change->deletion = type == CHANGE_DELETION;
+    change->modification = type == CHANGE_MODIFICATION;
+    change->prev_hash = prev_hash;
+    change->new_hash = new_hash;
 
-            }
+    (*change_count)++;
 
+}
 
-        }
+// Head snapshot file that is no longer staged
+void note_deletion(void* context, const struct File* file){
 
+    struct DeletionWalk* walk = (struct DeletionWalk*)context;
 
+    if(path_index_find(walk->system, walk->branch, file->path_id) != -1){
+        return;
     }
 
+    if(walk->changes != NULL){
+        append_change(walk->system, walk->changes, walk->num_changes, walk->cap_changes, file->path_id, CHANGE_DELETION, 0, 0);
+    } else if(walk->first == NULL || compare_paths(file->file_name, walk->first) < 0){
+        walk->first = file->file_name;
+    }
 
 }
 
 // Detect changes between head commit and current state of the system on the active branch
-struct Changes* detect_changes(struct System* system, size_t* num_changes){
+// Each staged file is looked up in the head snapshot, which is only walked
+// in full when some of its files are no longer staged
+// snapshot is set to the head snapshot with only the differing paths replaced
+struct Changes* detect_changes(struct System* system, size_t* num_changes, struct TreeNode** snapshot){
 
     int branch = system->active_branch_id;
 
-    struct Changes* changes = (struct Changes*)malloc(sizeof(struct Changes));
-
     size_t change_count = 0;
+    size_t change_cap = 1;
+    struct Changes* changes = (struct Changes*)malloc(sizeof(struct Changes)*change_cap);
 
     // If the head_commit is null, that should mean this is the first commit
-    // Therefore all current files are new, and no deletion and modifications needs to be checked
-    if(system->head_commit == NULL){
-        
-        int num_checks = system->num_files[branch];
-
-        int check_count = 0;
-
-        int index = 0;
-
-        while(check_count < num_checks){
-
-            // Check if file still exists
-            FILE* file_check = fopen(system->files[branch][index].file_name, "rb");
-
-            if(file_check != NULL){
-
-                // File still exists
-
-                // Append into name and change into changes array
-                changes = (struct Changes*)realloc(changes, (change_count+1) * sizeof(struct Changes));
-                changes[change_count].file_name = strdup(system->files[branch][index].file_name);
-                changes[change_count].deletion = false;
-                changes[change_count].addition = true;
-                changes[change_count].modification = false;
-                change_count++;
-                
-                index++;
-
-                check_count++;
-
-                fclose(file_check);
-
-            } else {
-                // File has been removed oustide of SVC
+    // Therefore all current files are new
+    struct TreeNode* head = NULL;
 
-                // Remove file from svc system
-                svc_rm(system, system->files[branch][index].file_name);
-
-                check_count++;
+    if(system->head_commit != NULL){
+        head = commit_load(system, system->head_commit)->tree;
+    }
 
-            }
+    struct File* stage = branch_files(system, branch);
+    size_t num_stage = system->num_files[branch];
 
+    // Read and hash every tracked file up front, possibly in parallel
+    struct ScanResult* scanned = scan_tracked_files(system, stage, num_stage);
 
+    // Files that were removed outside of svc are dropped after the walk
+    size_t num_missing = 0;
+    size_t* missing = (size_t*)malloc(sizeof(size_t)*(num_stage + 1));
 
-        }
+    size_t num_matched = 0;
+    struct TreeNode* tree = head;
 
+    for(size_t s = 0; s < num_stage; s++){
 
-        memcpy(num_changes, &change_count, sizeof(size_t));
+        const struct File* tracked = tree_find(system, head, stage[s].file_name);
+        struct ScanResult* result = &scanned[s];
 
-        // If there is more than 1 change, sort the array
-        if(change_count > 1){
-            sort_changes(changes, change_count);
+        if(tracked != NULL){
+            num_matched++;
         }
 
-        return changes;
-
-    }
-
-
-    // If the head commit was not null
-    // This indicates that this is not the first commit
-    // Perform checks for the file against the head commit
+        if(result->hash == -2){
 
-    // Detect removals from svc
-    for(int i = 0; i < system->head_commit->num_files; i++){
-
-        bool file_found = false;
-
-        for(int j = 0; j < system->num_files[branch]; j++){
-
-            if(strcmp(system->files[branch][j].file_name, system->head_commit->files[i].file_name) == 0){
-                // Found equivalent
-                file_found = true;
-                break;
+            if(tracked != NULL){
+                // A force removal has occured
+                append_change(system, &changes, &change_count, &change_cap, stage[s].path_id, CHANGE_DELETION, 0, 0);
+                tree = tree_remove(system, tree, stage[s].file_name);
             }
 
-
+            // File has been removed manually
+            missing[num_missing++] = s;
+            continue;
         }
 
-        if(!file_found){
-            // A deletion has occured
-            // Append into name and change into changes array
-            changes = (struct Changes*)realloc(changes, (change_count+1) * sizeof(struct Changes));
-            changes[change_count].file_name = strdup(system->head_commit->files[i].file_name);
-            changes[change_count].deletion = true;
-            changes[change_count].addition = false;
-            changes[change_count].modification = false;
-            change_count++;
-
+        if(tracked == NULL){
+            // Added since the head commit
+            append_change(system, &changes, &change_count, &change_cap, stage[s].path_id, CHANGE_ADDITION, 0, 0);
+        } else if(result->hash != (int)tracked->hash){
+            // Found modified file
+            append_change(system, &changes, &change_count, &change_cap, stage[s].path_id, CHANGE_MODIFICATION, (int)tracked->hash, result->hash);
         }
 
+        // Store this version of the file into the system
+        apply_scan_result(system, &stage[s], result);
 
-    }
-
-    // Detect removal outside svc
-
-    for(int m = 0; m < system->head_commit->num_files; m++){
-        
-        FILE* file_check = fopen(system->head_commit->files[m].file_name, "rb");
-
-        if(file_check == NULL){
-
-            // A force removal has occured
-            // Add this as a change
-            changes = (struct Changes*)realloc(changes, (change_count+1) * sizeof(struct Changes));
-            changes[change_count].file_name = strdup(system->head_commit->files[m].file_name);
-            changes[change_count].deletion = true;
-            changes[change_count].addition = false;
-            changes[change_count].modification = false;
-            change_count++;
-
-            svc_rm(system, system->head_commit->files[m].file_name);
-
-        } else {
-            fclose(file_check);
+        // Files staged again since the head commit moved in staging order
+        if(tracked == NULL || tracked->fc_index != stage[s].fc_index || tracked->hash != stage[s].hash || tracked->order != stage[s].order){
+            tree = tree_set(system, tree, &stage[s]);
         }
 
-
     }
 
+    // Tracked by the head commit but removed from svc
+    if(num_matched < tree_num_files(head)){
 
-    // Detect additions
-    for(int i = 0; i < system->num_files[branch]; i++){
-
-        bool file_found = false;
-
-        for(int j = 0; j < system->head_commit->num_files; j++){
-
-            if(strcmp(system->files[branch][i].file_name, system->head_commit->files[j].file_name) == 0){
-                // Found equivalent
-                file_found = true;
-                break;
-            }
-
-
-        }
-
-        if(!file_found){
-            // An addition has occured
-            //Check if file still exists
-            FILE* file_check = fopen(system->files[branch][i].file_name,"rb");
-
-            if(file_check != NULL){
-
-                // File still exists
-
-                // Append into name and change into changes array
-                changes = (struct Changes*)realloc(changes, (change_count+1) * sizeof(struct Changes));
-                changes[change_count].file_name = strdup(system->files[branch][i].file_name);
-                changes[change_count].deletion = false;
-                changes[change_count].addition = true;
-                changes[change_count].modification = false;
-                change_count++;
-
-                int hash_check = hash_file(system, system->files[branch][i].file_name);
-
-                // Check whether content has been updated since added
-                if(system->files[branch][i].hash != hash_check){
-                    // The file has been changed since added
-                    // Store this version of the file into the system
-                    FILE* file = fopen(system->files[branch][i].file_name, "rb");
-                    // Update the pointer to file content in the system
-                    system->files[branch][i].fc_index = store_content(system, file);
-                    system->files[branch][i].fc_length = num_bytes(file);
-                    fclose(file);
-                    // Store the new hash into the file
-                    system->files[branch][i].hash = hash_check;
-                }
-
-                fclose(file_check);
-
-            } else {
-                // File has been removed manually
-                // Remove file from svc system
-                svc_rm(system, system->files[branch][i].file_name);
-
-            }
-
+        size_t first = change_count;
+        struct DeletionWalk walk = {system, branch, &changes, &change_count, &change_cap, NULL};
+        tree_walk(head, note_deletion, &walk);
 
+        for(size_t c = first; c < change_count; c++){
+            tree = tree_remove(system, tree, changes[c].file_name);
         }
-
-
     }
 
-    // Detect modifications
-    for(int i = 0; i < system->num_files[branch]; i++){
-
-        // bool modified = false;
-
-        for(int j = 0; j < system->head_commit->num_files; j++){
-
-            if(strcmp(system->files[branch][i].file_name, system->head_commit->files[j].file_name) == 0){
-                // Found file with the same name
-                
-                int system_hash = hash_file(system, system->files[branch][i].file_name);
-                int head_hash = system->head_commit->files[j].hash;
-
-
-                if(system_hash != head_hash){
-                    // Found modified file
-                    
-                    changes = (struct Changes*)realloc(changes, (change_count+1) * sizeof(struct Changes));
-                    changes[change_count].file_name = strdup(system->head_commit->files[j].file_name);
-                    changes[change_count].deletion = false;
-                    changes[change_count].addition = false;
-                    changes[change_count].modification = true;
-
-                    changes[change_count].prev_hash = head_hash;
-                    changes[change_count].new_hash = system_hash;
-
-                    change_count++;
-
-                    // Store this version of the file into the system
-                    FILE* file = fopen(system->files[branch][i].file_name, "rb");
-                    // Update the pointer to file content in the system
-                    system->files[branch][i].fc_index = store_content(system, file);
-                    system->files[branch][i].fc_length = num_bytes(file);
-                    fclose(file);
-
-                    // Store the new hash into the file
-                    system->files[branch][i].hash = system_hash;
-
-                }
-            }
-
-
-        }
-
+    free_scan_results(scanned, num_stage);
 
+    for(size_t m = 0; m < num_missing; m++){
+        remove_file_at(system, branch, missing[m]);
     }
 
+    free(missing);
 
-    memcpy(num_changes, &change_count, sizeof(size_t));
+    qsort(changes, change_count, sizeof(struct Changes), compare_changes);
 
-    if(change_count > 1){
-        sort_changes(changes, change_count);
-    }
+    *num_changes = change_count;
+    *snapshot = tree;
 
     return changes;
 
-
-
 }
 
-
 // Perform hash algorithm as prescribed
-char* get_commit_id(struct Commit* commit, struct Changes* changes, size_t num_changes){
+char* get_commit_id(struct Arena* arena, char* message, struct Changes* changes, size_t num_changes){
 
-    char* hex_id = (char*)malloc(7);
+    char* hex_id = (char*)arena_alloc(arena, 7);
 
     int id = 0;
 
-    for(int i = 0; i < strlen(commit->message); i++){
-        id = (id + commit->message[i]) % 1000;
+    for(int i = 0; i < strlen(message); i++){
+        id = (id + message[i]) % 1000;
     }
 
 
@@ -684,58 +624,55 @@ char* get_commit_id(struct Commit* commit, struct Changes* changes, size_t num_c
 void *get_commit(void *helper, char *commit_id) {
 
     struct System* system = (struct System*)helper;
+
+    TRACE_CALL(system, TRACE_GET_COMMIT){
+        trace_commit_id(system, commit_id);
+        trace_call_run(&trace_call);
+    }
     
-    if(commit_id == NULL || system->initial_commit == NULL){
+    if(commit_id == NULL || system->num_commits == 0){
         return NULL;
     }
 
-    // Perform post order recursion on the commit tree
-
-    struct Queue* queue = createQueue(MAX_QUEUE_SIZE);
-
-    struct Commit* result = NULL;
-
-    enqueue(queue, system->initial_commit);
-
-    while(!isEmpty(queue)){
-
-        struct Commit* cursor = dequeue(queue);
-
-        // Looking for a matching commit id
-        if(strcmp(cursor->id, commit_id) == 0){
-            // Found a commit with matching id
-            result = cursor;
-            break;
-        } else {
-            // The current cursor does not match
-            for(int i = 0; i < cursor->num_childs; i++){
-                enqueue(queue, &(cursor->child_commits[i]));
-            }
+    // Constant time lookup in the commit index
+    return commit_index_find(system, commit_id);
+}
 
+// Retrieve pointer to the only commit whose id starts with id_prefix
+// Returns NULL if no commit or several commits match
+void *svc_resolve_commit(void *helper, char *id_prefix) {
 
-        }
+    struct System* system = (struct System*)helper;
 
+    TRACE_CALL(system, TRACE_RESOLVE_COMMIT){
+        trace_commit_id(system, id_prefix);
+        trace_call_run(&trace_call);
     }
 
-    
-    if(result == NULL){
-        // Given ID does not exist
-        
-        freeQueue(queue);
-
+    if(id_prefix == NULL || id_prefix[0] == '\0' || system->num_commits == 0){
         return NULL;
     }
 
+    // An exact id wins even if it is also the prefix of a longer id
+    struct Commit* commit = commit_index_find(system, id_prefix);
 
-    freeQueue(queue);
-
+    if(commit != NULL){
+        return commit;
+    }
 
-    return result;
+    return commit_index_resolve(system, id_prefix);
 }
 
 // Retrieve the immediate parents
 char **get_prev_commits(void *helper, void *commit, int *n_prev) {
 
+    struct System* system = (struct System*)helper;
+
+    TRACE_CALL(system, TRACE_PREV_COMMITS){
+        trace_handle(system->trace, commit);
+        trace_call_run(&trace_call);
+    }
+
     struct Commit* com = (struct Commit*)commit;
 
     if(n_prev == NULL){
@@ -757,47 +694,361 @@ char **get_prev_commits(void *helper, void *commit, int *n_prev) {
 
     *n_prev = com->num_parents;
 
-    if(com->num_parents == 1){
-        prev_commits[0] = com->parent_commit->id;
-    } else if (com->num_parents == 2){
-        prev_commits[0] = com->parent_commit->id;
-        prev_commits[1] = com->parent_commit2->id;
+    for(size_t k = 0; k < com->num_parents; k++){
+        prev_commits[k] = commit_parent(system, com, k)->id;
     }
 
     return prev_commits;
 }
 
-// Print out relevant info for the commit
-void print_commit(void *helper, char *commit_id) {
-
+// Commit at the head of branch_name, NULL if it has no commits yet
+void *svc_branch_head(void *helper, char *branch_name) {
 
     struct System* system = (struct System*)helper;
 
-    if(commit_id == NULL){
-        printf("Invalid commit id\n");
-        return;
+    TRACE_CALL(system, TRACE_BRANCH_HEAD){
+        trace_string(system->trace, TRACE_KIND_NAME, branch_name);
+        trace_call_run(&trace_call);
     }
 
-    struct Commit* commit = get_commit(helper, commit_id);
+    if(branch_name == NULL){
+        return NULL;
+    }
+
+    size_t branch = find_branch(system, branch_name);
+
+    if(branch == (size_t)-1){
+        return NULL;
+    }
+
+    return system->branch_ptrs[branch];
+}
+
+// 1 if ancestor is commit or one of its ancestors, 0 if not
+// Returns -1 if either commit is NULL
+int svc_is_ancestor(void *helper, void *ancestor, void *commit) {
+
+    struct System* system = (struct System*)helper;
+
+    TRACE_CALL(system, TRACE_IS_ANCESTOR){
+        trace_handle(system->trace, ancestor);
+        trace_handle(system->trace, commit);
+        trace_call_run(&trace_call);
+    }
+
+    if(ancestor == NULL || commit == NULL){
+        return -1;
+    }
+
+    return commit_is_ancestor(system, (struct Commit*)ancestor, (struct Commit*)commit);
+}
+
+// Lowest common ancestor of two commits
+// Returns NULL if either is NULL or their histories never meet
+void *svc_merge_base(void *helper, void *commit_a, void *commit_b) {
+
+    struct System* system = (struct System*)helper;
+
+    TRACE_CALL(system, TRACE_MERGE_BASE){
+        trace_handle(system->trace, commit_a);
+        trace_handle(system->trace, commit_b);
+        trace_call_run(&trace_call);
+    }
+
+    return merge_base(system, (struct Commit*)commit_a, (struct Commit*)commit_b);
+}
+
+// Number of commits reachable from to but not from from, as in from..to
+// A NULL from counts all of to's history
+// Returns -1 if to is NULL
+int svc_count_between(void *helper, void *from, void *to) {
+
+    struct System* system = (struct System*)helper;
+
+    TRACE_CALL(system, TRACE_COUNT_BETWEEN){
+        trace_handle(system->trace, from);
+        trace_handle(system->trace, to);
+        trace_call_run(&trace_call);
+    }
+
+    if(to == NULL){
+        return -1;
+    }
+
+    return (int)count_between(system, (struct Commit*)from, (struct Commit*)to);
+}
+
+// Record a path whose content differs between the two snapshots of a diff
+void diff_step(void* context, const struct File* old_file, const struct File* new_file){
+
+    if(old_file != NULL && new_file != NULL && old_file->fc_index == new_file->fc_index){
+        return;
+    }
+
+    append_step((struct CheckoutPlan*)context, old_file, new_file);
+
+}
+
+// Unified diff of the files that differ from old_commit to new_commit
+// A NULL old_commit diffs against an empty snapshot
+// Like snprintf, at most buffer_size bytes are written including the
+// terminator, and the length of the whole diff is returned
+// Returns -1 if new_commit is NULL
+long svc_diff(void *helper, void *old_commit, void *new_commit, char *buffer, size_t buffer_size) {
+
+    struct System* system = (struct System*)helper;
+
+    TRACE_CALL(system, TRACE_DIFF){
+        trace_handle(system->trace, old_commit);
+        trace_handle(system->trace, new_commit);
+        trace_buffer(system->trace, buffer, buffer_size);
+        trace_call_run(&trace_call);
+    }
+
+    if(new_commit == NULL || (buffer == NULL && buffer_size > 0)){
+        return -1;
+    }
+
+    struct CommitBody* old_body = old_commit == NULL ? NULL : commit_load(system, (struct Commit*)old_commit);
+    struct CommitBody* new_body = commit_load(system, (struct Commit*)new_commit);
+
+    struct CheckoutPlan plan = {system, system->active_branch_id, NULL, 0, 0};
+
+    tree_diff(old_body == NULL ? NULL : old_body->tree, new_body->tree, diff_step, &plan);
+
+    if(plan.num_steps > 0){
+        qsort(plan.steps, plan.num_steps, sizeof(struct CheckoutStep), compare_steps);
+    }
+
+    struct DiffWriter out = {buffer, buffer_size, 0};
+
+    for(size_t i = 0; i < plan.num_steps; i++){
+
+        const struct File* old_file = plan.steps[i].old_file;
+        const struct File* new_file = plan.steps[i].new_file;
+
+        const char* old = old_file == NULL ? "" : blob_content(system, old_file->fc_index);
+        const char* new = new_file == NULL ? "" : blob_content(system, new_file->fc_index);
+
+        diff_unified(&out,
+            old_file == NULL ? NULL : old_file->file_name, old, old_file == NULL ? 0 : old_file->fc_length,
+            new_file == NULL ? NULL : new_file->file_name, new, new_file == NULL ? 0 : new_file->fc_length);
+    }
+
+    free(plan.steps);
+
+    diff_write_end(&out);
+
+    return (long)out.length;
+}
+
+// Head snapshot file that is no longer staged, shown as deleted
+void diff_unstaged(void* context, const struct File* file){
+
+    struct CheckoutPlan* plan = (struct CheckoutPlan*)context;
+
+    if(path_index_find(plan->system, plan->branch, file->path_id) == -1){
+        append_step(plan, file, NULL);
+    }
+
+}
+
+// Unified diff of the working copy against the active head, over the
+// files staged on the active branch and the head files no longer staged
+// Files whose trusted stat shows they still hold the head content are
+// never read. Output is written as for svc_diff
+long svc_diff_working(void *helper, char *buffer, size_t buffer_size) {
+
+    struct System* system = (struct System*)helper;
+
+    TRACE_CALL(system, TRACE_DIFF_WORKING){
+        trace_buffer(system->trace, buffer, buffer_size);
+        trace_sync_staged(system);
+        trace_call_run(&trace_call);
+    }
+
+    if(buffer == NULL && buffer_size > 0){
+        return -1;
+    }
+
+    size_t branch = system->active_branch_id;
+    struct CommitBody* head = system->head_commit == NULL ? NULL : commit_load(system, system->head_commit);
+    struct TreeNode* tree = head == NULL ? NULL : head->tree;
+
+    struct CheckoutPlan plan = {system, branch, NULL, 0, 0};
+
+    for(size_t i = 0; i < system->num_files[branch]; i++){
+
+        struct File* file = &system->files[branch][i];
+
+        if(file->file_name == NULL){
+            continue;
+        }
+
+        const struct File* old_file = tree_find(system, tree, file->file_name);
+
+        struct stat st;
+
+        if(old_file != NULL && old_file->fc_index == file->fc_index && stat(file->file_name, &st) == 0 && stat_cache_fresh(file, &st)){
+            continue;
+        }
+
+        append_step(&plan, old_file, file);
+    }
+
+    tree_walk(tree, diff_unstaged, &plan);
+
+    if(plan.num_steps > 0){
+        qsort(plan.steps, plan.num_steps, sizeof(struct CheckoutStep), compare_steps);
+    }
+
+    struct DiffWriter out = {buffer, buffer_size, 0};
+
+    for(size_t i = 0; i < plan.num_steps; i++){
+
+        const struct File* old_file = plan.steps[i].old_file;
+        const struct File* new_file = plan.steps[i].new_file;
+
+        const char* old = old_file == NULL ? "" : blob_content(system, old_file->fc_index);
+        size_t old_length = old_file == NULL ? 0 : old_file->fc_length;
+
+        // A staged file missing from disk is shown as deleted
+        struct FileView view;
+        view.data = "";
+        view.size = 0;
+        view.mapped = false;
+
+        if(new_file != NULL && stats_view_open(system->stats, new_file->file_name, &view, &system->scratch, &system->scratch_cap) != 0){
+            new_file = NULL;
+        }
+
+        bool same = old_file == NULL ? new_file == NULL
+            : new_file != NULL && view.size == old_length && memcmp(view.data, old, old_length) == 0;
+
+        if(!same){
+            diff_unified(&out,
+                old_file == NULL ? NULL : old_file->file_name, old, old_length,
+                new_file == NULL ? NULL : new_file->file_name, view.data, view.size);
+        }
+
+        file_view_close(&view);
+    }
+
+    free(plan.steps);
+
+    diff_write_end(&out);
+
+    return (long)out.length;
+}
+
+// Walk the history of commit, see svc_log_options, NULL options for
+// every commit in date order. Returns NULL if commit is NULL
+svc_log *svc_log_open(void *helper, void *commit, const svc_log_options *options) {
+
+    struct System* system = (struct System*)helper;
+    uint32_t trace_id = 0;
+
+    TRACE_CALL(system, TRACE_LOG_OPEN){
+        trace_handle(system->trace, commit);
+        trace_log_options(system->trace, options);
+        trace_id = system->trace->num_logs++;
+        trace_call_run(&trace_call);
+    }
+
+    if(commit == NULL){
+        return NULL;
+    }
+
+    svc_log* log = log_open(system, (struct Commit*)commit, options);
+
+    log->trace_id = trace_id;
+
+    return log;
+}
+
+// Fill entry with the next commit of the log, nothing is allocated
+// Returns 1 if there was one, 0 once the log is done
+int svc_log_next(svc_log *log, svc_log_entry *entry) {
+
+    if(log == NULL || entry == NULL){
+        return 0;
+    }
+
+    TRACE_CALL(log->system, TRACE_LOG_NEXT){
+        trace_put_varint(log->system->trace->out, log->trace_id);
+        trace_call_run(&trace_call);
+    }
+
+    struct Commit* commit = log_next(log);
+
+    if(commit == NULL){
+        return 0;
+    }
+
+    struct System* system = log->system;
+
+    entry->commit = commit;
+    entry->id = commit->id;
+    entry->message = commit_load_changes(system, commit)->message;
+    entry->branch = system->branches[commit->branch_id];
+    entry->n_parents = commit->num_parents;
+    entry->parents[0] = commit_parent(system, commit, 0);
+    entry->parents[1] = commit_parent(system, commit, 1);
+
+    return 1;
+}
+
+void svc_log_close(svc_log *log) {
+
+    if(log != NULL){
+
+        TRACE_CALL(log->system, TRACE_LOG_CLOSE){
+            trace_put_varint(log->system->trace->out, log->trace_id);
+            trace_call_run(&trace_call);
+        }
+
+        log_close(log);
+    }
+}
+
+// Print out relevant info for the commit
+void print_commit(void *helper, char *commit_id) {
+
+
+    struct System* system = (struct System*)helper;
+
+    TRACE_CALL(system, TRACE_PRINT_COMMIT){
+        trace_commit_id(system, commit_id);
+        trace_call_run(&trace_call);
+    }
+
+    if(commit_id == NULL){
+        printf("Invalid commit id\n");
+        return;
+    }
+
+    struct Commit* commit = get_commit(helper, commit_id);
     
     if(commit == NULL){
         printf("Invalid commit id\n");
         return;
     }
 
+    struct CommitBody* body = commit_load(system, commit);
+
     // Print commit information
-    printf("%s [%s]: %s\n", commit->id, system->branches[commit->branch_id], commit->message);
+    printf("%s [%s]: %s\n", commit->id, system->branches[commit->branch_id], body->message);
 
-    for(int i = 0; i < commit->num_changes; i++){
+    for(int i = 0; i < body->num_changes; i++){
 
         printf("    ");
 
-        if(commit->changes[i].addition){
-            printf("+ %s\n", commit->changes[i].file_name);
-        } else if (commit->changes[i].deletion){
-            printf("- %s\n", commit->changes[i].file_name);  
-        } else if (commit->changes[i].modification){
-            printf("/ %s [% 10d -> % 10d]\n", commit->changes[i].file_name, commit->changes[i].prev_hash, commit->changes[i].new_hash);
+        if(body->changes[i].addition){
+            printf("+ %s\n", body->changes[i].file_name);
+        } else if (body->changes[i].deletion){
+            printf("- %s\n", body->changes[i].file_name);  
+        } else if (body->changes[i].modification){
+            printf("/ %s [% 10d -> % 10d]\n", body->changes[i].file_name, body->changes[i].prev_hash, body->changes[i].new_hash);
         }
 
 
@@ -807,12 +1058,16 @@ void print_commit(void *helper, char *commit_id) {
 
     // Print tracked files
     printf("    ");
-    printf("Tracked files (%zu):\n", commit->num_files);
-    for(int j = 0; j < commit->num_files; j++){
+    size_t num_files = tree_num_files(body->tree);
+    const struct File** files = tree_list_files(body->tree);
+
+    printf("Tracked files (%zu):\n", num_files);
+    for(size_t j = 0; j < num_files; j++){
         printf("    ");
-        printf("[% 10ld] %s\n", commit->files[j].hash, commit->files[j].file_name);
+        printf("[% 10ld] %s\n", files[j]->hash, files[j]->file_name);
     }
 
+    free(files);
 
 
 
@@ -824,6 +1079,11 @@ int svc_branch(void *helper, char *branch_name) {
 
     struct System* system = (struct System*)helper;
 
+    TRACE_CALL(system, TRACE_BRANCH){
+        trace_string(system->trace, TRACE_KIND_NAME, branch_name);
+        trace_call_run(&trace_call);
+    }
+
     if(branch_name == NULL){
         return -1;
     }
@@ -835,11 +1095,8 @@ int svc_branch(void *helper, char *branch_name) {
         return -1;
     }
 
-    for(int i = 0; i < system->num_branches; i++){
-
-        if(strcmp(system->branches[i], branch_name) == 0){
-            return -2;
-        }
+    if(find_branch(system, branch_name) != (size_t)-1){
+        return -2;
     }
 
     int made_changes = check_uncommitted_changes(system);
@@ -851,6 +1108,8 @@ int svc_branch(void *helper, char *branch_name) {
 
     int branch = system->active_branch_id;
 
+    branch_files(system, branch);
+
     // Can begin branching at this point
     system->num_branches++;
     
@@ -862,22 +1121,24 @@ int svc_branch(void *helper, char *branch_name) {
     system->files[system->num_branches -1] = (struct File*)malloc(sizeof(struct File)*system->cap_files[branch]);
     system->num_files = (size_t*)realloc(system->num_files, sizeof(size_t)*system->num_branches);
     system->cap_files = (size_t*)realloc(system->cap_files, sizeof(size_t)*system->num_branches);
+    system->file_index = (struct PathIndex*)realloc(system->file_index, sizeof(struct PathIndex)*system->num_branches);
+    system->num_dead = (size_t*)realloc(system->num_dead, sizeof(size_t)*system->num_branches);
 
     // Copy all the content over into the new branch
-    memcpy(system->files[b_idx], system->files[branch], sizeof(struct File*)*system->num_files[branch]);
+    memcpy(system->files[b_idx], system->files[branch], sizeof(struct File)*system->num_files[branch]);
     memcpy(&system->num_files[b_idx], &system->num_files[branch], sizeof(size_t));
     memcpy(&system->cap_files[b_idx], &system->cap_files[branch], sizeof(size_t));
     
     for(int j = 0; j < system->num_files[branch]; j++){
 
-        system->files[b_idx][j].file_name = strdup(system->files[branch][j].file_name);
-        system->files[b_idx][j].hash = system->files[branch][j].hash;
-        system->files[b_idx][j].fc_index = system->files[branch][j].fc_index;
-        system->files[b_idx][j].fc_length = system->files[branch][j].fc_length;
+        // Paths are interned, so only the blobs need another reference
+        blob_retain(system, system->files[b_idx][j].fc_index);
 
 
     }
 
+    path_index_create(system, b_idx);
+
 
     // Alloate space for new branch_ptrs
     system->branch_ptrs = (struct Commit**)realloc(system->branch_ptrs, sizeof(struct Commit*)*system->num_branches);
@@ -886,7 +1147,15 @@ int svc_branch(void *helper, char *branch_name) {
 
     // Allocate space for new branch name
     system->branches = (char**)realloc(system->branches, sizeof(char*)*system->num_branches);
-    system->branches[system->num_branches - 1] = strdup(branch_name);
+    system->branches[system->num_branches - 1] = arena_strdup(system->arena, branch_name);
+
+    if(system->repo != NULL){
+        repo_save_stage(system, branch);
+        repo_save_stage(system, b_idx);
+        repo_save_state(system);
+    }
+
+    stats_bump(&system->stats->branches, 1);
 
     return 0;
 }
@@ -921,6 +1190,7 @@ int check_validity(char* name){
 // Return 0 if there are no changes
 int check_uncommitted_changes(struct System* system){
 
+    SPAN(system->spans, "check_uncommitted_changes");
 
     int branch = system->active_branch_id;
 
@@ -933,448 +1203,1130 @@ int check_uncommitted_changes(struct System* system){
 
     }
 
+    struct TreeNode* head = commit_load(system, system->head_commit)->tree;
 
-    // Detect removals from svc
-    for(int i = 0; i < system->head_commit->num_files; i++){
+    struct File* stage = branch_files(system, branch);
+    size_t num_stage = system->num_files[branch];
 
-        bool file_found = false;
+    // Files are checked in path order, stopping at the first change
+    // Files removed by hand are only dropped up to that point
+    struct File** sorted = (struct File**)malloc(sizeof(struct File*)*(num_stage + 1));
+    const struct File** tracked = (const struct File**)malloc(sizeof(struct File*)*(num_stage + 1));
+    size_t num_tracked = 0;
 
-        for(int j = 0; j < system->num_files[branch]; j++){
-
-            if(strcmp(system->files[branch][j].file_name, system->head_commit->files[i].file_name) == 0){
-                // Found equivalent
-                file_found = true;
-                break;
-            }
+    for(size_t s = 0; s < num_stage; s++){
 
+        sorted[s] = &stage[s];
+        tracked[s] = tree_find(system, head, stage[s].file_name);
 
+        if(tracked[s] != NULL){
+            num_tracked++;
         }
+    }
 
-        if(!file_found){
-            // A deletion has occured
-            // Append into name and change into changes array
-            return 1;
-        }
+    qsort(sorted, num_stage, sizeof(struct File*), compare_file_ptrs);
 
+    // Earliest head file that is no longer staged, only looked for when
+    // some head file was not matched
+    struct DeletionWalk walk = {system, branch, NULL, NULL, NULL, NULL};
 
+    if(num_tracked < tree_num_files(head)){
+        tree_walk(head, note_deletion, &walk);
     }
 
-    // Detect removal outside svc
+    size_t num_missing = 0;
+    size_t* missing = (size_t*)malloc(sizeof(size_t)*(num_stage + 1));
 
-    for(int m = 0; m < system->head_commit->num_files; m++){
-        
-        FILE* file_check = fopen(system->head_commit->files[m].file_name, "rb");
+    int made_changes = 0;
 
-        if(file_check == NULL){
+    for(size_t s = 0; !made_changes && s < num_stage; s++){
 
-            // A force removal has occured
-            return 1;
+        size_t index = sorted[s] - stage;
 
+        if(walk.first != NULL && compare_paths(walk.first, stage[index].file_name) < 0){
+            // A deletion has occured
+            made_changes = 1;
+            break;
+        }
+
+        if(tracked[index] == NULL){
+
+            // An addition has occured if the file still exists
+            struct stat st;
+
+            if(stat(stage[index].file_name, &st) == 0){
+                made_changes = 1;
+            } else {
+                // File has been removed manually
+                missing[num_missing++] = index;
+            }
 
         } else {
-            fclose(file_check);
+
+            // A force removal or a modification
+            if(tracked_file_hash(system, &stage[index]) != (int)tracked[index]->hash){
+                made_changes = 1;
+            }
         }
 
+    }
 
+    if(walk.first != NULL){
+        made_changes = 1;
     }
 
+    free(sorted);
+    free(tracked);
 
-    // Detect additions
-    for(int i = 0; i < system->num_files[branch]; i++){
+    // Remove files that were deleted outside svc from the system
+    for(size_t m = 0; m < num_missing; m++){
+        remove_file_at(system, branch, missing[m]);
+    }
 
-        bool file_found = false;
+    free(missing);
 
-        for(int j = 0; j < system->head_commit->num_files; j++){
+    return made_changes;
 
-            if(strcmp(system->files[branch][i].file_name, system->head_commit->files[j].file_name) == 0){
-                // Found equivalent
-                file_found = true;
-                break;
-            }
+}
+
+// Index of the branch called branch_name, or -1
+size_t find_branch(struct System* system, char* branch_name){
 
+    stats_bump(&system->stats->branch_lookups, 1);
 
+    for(size_t i = 0; i < system->num_branches; i++){
+
+        stats_bump(&system->stats->string_compares, 1);
+
+        if(strcmp(branch_name, system->branches[i]) == 0){
+            return i;
         }
 
-        if(!file_found){
-            // An addition has occured
-            // MARK: Check if file still exists
-            FILE* file_check = fopen(system->files[branch][i].file_name,"rb");
+    }
 
-            if(file_check != NULL){
+    return -1;
 
-                // File still exists
-                fclose(file_check);
+}
 
-                return 1;
-            } else {
+// Record a path whose file differs between the two heads of a checkout
+void checkout_step(void* context, const struct File* old_file, const struct File* new_file){
 
-                // File has been removed manually
-                // Remove file from svc system
-                svc_rm(system, system->files[branch][i].file_name);
+    struct CheckoutPlan* plan = (struct CheckoutPlan*)context;
 
-            }
+    if(old_file != NULL && new_file != NULL && old_file->fc_index == new_file->fc_index){
+        // Same content, only its place in staging order moved
+        return;
+    }
+
+    if(new_file == NULL && path_index_find(plan->system, plan->branch, old_file->path_id) != -1){
+        // Staged on the target branch, just not committed there yet
+        return;
+    }
 
+    append_step(plan, old_file, new_file);
 
-        }
+}
 
+void append_step(struct CheckoutPlan* plan, const struct File* old_file, const struct File* new_file){
 
+    if(plan->num_steps == plan->cap_steps){
+        plan->cap_steps = plan->cap_steps == 0 ? 16 : plan->cap_steps*2;
+        plan->steps = (struct CheckoutStep*)realloc(plan->steps, sizeof(struct CheckoutStep)*plan->cap_steps);
     }
 
-    // Detect modifications
-    for(int i = 0; i < system->num_files[branch]; i++){
+    plan->steps[plan->num_steps].old_file = old_file;
+    plan->steps[plan->num_steps].new_file = new_file;
+    plan->num_steps++;
 
-        // bool modified = false;
+}
+
+const char* step_path(const struct CheckoutStep* step){
 
-        for(int j = 0; j < system->head_commit->num_files; j++){
+    return step->new_file != NULL ? step->new_file->file_name : step->old_file->file_name;
 
-            if(strcmp(system->files[branch][i].file_name, system->head_commit->files[j].file_name) == 0){
-                // Found file with the same name
-                
-                int system_hash = hash_file(system, system->files[branch][i].file_name);
-                int head_hash = system->head_commit->files[j].hash;
+}
 
-                if(system_hash != head_hash){
-                    // Found modified file
+int compare_steps(const void* a, const void* b){
 
-                    return 1;
+    return compare_paths(step_path((const struct CheckoutStep*)a), step_path((const struct CheckoutStep*)b));
 
-                }
-            }
+}
 
+// Paths to write or delete to move the working copy from the active
+// head to the head of branch, found by diffing the two snapshots
+void plan_checkout(struct System* system, size_t branch, struct CheckoutPlan* plan){
 
-        }
+    SPAN(system->spans, "plan_checkout");
 
+    struct CommitBody* current = commit_load(system, system->head_commit);
+    struct CommitBody* target = commit_load(system, system->branch_ptrs[branch]);
 
+    // Files staged on the target branch are looked up, so they must be read
+    if(system->repo != NULL){
+        repo_load_stage(system, branch);
     }
 
+    plan->system = system;
+    plan->branch = branch;
+    plan->steps = NULL;
+    plan->num_steps = 0;
+    plan->cap_steps = 0;
 
+    tree_diff(current == NULL ? NULL : current->tree, target == NULL ? NULL : target->tree, checkout_step, plan);
 
-    return 0;
+    if(plan->num_steps > 0){
+        qsort(plan->steps, plan->num_steps, sizeof(struct CheckoutStep), compare_steps);
+    }
 
 }
 
-// Check out given branch name
-int svc_checkout(void *helper, char *branch_name) {
+// Create every missing directory above path
+void make_parent_dirs(const char* path){
 
+    char* prefix = strdup(path);
 
-    struct System* system = (struct System*)helper;
-
-    if(branch_name == NULL){
-        return -1;
+    for(char* slash = strchr(prefix, '/'); slash != NULL; slash = strchr(slash + 1, '/')){
+        *slash = '\0';
+        mkdir(prefix, 0755);
+        *slash = '/';
     }
 
-    // Check through all existing branches for matching branch name
-    size_t branch_id = -1;
-    for(size_t i = 0; i < system->num_branches; i++){
+    free(prefix);
 
-        if(strcmp(branch_name, system->branches[i]) == 0){
+}
+
+// Remove path, then any directories above it that are left empty
+void remove_file_and_dirs(const char* path){
+
+    if(remove(path) != 0){
+        return;
+    }
 
-            branch_id = i;
+    char* prefix = strdup(path);
+
+    for(char* slash = strrchr(prefix, '/'); slash != NULL; slash = strrchr(prefix, '/')){
+        *slash = '\0';
+        if(rmdir(prefix) != 0){
             break;
         }
+    }
+
+    free(prefix);
+
+}
+
+// Write a stored blob out to path
+// Returns -1 if the file can not be opened
+int write_blob(struct System* system, const char* path, int fc_index, int length){
+
+    SPAN(system->spans, "write_blob");
+
+    FILE* file = fopen(path, "w");
+
+    if(file == NULL){
+        make_parent_dirs(path);
+        file = fopen(path, "w");
+    }
+
+    if(file == NULL){
+        return -1;
+    }
+
+    fwrite(blob_content(system, fc_index), 1, length, file);
+    stats_bump(&system->stats->bytes_written, length);
+
+    fclose(file);
+
+    return 0;
+
+}
+
+// Check out given branch name
+int svc_checkout(void *helper, char *branch_name) {
+
+
+    struct System* system = (struct System*)helper;
+
+    TRACE_CALL(system, TRACE_CHECKOUT){
+        trace_string(system->trace, TRACE_KIND_NAME, branch_name);
+        trace_sync_staged(system);
+        trace_call_run(&trace_call);
+    }
+
+    if(branch_name == NULL){
+        return -1;
+    }
+
+    // Check through all existing branches for matching branch name
+    size_t branch_id = find_branch(system, branch_name);
+
+    if(branch_id == (size_t)-1){
+        // No branch with this name exists
+        return -1;
+    }
+
+    int made_changes = check_uncommitted_changes(system);
+
+    if(made_changes){
+        return -2;
+    }
+
+    // This branch exists without uncommitted changes
+    // Work out what differs before the heads are switched
+    struct CheckoutPlan plan;
+    plan_checkout(system, branch_id, &plan);
+
+    // The branch left is saved, its staging area may have changed while it was active
+    size_t left_branch = system->active_branch_id;
+
+    system->active_branch_id = branch_id;
+    system->head_commit = system->branch_ptrs[branch_id];
+
+    // Only files whose content differs between the two heads are written,
+    // and files tracked only by the branch being left are removed
+    struct Span writing = span_begin(system->spans, "write_files");
+
+    for(size_t i = 0; i < plan.num_steps; i++){
+
+        const struct File* old_file = plan.steps[i].old_file;
+        const struct File* new_file = plan.steps[i].new_file;
+
+        if(new_file == NULL){
+            remove_file_and_dirs(old_file->file_name);
+        } else {
+            write_blob(system, new_file->file_name, new_file->fc_index, new_file->fc_length);
+        }
+
+    }
+
+    span_end(&writing);
+
+    free(plan.steps);
+
+    if(system->repo != NULL){
+        repo_save_stage(system, left_branch);
+        repo_save_state(system);
+    }
+
+
+    return 0;
+}
+
+// Work svc_checkout would do for branch_name, without doing it
+// Returns the same errors as svc_checkout, the plan is only filled on 0
+int svc_plan_checkout(void *helper, char *branch_name, svc_checkout_plan *plan) {
+
+    struct System* system = (struct System*)helper;
+
+    TRACE_CALL(system, TRACE_PLAN_CHECKOUT){
+        trace_string(system->trace, TRACE_KIND_NAME, branch_name);
+        trace_sync_staged(system);
+        trace_call_run(&trace_call);
+    }
+
+    if(branch_name == NULL || plan == NULL){
+        return -1;
+    }
+
+    size_t branch_id = find_branch(system, branch_name);
+
+    if(branch_id == (size_t)-1){
+        return -1;
+    }
+
+    if(check_uncommitted_changes(system)){
+        return -2;
+    }
+
+    struct CheckoutPlan steps;
+    plan_checkout(system, branch_id, &steps);
+
+    plan->entries = (svc_plan_entry*)malloc(sizeof(svc_plan_entry)*(steps.num_steps + 1));
+    plan->n_entries = steps.num_steps;
+    plan->bytes = 0;
+
+    for(size_t i = 0; i < steps.num_steps; i++){
+
+        const struct File* old_file = steps.steps[i].old_file;
+        const struct File* new_file = steps.steps[i].new_file;
+        svc_plan_entry* entry = &plan->entries[i];
+
+        entry->file_name = (char*)step_path(&steps.steps[i]);
+
+        if(new_file == NULL){
+            entry->action = SVC_PLAN_DELETE;
+            entry->bytes = 0;
+        } else {
+            entry->action = old_file == NULL ? SVC_PLAN_CREATE : SVC_PLAN_UPDATE;
+            entry->bytes = new_file->fc_length;
+        }
+
+        plan->bytes += entry->bytes;
+    }
+
+    free(steps.steps);
+
+    return 0;
+
+}
+
+void svc_free_plan(svc_checkout_plan *plan) {
+
+    if(plan == NULL){
+        return;
+    }
+
+    free(plan->entries);
+    plan->entries = NULL;
+    plan->n_entries = 0;
+    plan->bytes = 0;
+
+}
+
+// Print all branches created
+char **list_branches(void *helper, int *n_branches) {
+
+    struct System* system = (struct System*)helper;
+
+    TRACE_CALL(system, TRACE_LIST_BRANCHES){
+        trace_call_run(&trace_call);
+    }
+
+    if(n_branches == NULL){
+        return NULL;
+    }
+    
+    // For each branch, print out their name
+    for(int i = 0; i < system->num_branches; i++){
+        
+        printf("%s\n", system->branches[i]);
+
+    }
+
+    char** branches = (char**)malloc(sizeof(char*)*system->num_branches);
+
+    for(int j = 0; j < system->num_branches; j++){
+
+        branches[j] = system->branches[j];
+
+    }
+
+    *n_branches = system->num_branches;
+
+    return branches;
+}
+
+// Begin tracking given file in the svc system
+int svc_add(void *helper, char *file_name) {
+
+    struct System* system = (struct System*)helper;
+
+    TRACE_CALL(system, TRACE_ADD){
+        trace_string(system->trace, TRACE_KIND_PATH, file_name);
+        trace_sync(system->trace, file_name);
+        trace_call_run(&trace_call);
+    }
+    
+    int branch = system->active_branch_id;
+
+    if(file_name == NULL){
+        return -1;
+    }
+
+    if(path_index_find(system, branch, path_lookup(system, file_name)) != -1){
+        // Found a file with the same name
+        return -2;
+    }
+
+    // Read the file once, both the hash and the stored copy come from this view
+    struct FileView view;
+
+    if(stats_view_open(system->stats, file_name, &view, &system->scratch, &system->scratch_cap) != 0){
+        return -3;
+    }
+
+    // Add to SVC system
+
+    // Add to list of tracked files
+    if(system->num_files[branch] == system->cap_files[branch]){
+        // We need to expand the capacity of the files array
+        // We realloc double the space because its generally efficient
+        system->files[branch] = (struct File*)realloc(system->files[branch], sizeof(struct File)*system->cap_files[branch]*2);
+        system->cap_files[branch] = system->cap_files[branch]*2;
+    }
+
+    // Now that the files array have enough space
+    // Initialise the struct we are going to use
+    struct File* new_file = &system->files[branch][system->num_files[branch]];
+    struct Span hashing = span_begin(system->spans, "hash");
+    new_file->hash = hash_content(file_name, view.data, view.size);
+    stats_add(&system->stats->bytes_hashed, view.size);
+    span_end(&hashing);
+    new_file->path_id = path_intern(system, file_name);
+    new_file->file_name = path_string(system, new_file->path_id);
+    new_file->order = system->next_order++;
+
+    system->num_files[branch]++;
+
+    path_index_add(system, branch, system->num_files[branch] - 1);
+
+    // Copy the file and it's contents, into our system version controls
+    new_file->fc_index = store_view(system, view.data, view.size);
+
+    new_file->fc_length = view.size;
+
+    stat_cache_record(new_file, &view.st);
+
+    file_view_close(&view);
+    
+    return new_file->hash;
+}
+
+// Scan one tracked file on whichever thread picked it up
+// Only the file itself and its result are written, so files can be
+// scanned in any order and on any number of threads
+void scan_tracked_file(void* context, size_t index, char** scratch, size_t* scratch_cap){
+
+    struct ScanJob* job = (struct ScanJob*)context;
+    struct File* file = &job->files[index];
+    struct ScanResult* result = &job->results[index];
+
+    result->content = NULL;
+    result->hash = -2;
+
+    struct stat st;
+
+    if(stat(file->file_name, &st) != 0){
+        return;
+    }
+
+    if(stat_cache_fresh(file, &st)){
+        result->hash = file->hash;
+        return;
+    }
+
+    struct FileView view;
+
+    if(stats_view_open(job->stats, file->file_name, &view, scratch, scratch_cap) != 0){
+        return;
+    }
+
+    struct Span hashing = span_begin(job->spans, "hash");
+    result->hash = hash_content(file->file_name, view.data, view.size);
+    stats_add(&job->stats->bytes_hashed, view.size);
+    span_end(&hashing);
+
+    if(result->hash == (int)file->hash){
+        // Only a stat whose content matches the stored hash may be cached
+        stat_cache_record(file, &view.st);
+    } else {
+        // Keep the new content so it can be stored without reading it again
+        result->content = (char*)malloc(view.size + 1);
+        memcpy(result->content, view.data, view.size);
+        result->content[view.size] = '\0';
+        result->length = view.size;
+        result->st = view.st;
+        hashing = span_begin(job->spans, "hash");
+        sha256(view.data, view.size, result->digest);
+        stats_add(&job->stats->bytes_hashed, view.size);
+        span_end(&hashing);
+    }
+
+    file_view_close(&view);
+
+}
+
+// Hash every tracked file of a branch, one result per file
+// Large branches are spread over the worker threads
+struct ScanResult* scan_tracked_files(struct System* system, struct File* files, size_t num_files){
+
+    SPAN(system->spans, "scan_tracked_files");
+
+    struct ScanJob job;
+    job.files = files;
+    job.stats = system->stats;
+    job.spans = system->spans;
+    job.results = (struct ScanResult*)malloc(sizeof(struct ScanResult)*(num_files + 1));
+
+    if(num_files >= SCAN_PARALLEL_MIN && system->workers == NULL){
+        system->workers = workers_create(system->num_threads);
+    }
+
+    struct WorkerPool* pool = num_files >= SCAN_PARALLEL_MIN ? system->workers : NULL;
+
+    workers_run(pool, scan_tracked_file, &job, num_files, &system->scratch, &system->scratch_cap);
+
+    return job.results;
+
+}
+
+// Bring a tracked file up to date with its scan
+// Content that changed is moved into the blob store
+void apply_scan_result(struct System* system, struct File* file, struct ScanResult* result){
+
+    if(result->content == NULL){
+        return;
+    }
+
+    // The version being replaced is the base for a delta of the new one
+    int previous = file->fc_index;
+    file->fc_index = store_owned(system, result->digest, result->content, result->length, previous);
+    blob_release(system, previous);
+    file->fc_length = result->length;
+    file->hash = result->hash;
+
+    stat_cache_record(file, &result->st);
+
+    result->content = NULL;
+
+}
+
+// Free content of scans that were never applied
+void free_scan_results(struct ScanResult* results, size_t num_results){
+
+    for(size_t i = 0; i < num_results; i++){
+        free(results[i].content);
+    }
+
+    free(results);
+
+}
+
+// Store the content of this file into the blob store
+// And return the index of the blob, holding one reference for the caller
+// Returns BLOB_NONE if the file could not be read
+int store_content(struct System* system, char* file_path){
+
+    SPAN(system->spans, "store_content");
+
+    struct FileView view;
+
+    if(stats_view_open(system->stats, file_path, &view, &system->scratch, &system->scratch_cap) != 0){
+        return BLOB_NONE;
+    }
+
+    int index = store_view(system, view.data, view.size);
+
+    file_view_close(&view);
+
+    return index;
+
+}
+
+// Store contents already in memory into the blob store
+// Content that is already stored is shared rather than copied
+int store_view(struct System* system, const char* data, size_t length){
+
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    struct Span hashing = span_begin(system->spans, "hash");
+    sha256(data, length, digest);
+    stats_add(&system->stats->bytes_hashed, length);
+    span_end(&hashing);
+
+    int index = blob_lookup(system, digest);
+
+    if(index != BLOB_NONE){
+        // Identical content is already stored
+        blob_retain(system, index);
+        return index;
+    }
+
+    // Null terminate the file_content
+    char* content = (char*)malloc(length + 1);
+    memcpy(content, data, length);
+    content[length] = '\0';
+
+    return blob_insert_against(system, digest, content, length, BLOB_NONE);
+
+}
+
+// Store content whose digest is already known, taking ownership of it
+// New content may be kept as a delta against base, which can be BLOB_NONE
+int store_owned(struct System* system, const unsigned char* digest, char* content, size_t length, int base){
+
+    int index = blob_lookup(system, digest);
+
+    if(index != BLOB_NONE){
+        // Identical content is already stored
+        blob_retain(system, index);
+        free(content);
+        return index;
+    }
+
+    return blob_insert_against(system, digest, content, length, base);
+
+}
+
+// Current hash of a tracked file
+// Files whose stat has not changed since their hash was taken are not read
+// Returns -2 if the file can not be read
+int tracked_file_hash(struct System* system, struct File* file){
+
+    struct stat st;
+
+    if(stat(file->file_name, &st) != 0){
+        return -2;
+    }
+
+    if(stat_cache_fresh(file, &st)){
+        return file->hash;
+    }
+
+    struct FileView view;
+
+    if(stats_view_open(system->stats, file->file_name, &view, &system->scratch, &system->scratch_cap) != 0){
+        return -2;
+    }
+
+    struct Span hashing = span_begin(system->spans, "hash");
+    int hash = hash_content(file->file_name, view.data, view.size);
+    stats_add(&system->stats->bytes_hashed, view.size);
+    span_end(&hashing);
+
+    // Only a stat whose content matches the stored hash may be cached
+    if(hash == (int)file->hash){
+        stat_cache_record(file, &view.st);
+    }
+
+    file_view_close(&view);
+
+    return hash;
+
+}
+
+// Stop tracking given file
+int svc_rm(void *helper, char *file_name) {
+
+    struct System* system = (struct System*)helper;
+
+    TRACE_CALL(system, TRACE_RM){
+        trace_string(system->trace, TRACE_KIND_PATH, file_name);
+        trace_call_run(&trace_call);
+    }
+
+    int branch = system->active_branch_id;
+    
+
+    if(file_name == NULL){
+        return -1;
+    }
+
+    int rm_hash = 0;
+
+    int index = path_index_find(system, branch, path_lookup(system, file_name));
+
+    if(index != -1){
+        // We found the file we wanted to remove from the SVC system
+
+        rm_hash = system->files[branch][index].hash;
+
+        remove_file_at(system, branch, index);
+
+    }
+
+    if(rm_hash == 0){
+        return -2;
+    }
+
+
+    return rm_hash;
+}
+
+// Drop the file at index from the branch
+// The gap is left as a hole and closed later by branch_files
+void remove_file_at(struct System* system, size_t branch, size_t index){
+
+    path_index_remove(system, branch, index);
+
+    system->files[branch][index].file_name = NULL;
+    system->files[branch][index].path_id = PATH_NONE;
+
+    blob_release(system, system->files[branch][index].fc_index);
+
+    if(index == system->num_files[branch] - 1){
+        // Nothing follows the last file, so no hole is left
+        system->num_files[branch]--;
+    } else {
+        system->num_dead[branch]++;
+    }
+
+}
+
+// Mark paths whose content differs between the head and the reset commit
+void reset_step(void* context, const struct File* old_file, const struct File* new_file){
+
+    char* rewrite = (char*)context;
+
+    if(new_file != NULL && (old_file == NULL || old_file->fc_index != new_file->fc_index)){
+        rewrite[new_file->path_id] = 1;
+    }
+
+}
+
+// True if the file on disk already holds the content of target
+// A staged copy of the same blob with a trusted stat saves reading it
+int working_copy_matches(struct System* system, const struct File* staged, const struct File* target){
+
+    struct stat st;
+
+    if(stat(target->file_name, &st) != 0){
+        return 0;
+    }
+
+    if(staged != NULL && staged->fc_index == target->fc_index && stat_cache_fresh(staged, &st)){
+        return 1;
+    }
+
+    if(st.st_size != target->fc_length){
+        return 0;
+    }
+
+    struct FileView view;
+
+    if(stats_view_open(system->stats, target->file_name, &view, &system->scratch, &system->scratch_cap) != 0){
+        return 0;
+    }
+
+    int same = view.size == (size_t)target->fc_length
+        && (view.size == 0 || memcmp(view.data, blob_content(system, target->fc_index), view.size) == 0);
+
+    file_view_close(&view);
+
+    return same;
+
+}
+
+// Reset to give commit 
+int svc_reset(void *helper, char *commit_id) {
+
+    struct System* system = (struct System*)helper;
 
+    TRACE_CALL(system, TRACE_RESET){
+        trace_commit_id(system, commit_id);
+        trace_sync_staged(system);
+        trace_call_run(&trace_call);
     }
-
-    if(branch_id == -1){
-        // No branch with this name exists
+    
+    if(commit_id == NULL){
         return -1;
     }
 
-    int made_changes = check_uncommitted_changes(system);
+    struct Commit* commit = get_commit(helper, commit_id);
 
-    if(made_changes){
+    if(commit == NULL){
         return -2;
     }
 
-    // This branch exists without uncommitted changes
-    // Check out branch
-
-    system->active_branch_id = branch_id;
-    system->head_commit = system->branch_ptrs[branch_id];
+    struct CommitBody* body = commit_load(system, commit);
+    struct CommitBody* current = system->head_commit == NULL ? NULL : commit_load(system, system->head_commit);
 
-    struct Commit* commit = system->head_commit;
-
-
-    // Replace all files shared by both branches to make sure 
-    // each file the contain the content of
-    // The most recent commit on this branch
-    for(int i = 0; i < commit->num_files; i++){
+    size_t branch = system->active_branch_id;
 
-        FILE* file = fopen(commit->files[i].file_name, "w");
+    // Paths the reset commit stores differently from the head are written
+    // without looking at them, shared subtrees are skipped by the diff
+    char* rewrite = (char*)calloc(system->paths->num_paths + 1, 1);
+    tree_diff(current == NULL ? NULL : current->tree, body->tree, reset_step, rewrite);
 
+    // Update head commit and branch ptrs to the reset commit
+    system->head_commit = commit;
+    system->branch_ptrs[branch] = commit;
 
-        char* file_content = system->file_contents[commit->files[i].fc_index];
+    size_t num_files = tree_num_files(body->tree);
+    const struct File** files = tree_list_files(body->tree);
 
-        int num_elm = commit->files[i].fc_length;
+    // Keep the old staging area aside, its entries are rewritten in place
+    struct File* stage = branch_files(system, branch);
+    size_t num_stage = system->num_files[branch];
 
+    struct File* previous = (struct File*)malloc(sizeof(struct File)*(num_stage + 1));
+    memcpy(previous, stage, sizeof(struct File)*num_stage);
 
-        fwrite(file_content, 1, num_elm, file);
+    if(system->cap_files[branch] < num_files){
+        size_t cap = system->cap_files[branch] > 0 ? system->cap_files[branch] : 1;
+        while(cap < num_files){
+            cap *= 2;
+        }
+        system->files[branch] = (struct File*)realloc(system->files[branch], sizeof(struct File)*cap);
+        system->cap_files[branch] = cap;
+    }
 
-        fflush(file);
+    // Revert every tracked file, only writing those whose content on disk
+    // is not already the reset commit's copy
+    struct Span writing = span_begin(system->spans, "write_files");
 
-        fclose(file);
+    for(size_t i = 0; i < num_files; i++){
 
-    }
-    
+        int index = path_index_find(system, branch, files[i]->path_id);
+        const struct File* staged = index == -1 ? NULL : &previous[index];
 
+        if(rewrite[files[i]->path_id] || !working_copy_matches(system, staged, files[i])){
+            write_blob(system, files[i]->file_name, files[i]->fc_index, files[i]->fc_length);
+            staged = NULL;
+        }
 
-    return 0;
-}
+        // Paths are interned, take a reference on each blob
+        system->files[branch][i] = *files[i];
+        blob_retain(system, files[i]->fc_index);
 
-// Print all branches created
-char **list_branches(void *helper, int *n_branches) {
+        if(staged != NULL && staged->fc_index == files[i]->fc_index){
+            // Untouched file, its stat still describes this content
+            stat_cache_copy(&system->files[branch][i], staged);
+        }
 
-    if(n_branches == NULL){
-        return NULL;
     }
-    
-    struct System* system = (struct System*)helper;
-    
-    // For each branch, print out their name
-    for(int i = 0; i < system->num_branches; i++){
-        
-        printf("%s\n", system->branches[i]);
 
-    }
+    span_end(&writing);
 
-    char** branches = (char**)malloc(sizeof(char*)*system->num_branches);
+    // References on the old staging area go only once the new one holds its own
+    for(size_t i = 0; i < num_stage; i++){
+        blob_release(system, previous[i].fc_index);
+    }
 
-    for(int j = 0; j < system->num_branches; j++){
+    free(previous);
+    free(files);
+    free(rewrite);
 
-        branches[j] = system->branches[j];
+    system->num_files[branch] = num_files;
+    system->num_dead[branch] = 0;
+    path_index_rebuild(system, branch);
 
+    if(system->repo != NULL){
+        repo_save_stage(system, branch);
+        repo_save_state(system);
     }
 
-    *n_branches = system->num_branches;
 
-    return branches;
+    return 0;
 }
 
-// Begin tracking given file in the svc system
-int svc_add(void *helper, char *file_name) {
-
-    struct System* system = (struct System*)helper;
-    
-    int branch = system->active_branch_id;
-
-    if(file_name == NULL){
-        return -1;
-    }
 
-    for(int i = 0; i < system->num_files[branch]; i++){
+// Classify a path the other branch changed since the merge base
+void merge_step(void* context, const struct File* base_file, const struct File* theirs_file){
 
-        if(strcmp(system->files[branch][i].file_name, file_name) == 0){
-            // Found a file with the same name
-            return -2;
-        }
+    struct MergePlan* plan = (struct MergePlan*)context;
 
+    if(base_file != NULL && theirs_file != NULL && base_file->fc_index == theirs_file->fc_index){
+        // Same content, only its place in staging order moved
+        return;
     }
 
-    FILE* file = fopen(file_name, "rb");
-
-    if(file == NULL){
-        return -3;
-    }
+    const char* path = theirs_file != NULL ? theirs_file->file_name : base_file->file_name;
+    const struct File* ours_file = tree_find(plan->system, plan->ours_tree, path);
 
-    // Add to SVC system
+    int ours_blob = ours_file == NULL ? BLOB_NONE : ours_file->fc_index;
+    int theirs_blob = theirs_file == NULL ? BLOB_NONE : theirs_file->fc_index;
+    int base_blob = base_file == NULL ? BLOB_NONE : base_file->fc_index;
 
-    // Add to list of tracked files
-    if(system->num_files[branch] == system->cap_files[branch]){
-        // We need to expand the capacity of the files array
-        // We realloc double the space because its generally efficient
-        system->files[branch] = (struct File*)realloc(system->files[branch], sizeof(struct File)*system->cap_files[branch]*2);
-        system->cap_files[branch] = system->cap_files[branch]*2;
+    if(ours_blob == theirs_blob){
+        // Both sides made the same change
+        return;
     }
 
-    // Now that the files array have enough space
-    // Initialise the struct we are going to use
-    struct File* new_file = &system->files[branch][system->num_files[branch]];
-    new_file->hash = (size_t)hash_file(helper, file_name);
-    new_file->file_name = strdup(file_name);
-
-    system->num_files[branch]++;
+    struct MergeStep step = {base_file, ours_file, theirs_file, MERGE_TAKE_THEIRS, NULL, 0};
 
-    // Copy the file and it's contents, into our system version controls
-    new_file->fc_index = store_content(system, file);
+    if(ours_blob != base_blob){
 
-    new_file->fc_length = num_bytes(file);
+        if(ours_file == NULL || theirs_file == NULL){
+            // Changed on one side, deleted on the other
+            step.action = MERGE_CONFLICT;
+        } else {
+            struct System* system = plan->system;
+            const char* base = base_file == NULL ? "" : blob_content(system, base_blob);
+            const char* ours = blob_content(system, ours_blob);
+            const char* theirs = blob_content(system, theirs_blob);
 
-    fclose(file);
-    
-    return new_file->hash;
-}
+            int conflicts = diff3_merge(base, base_file == NULL ? 0 : base_file->fc_length, ours, ours_file->fc_length, theirs, theirs_file->fc_length, &step.merged, &step.merged_length);
 
-// Store the content of this file into system->file_contents
-// And return the index where the content is stored inside file_contents array
-int store_content(struct System* system, FILE* file){
+            step.action = conflicts == 0 ? MERGE_CONTENT : MERGE_CONFLICT;
+        }
 
-    // Reallocate system->file_contents array
-    if(system->cap_content == system->num_content){
-        system->file_contents = (char**)realloc(system->file_contents, sizeof(char*)*(system->num_content*2));
-        system->cap_content = system->cap_content * 2;;
     }
 
-    size_t length = num_bytes(file);
-
-    system->file_contents[system->num_content] = (char*)malloc(sizeof(char)*(length+1));
+    if(step.action == MERGE_CONFLICT){
+        plan->num_conflicts++;
+    }
 
-    if(system->file_contents[system->num_content] != NULL){
-        fread(system->file_contents[system->num_content], 1, length, file);
+    if(plan->num_steps == plan->cap_steps){
+        plan->cap_steps = plan->cap_steps == 0 ? 16 : plan->cap_steps*2;
+        plan->steps = (struct MergeStep*)realloc(plan->steps, sizeof(struct MergeStep)*plan->cap_steps);
     }
 
-    // Null terminate the file_content
-    system->file_contents[system->num_content][length] = '\0';
+    plan->steps[plan->num_steps++] = step;
 
-    system->num_content++;
+}
+
+const char* merge_step_path(const struct MergeStep* step){
 
-    return system->num_content-1;
+    return step->theirs != NULL ? step->theirs->file_name : step->base->file_name;
 
 }
 
-// Stop tracking given file
-int svc_rm(void *helper, char *file_name) {
+int compare_merge_steps(const void* a, const void* b){
 
-    struct System* system = (struct System*)helper;
+    return compare_paths(merge_step_path((const struct MergeStep*)a), merge_step_path((const struct MergeStep*)b));
 
-    int branch = system->active_branch_id;
-    
+}
 
-    if(file_name == NULL){
-        return -1;
-    }
+// Paths the merge of branch into the active branch changes, found by
+// diffing the merge base with the branch head. Paths only the active
+// branch changed are never looked at
+void plan_merge(struct System* system, size_t branch, struct MergePlan* plan){
 
-    int rm_hash = 0;
+    SPAN(system->spans, "plan_merge");
 
+    struct Commit* theirs_head = system->branch_ptrs[branch];
+    struct Commit* base = merge_base(system, system->head_commit, theirs_head);
 
-    for(int i = 0; i < system->num_files[branch]; i++){
-        if(strcmp(system->files[branch][i].file_name, file_name) == 0){
-            // We found the file we wanted to remove from the SVC system
+    struct CommitBody* ours_body = system->head_commit == NULL ? NULL : commit_load(system, system->head_commit);
+    struct CommitBody* theirs_body = theirs_head == NULL ? NULL : commit_load(system, theirs_head);
+    struct CommitBody* base_body = base == NULL ? NULL : commit_load(system, base);
 
-           rm_hash = system->files[branch][i].hash;
+    plan->system = system;
+    plan->ours_tree = ours_body == NULL ? NULL : ours_body->tree;
+    plan->steps = NULL;
+    plan->num_steps = 0;
+    plan->cap_steps = 0;
+    plan->num_conflicts = 0;
 
-           free(system->files[branch][i].file_name);
+    tree_diff(base_body == NULL ? NULL : base_body->tree, theirs_body == NULL ? NULL : theirs_body->tree, merge_step, plan);
 
-            // Close the gap created by moving all the files forward by 1
-            organise_files(system, i);
+    if(plan->num_steps > 0){
+        qsort(plan->steps, plan->num_steps, sizeof(struct MergeStep), compare_merge_steps);
+    }
 
-            system->num_files[branch]--;
+}
 
-        }
-    }
+void free_merge_plan(struct MergePlan* plan){
 
-    if(rm_hash == 0){
-        return -2;
+    for(size_t i = 0; i < plan->num_steps; i++){
+        free(plan->steps[i].merged);
     }
 
+    free(plan->steps);
 
-    return rm_hash;
 }
 
-// Remove the gaps in the file array created by svc_rm
-void organise_files(struct System* system, int index){
-
-    int branch = system->active_branch_id;
+// Index of the resolution given for path, or -1
+int find_resolution(const char* path, struct resolution *resolutions, int n_resolutions){
 
-    for(int i = index; i < system->num_files[branch] - 1; i++){
+    for(int i = 0; i < n_resolutions; i++){
 
-        memcpy(&system->files[branch][i], &system->files[branch][i+1], sizeof(struct File));
-        system->files[branch][i].fc_index = system->files[branch][i+1].fc_index;
-        system->files[branch][i].fc_length = system->files[branch][i+1].fc_length;
-        system->files[branch][i].hash = system->files[branch][i+1].hash;
+        if(resolutions[i].file_name != NULL && strcmp(resolutions[i].file_name, path) == 0){
+            return i;
+        }
 
     }
 
+    return -1;
+
 }
 
-// Reset to give commit 
-int svc_reset(void *helper, char *commit_id) {
+// Stage the result of a merge step on branch and write it out
+void apply_merge_step(struct System* system, size_t branch, struct MergeStep* step){
 
-    struct System* system = (struct System*)helper;
-    
-    if(commit_id == NULL){
-        return -1;
+    const char* path = merge_step_path(step);
+    int path_id = step->theirs != NULL ? step->theirs->path_id : step->base->path_id;
+    int index = path_index_find(system, branch, path_id);
+
+    if(step->action == MERGE_TAKE_THEIRS && step->theirs == NULL){
+        // Deleted by the other branch, untouched here
+        if(index != -1){
+            remove_file_at(system, branch, index);
+        }
+        remove_file_and_dirs(path);
+        return;
     }
 
-    struct Commit* commit = get_commit(helper, commit_id);
+    if(index == -1){
 
-    if(commit == NULL){
-        return -2;
-    }
+        if(system->num_files[branch] == system->cap_files[branch]){
+            size_t cap = system->cap_files[branch] > 0 ? system->cap_files[branch]*2 : 16;
+            system->files[branch] = (struct File*)realloc(system->files[branch], sizeof(struct File)*cap);
+            system->cap_files[branch] = cap;
+        }
 
-    size_t branch = system->active_branch_id;
+        index = system->num_files[branch];
+        system->files[branch][index] = *step->theirs;
+        // Keeps the other branch's order, so snapshots list it where that
+        // branch staged it
+        system->files[branch][index].fc_index = BLOB_NONE;
+        system->num_files[branch]++;
 
-    // Update head commit and branch ptrs to the reset commit
-    system->head_commit = commit;
-    system->branch_ptrs[branch] = commit;
+        path_index_add(system, branch, index);
 
-    // For every file that is tracked by this commit
-    // Revert all changes by writing this copy of the file into the drive
+    }
 
-    for(int i = 0; i < commit->num_files; i++){
+    struct File* file = &system->files[branch][index];
 
-        FILE* file = fopen(commit->files[i].file_name, "w");
+    if(file->fc_index != BLOB_NONE){
+        blob_release(system, file->fc_index);
+    }
 
-        char* file_content = system->file_contents[commit->files[i].fc_index];
+    if(step->action == MERGE_TAKE_THEIRS){
 
-        int num_elm = commit->files[i].fc_length;
+        blob_retain(system, step->theirs->fc_index);
+        file->fc_index = step->theirs->fc_index;
+        file->fc_length = step->theirs->fc_length;
+        file->hash = step->theirs->hash;
 
-        fwrite(file_content, 1, num_elm, file);
+    } else {
 
-        fflush(file);
+        struct Span hashing = span_begin(system->spans, "hash");
+        unsigned char digest[SHA256_DIGEST_SIZE];
+        sha256(step->merged, step->merged_length, digest);
+        file->hash = hash_content(file->file_name, step->merged, step->merged_length);
+        stats_add(&system->stats->bytes_hashed, 2*(uint64_t)step->merged_length);
+        span_end(&hashing);
 
-        fclose(file);
+        // Merged content is mostly our version, so it is stored against it
+        file->fc_index = store_owned(system, digest, step->merged, step->merged_length, step->ours->fc_index);
+        file->fc_length = step->merged_length;
+        step->merged = NULL;
 
     }
 
-    // Next update the system->files[branch] to be the same this commit's files
-    // First free this branch entirely
+    // The working copy is about to be rewritten
+    stat_cache_clear(file);
 
-    for(int i = 0; i < system->num_files[branch]; i++){
+    write_blob(system, file->file_name, file->fc_index, file->fc_length);
 
-        free(system->files[branch][i].file_name);
-    }
+}
 
-    system->files[branch] = (struct File*)realloc(system->files[branch], sizeof(struct File)*commit->num_files);
-    memcpy(system->files[branch], commit->files, sizeof(struct File)*commit->num_files);
-    // STRDUP all the file names
-    for(int j = 0; j < commit->num_files; j++){
+// Merge given branch into the active branch
+char *svc_merge(void *helper, char *branch_name, struct resolution *resolutions, int n_resolutions) {
 
-        system->files[branch][j].file_name = strdup(commit->files[j].file_name);
+    struct System* system = (struct System*)helper;
 
-    }
+    TRACE_CALL(system, TRACE_MERGE){
 
-    // Then we reallocate the number of files according to our commit
-    system->num_files[branch] = commit->num_files;
-    system->cap_files[branch] = commit->num_files;
+        int recorded = resolutions == NULL ? 0 : n_resolutions;
 
+        trace_string(system->trace, TRACE_KIND_NAME, branch_name);
+        trace_number(system->trace, recorded);
 
-    return 0;
-}
+        for(int i = 0; i < recorded; i++){
+            trace_string(system->trace, TRACE_KIND_PATH, resolutions[i].file_name);
+            trace_string(system->trace, TRACE_KIND_PATH, resolutions[i].resolved_file);
+        }
 
+        trace_sync_staged(system);
 
-// Merge given branch into the active branch
-char *svc_merge(void *helper, char *branch_name, struct resolution *resolutions, int n_resolutions) {
+        for(int i = 0; i < recorded; i++){
+            trace_sync(system->trace, resolutions[i].resolved_file);
+        }
 
-    struct System* system = (struct System*)helper;
+        trace_call_run(&trace_call);
+    }
 
     if(branch_name == NULL){
         printf("Invalid branch name\n");
         return NULL;
     }
 
-    size_t small_branch = -1;
+    size_t small_branch = find_branch(system, branch_name);
     size_t main_branch = system->active_branch_id;
 
-    for(size_t i = 0; i < system->num_branches; i++){
-
-        if(strcmp(branch_name, system->branches[i]) == 0){
-            // Found the branch
-            small_branch = i;
-        }
-
-    }
-
-    if(small_branch == -1){
+    if(small_branch == (size_t)-1){
         printf("Branch not found\n");
         return NULL;
     }
@@ -1390,106 +2342,173 @@ char *svc_merge(void *helper, char *branch_name, struct resolution *resolutions,
         return NULL;
     }
 
-    // Begin merging procedure
-    // Add all the files from small branch into main branch
-    for(int i = 0; i < system->num_files[small_branch]; i++){
+    // Three way merge against the lowest common ancestor of both heads
+    struct MergePlan plan;
+    plan_merge(system, small_branch, &plan);
 
-        int file_index = check_branch_for_file(system, main_branch, system->files[small_branch][i].file_name);
+    // Conflicts the caller has not resolved stop the merge before anything
+    // is written
+    int unresolved = 0;
 
-        if (file_index == -1) {
+    for(size_t i = 0; i < plan.num_steps; i++){
 
-            // File was not found in main branch
+        const char* path = merge_step_path(&plan.steps[i]);
 
-            // Add file from small branch into main branch
-            if(system->num_files[main_branch] == system->cap_files[main_branch]){
-                // Reallocate space for new file to be added
-                system->files[main_branch] = (struct File*)realloc(system->files[main_branch], sizeof(struct File)*system->cap_files[main_branch]*2);
-                system->cap_files[main_branch] = system->cap_files[main_branch]*2;
-            }
+        if(plan.steps[i].action == MERGE_CONFLICT && find_resolution(path, resolutions, n_resolutions) == -1){
+            printf("Merge conflict in %s\n", path);
+            unresolved++;
+        }
 
+    }
 
-            // Begin adding files
-            int file_index = system->num_files[main_branch];
-            // system->files[main_branch][file_index] = 
+    if(unresolved > 0){
+        free_merge_plan(&plan);
+        return NULL;
+    }
 
-            memcpy(&system->files[main_branch][file_index], &system->files[small_branch][i], sizeof(struct File));
-            system->files[main_branch][file_index].file_name = strdup(system->files[small_branch][i].file_name);
-            system->files[main_branch][file_index].fc_index = system->files[small_branch][i].fc_index;
-            system->files[main_branch][file_index].fc_length = system->files[small_branch][i].fc_length;
-            system->files[main_branch][file_index].hash = system->files[small_branch][i].hash;
+    branch_files(system, main_branch);
 
-            // Write these files into the main_branch
-            char* file_name = system->files[main_branch][file_index].file_name;
+    // Only paths whose merged result differs from our head are written,
+    // which as there are no uncommitted changes is the working copy
+    struct Span writing = span_begin(system->spans, "write_files");
 
-            FILE* file = fopen(file_name, "w");
+    for(size_t i = 0; i < plan.num_steps; i++){
 
-            char* file_content = system->file_contents[system->files[main_branch][file_index].fc_index];
+        if(plan.steps[i].action != MERGE_CONFLICT){
+            apply_merge_step(system, main_branch, &plan.steps[i]);
+        }
 
-            int num_elm = system->files[main_branch][file_index].fc_length;
+    }
 
-            fwrite(file_content, 1, num_elm, file);
+    span_end(&writing);
 
-            fflush(file);
+    free_merge_plan(&plan);
 
-            fclose(file);
+    // Handle all resolutions
 
-            system->num_files[main_branch]++;
+    resolve_file_clashes(system, resolutions, n_resolutions);
 
-        } else {
+    // Merge completed
+    // Call commit for merged branch 
+    char* prefix = "Merged branch ";
+
+    char* message = (char*)malloc(strlen(prefix) + strlen(branch_name) + 1);
+
+    strcpy(message, prefix);
+
+    strcat(message, branch_name);
+
+    // The merged branch becomes the second parent of the commit
+    system->merge_branch = small_branch;
+
+    char* commit_id = svc_commit(system, message);
+
+    system->merge_branch = -1;
+
+    free(message);
+
+    printf("Merge successful\n");
+
+    return commit_id;
+}
 
-            // File was also in main branch
-            system->files[main_branch][file_index].fc_index = system->files[small_branch][i].fc_index;
-            system->files[main_branch][file_index].fc_length = system->files[small_branch][i].fc_length;
-            system->files[main_branch][file_index].hash = system->files[small_branch][i].hash;
+// Paths that merging branch_name into the active branch would leave in
+// conflict, so resolutions can be prepared before calling svc_merge
+// The array is the caller's to free, the paths are owned by the system
+char **svc_merge_conflicts(void *helper, char *branch_name, int *n_conflicts) {
 
-            // Write these files into the main_branch
-            char* file_name = system->files[main_branch][file_index].file_name;
+    struct System* system = (struct System*)helper;
 
-            FILE* file = fopen(file_name, "w");
+    TRACE_CALL(system, TRACE_MERGE_CONFLICTS){
+        trace_string(system->trace, TRACE_KIND_NAME, branch_name);
+        trace_sync_staged(system);
+        trace_call_run(&trace_call);
+    }
 
-            char* file_content = system->file_contents[system->files[main_branch][file_index].fc_index];
+    if(branch_name == NULL || n_conflicts == NULL){
+        return NULL;
+    }
 
-            int num_elm = system->files[main_branch][file_index].fc_length;
+    size_t branch = find_branch(system, branch_name);
 
-            fwrite(file_content, 1, num_elm, file);
+    if(branch == (size_t)-1 || branch == system->active_branch_id){
+        return NULL;
+    }
 
-            fflush(file);
+    struct MergePlan plan;
+    plan_merge(system, branch, &plan);
 
-            fclose(file);
+    char** conflicts = (char**)malloc(sizeof(char*)*(plan.num_conflicts + 1));
+    int count = 0;
 
+    for(size_t i = 0; i < plan.num_steps; i++){
 
+        if(plan.steps[i].action == MERGE_CONFLICT){
+            conflicts[count++] = (char*)merge_step_path(&plan.steps[i]);
         }
 
+    }
+
+    free_merge_plan(&plan);
+
+    *n_conflicts = count;
+
+    return conflicts;
+
+}
+
+// Counters and call latencies since the last reset
+// Safe to call while another thread is using the system
+int svc_stats(void *helper, struct svc_stats *stats) {
+
+    struct System* system = (struct System*)helper;
 
+    if(system == NULL || stats == NULL){
+        return -1;
     }
 
-    // Handle all resolutions
+    stats_snapshot(system->stats, stats);
 
-    resolve_file_clashes(system, resolutions, n_resolutions);
+    return 0;
 
-    // Merge completed
-    // Call commit for merged branch 
-    char* prefix = "Merged branch ";
+}
 
-    char* message = (char*)malloc(strlen(prefix) + strlen(branch_name) + 1);
+void svc_stats_reset(void *helper) {
 
-    strcpy(message, prefix);
+    struct System* system = (struct System*)helper;
 
-    strcat(message, branch_name);
+    if(system != NULL){
+        stats_reset(system->stats);
+    }
 
-    char* commit_id = svc_commit(system, message);
+}
 
-    struct Commit* commit = get_commit(system, commit_id);
+// Switch recording spans of internal phases on or off
+void svc_spans(void *helper, int enabled) {
 
-    commit->parent_commit2 = system->branch_ptrs[small_branch];
+    struct System* system = (struct System*)helper;
 
-    commit->num_parents = 2;
+    if(system != NULL){
+        spans_enable(system->spans, enabled != 0);
+    }
 
-    free(message);
+}
 
-    printf("Merge successful\n");
+// Write the latest spans of every thread as Chrome trace events
+int svc_spans_dump(void *helper, const char *path) {
+
+    struct System* system = (struct System*)helper;
+
+    if(system == NULL || path == NULL){
+        return -1;
+    }
+
+    if(spans_dump(system->spans, path) != 0){
+        return -2;
+    }
+
+    return 0;
 
-    return commit_id;
 }
 
 // Handle all resolutions given
@@ -1508,18 +2527,16 @@ void resolve_file_clashes(struct System* system, struct resolution *resolutions,
             continue;
         }
 
-        FILE* file_ptr = fopen(resolutions[i].resolved_file, "rb");
+        struct FileView view;
+
+        if(stats_view_open(system->stats, resolutions[i].resolved_file, &view, &system->scratch, &system->scratch_cap) != 0){
+            // Resolution file could not be read
+            continue;
+        }
 
         // Store the file content in to the system
         // Also update the file_content pointer to the new content
-        int file_index = -1;
-        int num_files = system->num_files[branch]; 
-
-        for(int j = 0; j < num_files; j++){
-            if(strcmp(system->files[branch][j].file_name, resolutions[i].file_name) == 0){
-                file_index = j;
-            }
-        }
+        int file_index = path_index_find(system, branch, path_lookup(system, resolutions[i].file_name));
 
         // If file was not found in the branch
         if(file_index == -1){
@@ -1537,59 +2554,40 @@ void resolve_file_clashes(struct System* system, struct resolution *resolutions,
             // Initialise the struct we are going to use
             struct File* new_file = &system->files[branch][system->num_files[branch]];
             // new_file->hash = (size_t)hash_file(system, resolutions[i].resolved_file);
-            new_file->file_name = strdup(resolutions[i].file_name);
+            new_file->path_id = path_intern(system, resolutions[i].file_name);
+            new_file->file_name = path_string(system, new_file->path_id);
+            new_file->fc_index = BLOB_NONE;
+            new_file->order = system->next_order++;
+            stat_cache_clear(new_file);
             file_index = system->num_files[branch];
             system->num_files[branch]++;
 
-        }
-
-
-        // Hash, index, and check length of the resolution file
-        system->files[branch][file_index].hash = (size_t)hash_file(system, resolutions[i].resolved_file);
-        system->files[branch][file_index].fc_index = store_content(system, file_ptr);
-        system->files[branch][file_index].fc_length = num_bytes(file_ptr);
-
-
-        fclose(file_ptr);
-
-        // Print out the content into file_name
-        FILE* file = fopen(resolutions[i].file_name, "w");
-
-        char* file_content = system->file_contents[system->files[branch][file_index].fc_index];
+            path_index_add(system, branch, file_index);
 
-        int num_elm = system->files[branch][file_index].fc_length;
-
-        fwrite(file_content, 1, num_elm, file);
-
-        fflush(file);
-
-        fclose(file);
-
-    }
-
-
-}
-
-
-// Return -1 if no corresponding file was found
-// Return index of file in main branch if the file was found
-int check_branch_for_file(struct System* system, size_t branch, char* file_name){
+        }
 
-    int file_index = -1;
+        if(system->files[branch][file_index].fc_index != BLOB_NONE){
+            blob_release(system, system->files[branch][file_index].fc_index);
+        }
 
-    for(int i = 0; i < system->num_files[branch]; i++){
 
-        if(strcmp(system->files[branch][i].file_name, file_name) == 0){
+        // Hash, index, and check length of the resolution file
+        struct Span hashing = span_begin(system->spans, "hash");
+        system->files[branch][file_index].hash = hash_content(resolutions[i].resolved_file, view.data, view.size);
+        stats_add(&system->stats->bytes_hashed, view.size);
+        span_end(&hashing);
+        system->files[branch][file_index].fc_index = store_view(system, view.data, view.size);
+        system->files[branch][file_index].fc_length = view.size;
+        // The working copy is about to be rewritten
+        stat_cache_clear(&system->files[branch][file_index]);
 
-            file_index = i;
-            break;
 
-        }
+        file_view_close(&view);
 
+        // Print out the content into file_name, the merge may have removed its directory
+        write_blob(system, resolutions[i].file_name, system->files[branch][file_index].fc_index, system->files[branch][file_index].fc_length);
 
     }
 
-    return file_index;
 
 }
-
@@ -9,8 +9,110 @@ typedef struct resolution {
     char *resolved_file;
 } resolution;
 
+typedef struct svc_options {
+    // Threads used to scan tracked files on commit, 0 for one per CPU
+    int num_threads;
+    // Allocator for history metadata, both NULL for malloc and free
+    // release is given the size that was passed to alloc
+    void *(*alloc)(size_t size, void *user);
+    void (*release)(void *ptr, size_t size, void *user);
+    void *alloc_user;
+    // How stored file contents are compressed, one of SVC_COMPRESS_*
+    int compression;
+    // File every call is recorded to for svc_replay, NULL for none
+    // Contents are never recorded, only fingerprints of their chunks
+    char *trace_path;
+    int trace_flags; // SVC_TRACE_*
+} svc_options;
+
+#define SVC_COMPRESS_FAST 0 // Default, fast LZ
+#define SVC_COMPRESS_HIGH 1 // Slower to store, smaller
+#define SVC_COMPRESS_NONE 2
+
+#define SVC_TRACE_ANONYMISE 1 // Paths, branch names and messages are replaced by stand-ins
+
+// What a checkout does to one path
+#define SVC_PLAN_CREATE 0 // Not tracked before, written from scratch
+#define SVC_PLAN_UPDATE 1 // Tracked with other content, rewritten
+#define SVC_PLAN_DELETE 2 // Only tracked by the branch being left
+
+typedef struct svc_plan_entry {
+    char *file_name; // Owned by the system
+    int action;
+    size_t bytes; // Bytes written, 0 for deletions
+} svc_plan_entry;
+
+typedef struct svc_checkout_plan {
+    svc_plan_entry *entries; // In path order
+    size_t n_entries;
+    size_t bytes; // Total bytes the checkout writes
+} svc_checkout_plan;
+
+// Order svc_log yields commits in, children always come before parents
+#define SVC_LOG_DATE_ORDER 0 // Newest first, commits are dated by when they were made
+#define SVC_LOG_TOPO_ORDER 1 // Each line of history in one run
+
+typedef struct svc_log_options {
+    int order; // SVC_LOG_DATE_ORDER or SVC_LOG_TOPO_ORDER
+    int first_parent; // Only follow the first parent of merges
+    // Only commits changing one of these files, or a file below one
+    char **paths;
+    int n_paths;
+    size_t skip; // Matching commits passed over first, for paging
+    size_t max_count; // Most commits yielded, 0 for no limit
+} svc_log_options;
+
+// One commit of a log, owned by the system
+typedef struct svc_log_entry {
+    void *commit; // Handle, as returned by get_commit
+    char *id;
+    char *message;
+    char *branch; // Branch the commit was made on
+    void *parents[2]; // NULL where absent
+    int n_parents;
+} svc_log_entry;
+
+typedef struct svc_log svc_log;
+
+// Call latencies are counted in power of two buckets, bucket b holding
+// calls that took from 2^b up to 2^(b+1) nanoseconds, the last one longer
+#define SVC_STATS_BUCKETS 40
+#define SVC_STATS_CALLS 24 // Every entry point from hash_file on
+
+typedef struct svc_call_stats {
+    const char *name; // Entry point
+    unsigned long long calls; // Outermost calls, the library calling itself is not counted
+    unsigned long long timed; // Calls timed, lookups only time one call in 64
+    unsigned long long total_ns; // Of the timed calls
+    unsigned long long max_ns; // Since the last reset
+    unsigned long long buckets[SVC_STATS_BUCKETS];
+} svc_call_stats;
+
+// Counts since the last svc_stats_reset, not typedef'd as svc_stats is the call
+struct svc_stats {
+    unsigned long long files_opened; // Working copy files read
+    unsigned long long bytes_read; // From the working copy
+    unsigned long long bytes_hashed; // Each pass of a hash over contents counts
+    unsigned long long bytes_written; // To the working copy and the repository
+    unsigned long long blobs_stored; // New contents, identical ones are shared
+    unsigned long long path_lookups;
+    unsigned long long commit_lookups; // By id or prefix
+    unsigned long long branch_lookups;
+    unsigned long long string_compares; // Made by the three lookups
+    unsigned long long commits;
+    unsigned long long branches;
+    unsigned long long blob_bytes; // Stored contents held in memory now, kept by a reset
+    svc_call_stats calls[SVC_STATS_CALLS];
+};
+
 void *svc_init(void);
 
+void *svc_init_opts(const svc_options *options);
+
+void *svc_open(char *repo_path);
+
+void *svc_open_opts(char *repo_path, const svc_options *options);
+
 void cleanup(void *helper);
 
 int hash_file(void *helper, char *file_path);
@@ -19,14 +121,38 @@ char *svc_commit(void *helper, char *message);
 
 void *get_commit(void *helper, char *commit_id);
 
+void *svc_resolve_commit(void *helper, char *id_prefix);
+
 char **get_prev_commits(void *helper, void *commit, int *n_prev);
 
+void *svc_branch_head(void *helper, char *branch_name);
+
+int svc_is_ancestor(void *helper, void *ancestor, void *commit);
+
+void *svc_merge_base(void *helper, void *commit_a, void *commit_b);
+
+int svc_count_between(void *helper, void *from, void *to);
+
+long svc_diff(void *helper, void *old_commit, void *new_commit, char *buffer, size_t buffer_size);
+
+long svc_diff_working(void *helper, char *buffer, size_t buffer_size);
+
+svc_log *svc_log_open(void *helper, void *commit, const svc_log_options *options);
+
+int svc_log_next(svc_log *log, svc_log_entry *entry);
+
+void svc_log_close(svc_log *log);
+
 void print_commit(void *helper, char *commit_id);
 
 int svc_branch(void *helper, char *branch_name);
 
 int svc_checkout(void *helper, char *branch_name);
 
+int svc_plan_checkout(void *helper, char *branch_name, svc_checkout_plan *plan);
+
+void svc_free_plan(svc_checkout_plan *plan);
+
 char **list_branches(void *helper, int *n_branches);
 
 int svc_add(void *helper, char *file_name);
@@ -37,5 +163,18 @@ int svc_reset(void *helper, char *commit_id);
 
 char *svc_merge(void *helper, char *branch_name, resolution *resolutions, int n_resolutions);
 
+char **svc_merge_conflicts(void *helper, char *branch_name, int *n_conflicts);
+
+int svc_stats(void *helper, struct svc_stats *stats);
+
+void svc_stats_reset(void *helper);
+
+// Spans of internal phases, each thread keeps its latest ones, off by default
+void svc_spans(void *helper, int enabled);
+
+// Written as Chrome trace event JSON, for chrome://tracing or Perfetto
+// Call between other calls, returns -2 if path could not be written
+int svc_spans_dump(void *helper, const char *path);
+
 #endif
 
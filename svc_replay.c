@@ -0,0 +1,920 @@
+#include "svc.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Replays a trace recorded through svc_options.trace_path, see trace.h
+// Usage: ./svc_replay [-f csv|json] [-d directory] trace
+// The working copy is rebuilt in the directory, which must not exist yet.
+// Files get stand-in contents of their recorded sizes, made chunk by chunk
+// from the fingerprints, so they share content where the recorded ones
+// did. Absolute paths are replayed below the directory.
+// Each call is made with the recorded arguments and timed on its own, and
+// is reported next to the latency it had when recorded, so the same trace
+// can be replayed against two builds. Calls that made a different number
+// of commits than when recorded are counted as mismatches.
+// Stand-ins do not keep the lines of the recorded files, so a merge that
+// made a commit when recorded has the paths it would leave in conflict
+// resolved to our side with a line added, and makes its commit again.
+// Commits are looked up by their recorded creation numbers, those the
+// replay did not make, or that a system opened from a repository started
+// with, are missing and name no commit.
+
+#define REPLAY_DIR "svc_replay_repo"
+#define REPLAY_ID_MAX 64
+#define REPLAY_RESOLVED "svc_replay_resolved" // Merged stand-ins, numbered
+
+// Cursor over a trace held in memory
+// Reads past the end give zeros and set failed
+struct TraceReader {
+
+    const unsigned char* data;
+    size_t length;
+    size_t position;
+    bool failed;
+
+};
+
+uint64_t trace_get_varint(struct TraceReader* reader){
+
+    uint64_t value = 0;
+
+    for(int shift = 0; shift < 64; shift += 7){
+
+        if(reader->position >= reader->length){
+            reader->failed = true;
+            return 0;
+        }
+
+        unsigned char byte = reader->data[reader->position++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+
+        if((byte & 0x80) == 0){
+            return value;
+        }
+    }
+
+    reader->failed = true;
+    return 0;
+
+}
+
+int64_t trace_get_signed(struct TraceReader* reader){
+
+    uint64_t value = trace_get_varint(reader);
+
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+
+}
+
+uint64_t trace_get_fingerprint(struct TraceReader* reader){
+
+    if(reader->length - reader->position < 8){
+        reader->failed = true;
+        reader->position = reader->length;
+        return 0;
+    }
+
+    uint64_t value = 0;
+
+    for(int i = 0; i < 8; i++){
+        value |= (uint64_t)reader->data[reader->position++] << (i*8);
+    }
+
+    return value;
+
+}
+
+// Next length bytes, NULL if the trace ends first
+const char* trace_get_bytes(struct TraceReader* reader, size_t length){
+
+    if(reader->length - reader->position < length){
+        reader->failed = true;
+        reader->position = reader->length;
+        return NULL;
+    }
+
+    const char* bytes = (const char*)reader->data + reader->position;
+    reader->position += length;
+
+    return bytes;
+
+}
+
+// Recorded and replayed latency of every call made to one function
+struct OpTimes {
+
+    double* recorded;
+    double* replayed;
+    size_t count;
+    size_t cap;
+    size_t mismatches;
+
+};
+
+struct Replay {
+
+    void* helper;
+
+    // Strings in the order the trace sent them
+    char** strings;
+    size_t num_strings;
+    size_t cap_strings;
+
+    // Commits made by the replay, by recorded creation number, NULL for
+    // commits the replay did not make
+    void** commits;
+    char** ids;
+    size_t num_commits;
+    size_t cap_commits;
+
+    // Logs by the number the trace gave them, NULL once closed
+    svc_log** logs;
+    size_t num_logs;
+    size_t cap_logs;
+
+    // Active branch, new commits are its head
+    char* branch;
+
+    char* content;
+    char* existing;
+    size_t content_cap;
+
+    char* buffer;
+    size_t buffer_cap;
+
+    struct OpTimes ops[TRACE_NUM_OPS];
+
+};
+
+// Arguments of one call
+struct Call {
+
+    int op;
+    char* strings[2];
+    void* commits[2];
+    char id[REPLAY_ID_MAX];
+    int64_t numbers[2];
+    uint64_t buffer;
+    uint64_t log;
+
+    bool has_options;
+    svc_log_options options;
+    resolution* resolutions;
+    int num_stand_ins; // Resolution files the replay wrote
+
+    // What the trace gives for the call after its arguments
+    double recorded;
+    uint64_t recorded_commits;
+
+};
+
+
+double now_seconds(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+
+}
+
+char* read_string(struct Replay* replay, struct TraceReader* reader){
+
+    uint64_t ref = trace_get_varint(reader);
+
+    if(ref == TRACE_STRING_NULL){
+        return NULL;
+    }
+
+    if(ref == TRACE_STRING_NEW){
+
+        size_t length = trace_get_varint(reader);
+        const char* bytes = trace_get_bytes(reader, length);
+
+        if(bytes == NULL){
+            return NULL;
+        }
+
+        if(replay->num_strings == replay->cap_strings){
+            replay->cap_strings = replay->cap_strings == 0 ? 256 : replay->cap_strings*2;
+            replay->strings = (char**)realloc(replay->strings, sizeof(char*)*replay->cap_strings);
+        }
+
+        char* string = strndup(bytes, length);
+        replay->strings[replay->num_strings++] = string;
+
+        return string;
+    }
+
+    if(ref - TRACE_STRING_FIRST >= replay->num_strings){
+        reader->failed = true;
+        return NULL;
+    }
+
+    return replay->strings[ref - TRACE_STRING_FIRST];
+
+}
+
+// Paths are kept inside the replay directory
+char* read_path(struct Replay* replay, struct TraceReader* reader){
+
+    char* path = read_string(replay, reader);
+
+    while(path != NULL && *path == '/'){
+        path++;
+    }
+
+    return path;
+
+}
+
+// Replayed commit the recorded creation number names, NULL if missing
+void* replayed_commit(struct Replay* replay, uint64_t ref){
+
+    if(ref < TRACE_COMMIT_FIRST || ref - TRACE_COMMIT_FIRST >= replay->num_commits){
+        return NULL;
+    }
+
+    return replay->commits[ref - TRACE_COMMIT_FIRST];
+
+}
+
+void* read_handle(struct Replay* replay, struct TraceReader* reader){
+
+    return replayed_commit(replay, trace_get_varint(reader));
+
+}
+
+// Id or id prefix naming the replayed commit the recorded one named
+char* read_id(struct Replay* replay, struct TraceReader* reader, char* id){
+
+    uint64_t ref = trace_get_varint(reader);
+
+    if(ref == TRACE_COMMIT_NONE){
+        return NULL;
+    }
+
+    if(ref == TRACE_COMMIT_LITERAL){
+        return read_string(replay, reader);
+    }
+
+    size_t length = trace_get_varint(reader);
+
+    // Commits the replay did not make are named by an id nothing has
+    if(replayed_commit(replay, ref) == NULL){
+        strcpy(id, "~");
+        return id;
+    }
+
+    if(length >= REPLAY_ID_MAX){
+        length = REPLAY_ID_MAX - 1;
+    }
+
+    strncpy(id, replay->ids[ref - TRACE_COMMIT_FIRST], length);
+    id[length] = '\0';
+
+    return id;
+
+}
+
+// Gives the next count recorded creation numbers to commit, the first
+// one only, as a call makes one commit at most
+void add_commits(struct Replay* replay, uint64_t count, void* commit, char* id){
+
+    for(uint64_t i = 0; i < count; i++){
+
+        if(replay->num_commits == replay->cap_commits){
+            replay->cap_commits = replay->cap_commits == 0 ? 256 : replay->cap_commits*2;
+            replay->commits = (void**)realloc(replay->commits, sizeof(void*)*replay->cap_commits);
+            replay->ids = (char**)realloc(replay->ids, sizeof(char*)*replay->cap_commits);
+        }
+
+        replay->commits[replay->num_commits] = i == 0 ? commit : NULL;
+        replay->ids[replay->num_commits++] = i == 0 ? id : NULL;
+    }
+
+}
+
+void read_arguments(struct Replay* replay, struct TraceReader* reader, struct Call* call){
+
+    switch(call->op){
+
+        case TRACE_INIT:
+            call->numbers[0] = trace_get_varint(reader);
+            call->numbers[1] = trace_get_varint(reader);
+            // History a system was opened with is not in the trace
+            add_commits(replay, trace_get_varint(reader), NULL, NULL);
+            break;
+
+        case TRACE_HASH_FILE:
+        case TRACE_ADD:
+        case TRACE_RM:
+            call->strings[0] = read_path(replay, reader);
+            break;
+
+        case TRACE_COMMIT:
+        case TRACE_BRANCH_HEAD:
+        case TRACE_BRANCH:
+        case TRACE_CHECKOUT:
+        case TRACE_PLAN_CHECKOUT:
+        case TRACE_MERGE_CONFLICTS:
+            call->strings[0] = read_string(replay, reader);
+            break;
+
+        case TRACE_GET_COMMIT:
+        case TRACE_RESOLVE_COMMIT:
+        case TRACE_PRINT_COMMIT:
+        case TRACE_RESET:
+            call->strings[0] = read_id(replay, reader, call->id);
+            break;
+
+        case TRACE_PREV_COMMITS:
+            call->commits[0] = read_handle(replay, reader);
+            break;
+
+        case TRACE_DIFF:
+        case TRACE_IS_ANCESTOR:
+        case TRACE_MERGE_BASE:
+        case TRACE_COUNT_BETWEEN:
+            call->commits[0] = read_handle(replay, reader);
+            call->commits[1] = read_handle(replay, reader);
+            if(call->op == TRACE_DIFF){
+                call->buffer = trace_get_varint(reader);
+            }
+            break;
+
+        case TRACE_DIFF_WORKING:
+            call->buffer = trace_get_varint(reader);
+            break;
+
+        case TRACE_LOG_OPEN:
+            call->commits[0] = read_handle(replay, reader);
+            call->has_options = trace_get_varint(reader) == 1;
+            if(call->has_options){
+                call->options.order = trace_get_signed(reader);
+                call->options.first_parent = trace_get_signed(reader);
+                call->options.n_paths = trace_get_signed(reader);
+                call->options.paths = (char**)calloc(call->options.n_paths > 0 ? call->options.n_paths : 1, sizeof(char*));
+                for(int p = 0; p < call->options.n_paths && !reader->failed; p++){
+                    call->options.paths[p] = read_path(replay, reader);
+                }
+                call->options.skip = trace_get_varint(reader);
+                call->options.max_count = trace_get_varint(reader);
+            }
+            break;
+
+        case TRACE_LOG_NEXT:
+        case TRACE_LOG_CLOSE:
+            call->log = trace_get_varint(reader);
+            break;
+
+        case TRACE_MERGE:
+            call->strings[0] = read_string(replay, reader);
+            call->numbers[0] = trace_get_signed(reader);
+            call->resolutions = (resolution*)calloc(call->numbers[0] > 0 ? call->numbers[0] : 1, sizeof(resolution));
+            for(int64_t i = 0; i < call->numbers[0] && !reader->failed; i++){
+                call->resolutions[i].file_name = read_path(replay, reader);
+                call->resolutions[i].resolved_file = read_path(replay, reader);
+            }
+            break;
+    }
+
+}
+
+// Stand-in text for a chunk, the same for every chunk with its fingerprint
+void fill_chunk(char* data, size_t length, uint64_t fingerprint){
+
+    uint64_t state = fingerprint;
+    size_t i = 0;
+
+    while(i < length){
+
+        uint64_t bits = trace_splitmix(&state);
+
+        for(int k = 0; k < 8 && i < length; k++, bits >>= 8){
+            unsigned int byte = bits & 0xff;
+            data[i++] = byte < 16 ? '\n' : byte < 56 ? ' ' : 'a' + byte % 26;
+        }
+    }
+
+}
+
+void make_dirs_for(char* path){
+
+    for(char* slash = strchr(path, '/'); slash != NULL; slash = strchr(slash + 1, '/')){
+        *slash = '\0';
+        mkdir(path, 0755);
+        *slash = '/';
+    }
+
+}
+
+// Puts the recorded content in place, files already holding it are left
+// alone so their stat, and the library's stat cache, stay as they were
+void write_file(struct Replay* replay, struct TraceReader* reader){
+
+    char* path = read_path(replay, reader);
+    size_t size = trace_get_varint(reader);
+    size_t count = trace_get_varint(reader);
+
+    if(size > replay->content_cap){
+        replay->content_cap = size;
+        replay->content = (char*)realloc(replay->content, size);
+        replay->existing = (char*)realloc(replay->existing, size);
+    }
+
+    size_t position = 0;
+
+    for(size_t i = 0; i < count && !reader->failed; i++){
+
+        size_t length = trace_get_varint(reader);
+        uint64_t fingerprint = trace_get_fingerprint(reader);
+
+        if(length > size - position){
+            reader->failed = true;
+            return;
+        }
+
+        fill_chunk(replay->content + position, length, fingerprint);
+        position += length;
+    }
+
+    if(reader->failed || path == NULL || position != size){
+        reader->failed = true;
+        return;
+    }
+
+    struct stat st;
+
+    if(stat(path, &st) == 0 && (size_t)st.st_size == size){
+
+        FILE* file = fopen(path, "rb");
+        bool same = file != NULL && fread(replay->existing, 1, size, file) == size && memcmp(replay->existing, replay->content, size) == 0;
+
+        if(file != NULL){
+            fclose(file);
+        }
+
+        if(same){
+            return;
+        }
+    }
+
+    make_dirs_for(path);
+
+    FILE* file = fopen(path, "wb");
+
+    if(file != NULL){
+        fwrite(replay->content, 1, size, file);
+        fclose(file);
+    }
+
+}
+
+// Working copy records up to the call's TRACE_RUN
+void replay_files(struct Replay* replay, struct TraceReader* reader){
+
+    while(!reader->failed){
+
+        uint64_t record = trace_get_varint(reader);
+
+        if(record == TRACE_RUN){
+            return;
+        } else if(record == TRACE_FILE){
+            write_file(replay, reader);
+        } else if(record == TRACE_GONE){
+            char* path = read_path(replay, reader);
+            if(path != NULL){
+                remove(path);
+            }
+        } else {
+            reader->failed = true;
+        }
+    }
+
+}
+
+char* diff_buffer(struct Replay* replay, uint64_t buffer){
+
+    if(buffer == 0){
+        return NULL;
+    }
+
+    if(buffer - 1 > replay->buffer_cap){
+        replay->buffer_cap = buffer - 1;
+        replay->buffer = (char*)realloc(replay->buffer, replay->buffer_cap);
+    }
+
+    return replay->buffer;
+
+}
+
+svc_log* find_log(struct Replay* replay, uint64_t log){
+
+    return log < replay->num_logs ? replay->logs[log] : NULL;
+
+}
+
+// Merged stand-in for path, written to the numbered resolution file
+// It is our side with a line added, so the merge changes the path as the
+// recorded one did and commits
+char* write_stand_in(const char* path, int number){
+
+    char* resolved = (char*)malloc(strlen(REPLAY_RESOLVED) + 16);
+    sprintf(resolved, "%s.%d", REPLAY_RESOLVED, number);
+
+    FILE* in = fopen(path, "rb");
+    FILE* out = fopen(resolved, "wb");
+
+    if(out != NULL){
+
+        char block[4096];
+        size_t got;
+
+        while(in != NULL && (got = fread(block, 1, sizeof(block), in)) > 0){
+            fwrite(block, 1, got, out);
+        }
+
+        fputc('\n', out);
+        fclose(out);
+    }
+
+    if(in != NULL){
+        fclose(in);
+    }
+
+    return resolved;
+
+}
+
+// Resolves the paths the merge would leave in conflict that the recorded
+// resolutions do not cover
+void resolve_stand_ins(struct Replay* replay, struct Call* call){
+
+    int count = 0;
+    char** conflicts = svc_merge_conflicts(replay->helper, call->strings[0], &count);
+
+    if(conflicts == NULL || count == 0){
+        free(conflicts);
+        return;
+    }
+
+    int resolved = call->numbers[0] > 0 ? (int)call->numbers[0] : 0;
+    call->resolutions = (resolution*)realloc(call->resolutions, sizeof(resolution)*(resolved + count));
+
+    for(int i = 0; i < count; i++){
+
+        bool covered = false;
+
+        for(int r = 0; r < resolved && !covered; r++){
+            covered = call->resolutions[r].file_name != NULL && strcmp(call->resolutions[r].file_name, conflicts[i]) == 0;
+        }
+
+        if(!covered){
+            call->resolutions[resolved].file_name = conflicts[i];
+            call->resolutions[resolved].resolved_file = write_stand_in(conflicts[i], call->num_stand_ins++);
+            resolved++;
+        }
+    }
+
+    call->numbers[0] = resolved;
+    free(conflicts);
+
+}
+
+// Frees what reading and running the call allocated
+void free_call(struct Call* call){
+
+    // Stand-ins come last in the resolutions
+    int first = (int)call->numbers[0] - call->num_stand_ins;
+
+    for(int i = 0; i < call->num_stand_ins; i++){
+        remove(call->resolutions[first + i].resolved_file);
+        free(call->resolutions[first + i].resolved_file);
+    }
+
+    free(call->options.paths);
+    free(call->resolutions);
+
+}
+
+// Makes the call, returns how long it took and sets the commits it made
+double run_call(struct Replay* replay, struct Call* call, size_t* commits){
+
+    void* helper = replay->helper;
+    void* pointer = NULL;
+    char* text = NULL;
+    long number = 0;
+    int count = 0;
+    svc_checkout_plan plan;
+    svc_log_entry entry;
+    svc_options options = {.num_threads = (int)call->numbers[0], .compression = (int)call->numbers[1]};
+
+    // Merges that were clean when recorded stay clean, the lookup is not timed
+    if(call->op == TRACE_MERGE && call->recorded_commits > 0){
+        resolve_stand_ins(replay, call);
+    }
+
+    double start = now_seconds();
+
+    switch(call->op){
+        case TRACE_INIT: pointer = svc_init_opts(&options); break;
+        case TRACE_CLEANUP: cleanup(helper); break;
+        case TRACE_HASH_FILE: number = hash_file(helper, call->strings[0]); break;
+        case TRACE_COMMIT: text = svc_commit(helper, call->strings[0]); break;
+        case TRACE_GET_COMMIT: pointer = get_commit(helper, call->strings[0]); break;
+        case TRACE_RESOLVE_COMMIT: pointer = svc_resolve_commit(helper, call->strings[0]); break;
+        case TRACE_PREV_COMMITS: pointer = get_prev_commits(helper, call->commits[0], &count); break;
+        case TRACE_BRANCH_HEAD: pointer = svc_branch_head(helper, call->strings[0]); break;
+        case TRACE_IS_ANCESTOR: number = svc_is_ancestor(helper, call->commits[0], call->commits[1]); break;
+        case TRACE_MERGE_BASE: pointer = svc_merge_base(helper, call->commits[0], call->commits[1]); break;
+        case TRACE_COUNT_BETWEEN: number = svc_count_between(helper, call->commits[0], call->commits[1]); break;
+        case TRACE_DIFF: number = svc_diff(helper, call->commits[0], call->commits[1], diff_buffer(replay, call->buffer), call->buffer == 0 ? 0 : call->buffer - 1); break;
+        case TRACE_DIFF_WORKING: number = svc_diff_working(helper, diff_buffer(replay, call->buffer), call->buffer == 0 ? 0 : call->buffer - 1); break;
+        case TRACE_LOG_OPEN: pointer = svc_log_open(helper, call->commits[0], call->has_options ? &call->options : NULL); break;
+        case TRACE_LOG_NEXT: number = svc_log_next(find_log(replay, call->log), &entry); break;
+        case TRACE_LOG_CLOSE: svc_log_close(find_log(replay, call->log)); break;
+        case TRACE_PRINT_COMMIT: print_commit(helper, call->strings[0]); break;
+        case TRACE_BRANCH: number = svc_branch(helper, call->strings[0]); break;
+        case TRACE_CHECKOUT: number = svc_checkout(helper, call->strings[0]); break;
+        case TRACE_PLAN_CHECKOUT: number = svc_plan_checkout(helper, call->strings[0], &plan); break;
+        case TRACE_LIST_BRANCHES: pointer = list_branches(helper, &count); break;
+        case TRACE_ADD: number = svc_add(helper, call->strings[0]); break;
+        case TRACE_RM: number = svc_rm(helper, call->strings[0]); break;
+        case TRACE_RESET: number = svc_reset(helper, call->strings[0]); break;
+        case TRACE_MERGE: text = svc_merge(helper, call->strings[0], call->resolutions, (int)call->numbers[0]); break;
+        case TRACE_MERGE_CONFLICTS: pointer = svc_merge_conflicts(helper, call->strings[0], &count); break;
+    }
+
+    double elapsed = now_seconds() - start;
+
+    *commits = 0;
+
+    switch(call->op){
+
+        case TRACE_INIT:
+            replay->helper = pointer;
+            break;
+
+        case TRACE_CLEANUP:
+            replay->helper = NULL;
+            break;
+
+        case TRACE_COMMIT:
+        case TRACE_MERGE:
+            *commits = text != NULL;
+            break;
+
+        case TRACE_CHECKOUT:
+            if(number == 0){
+                replay->branch = call->strings[0];
+            }
+            break;
+
+        case TRACE_PLAN_CHECKOUT:
+            if(number == 0){
+                svc_free_plan(&plan);
+            }
+            break;
+
+        case TRACE_PREV_COMMITS:
+        case TRACE_LIST_BRANCHES:
+        case TRACE_MERGE_CONFLICTS:
+            free(pointer);
+            break;
+
+        case TRACE_LOG_OPEN:
+            if(replay->num_logs == replay->cap_logs){
+                replay->cap_logs = replay->cap_logs == 0 ? 16 : replay->cap_logs*2;
+                replay->logs = (svc_log**)realloc(replay->logs, sizeof(svc_log*)*replay->cap_logs);
+            }
+            replay->logs[replay->num_logs++] = (svc_log*)pointer;
+            break;
+
+        case TRACE_LOG_CLOSE:
+            if(call->log < replay->num_logs){
+                replay->logs[call->log] = NULL;
+            }
+            break;
+    }
+
+    // The creation numbers the recording gave the call's commits name the
+    // commit the replay made, or none
+    void* made = *commits > 0 ? svc_branch_head(helper, replay->branch) : NULL;
+    add_commits(replay, call->recorded_commits, made, made == NULL ? NULL : text);
+
+    return elapsed;
+
+}
+
+void record(struct OpTimes* op, double recorded, double replayed){
+
+    if(op->count == op->cap){
+        op->cap = op->cap == 0 ? 64 : op->cap*2;
+        op->recorded = (double*)realloc(op->recorded, sizeof(double)*op->cap);
+        op->replayed = (double*)realloc(op->replayed, sizeof(double)*op->cap);
+    }
+
+    op->recorded[op->count] = recorded;
+    op->replayed[op->count] = replayed;
+    op->count++;
+
+}
+
+int compare_doubles(const void* a, const void* b){
+
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+
+}
+
+// Nearest rank percentile, sorts the samples
+double percentile(double* samples, size_t count, double fraction){
+
+    qsort(samples, count, sizeof(double), compare_doubles);
+
+    size_t rank = (size_t)ceil(fraction * count);
+
+    return samples[rank == 0 ? 0 : rank - 1];
+
+}
+
+void report(FILE* out, const char* format, const char* trace_path, struct Replay* replay){
+
+    bool json = strcmp(format, "json") == 0;
+    bool first = true;
+
+    if(json){
+        fprintf(out, "{\"trace\": \"%s\", \"ops\": [\n", trace_path);
+    } else {
+        fprintf(out, "op,calls,recorded_s,replayed_s,recorded_p50_us,replayed_p50_us,replayed_p99_us,mismatches\n");
+    }
+
+    for(int i = 1; i < TRACE_NUM_OPS; i++){
+
+        struct OpTimes* op = &replay->ops[i];
+
+        if(op->count == 0){
+            continue;
+        }
+
+        double recorded = 0;
+        double replayed = 0;
+
+        for(size_t s = 0; s < op->count; s++){
+            recorded += op->recorded[s];
+            replayed += op->replayed[s];
+        }
+
+        double recorded_p50 = percentile(op->recorded, op->count, 0.50) * 1e6;
+        double replayed_p50 = percentile(op->replayed, op->count, 0.50) * 1e6;
+        double replayed_p99 = percentile(op->replayed, op->count, 0.99) * 1e6;
+
+        if(json){
+            fprintf(out, "%s  {\"op\": \"%s\", \"calls\": %zu, \"recorded_s\": %.6f, \"replayed_s\": %.6f, \"recorded_p50_us\": %.2f, \"replayed_p50_us\": %.2f, \"replayed_p99_us\": %.2f, \"mismatches\": %zu}", first ? "" : ",\n", trace_op_names[i], op->count, recorded, replayed, recorded_p50, replayed_p50, replayed_p99, op->mismatches);
+        } else {
+            fprintf(out, "%s,%zu,%.6f,%.6f,%.2f,%.2f,%.2f,%zu\n", trace_op_names[i], op->count, recorded, replayed, recorded_p50, replayed_p50, replayed_p99, op->mismatches);
+        }
+
+        first = false;
+    }
+
+    if(json){
+        fprintf(out, "\n]}\n");
+    }
+
+}
+
+int main(int argc, char** argv){
+
+    const char* format = "csv";
+    const char* directory = REPLAY_DIR;
+    int option;
+
+    while((option = getopt(argc, argv, "f:d:")) != -1){
+        switch(option){
+            case 'f': format = optarg; break;
+            case 'd': directory = optarg; break;
+            default: optind = argc + 1; break;
+        }
+    }
+
+    if(optind != argc - 1 || (strcmp(format, "csv") != 0 && strcmp(format, "json") != 0)){
+        fprintf(stderr, "usage: %s [-f csv|json] [-d directory] trace\n", argv[0]);
+        return 1;
+    }
+
+    const char* trace_path = argv[optind];
+    FILE* file = fopen(trace_path, "rb");
+
+    if(file == NULL){
+        fprintf(stderr, "can not read %s\n", trace_path);
+        return 1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    unsigned char* data = (unsigned char*)malloc(length > 0 ? length : 1);
+    size_t got = fread(data, 1, length, file);
+    fclose(file);
+
+    struct TraceReader reader = {data, got, 0, false};
+    const char* magic = trace_get_bytes(&reader, TRACE_MAGIC_LENGTH);
+
+    if(magic == NULL || memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LENGTH) != 0 || trace_get_varint(&reader) != TRACE_VERSION){
+        fprintf(stderr, "%s is not a version %d trace\n", trace_path, TRACE_VERSION);
+        return 1;
+    }
+
+    trace_get_varint(&reader);
+
+    if(mkdir(directory, 0755) != 0 || chdir(directory) != 0){
+        fprintf(stderr, "can not make %s, it must not exist yet\n", directory);
+        return 1;
+    }
+
+    struct Replay replay;
+    memset(&replay, 0, sizeof(replay));
+    replay.branch = "master";
+
+    // Library calls print their outcome, none of it is wanted here
+    FILE* saved = stdout;
+    stdout = fopen("/dev/null", "w");
+
+    while(reader.position < reader.length){
+
+        struct Call call;
+        memset(&call, 0, sizeof(call));
+        call.op = reader.data[reader.position++];
+
+        if(call.op == 0 || call.op >= TRACE_NUM_OPS || (call.op != TRACE_INIT && replay.helper == NULL)){
+            reader.failed = true;
+            break;
+        }
+
+        read_arguments(&replay, &reader, &call);
+        replay_files(&replay, &reader);
+        call.recorded = trace_get_varint(&reader) / 1e9;
+        call.recorded_commits = trace_get_varint(&reader);
+
+        if(reader.failed){
+            free_call(&call);
+            break;
+        }
+
+        size_t commits = 0;
+        double replayed = run_call(&replay, &call, &commits);
+
+        free_call(&call);
+
+        record(&replay.ops[call.op], call.recorded, replayed);
+
+        if(call.recorded_commits != commits){
+            replay.ops[call.op].mismatches++;
+        }
+    }
+
+    // Traces cut short by a crash leave the system open
+    if(replay.helper != NULL){
+        cleanup(replay.helper);
+    }
+
+    fclose(stdout);
+    stdout = saved;
+
+    if(reader.failed){
+        fprintf(stderr, "%s ends inside a call, replayed up to it\n", trace_path);
+    }
+
+    report(stdout, format, trace_path, &replay);
+
+    for(size_t i = 0; i < replay.num_strings; i++){
+        free(replay.strings[i]);
+    }
+    for(int i = 0; i < TRACE_NUM_OPS; i++){
+        free(replay.ops[i].recorded);
+        free(replay.ops[i].replayed);
+    }
+    free(replay.strings);
+    free(replay.commits);
+    free(replay.ids);
+    free(replay.logs);
+    free(replay.content);
+    free(replay.existing);
+    free(replay.buffer);
+    free(data);
+
+    return 0;
+
+}
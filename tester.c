@@ -1,8 +1,18 @@
+#define _XOPEN_SOURCE 700 // nftw
 #include <assert.h>
 #include "svc.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
 // #include "svc.c"
 // #include "structs.h"
+#include "structures.h"
 
 
 void test_hash(void* helper){
@@ -12,17 +22,1241 @@ void test_hash(void* helper){
 
 }
 
+// Each test runs in a directory of its own below the scratch directory
+void enter(const char* name){
+
+    mkdir(name, 0755);
+    int entered = chdir(name);
+    assert(entered == 0);
+
+}
+
+void leave(void){
+
+    int left = chdir("..");
+    assert(left == 0);
+
+}
+
+void write_file(const char* path, const char* contents){
+
+    FILE* file = fopen(path, "w");
+    assert(file != NULL);
+    fputs(contents, file);
+    fclose(file);
+
+}
+
+// True if the file at path holds exactly contents
+int file_is(const char* path, const char* contents){
+
+    char buffer[8192];
+    FILE* file = fopen(path, "r");
+
+    if(file == NULL){
+        return 0;
+    }
+
+    size_t length = fread(buffer, 1, sizeof(buffer) - 1, file);
+    buffer[length] = '\0';
+    fclose(file);
+
+    return strcmp(buffer, contents) == 0;
+
+}
+
+int remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw){
+
+    return remove(path);
+
+}
+
+// Live blobs holding contents, and the references held on them
+size_t blob_count(void* helper, const char* contents, size_t* refs){
+
+    struct System* system = (struct System*)helper;
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    size_t count = 0;
+
+    sha256(contents, strlen(contents), digest);
+    *refs = 0;
+
+    for(size_t i = 0; i < system->num_blobs; i++){
+        if(system->blobs[i].refcount > 0 && memcmp(system->blobs[i].digest, digest, SHA256_DIGEST_SIZE) == 0){
+            count++;
+            *refs += system->blobs[i].refcount;
+        }
+    }
+
+    return count;
+
+}
+
+void test_blob_store(void){
+
+    enter("blob_store");
+
+    void *helper = svc_init();
+    size_t refs = 0;
+
+    // Identical contents are stored once
+    write_file("a.txt", "same\n");
+    write_file("b.txt", "same\n");
+    svc_add(helper, "a.txt");
+    svc_add(helper, "b.txt");
+    assert(blob_count(helper, "same\n", &refs) == 1);
+    assert(refs == 2);
+
+    char *first = svc_commit(helper, "first");
+    assert(first != NULL);
+
+    write_file("a.txt", "other\n");
+    char *second = svc_commit(helper, "second");
+    assert(second != NULL);
+
+    size_t committed = 0;
+    assert(blob_count(helper, "other\n", &committed) == 1);
+
+    // The staging area lets go of its reference, the second commit keeps its own
+    int reset = svc_reset(helper, first);
+    assert(reset == 0);
+    assert(file_is("a.txt", "same\n"));
+    assert(blob_count(helper, "other\n", &refs) == 1);
+    assert(refs == committed - 1);
+
+    cleanup(helper);
+    leave();
+
+}
+
+void test_resolve_commit(void){
+
+    enter("resolve_commit");
+
+    void *helper = svc_init();
+    char *ids[20];
+    char contents[16];
+
+    write_file("a.txt", "start\n");
+    svc_add(helper, "a.txt");
+
+    for(int i = 0; i < 20; i++){
+        snprintf(contents, sizeof(contents), "%d\n", i);
+        write_file("a.txt", contents);
+        ids[i] = svc_commit(helper, "change");
+        assert(ids[i] != NULL);
+    }
+
+    // Twenty ids over sixteen hex digits, so two of them share a first digit
+    int shared = -1;
+    for(int i = 0; i < 20 && shared < 0; i++){
+        for(int j = i + 1; j < 20; j++){
+            if(ids[i][0] == ids[j][0] && strcmp(ids[i], ids[j]) != 0){
+                shared = i;
+                break;
+            }
+        }
+    }
+
+    assert(shared >= 0);
+    char ambiguous[2] = {ids[shared][0], '\0'};
+    assert(svc_resolve_commit(helper, ambiguous) == NULL);
+
+    // Every commit is found by the shortest prefix no other id starts with
+    for(int i = 0; i < 20; i++){
+
+        // Commits with the same id are both found as the one made first
+        size_t length = 1;
+        for(int j = 0; j < 20; j++){
+            while(strcmp(ids[i], ids[j]) != 0 && strncmp(ids[i], ids[j], length) == 0){
+                length++;
+            }
+        }
+
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), "%.*s", (int)length, ids[i]);
+
+        void *commit = get_commit(helper, ids[i]);
+        assert(commit != NULL);
+        assert(svc_resolve_commit(helper, prefix) == commit);
+    }
+
+    assert(svc_resolve_commit(helper, "") == NULL);
+    assert(svc_resolve_commit(helper, "xyz") == NULL);
+
+    cleanup(helper);
+    leave();
+
+}
+
+// Id of the head commit of the named branch, NULL if there is none
+const char* head_id(void* helper, const char* branch){
+
+    struct System* system = (struct System*)helper;
+
+    for(size_t b = 0; b < system->num_branches; b++){
+        if(strcmp(system->branches[b], branch) == 0){
+            return system->branch_ptrs[b] == NULL ? NULL : system->branch_ptrs[b]->id;
+        }
+    }
+
+    return NULL;
+
+}
+
+// Run part of a test in a process of its own, as a second run of a program would
+void in_child(void (*run)(void)){
+
+    fflush(stdout);
+    pid_t pid = fork();
+    assert(pid >= 0);
+
+    if(pid == 0){
+        run();
+        exit(0);
+    }
+
+    int status = 0;
+    pid_t waited = waitpid(pid, &status, 0);
+    assert(waited == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+}
+
+// Commit ids are handed from one run to the next through these files
+void persist_first(void){
+
+    void *helper = svc_open("repo");
+    assert(helper != NULL);
+
+    write_file("a.txt", "one\n");
+    write_file("b.txt", "two\n");
+    svc_add(helper, "a.txt");
+    svc_add(helper, "b.txt");
+
+    char *first = svc_commit(helper, "first");
+    assert(first != NULL);
+    write_file("first.id", first);
+
+    int branched = svc_branch(helper, "dev");
+    assert(branched == 0);
+
+    cleanup(helper);
+
+}
+
+void persist_second(void){
+
+    void *helper = svc_open("repo");
+    assert(helper != NULL);
+
+    char first[64];
+    FILE* file = fopen("first.id", "r");
+    assert(file != NULL);
+    char *read = fgets(first, sizeof(first), file);
+    assert(read != NULL);
+    fclose(file);
+
+    assert(strcmp(head_id(helper, "master"), first) == 0);
+    assert(strcmp(head_id(helper, "dev"), first) == 0);
+    assert(get_commit(helper, first) != NULL);
+
+    // The staging area came back with its files, so nothing is left to commit
+    char *nothing = svc_commit(helper, "nothing");
+    assert(nothing == NULL);
+
+    int checked_out = svc_checkout(helper, "dev");
+    assert(checked_out == 0);
+    write_file("a.txt", "one more\n");
+
+    char *second = svc_commit(helper, "second");
+    assert(second != NULL);
+    write_file("second.id", second);
+
+    cleanup(helper);
+
+}
+
+void persist_third(void){
+
+    void *helper = svc_open("repo");
+    assert(helper != NULL);
+
+    assert(file_is("first.id", head_id(helper, "master")));
+    assert(file_is("second.id", head_id(helper, "dev")));
+
+    // Dev is still the active branch, and checking out master restores its files
+    int checked_out = svc_checkout(helper, "master");
+    assert(checked_out == 0);
+    assert(file_is("a.txt", "one\n"));
+
+    int n_prev = 0;
+    char **prev = get_prev_commits(helper, get_commit(helper, (char*)head_id(helper, "dev")), &n_prev);
+    assert(n_prev == 1);
+    assert(strcmp(prev[0], head_id(helper, "master")) == 0);
+    free(prev);
+
+    cleanup(helper);
+
+}
+
+void test_open_persistence(void){
+
+    enter("persistence");
+
+    in_child(persist_first);
+    in_child(persist_second);
+    in_child(persist_third);
+
+    leave();
+
+}
+
+void test_racy_stat(void){
+
+    enter("racy_stat");
+
+    void *helper = svc_init();
+
+    write_file("a.txt", "aaaa\n");
+    svc_add(helper, "a.txt");
+    char *first = svc_commit(helper, "first");
+    assert(first != NULL);
+
+    // Same size and, on coarse clocks, the same timestamps as the recorded stat
+    write_file("a.txt", "bbbb\n");
+    char *second = svc_commit(helper, "second");
+    assert(second != NULL);
+
+    char *nothing = svc_commit(helper, "nothing");
+    assert(nothing == NULL);
+
+    cleanup(helper);
+    leave();
+
+}
+
+void test_add_rm_add(void){
+
+    enter("add_rm_add");
+
+    void *helper = svc_init();
+
+    write_file("a.txt", "alpha\n");
+    write_file("b.txt", "beta\n");
+
+    int hash = svc_add(helper, "a.txt");
+    assert(hash == hash_file(helper, "a.txt"));
+    int added = svc_add(helper, "b.txt");
+    assert(added == hash_file(helper, "b.txt"));
+
+    // Removing leaves a tombstone that must not hide the path or its neighbours
+    int removed = svc_rm(helper, "a.txt");
+    assert(removed == hash);
+    removed = svc_rm(helper, "a.txt");
+    assert(removed == -2);
+    added = svc_add(helper, "b.txt");
+    assert(added == -2);
+
+    added = svc_add(helper, "a.txt");
+    assert(added == hash);
+    added = svc_add(helper, "a.txt");
+    assert(added == -2);
+
+    char *id = svc_commit(helper, "both");
+    assert(id != NULL);
+
+    // Both files made it into the commit
+    write_file("a.txt", "changed\n");
+    write_file("b.txt", "changed\n");
+    int reset = svc_reset(helper, id);
+    assert(reset == 0);
+    assert(file_is("a.txt", "alpha\n"));
+    assert(file_is("b.txt", "beta\n"));
+
+    cleanup(helper);
+    leave();
+
+}
+
+// Two commits over enough files to be scanned on the worker threads
+// The ids are copied into first and second
+void threaded_commits(int num_threads, char* first, char* second){
+
+    svc_options options = {num_threads};
+    void *helper = svc_init_opts(&options);
+    char name[32];
+    char contents[32];
+
+    for(int i = 0; i < 200; i++){
+        snprintf(name, sizeof(name), "f%d.txt", i);
+        snprintf(contents, sizeof(contents), "file %d\n", i);
+        write_file(name, contents);
+        svc_add(helper, name);
+    }
+
+    char *id = svc_commit(helper, "first");
+    assert(id != NULL);
+    strcpy(first, id);
+
+    for(int i = 0; i < 200; i += 3){
+        snprintf(name, sizeof(name), "f%d.txt", i);
+        snprintf(contents, sizeof(contents), "changed %d\n", i);
+        write_file(name, contents);
+    }
+
+    id = svc_commit(helper, "second");
+    assert(id != NULL);
+    strcpy(second, id);
+
+    cleanup(helper);
+
+}
+
+void test_thread_count(void){
+
+    char first[2][64];
+    char second[2][64];
+
+    enter("one_thread");
+    threaded_commits(1, first[0], second[0]);
+    leave();
+
+    enter("eight_threads");
+    threaded_commits(8, first[1], second[1]);
+    leave();
+
+    assert(strcmp(first[0], first[1]) == 0);
+    assert(strcmp(second[0], second[1]) == 0);
+    assert(strcmp(first[0], second[0]) != 0);
+
+}
+
+struct AllocCount {
+
+    size_t allocs;
+    size_t releases;
+    size_t live_bytes;
+
+};
+
+void *counting_alloc(size_t size, void *user){
+
+    struct AllocCount* count = (struct AllocCount*)user;
+    count->allocs++;
+    count->live_bytes += size;
+
+    return malloc(size);
+
+}
+
+void counting_release(void *ptr, size_t size, void *user){
+
+    struct AllocCount* count = (struct AllocCount*)user;
+    count->releases++;
+    count->live_bytes -= size;
+
+    free(ptr);
+
+}
+
+void test_custom_allocator(void){
+
+    enter("custom_allocator");
+
+    struct AllocCount count = {0, 0, 0};
+    svc_options options = {0, counting_alloc, counting_release, &count};
+    void *helper = svc_init_opts(&options);
+    char contents[16];
+
+    write_file("a.txt", "start\n");
+    svc_add(helper, "a.txt");
+
+    for(int i = 0; i < 50; i++){
+        snprintf(contents, sizeof(contents), "%d\n", i);
+        write_file("a.txt", contents);
+        char *id = svc_commit(helper, "change");
+        assert(id != NULL);
+    }
+
+    // History metadata came from the allocator, and all of it goes back
+    assert(count.allocs > 0);
+    cleanup(helper);
+    assert(count.releases == count.allocs);
+    assert(count.live_bytes == 0);
+
+    leave();
+
+}
+
+void test_plan_checkout(void){
+
+    enter("plan_checkout");
+
+    void *helper = svc_init();
+
+    write_file("a.txt", "aaa\n");
+    write_file("b.txt", "bb\n");
+    write_file("same.txt", "same\n");
+    svc_add(helper, "a.txt");
+    svc_add(helper, "b.txt");
+    svc_add(helper, "same.txt");
+    char *first = svc_commit(helper, "first");
+    assert(first != NULL);
+
+    int branched = svc_branch(helper, "dev");
+    assert(branched == 0);
+    int checked_out = svc_checkout(helper, "dev");
+    assert(checked_out == 0);
+
+    write_file("a.txt", "aaaaaa\n");
+    write_file("c.txt", "c\n");
+    svc_add(helper, "c.txt");
+    svc_rm(helper, "b.txt");
+    char *second = svc_commit(helper, "second");
+    assert(second != NULL);
+
+    checked_out = svc_checkout(helper, "master");
+    assert(checked_out == 0);
+
+    // Unchanged files are left out, the rest come in path order
+    svc_checkout_plan plan;
+    int planned = svc_plan_checkout(helper, "dev", &plan);
+    assert(planned == 0);
+    assert(plan.n_entries == 3);
+    assert(strcmp(plan.entries[0].file_name, "a.txt") == 0);
+    assert(plan.entries[0].action == SVC_PLAN_UPDATE && plan.entries[0].bytes == 7);
+    assert(strcmp(plan.entries[1].file_name, "b.txt") == 0);
+    assert(plan.entries[1].action == SVC_PLAN_DELETE && plan.entries[1].bytes == 0);
+    assert(strcmp(plan.entries[2].file_name, "c.txt") == 0);
+    assert(plan.entries[2].action == SVC_PLAN_CREATE && plan.entries[2].bytes == 2);
+    assert(plan.bytes == 9);
+    svc_free_plan(&plan);
+
+    planned = svc_plan_checkout(helper, "missing", &plan);
+    assert(planned == -1);
+
+    // Planning does nothing to the working copy
+    assert(file_is("a.txt", "aaa\n"));
+
+    cleanup(helper);
+    leave();
+
+}
+
+// Give a file an old modification time, so a rewrite shows up
+void age_file(const char* path){
+
+    struct timeval times[2] = {{1000000, 0}, {1000000, 0}};
+    int aged = utimes(path, times);
+    assert(aged == 0);
+
+}
+
+time_t mtime_of(const char* path){
+
+    struct stat st;
+    int found = stat(path, &st);
+    assert(found == 0);
+
+    return st.st_mtime;
+
+}
+
+void test_reset_writes(void){
+
+    enter("reset_writes");
+
+    void *helper = svc_init();
+
+    write_file("a.txt", "alpha\n");
+    write_file("b.txt", "beta\n");
+    svc_add(helper, "a.txt");
+    svc_add(helper, "b.txt");
+    char *first = svc_commit(helper, "first");
+    assert(first != NULL);
+
+    write_file("a.txt", "edited\n");
+    age_file("a.txt");
+    age_file("b.txt");
+
+    int reset = svc_reset(helper, first);
+    assert(reset == 0);
+
+    // Only the file that differs from the commit is written
+    assert(file_is("a.txt", "alpha\n"));
+    assert(mtime_of("a.txt") != 1000000);
+    assert(file_is("b.txt", "beta\n"));
+    assert(mtime_of("b.txt") == 1000000);
+
+    cleanup(helper);
+    leave();
+
+}
+
+// Eight numbered lines with line number changed marked as version
+void versioned_contents(char* buffer, size_t size, int changed, int version){
+
+    size_t length = 0;
+
+    for(int line = 0; line < 8; line++){
+        int mark = line == changed ? version : 0;
+        length += snprintf(buffer + length, size - length, "line %d of a file long enough for deltas %d\n", line, mark);
+    }
+
+}
+
+void test_delta_chain(void){
+
+    enter("delta_chain");
+
+    void *helper = svc_init();
+    struct System* system = (struct System*)helper;
+
+    // Far more versions than a chain may hold, so chains are restarted
+    char contents[512];
+    char message[32];
+    char *ids[25];
+
+    versioned_contents(contents, sizeof(contents), -1, 0);
+    write_file("a.txt", contents);
+    svc_add(helper, "a.txt");
+
+    for(int v = 0; v < 25; v++){
+        versioned_contents(contents, sizeof(contents), v % 8, v + 1);
+        write_file("a.txt", contents);
+        snprintf(message, sizeof(message), "version %d", v + 1);
+        ids[v] = svc_commit(helper, message);
+        assert(ids[v] != NULL);
+    }
+
+    int max_depth = 0;
+    for(size_t i = 0; i < system->num_blobs; i++){
+        if(system->blobs[i].refcount > 0 && system->blobs[i].depth > max_depth){
+            max_depth = system->blobs[i].depth;
+        }
+    }
+    assert(max_depth > 1);
+
+    // Every version comes back intact, oldest first so nothing is cached
+    // Ids can repeat, and a repeated id only finds the first of its commits
+    for(int v = 0; v < 25; v++){
+
+        bool repeated = false;
+        for(int w = 0; w < v; w++){
+            repeated = repeated || strcmp(ids[w], ids[v]) == 0;
+        }
+        if(repeated){
+            continue;
+        }
+
+        int reset = svc_reset(helper, ids[v]);
+        assert(reset == 0);
+        versioned_contents(contents, sizeof(contents), v % 8, v + 1);
+        assert(file_is("a.txt", contents));
+    }
+
+    cleanup(helper);
+    leave();
+
+}
+
+// Codec of the live blob holding contents, -1 if there is none
+int blob_codec(void* helper, const char* contents){
+
+    struct System* system = (struct System*)helper;
+    unsigned char digest[SHA256_DIGEST_SIZE];
+
+    sha256(contents, strlen(contents), digest);
+
+    for(size_t i = 0; i < system->num_blobs; i++){
+        if(system->blobs[i].refcount > 0 && memcmp(system->blobs[i].digest, digest, SHA256_DIGEST_SIZE) == 0){
+            return system->blobs[i].codec;
+        }
+    }
+
+    return -1;
+
+}
+
+void compressed_round_trip(int compression){
+
+    svc_options options = {0};
+    options.compression = compression;
+    void *helper = svc_init_opts(&options);
+
+    // Repetitive enough for any codec to shrink
+    char contents[4096];
+    size_t length = 0;
+    for(int line = 0; length + 64 < sizeof(contents); line++){
+        length += snprintf(contents + length, sizeof(contents) - length, "%d: the same words over and over\n", line % 10);
+    }
+
+    write_file("a.txt", contents);
+    svc_add(helper, "a.txt");
+    char *first = svc_commit(helper, "first");
+    assert(first != NULL);
+
+    int codec = blob_codec(helper, contents);
+    assert(compression == SVC_COMPRESS_NONE ? codec == 0 : codec != 0);
+
+    write_file("a.txt", "something else\n");
+    char *second = svc_commit(helper, "second");
+    assert(second != NULL);
+
+    int reset = svc_reset(helper, first);
+    assert(reset == 0);
+    assert(file_is("a.txt", contents));
+
+    cleanup(helper);
+
+}
+
+void test_compression_modes(void){
+
+    enter("compress_fast");
+    compressed_round_trip(SVC_COMPRESS_FAST);
+    leave();
+
+    enter("compress_high");
+    compressed_round_trip(SVC_COMPRESS_HIGH);
+    leave();
+
+    enter("compress_none");
+    compressed_round_trip(SVC_COMPRESS_NONE);
+    leave();
+
+}
+
+// Commit that must succeed, returns its id
+char* must_commit(void* helper, char* message){
+
+    char *id = svc_commit(helper, message);
+    assert(id != NULL);
+
+    return id;
+
+}
+
+void must_checkout(void* helper, char* branch){
+
+    int checked_out = svc_checkout(helper, branch);
+    assert(checked_out == 0);
+
+}
+
+// Master and dev both at a commit of a.txt and b.txt, dev checked out
+void *merge_setup(const char* a){
+
+    void *helper = svc_init();
+
+    write_file("a.txt", a);
+    write_file("b.txt", "bee\n");
+    svc_add(helper, "a.txt");
+    svc_add(helper, "b.txt");
+    must_commit(helper, "base");
+
+    int branched = svc_branch(helper, "dev");
+    assert(branched == 0);
+    must_checkout(helper, "dev");
+
+    return helper;
+
+}
+
+// Paths svc_merge would stop on, each must be one of expected
+int merge_conflicts(void* helper, const char* expected){
+
+    int n_conflicts = -1;
+    char **conflicts = svc_merge_conflicts(helper, "dev", &n_conflicts);
+
+    for(int i = 0; i < n_conflicts; i++){
+        assert(expected != NULL && strcmp(conflicts[i], expected) == 0);
+    }
+
+    free(conflicts);
+
+    return n_conflicts;
+
+}
+
+void test_merge_theirs_only(void){
+
+    enter("theirs_only");
+
+    void *helper = merge_setup("1\n2\n3\n");
+
+    write_file("a.txt", "1\ntwo\n3\n");
+    must_commit(helper, "dev edit");
+
+    must_checkout(helper, "master");
+    assert(file_is("a.txt", "1\n2\n3\n"));
+    assert(merge_conflicts(helper, NULL) == 0);
+
+    char *merged = svc_merge(helper, "dev", NULL, 0);
+    assert(merged != NULL);
+    assert(file_is("a.txt", "1\ntwo\n3\n"));
+
+    cleanup(helper);
+    leave();
+
+}
+
+void test_merge_ours_only(void){
+
+    enter("ours_only");
+
+    void *helper = merge_setup("1\n2\n3\n");
+
+    // Dev only touches b.txt, so there is something to merge
+    write_file("b.txt", "bee two\n");
+    must_commit(helper, "dev edit");
+
+    must_checkout(helper, "master");
+    write_file("a.txt", "1\n2\nthree\n");
+    must_commit(helper, "master edit");
+
+    char *merged = svc_merge(helper, "dev", NULL, 0);
+    assert(merged != NULL);
+    assert(file_is("a.txt", "1\n2\nthree\n"));
+    assert(file_is("b.txt", "bee two\n"));
+
+    cleanup(helper);
+    leave();
+
+}
+
+void test_merge_separate_lines(void){
+
+    enter("separate_lines");
+
+    void *helper = merge_setup("1\n2\n3\n4\n5\n");
+
+    write_file("a.txt", "one\n2\n3\n4\n5\n");
+    must_commit(helper, "dev edit");
+
+    must_checkout(helper, "master");
+    write_file("a.txt", "1\n2\n3\n4\nfive\n");
+    must_commit(helper, "master edit");
+
+    assert(merge_conflicts(helper, NULL) == 0);
+
+    char *merged = svc_merge(helper, "dev", NULL, 0);
+    assert(merged != NULL);
+    assert(file_is("a.txt", "one\n2\n3\n4\nfive\n"));
+
+    // Both heads are parents of the merge
+    int n_prev = 0;
+    char **prev = get_prev_commits(helper, get_commit(helper, merged), &n_prev);
+    assert(n_prev == 2);
+    free(prev);
+
+    cleanup(helper);
+    leave();
+
+}
+
+void test_merge_conflict(void){
+
+    enter("conflict");
+
+    void *helper = merge_setup("1\n2\n3\n");
+
+    write_file("a.txt", "1\ndev\n3\n");
+    must_commit(helper, "dev edit");
+
+    must_checkout(helper, "master");
+    write_file("a.txt", "1\nmaster\n3\n");
+    must_commit(helper, "master edit");
+
+    assert(merge_conflicts(helper, "a.txt") == 1);
+
+    // Nothing is written until every conflict is resolved
+    char *merged = svc_merge(helper, "dev", NULL, 0);
+    assert(merged == NULL);
+    assert(file_is("a.txt", "1\nmaster\n3\n"));
+
+    write_file("resolved.txt", "1\nboth\n3\n");
+    resolution resolutions[1] = {{"a.txt", "resolved.txt"}};
+    merged = svc_merge(helper, "dev", resolutions, 1);
+    assert(merged != NULL);
+    assert(file_is("a.txt", "1\nboth\n3\n"));
+
+    cleanup(helper);
+    leave();
+
+}
+
+void test_merge_delete_modify(void){
+
+    enter("delete_modify");
+
+    void *helper = merge_setup("1\n2\n3\n");
+
+    int removed = svc_rm(helper, "a.txt");
+    assert(removed >= 0);
+    remove("a.txt");
+    must_commit(helper, "dev delete");
+
+    must_checkout(helper, "master");
+    write_file("a.txt", "1\n2\nthree\n");
+    must_commit(helper, "master edit");
+
+    assert(merge_conflicts(helper, "a.txt") == 1);
+
+    char *merged = svc_merge(helper, "dev", NULL, 0);
+    assert(merged == NULL);
+
+    cleanup(helper);
+    leave();
+
+}
+
+// Commit a new version of a.txt on branch, which must be active
+// Returns the commit, found by branch since ids can repeat
+void *edit_and_commit(void* helper, char* branch, const char* contents){
+
+    write_file("a.txt", contents);
+    must_commit(helper, (char*)contents);
+
+    return svc_branch_head(helper, branch);
+
+}
+
+void test_ancestry(void){
+
+    enter("ancestry");
+
+    void *helper = svc_init();
+
+    write_file("a.txt", "base\n");
+    svc_add(helper, "a.txt");
+    must_commit(helper, "base");
+    void *base = svc_branch_head(helper, "master");
+
+    int branched = svc_branch(helper, "dev");
+    assert(branched == 0);
+
+    edit_and_commit(helper, "master", "m1\n");
+    void *ours = edit_and_commit(helper, "master", "m2\n");
+
+    must_checkout(helper, "dev");
+    edit_and_commit(helper, "dev", "d1\n");
+    edit_and_commit(helper, "dev", "d2\n");
+    void *theirs = edit_and_commit(helper, "dev", "d3\n");
+
+    assert(svc_merge_base(helper, ours, theirs) == base);
+    assert(svc_merge_base(helper, base, theirs) == base);
+    assert(svc_is_ancestor(helper, base, theirs) == 1);
+    assert(svc_is_ancestor(helper, ours, theirs) == 0);
+
+    assert(svc_count_between(helper, ours, theirs) == 3);
+    assert(svc_count_between(helper, theirs, ours) == 2);
+    assert(svc_count_between(helper, NULL, theirs) == 4);
+    assert(svc_count_between(helper, theirs, theirs) == 0);
+    assert(svc_count_between(helper, base, NULL) == -1);
+
+    // Once merged, the branch head is the base and nothing is left to count
+    must_checkout(helper, "master");
+    write_file("resolved.txt", "both\n");
+    resolution resolutions[1] = {{"a.txt", "resolved.txt"}};
+    char *merged_id = svc_merge(helper, "dev", resolutions, 1);
+    assert(merged_id != NULL);
+    void *merged = svc_branch_head(helper, "master");
+
+    assert(svc_merge_base(helper, merged, theirs) == theirs);
+    assert(svc_count_between(helper, merged, theirs) == 0);
+    assert(svc_count_between(helper, theirs, merged) == 3);
+
+    cleanup(helper);
+    leave();
+
+}
+
+void test_diff(void){
+
+    enter("diff");
+
+    void *helper = svc_init();
+
+    write_file("a.txt", "one\ntwo\nthree\n");
+    write_file("b.txt", "bee\n");
+    svc_add(helper, "a.txt");
+    svc_add(helper, "b.txt");
+    must_commit(helper, "first");
+    void *first = svc_branch_head(helper, "master");
+
+    write_file("a.txt", "one\nTWO\nthree\n");
+    svc_rm(helper, "b.txt");
+    write_file("c.txt", "sea\n");
+    svc_add(helper, "c.txt");
+
+    const char *expected =
+        "--- a/a.txt\n+++ b/a.txt\n@@ -1,3 +1,3 @@\n one\n-two\n+TWO\n three\n"
+        "--- a/b.txt\n+++ /dev/null\n@@ -1 +0,0 @@\n-bee\n"
+        "--- /dev/null\n+++ b/c.txt\n@@ -0,0 +1 @@\n+sea\n";
+
+    char buffer[512];
+    long length = svc_diff_working(helper, buffer, sizeof(buffer));
+    assert(length == (long)strlen(expected));
+    assert(strcmp(buffer, expected) == 0);
+
+    must_commit(helper, "second");
+    void *second = svc_branch_head(helper, "master");
+
+    // The committed change reads the same as it did in the working copy
+    long measured = svc_diff(helper, first, second, NULL, 0);
+    assert(measured == length);
+    long written = svc_diff(helper, first, second, buffer, sizeof(buffer));
+    assert(written == length);
+    assert(strcmp(buffer, expected) == 0);
+
+    // A short buffer gets as much as fits, the full length is still returned
+    char small[8];
+    written = svc_diff(helper, first, second, small, sizeof(small));
+    assert(written == length);
+    assert(strncmp(small, expected, sizeof(small) - 1) == 0 && small[sizeof(small) - 1] == '\0');
+
+    written = svc_diff(helper, second, second, buffer, sizeof(buffer));
+    assert(written == 0);
+    measured = svc_diff_working(helper, NULL, 0);
+    assert(measured == 0);
+
+    cleanup(helper);
+    leave();
+
+}
+
+
+// Messages of a log from start, joined by spaces
+void log_messages(void *helper, void *start, const svc_log_options *options, char *buffer){
+
+    svc_log *log = svc_log_open(helper, start, options);
+    svc_log_entry entry;
+
+    buffer[0] = '\0';
+
+    while(svc_log_next(log, &entry)){
+        if(buffer[0] != '\0'){
+            strcat(buffer, " ");
+        }
+        strcat(buffer, entry.message);
+    }
+
+    svc_log_close(log);
+
+}
+
+void test_log(void){
+
+    enter("log");
+
+    void *helper = svc_init();
+
+    write_file("a.txt", "a\n");
+    svc_add(helper, "a.txt");
+    must_commit(helper, "c1");
+
+    int branched = svc_branch(helper, "dev");
+    assert(branched == 0);
+    must_checkout(helper, "dev");
+    write_file("d.txt", "d\n");
+    svc_add(helper, "d.txt");
+    must_commit(helper, "d1");
+
+    must_checkout(helper, "master");
+    write_file("a.txt", "a two\n");
+    must_commit(helper, "m1");
+    write_file("a.txt", "a three\n");
+    must_commit(helper, "m2");
+    char *merged = svc_merge(helper, "dev", NULL, 0);
+    assert(merged != NULL);
+
+    void *head = svc_branch_head(helper, "master");
+    char messages[256];
+
+    // Newest first
+    log_messages(helper, head, NULL, messages);
+    assert(strcmp(messages, "Merged branch dev m2 m1 d1 c1") == 0);
+
+    // Each line of history in one run, the first parent's line first
+    svc_log_options topo = {SVC_LOG_TOPO_ORDER, 0, NULL, 0, 0, 0};
+    log_messages(helper, head, &topo, messages);
+    assert(strcmp(messages, "Merged branch dev m2 m1 d1 c1") == 0);
+
+    svc_log_options first_parent = {SVC_LOG_DATE_ORDER, 1, NULL, 0, 0, 0};
+    log_messages(helper, head, &first_parent, messages);
+    assert(strcmp(messages, "Merged branch dev m2 m1 c1") == 0);
+
+    // Pages of two
+    svc_log_options page = {SVC_LOG_DATE_ORDER, 0, NULL, 0, 0, 2};
+    log_messages(helper, head, &page, messages);
+    assert(strcmp(messages, "Merged branch dev m2") == 0);
+
+    page.skip = 2;
+    log_messages(helper, head, &page, messages);
+    assert(strcmp(messages, "m1 d1") == 0);
+
+    page.skip = 4;
+    log_messages(helper, head, &page, messages);
+    assert(strcmp(messages, "c1") == 0);
+
+    page.skip = 5;
+    log_messages(helper, head, &page, messages);
+    assert(strcmp(messages, "") == 0);
+
+    // Commits that changed a.txt, past the newest one
+    char *paths[1] = {"a.txt"};
+    svc_log_options filtered = {SVC_LOG_DATE_ORDER, 0, paths, 1, 1, 0};
+    log_messages(helper, head, &filtered, messages);
+    assert(strcmp(messages, "m1 c1") == 0);
+
+    cleanup(helper);
+    leave();
+
+}
+
+// Entry of a call in a stats snapshot, NULL when it has none
+svc_call_stats *call_stats(struct svc_stats *stats, const char *name){
+
+    for(int i = 0; i < SVC_STATS_CALLS; i++){
+        if(stats->calls[i].name != NULL && strcmp(stats->calls[i].name, name) == 0){
+            return &stats->calls[i];
+        }
+    }
+
+    return NULL;
+
+}
+
+void test_stats(void){
+
+    enter("stats");
+
+    void *helper = svc_init();
+
+    write_file("a.txt", "stats\n");
+    svc_add(helper, "a.txt");
+    must_commit(helper, "first");
+
+    struct svc_stats stats;
+    int read = svc_stats(helper, &stats);
+    assert(read == 0);
+    assert(stats.commits == 1);
+    assert(stats.files_opened > 0);
+    assert(stats.bytes_hashed > 0);
+    assert(stats.blob_bytes > 0);
+
+    svc_call_stats *commit = call_stats(&stats, "svc_commit");
+    assert(commit != NULL && commit->calls == 1 && commit->timed == 1);
+
+    // Counters start over, the held blob bytes stay
+    unsigned long long blob_bytes = stats.blob_bytes;
+    svc_stats_reset(helper);
+    read = svc_stats(helper, &stats);
+    assert(read == 0);
+    assert(stats.commits == 0);
+    assert(stats.bytes_hashed == 0);
+    assert(stats.blob_bytes == blob_bytes);
+
+    commit = call_stats(&stats, "svc_commit");
+    assert(commit != NULL && commit->calls == 0 && commit->max_ns == 0);
+
+    write_file("a.txt", "stats again\n");
+    must_commit(helper, "second");
+    read = svc_stats(helper, &stats);
+    assert(read == 0);
+    assert(stats.commits == 1);
+
+    read = svc_stats(NULL, &stats);
+    assert(read == -1);
+
+    cleanup(helper);
+    leave();
+
+}
+
+void test_spans(void){
+
+    enter("spans");
+
+    void *helper = svc_init();
+
+    svc_spans(helper, 1);
+
+    write_file("a.txt", "spans\n");
+    svc_add(helper, "a.txt");
+    must_commit(helper, "first");
+
+    int dumped = svc_spans_dump(helper, "spans.json");
+    assert(dumped == 0);
+
+    FILE *in = fopen("spans.json", "r");
+    assert(in != NULL);
+    char json[8192];
+    size_t length = fread(json, 1, sizeof(json) - 1, in);
+    json[length] = '\0';
+    fclose(in);
+
+    // A complete trace holding the hashing of a.txt
+    assert(strncmp(json, "{\"traceEvents\": [", 17) == 0);
+    assert(strstr(json, "\"name\": \"hash\"") != NULL);
+    assert(strstr(json, "\"ph\": \"X\"") != NULL);
+    assert(length > 2 && strcmp(json + length - 2, "}\n") == 0);
+
+    dumped = svc_spans_dump(helper, "missing/spans.json");
+    assert(dumped == -2);
+
+    svc_spans(helper, 0);
+    cleanup(helper);
+    leave();
+
+}
 
 int main(int argc, char **argv) {
     void *helper = svc_init();
-    
+
     // TODO: write your own tests here
     // Hint: you can use assert(EXPRESSION) if you want
     // e.g.  assert((2 + 3) == 5);
     test_hash(helper);
-    
-    // cleanup(helper);
-    
+
+    cleanup(helper);
+
+    // Every other test works in a scratch directory, removed at the end
+    char scratch[] = "/tmp/svc_tester_XXXXXX";
+    char *made = mkdtemp(scratch);
+    assert(made != NULL);
+    int entered = chdir(scratch);
+    assert(entered == 0);
+
+    test_blob_store();
+    test_resolve_commit();
+    test_open_persistence();
+    test_racy_stat();
+    test_add_rm_add();
+    test_thread_count();
+    test_custom_allocator();
+    test_plan_checkout();
+    test_reset_writes();
+    test_delta_chain();
+    test_compression_modes();
+    test_merge_theirs_only();
+    test_merge_ours_only();
+    test_merge_separate_lines();
+    test_merge_conflict();
+    test_merge_delete_modify();
+    test_ancestry();
+    test_diff();
+    test_log();
+    test_stats();
+    test_spans();
+
+    int left = chdir("/");
+    assert(left == 0);
+    nftw(scratch, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+    printf("All tests passed\n");
+
     return 0;
 }
-
@@ -0,0 +1,98 @@
+#ifndef SVC_TRACE
+#define SVC_TRACE
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Call trace format, written by recorder.h and read by svc_replay.c
+// A trace starts with TRACE_MAGIC, the format version and the SVC_TRACE_*
+// flags it was recorded with, then holds a record per outermost call:
+//   op, arguments, working copy records, TRACE_RUN,
+//   nanoseconds the call took, commits it made
+// Numbers are LEB128 varints, signed ones zigzag encoded, and
+// fingerprints are 8 little endian bytes.
+// Strings are TRACE_STRING_NULL, TRACE_STRING_NEW then the length and
+// bytes, or TRACE_STRING_FIRST plus the index of a string sent before.
+// Commits are TRACE_COMMIT_NONE, TRACE_COMMIT_LITERAL then a string for
+// an id that matched no commit, or TRACE_COMMIT_FIRST plus the commit's
+// creation number. Systems opened from a repository number their new
+// commits after the ones they were opened with. Ids passed as strings also give how many characters
+// were passed, so prefixes can be rebuilt from the replayed ids.
+// Working copy records give what a path held just before the call, as
+// TRACE_FILE, path, size, chunk count then each chunk's length and
+// fingerprint, or as TRACE_GONE and path for a file that was missing.
+// Chunks are cut by content, so versions of a file share the chunks
+// their edits did not touch.
+
+#define TRACE_MAGIC "SVCTRACE"
+#define TRACE_MAGIC_LENGTH 8
+#define TRACE_VERSION 1
+
+// Ops and their arguments, the numbers are part of the format
+#define TRACE_INIT 1 // threads, compression, commits opened with
+#define TRACE_CLEANUP 2
+#define TRACE_HASH_FILE 3 // path
+#define TRACE_COMMIT 4 // message
+#define TRACE_GET_COMMIT 5 // id
+#define TRACE_RESOLVE_COMMIT 6 // id
+#define TRACE_PREV_COMMITS 7 // commit
+#define TRACE_BRANCH_HEAD 8 // name
+#define TRACE_IS_ANCESTOR 9 // commit, commit
+#define TRACE_MERGE_BASE 10 // commit, commit
+#define TRACE_COUNT_BETWEEN 11 // commit, commit
+#define TRACE_DIFF 12 // commit, commit, buffer
+#define TRACE_DIFF_WORKING 13 // buffer
+#define TRACE_LOG_OPEN 14 // commit, 1 then options or 0 for none
+#define TRACE_LOG_NEXT 15 // log
+#define TRACE_LOG_CLOSE 16 // log
+#define TRACE_PRINT_COMMIT 17 // id
+#define TRACE_BRANCH 18 // name
+#define TRACE_CHECKOUT 19 // name
+#define TRACE_PLAN_CHECKOUT 20 // name
+#define TRACE_LIST_BRANCHES 21
+#define TRACE_ADD 22 // path
+#define TRACE_RM 23 // path
+#define TRACE_RESET 24 // id
+#define TRACE_MERGE 25 // name, signed count, then path and path per resolution
+#define TRACE_MERGE_CONFLICTS 26 // name
+#define TRACE_NUM_OPS 27
+// Buffers are given as 0 for NULL or their size plus one
+// Log options are order, first parent, path count, paths, skip, max count
+// Logs are numbered by the TRACE_LOG_OPEN records, counting from 0
+
+// Entry point each op records
+static const char* trace_op_names[TRACE_NUM_OPS] = {
+    NULL, "svc_init_opts", "cleanup", "hash_file", "svc_commit", "get_commit", "svc_resolve_commit",
+    "get_prev_commits", "svc_branch_head", "svc_is_ancestor", "svc_merge_base", "svc_count_between",
+    "svc_diff", "svc_diff_working", "svc_log_open", "svc_log_next", "svc_log_close", "print_commit",
+    "svc_branch", "svc_checkout", "svc_plan_checkout", "list_branches", "svc_add", "svc_rm",
+    "svc_reset", "svc_merge", "svc_merge_conflicts",
+};
+
+// Working copy records, then the end of the call's arguments
+#define TRACE_RUN 0
+#define TRACE_FILE 1
+#define TRACE_GONE 2
+
+#define TRACE_STRING_NULL 0
+#define TRACE_STRING_NEW 1
+#define TRACE_STRING_FIRST 2
+
+#define TRACE_COMMIT_NONE 0
+#define TRACE_COMMIT_LITERAL 1
+#define TRACE_COMMIT_FIRST 2
+
+// Fills the chunking table, and stand-in contents when replaying
+static uint64_t trace_splitmix(uint64_t* state){
+
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+    return z ^ (z >> 31);
+
+}
+
+
+#endif
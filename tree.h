@@ -0,0 +1,669 @@
+#ifndef SVC_TREE
+#define SVC_TREE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "structures.h"
+#include "sha256.h"
+#include "arena.h"
+#include "blobs.h"
+#include "intern.h"
+#include "statcache.h"
+
+// Commit snapshots as Merkle trees keyed by path component
+// A directory holds one entry per name, and its entries are spread over
+// a hash trie of 32 way inner nodes so even a huge flat directory is
+// changed by copying a handful of small nodes. Every node carries a
+// digest of everything below it and nodes are immutable and interned by
+// that digest, so equal subtrees are one node shared by every commit.
+// Changing k files copies O(k) nodes, and comparing two snapshots stops
+// at any subtree the two have in common.
+
+#define TREE_BITS 5
+#define TREE_WIDTH (1u << TREE_BITS)
+#define TREE_DIGEST_SIZE 16
+
+#define TREE_INNER 0
+#define TREE_FILE 1
+#define TREE_DIR 2
+
+struct TreeNode {
+
+    unsigned char digest[TREE_DIGEST_SIZE];
+    int kind;
+    size_t num_files; // Files at or below this node
+
+    // Entries, the name's interned id times two, plus one for directories
+    uint32_t key;
+    uint64_t key_hash;
+
+    struct File file; // TREE_FILE, without a stat cache
+    struct TreeNode* root; // TREE_DIR, never NULL
+
+    // TREE_INNER, one child per set bit of bitmap
+    uint32_t bitmap;
+    struct TreeNode** children;
+
+    // Offset of the node in the repository commits file, 0 until written
+    uint64_t stored;
+
+};
+
+// Every node ever made, by digest
+struct TreeTable {
+
+    struct TreeNode** slots;
+    size_t cap_slots;
+    size_t num_nodes;
+
+};
+
+// Called with each file of a snapshot
+typedef void (*tree_visit)(void* context, const struct File* file);
+
+// Called with each path that differs, old_file or new_file is NULL
+// when the path is only in one snapshot
+typedef void (*tree_change)(void* context, const struct File* old_file, const struct File* new_file);
+
+
+static struct TreeTable* tree_table_create(void){
+
+    struct TreeTable* table = (struct TreeTable*)malloc(sizeof(struct TreeTable));
+
+    table->cap_slots = 64;
+    table->num_nodes = 0;
+    table->slots = (struct TreeNode**)calloc(table->cap_slots, sizeof(struct TreeNode*));
+
+    return table;
+
+}
+
+// The nodes themselves belong to the arena
+static void tree_table_free(struct TreeTable* table){
+
+    free(table->slots);
+    free(table);
+
+}
+
+static size_t tree_table_slot(struct TreeTable* table, const unsigned char* digest){
+
+    uint64_t start;
+    memcpy(&start, digest, sizeof(start));
+
+    size_t slot = start & (table->cap_slots - 1);
+
+    while(table->slots[slot] != NULL && memcmp(table->slots[slot]->digest, digest, TREE_DIGEST_SIZE) != 0){
+        slot = (slot + 1) & (table->cap_slots - 1);
+    }
+
+    return slot;
+
+}
+
+static void tree_table_grow(struct TreeTable* table){
+
+    struct TreeNode** old = table->slots;
+    size_t old_cap = table->cap_slots;
+
+    table->cap_slots = table->cap_slots*2;
+    table->slots = (struct TreeNode**)calloc(table->cap_slots, sizeof(struct TreeNode*));
+
+    for(size_t i = 0; i < old_cap; i++){
+        if(old[i] != NULL){
+            table->slots[tree_table_slot(table, old[i]->digest)] = old[i];
+        }
+    }
+
+    free(old);
+
+}
+
+// Where an entry goes in its directory's trie, made from the bytes of its
+// name rather than its id so every process lays a directory out the same
+// way and inner nodes read back from a repository stay valid. The mix is a
+// bijection, so two entries only fail to part ways within 64 bits if
+// their names' hashes collide, as unlikely as two nodes sharing a digest.
+static uint64_t tree_key_hash(struct System* system, uint32_t key){
+
+    uint64_t hash = system->paths->hashes[key/2] ^ (key & 1 ? 0x9E3779B97F4A7C15ULL : 0);
+
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+
+    return hash;
+
+}
+
+static unsigned tree_slot(uint64_t key_hash, unsigned depth){
+
+    return (key_hash >> (depth*TREE_BITS)) & (TREE_WIDTH - 1);
+
+}
+
+static size_t tree_num_files(const struct TreeNode* node){
+
+    return node == NULL ? 0 : node->num_files;
+
+}
+
+// Return the stored node equal to candidate, storing a copy if it is new
+// children is copied for inner nodes, a new file entry takes a blob reference
+static struct TreeNode* tree_intern(struct System* system, struct TreeNode* candidate, struct TreeNode** children, size_t num_children){
+
+    unsigned char buffer[1 + sizeof(uint32_t) + TREE_WIDTH*TREE_DIGEST_SIZE + SHA256_DIGEST_SIZE + 4*sizeof(uint64_t)];
+    size_t length = 0;
+
+    buffer[length++] = candidate->kind;
+
+    if(candidate->kind == TREE_INNER){
+
+        memcpy(buffer + length, &candidate->bitmap, sizeof(uint32_t));
+        length += sizeof(uint32_t);
+
+        for(size_t i = 0; i < num_children; i++){
+            memcpy(buffer + length, children[i]->digest, TREE_DIGEST_SIZE);
+            length += TREE_DIGEST_SIZE;
+        }
+
+    } else {
+
+        memcpy(buffer + length, &candidate->key, sizeof(uint32_t));
+        length += sizeof(uint32_t);
+
+        if(candidate->kind == TREE_DIR){
+            memcpy(buffer + length, candidate->root->digest, TREE_DIGEST_SIZE);
+            length += TREE_DIGEST_SIZE;
+        } else {
+            uint64_t fields[4] = {(uint64_t)candidate->file.path_id, candidate->file.hash, (uint64_t)candidate->file.fc_length, candidate->file.order};
+            memcpy(buffer + length, system->blobs[candidate->file.fc_index].digest, SHA256_DIGEST_SIZE);
+            length += SHA256_DIGEST_SIZE;
+            memcpy(buffer + length, fields, sizeof(fields));
+            length += sizeof(fields);
+        }
+    }
+
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    sha256(buffer, length, digest);
+    memcpy(candidate->digest, digest, TREE_DIGEST_SIZE);
+
+    struct TreeTable* table = system->trees;
+    size_t slot = tree_table_slot(table, candidate->digest);
+
+    if(table->slots[slot] != NULL){
+        return table->slots[slot];
+    }
+
+    struct TreeNode* node = (struct TreeNode*)arena_memdup(system->arena, candidate, sizeof(struct TreeNode));
+
+    if(node->kind == TREE_INNER){
+        node->children = (struct TreeNode**)arena_memdup(system->arena, children, sizeof(struct TreeNode*)*num_children);
+    } else if(node->kind == TREE_FILE){
+        blob_retain(system, node->file.fc_index);
+    }
+
+    table->slots[slot] = node;
+    table->num_nodes++;
+
+    // Keep the load factor under 1/2
+    if(table->num_nodes*2 > table->cap_slots){
+        tree_table_grow(table);
+    }
+
+    return node;
+
+}
+
+// Entry for a file named name_id within its directory
+static struct TreeNode* tree_make_file(struct System* system, int name_id, const struct File* file){
+
+    struct TreeNode candidate;
+    memset(&candidate, 0, sizeof(candidate));
+
+    candidate.kind = TREE_FILE;
+    candidate.num_files = 1;
+    candidate.key = (uint32_t)name_id*2;
+    candidate.key_hash = tree_key_hash(system, candidate.key);
+    candidate.file = *file;
+
+    // Snapshots are shared, so they do not hold the working copy's stat
+    stat_cache_clear(&candidate.file);
+
+    return tree_intern(system, &candidate, NULL, 0);
+
+}
+
+// Entry for a non empty directory named name_id
+static struct TreeNode* tree_make_dir(struct System* system, int name_id, struct TreeNode* root){
+
+    struct TreeNode candidate;
+    memset(&candidate, 0, sizeof(candidate));
+
+    candidate.kind = TREE_DIR;
+    candidate.num_files = root->num_files;
+    candidate.key = (uint32_t)name_id*2 + 1;
+    candidate.key_hash = tree_key_hash(system, candidate.key);
+    candidate.root = root;
+
+    return tree_intern(system, &candidate, NULL, 0);
+
+}
+
+// Inner node over children, given in slot order
+// A lone entry is never wrapped, so every set of entries has one shape
+static struct TreeNode* tree_make_inner(struct System* system, uint32_t bitmap, struct TreeNode** children, size_t num_children){
+
+    if(num_children == 0){
+        return NULL;
+    }
+
+    if(num_children == 1 && children[0]->kind != TREE_INNER){
+        return children[0];
+    }
+
+    struct TreeNode candidate;
+    memset(&candidate, 0, sizeof(candidate));
+
+    candidate.kind = TREE_INNER;
+    candidate.bitmap = bitmap;
+
+    for(size_t i = 0; i < num_children; i++){
+        candidate.num_files += children[i]->num_files;
+    }
+
+    return tree_intern(system, &candidate, children, num_children);
+
+}
+
+// Child of an inner node in slot, or NULL
+static struct TreeNode* tree_child(const struct TreeNode* node, unsigned slot){
+
+    uint32_t bit = 1u << slot;
+
+    if(!(node->bitmap & bit)){
+        return NULL;
+    }
+
+    return node->children[__builtin_popcount(node->bitmap & (bit - 1))];
+
+}
+
+// Copy of an inner node with the child in slot replaced, NULL removes it
+static struct TreeNode* tree_with_child(struct System* system, const struct TreeNode* node, unsigned slot, struct TreeNode* child){
+
+    struct TreeNode* children[TREE_WIDTH];
+    size_t count = 0;
+    uint32_t bitmap = 0;
+
+    for(unsigned s = 0; s < TREE_WIDTH; s++){
+
+        struct TreeNode* current = s == slot ? child : tree_child(node, s);
+
+        if(current != NULL){
+            children[count++] = current;
+            bitmap |= 1u << s;
+        }
+    }
+
+    return tree_make_inner(system, bitmap, children, count);
+
+}
+
+// Inner nodes holding two entries that share the slots above depth
+static struct TreeNode* tree_pair(struct System* system, struct TreeNode* a, struct TreeNode* b, unsigned depth){
+
+    unsigned slot_a = tree_slot(a->key_hash, depth);
+    unsigned slot_b = tree_slot(b->key_hash, depth);
+
+    if(slot_a == slot_b){
+        struct TreeNode* child = tree_pair(system, a, b, depth + 1);
+        return tree_make_inner(system, 1u << slot_a, &child, 1);
+    }
+
+    struct TreeNode* children[2] = {a, b};
+
+    if(slot_b < slot_a){
+        children[0] = b;
+        children[1] = a;
+    }
+
+    return tree_make_inner(system, (1u << slot_a) | (1u << slot_b), children, 2);
+
+}
+
+// Directory entry with key, or NULL
+static struct TreeNode* tree_get(struct System* system, struct TreeNode* node, uint32_t key){
+
+    uint64_t key_hash = tree_key_hash(system, key);
+    unsigned depth = 0;
+
+    while(node != NULL && node->kind == TREE_INNER){
+        node = tree_child(node, tree_slot(key_hash, depth));
+        depth++;
+    }
+
+    if(node == NULL || node->key != key){
+        return NULL;
+    }
+
+    return node;
+
+}
+
+// Add or replace an entry in a directory
+static struct TreeNode* tree_put(struct System* system, struct TreeNode* node, struct TreeNode* entry, unsigned depth){
+
+    if(node == NULL){
+        return entry;
+    }
+
+    if(node->kind != TREE_INNER){
+
+        if(node->key == entry->key){
+            return entry;
+        }
+
+        return tree_pair(system, node, entry, depth);
+    }
+
+    unsigned slot = tree_slot(entry->key_hash, depth);
+    struct TreeNode* child = tree_child(node, slot);
+    struct TreeNode* updated = tree_put(system, child, entry, depth + 1);
+
+    if(updated == child){
+        return node;
+    }
+
+    return tree_with_child(system, node, slot, updated);
+
+}
+
+// Drop the entry with key from a directory
+static struct TreeNode* tree_delete(struct System* system, struct TreeNode* node, uint32_t key, unsigned depth){
+
+    if(node == NULL){
+        return NULL;
+    }
+
+    if(node->kind != TREE_INNER){
+        return node->key == key ? NULL : node;
+    }
+
+    unsigned slot = tree_slot(tree_key_hash(system, key), depth);
+    struct TreeNode* child = tree_child(node, slot);
+
+    if(child == NULL){
+        return node;
+    }
+
+    struct TreeNode* updated = tree_delete(system, child, key, depth + 1);
+
+    if(updated == child){
+        return node;
+    }
+
+    return tree_with_child(system, node, slot, updated);
+
+}
+
+// Length of the path component starting at name
+static size_t tree_component(const char* name, bool* last){
+
+    const char* slash = strchr(name, '/');
+
+    *last = slash == NULL;
+
+    return slash == NULL ? strlen(name) : (size_t)(slash - name);
+
+}
+
+// Snapshot file at path, or NULL
+static const struct File* tree_find(struct System* system, struct TreeNode* root, const char* path){
+
+    while(root != NULL){
+
+        bool last;
+        size_t length = tree_component(path, &last);
+        int name_id = path_lookup_n(system, path, length);
+
+        if(name_id == PATH_NONE){
+            return NULL;
+        }
+
+        struct TreeNode* entry = tree_get(system, root, (uint32_t)name_id*2 + !last);
+
+        if(entry == NULL){
+            return NULL;
+        }
+
+        if(last){
+            return &entry->file;
+        }
+
+        root = entry->root;
+        path += length + 1;
+    }
+
+    return NULL;
+
+}
+
+static struct TreeNode* tree_set_at(struct System* system, struct TreeNode* root, const struct File* file, const char* name){
+
+    bool last;
+    size_t length = tree_component(name, &last);
+    int name_id = path_intern_n(system, name, length);
+
+    if(last){
+        return tree_put(system, root, tree_make_file(system, name_id, file), 0);
+    }
+
+    struct TreeNode* entry = tree_get(system, root, (uint32_t)name_id*2 + 1);
+    struct TreeNode* sub = tree_set_at(system, entry == NULL ? NULL : entry->root, file, name + length + 1);
+
+    if(entry != NULL && sub == entry->root){
+        return root;
+    }
+
+    return tree_put(system, root, tree_make_dir(system, name_id, sub), 0);
+
+}
+
+// Snapshot with file added at its path, or replacing what was there
+static struct TreeNode* tree_set(struct System* system, struct TreeNode* root, const struct File* file){
+
+    return tree_set_at(system, root, file, file->file_name);
+
+}
+
+// Snapshot without the file at path, directories left empty go too
+static struct TreeNode* tree_remove(struct System* system, struct TreeNode* root, const char* path){
+
+    bool last;
+    size_t length = tree_component(path, &last);
+    int name_id = path_lookup_n(system, path, length);
+
+    if(root == NULL || name_id == PATH_NONE){
+        return root;
+    }
+
+    if(last){
+        return tree_delete(system, root, (uint32_t)name_id*2, 0);
+    }
+
+    uint32_t key = (uint32_t)name_id*2 + 1;
+    struct TreeNode* entry = tree_get(system, root, key);
+
+    if(entry == NULL){
+        return root;
+    }
+
+    struct TreeNode* sub = tree_remove(system, entry->root, path + length + 1);
+
+    if(sub == entry->root){
+        return root;
+    }
+
+    if(sub == NULL){
+        return tree_delete(system, root, key, 0);
+    }
+
+    return tree_put(system, root, tree_make_dir(system, name_id, sub), 0);
+
+}
+
+// Visit every file of a snapshot, in no particular order
+static void tree_walk(const struct TreeNode* node, tree_visit visit, void* context){
+
+    if(node == NULL){
+        return;
+    }
+
+    if(node->kind == TREE_FILE){
+        visit(context, &node->file);
+    } else if(node->kind == TREE_DIR){
+        tree_walk(node->root, visit, context);
+    } else {
+        for(int i = 0; i < __builtin_popcount(node->bitmap); i++){
+            tree_walk(node->children[i], visit, context);
+        }
+    }
+
+}
+
+static void tree_collect_file(void* context, const struct File* file){
+
+    const struct File*** next = (const struct File***)context;
+
+    **next = file;
+    (*next)++;
+
+}
+
+static int tree_compare_order(const void* a, const void* b){
+
+    uint64_t order_a = (*(const struct File* const*)a)->order;
+    uint64_t order_b = (*(const struct File* const*)b)->order;
+
+    return (order_a > order_b) - (order_a < order_b);
+
+}
+
+// Files of a snapshot in the order they were staged, caller frees
+static const struct File** tree_list_files(const struct TreeNode* root){
+
+    const struct File** files = (const struct File**)malloc(sizeof(struct File*)*(tree_num_files(root) + 1));
+    const struct File** next = files;
+
+    tree_walk(root, tree_collect_file, &next);
+
+    qsort(files, tree_num_files(root), sizeof(struct File*), tree_compare_order);
+
+    return files;
+
+}
+
+struct TreeSide {
+
+    tree_change report;
+    void* context;
+    bool removed;
+
+};
+
+static void tree_report_side(void* context, const struct File* file){
+
+    struct TreeSide* side = (struct TreeSide*)context;
+
+    if(side->removed){
+        side->report(side->context, file, NULL);
+    } else {
+        side->report(side->context, NULL, file);
+    }
+
+}
+
+// Bits of the slots a node covers at depth
+static uint32_t tree_slots_used(const struct TreeNode* node, unsigned depth){
+
+    if(node == NULL){
+        return 0;
+    }
+
+    if(node->kind == TREE_INNER){
+        return node->bitmap;
+    }
+
+    return 1u << tree_slot(node->key_hash, depth);
+
+}
+
+// What a node holds in slot at depth, an entry stands for itself
+static struct TreeNode* tree_slot_child(struct TreeNode* node, unsigned slot, unsigned depth){
+
+    if(node == NULL){
+        return NULL;
+    }
+
+    if(node->kind == TREE_INNER){
+        return tree_child(node, slot);
+    }
+
+    return tree_slot(node->key_hash, depth) == slot ? node : NULL;
+
+}
+
+static void tree_diff_level(struct TreeNode* a, struct TreeNode* b, unsigned depth, tree_change report, void* context){
+
+    // Interned nodes are equal exactly when they are the same node
+    if(a == b){
+        return;
+    }
+
+    if((a != NULL && a->kind == TREE_INNER) || (b != NULL && b->kind == TREE_INNER)){
+
+        uint32_t used = tree_slots_used(a, depth) | tree_slots_used(b, depth);
+
+        while(used != 0){
+            unsigned slot = __builtin_ctz(used);
+            used &= used - 1;
+            tree_diff_level(tree_slot_child(a, slot, depth), tree_slot_child(b, slot, depth), depth + 1, report, context);
+        }
+
+        return;
+    }
+
+    if(a != NULL && b != NULL && a->key == b->key){
+
+        if(a->kind == TREE_DIR){
+            tree_diff_level(a->root, b->root, 0, report, context);
+        } else {
+            report(context, &a->file, &b->file);
+        }
+
+        return;
+    }
+
+    struct TreeSide side = {report, context, true};
+    tree_walk(a, tree_report_side, &side);
+
+    side.removed = false;
+    tree_walk(b, tree_report_side, &side);
+
+}
+
+// Report every path whose file differs between snapshots a and b
+// Shared subtrees are skipped, so the work follows the number of differences
+// Both files are given for a path in both, even if only its order moved
+static void tree_diff(struct TreeNode* a, struct TreeNode* b, tree_change report, void* context){
+
+    tree_diff_level(a, b, 0, report, context);
+
+}
+
+
+#endif
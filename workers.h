@@ -0,0 +1,218 @@
+#ifndef SVC_WORKERS
+#define SVC_WORKERS
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Fixed pool of worker threads for splitting a loop over many items
+// Items are handed out in chunks from a shared counter, and the calling
+// thread works through chunks alongside the pool until none are left.
+// Every item is processed exactly once, so as long as a job only writes
+// to its own item the outcome does not depend on the number of threads.
+
+#define WORKER_CHUNK 16
+
+// Process item index, scratch is a read buffer owned by the running thread
+typedef void (*worker_job)(void* context, size_t index, char** scratch, size_t* scratch_cap);
+
+struct Worker {
+
+    pthread_t thread;
+    struct WorkerPool* pool;
+    char* scratch;
+    size_t scratch_cap;
+
+};
+
+struct WorkerPool {
+
+    struct Worker* workers;
+    size_t num_workers; // Threads besides the caller
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // Signalled when a batch starts or on shutdown
+    pthread_cond_t idle; // Signalled when the last worker leaves a batch
+
+    // Current batch
+    worker_job job;
+    void* context;
+    size_t num_items;
+    size_t next_item;
+    size_t batch; // Increases by one for every batch run
+    size_t busy; // Workers still inside the current batch
+    bool stop;
+
+};
+
+
+// Number of threads to use when the caller does not say
+static size_t workers_default_threads(void){
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(cpus < 1){
+        return 1;
+    }
+
+    return cpus;
+
+}
+
+// Take chunks of the current batch until it is used up
+static void workers_drain(struct WorkerPool* pool, char** scratch, size_t* scratch_cap){
+
+    while(true){
+
+        size_t start = __atomic_fetch_add(&pool->next_item, WORKER_CHUNK, __ATOMIC_RELAXED);
+
+        if(start >= pool->num_items){
+            return;
+        }
+
+        size_t end = start + WORKER_CHUNK;
+        if(end > pool->num_items){
+            end = pool->num_items;
+        }
+
+        for(size_t i = start; i < end; i++){
+            pool->job(pool->context, i, scratch, scratch_cap);
+        }
+    }
+
+}
+
+static void* workers_main(void* arg){
+
+    struct Worker* worker = (struct Worker*)arg;
+    struct WorkerPool* pool = worker->pool;
+    size_t seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while(true){
+
+        while(!pool->stop && pool->batch == seen){
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+
+        if(pool->stop){
+            break;
+        }
+
+        seen = pool->batch;
+        pthread_mutex_unlock(&pool->lock);
+
+        workers_drain(pool, &worker->scratch, &worker->scratch_cap);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->busy--;
+        if(pool->busy == 0){
+            pthread_cond_signal(&pool->idle);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+
+}
+
+// Start num_threads - 1 workers, the caller makes up the last thread
+// Returns NULL if no thread could be started
+static struct WorkerPool* workers_create(size_t num_threads){
+
+    if(num_threads < 2){
+        return NULL;
+    }
+
+    struct WorkerPool* pool = (struct WorkerPool*)calloc(1, sizeof(struct WorkerPool));
+    pool->workers = (struct Worker*)calloc(num_threads - 1, sizeof(struct Worker));
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    for(size_t i = 0; i < num_threads - 1; i++){
+
+        pool->workers[i].pool = pool;
+
+        if(pthread_create(&pool->workers[i].thread, NULL, workers_main, &pool->workers[i]) != 0){
+            break;
+        }
+
+        pool->num_workers++;
+    }
+
+    if(pool->num_workers == 0){
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->wake);
+        pthread_cond_destroy(&pool->idle);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+
+    return pool;
+
+}
+
+// Stop and join every worker, then free the pool
+static void workers_destroy(struct WorkerPool* pool){
+
+    if(pool == NULL){
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(size_t i = 0; i < pool->num_workers; i++){
+        pthread_join(pool->workers[i].thread, NULL);
+        free(pool->workers[i].scratch);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->idle);
+    free(pool->workers);
+    free(pool);
+
+}
+
+// Run job over items 0 to num_items and wait for all of them
+// Without a pool the items are simply processed in order on this thread
+static void workers_run(struct WorkerPool* pool, worker_job job, void* context, size_t num_items, char** scratch, size_t* scratch_cap){
+
+    if(pool == NULL){
+        for(size_t i = 0; i < num_items; i++){
+            job(context, i, scratch, scratch_cap);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    pool->context = context;
+    pool->num_items = num_items;
+    pool->next_item = 0;
+    pool->busy = pool->num_workers;
+    pool->batch++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    workers_drain(pool, scratch, scratch_cap);
+
+    pthread_mutex_lock(&pool->lock);
+    while(pool->busy > 0){
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+}
+
+
+#endif